@@ -11,6 +11,12 @@ endif()
 option(ENABLE_SDL "Build the SDL port" ${BUILD_DEFAULT})
 option(ENABLE_WX "Build the wxWidgets port" ${BUILD_DEFAULT})
 option(ENABLE_DEBUGGER "Enable the debugger" ON)
+option(ENABLE_BENCHMARKS "Build the headless core benchmarks" OFF)
+
+include(CMakeDependentOption)
+# The benchmarks report the time spent in each zone, they always need them.
+cmake_dependent_option(ENABLE_INSTRUMENTATION "Enable the per-frame timing zones and counters" OFF "NOT ENABLE_BENCHMARKS" ON)
+option(ENABLE_HEADLESS "Build the vbam-headless runner" OFF)
 option(ENABLE_ASAN "Enable -fsanitize=address by default. Requires debug build with GCC/Clang" OFF)
 
 # Static linking
@@ -49,7 +55,6 @@ set(MMX_DEFAULT ${ENABLE_ASM})
 
 option(ENABLE_ASM_SCALERS "Enable x86 ASM graphic filters" ${ASM_SCALERS_DEFAULT})
 
-include(CMakeDependentOption)
 cmake_dependent_option(ENABLE_MMX "Enable MMX" ${MMX_DEFAULT} "ENABLE_ASM_SCALERS" OFF)
 
 option(ENABLE_LIRC "Enable LIRC support" OFF)
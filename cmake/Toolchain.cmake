@@ -50,6 +50,11 @@ if(ENABLE_DEBUGGER)
     add_compile_definitions(VBAM_ENABLE_DEBUGGER)
 endif()
 
+# The instrumentation zones and counters are compiled out by default
+if(ENABLE_INSTRUMENTATION)
+    add_compile_definitions(VBAM_ENABLE_INSTRUMENTATION)
+endif()
+
 # The ASM core is disabled by default because we don't know on which platform we are
 if(NOT ENABLE_ASM_CORE)
     add_compile_definitions(C_CORE)
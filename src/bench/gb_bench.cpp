@@ -0,0 +1,266 @@
+// Headless benchmark for the Game Boy core.
+//
+// Runs the generated test ROMs (see gb_test_roms.h) and any ROM passed on the
+// command line for a fixed number of frames, reports the emulation speed, split
+// between the CPU, the PPU and the APU, and checks frame hashes against a
+// goldens file. The goldens file has one "<rom> <frame> <hash>" entry per
+// line and is regenerated, header included, with:
+//
+//   vbam-gb-bench --frames 3600 --print-hashes 2> src/bench/gb_goldens.txt
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench/gb_test_roms.h"
+#include "core/base/instrumentation.h"
+#include "core/base/sizes.h"
+#include "core/base/system.h"
+#include "core/gb/gb.h"
+#include "core/gb/gbGlobals.h"
+#include "core/gba/gbaSound.h"
+#include "headless/headless_system.h"
+
+extern uint8_t* g_pix;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Frames are hashed every kHashInterval frames.
+constexpr int kHashInterval = 60;
+constexpr int kDefaultFrames = 3600;
+
+// Printed before the hashes by --print-hashes, so that its output can replace
+// the goldens file as is.
+constexpr char kGoldensHeader[] =
+    "# Frame hashes of the generated test ROMs, for vbam-gb-bench --goldens.\n"
+    "# Regenerate with: vbam-gb-bench --frames 3600 --print-hashes 2> gb_goldens.txt\n";
+
+// Hashes of a run, indexed by frame number.
+using FrameHashes = std::map<int, uint64_t>;
+
+// Goldens, indexed by ROM name.
+using Goldens = std::map<std::string, FrameHashes>;
+
+FrameHashes g_hashes;
+
+// Time spent in `zone` by the frames completed so far.
+Clock::duration ZoneTime(InstrZone zone) {
+    uint64_t frames;
+    const InstrFrame totals = instrTotals(&frames);
+    return std::chrono::nanoseconds(totals.zone_ns[static_cast<size_t>(zone)]);
+}
+
+void OnDrawScreen() {
+    if (headlessFramesDrawn % kHashInterval == 0) {
+        g_hashes[headlessFramesDrawn] = headlessHash(g_pix, kGBPixSize);
+    }
+}
+
+bool LoadGoldens(const char* path, Goldens* goldens) {
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Cannot open goldens file %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream entry(line);
+        std::string name;
+        int frame;
+        std::string hash;
+        if (!(entry >> name >> frame >> hash)) {
+            fprintf(stderr, "Invalid goldens entry: %s\n", line.c_str());
+            return false;
+        }
+        (*goldens)[name][frame] = strtoull(hash.c_str(), nullptr, 16);
+    }
+    return true;
+}
+
+double ToMs(Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+double Percent(Clock::duration part, Clock::duration total) {
+    return total.count() ? 100.0 * part.count() / total.count() : 0.0;
+}
+
+// Runs the currently loaded ROM for `frames` frames. Returns false on error.
+bool Run(const std::string& name, int frames, bool print_hashes, const Goldens* goldens) {
+    gbGetHardwareType();
+    if (gbSgbMode) {
+        gbBorderOn = true;
+        gbBorderLineSkip = kSGBWidth;
+        gbBorderColumnSkip = (kSGBWidth - kGBWidth) / 2;
+        gbBorderRowSkip = (kSGBHeight - kGBHeight) / 2;
+    } else {
+        gbBorderOn = false;
+        gbBorderLineSkip = kGBWidth;
+        gbBorderColumnSkip = 0;
+        gbBorderRowSkip = 0;
+    }
+    gbReset();
+
+    g_hashes.clear();
+    headlessFramesDrawn = 0;
+
+    const Clock::duration render_start = ZoneTime(InstrZone::kRender);
+    const Clock::duration sound_start = ZoneTime(InstrZone::kSound);
+    Clock::duration total{};
+    while (headlessFramesDrawn < frames) {
+        const Clock::time_point start = Clock::now();
+        gbEmulate(GBSystem.emuCount);
+        total += Clock::now() - start;
+    }
+
+    printf("%-12s %6d %10.1f %10.1f ", name.c_str(), frames, frames * 1000.0 / ToMs(total),
+           ToMs(total));
+    if (kInstrumentationEnabled) {
+        // The zones of the frame still running are not accounted yet.
+        const Clock::duration render = ZoneTime(InstrZone::kRender) - render_start;
+        const Clock::duration sound = ZoneTime(InstrZone::kSound) - sound_start;
+        const Clock::duration cpu = total - render - sound;
+        printf("%10.1f (%4.1f%%) %10.1f (%4.1f%%) %10.1f (%4.1f%%)\n", ToMs(cpu),
+               Percent(cpu, total), ToMs(render), Percent(render, total), ToMs(sound),
+               Percent(sound, total));
+    } else {
+        printf("%17s %17s %17s\n", "n/a", "n/a", "n/a");
+    }
+
+    if (print_hashes) {
+        for (const auto& hash : g_hashes) {
+            fprintf(stderr, "%s %d %016" PRIx64 "\n", name.c_str(), hash.first, hash.second);
+        }
+    }
+
+    if (goldens == nullptr) {
+        return true;
+    }
+
+    const auto expected = goldens->find(name);
+    if (expected == goldens->end()) {
+        fprintf(stderr, "%s: no goldens\n", name.c_str());
+        return true;
+    }
+
+    bool result = true;
+    for (const auto& golden : expected->second) {
+        if (golden.first > frames) {
+            continue;
+        }
+
+        const auto actual = g_hashes.find(golden.first);
+        if (actual == g_hashes.end() || actual->second != golden.second) {
+            fprintf(stderr, "%s: frame %d hash mismatch, expected %016" PRIx64 ", got %016" PRIx64
+                    "\n", name.c_str(), golden.first, golden.second,
+                    actual == g_hashes.end() ? 0 : actual->second);
+            result = false;
+        }
+    }
+    return result;
+}
+
+void Usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options] [ROM files...]\n"
+            "Options:\n"
+            "  --frames N        Number of frames to run for each ROM (default: %d)\n"
+            "  --goldens FILE    Verify frame hashes against FILE\n"
+            "  --print-hashes    Print frame hashes to stderr, as a goldens file\n"
+            "  --no-builtin      Do not run the generated test ROMs\n",
+            program, kDefaultFrames);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int frames = kDefaultFrames;
+    const char* goldens_path = nullptr;
+    bool print_hashes = false;
+    bool builtin = true;
+    std::vector<const char*> rom_files;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--goldens") == 0 && i + 1 < argc) {
+            goldens_path = argv[++i];
+        } else if (strcmp(argv[i], "--print-hashes") == 0) {
+            print_hashes = true;
+        } else if (strcmp(argv[i], "--no-builtin") == 0) {
+            builtin = false;
+        } else if (argv[i][0] == '-') {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            rom_files.push_back(argv[i]);
+        }
+    }
+
+    if (frames <= 0) {
+        Usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Goldens goldens;
+    if (goldens_path && !LoadGoldens(goldens_path, &goldens)) {
+        return EXIT_FAILURE;
+    }
+
+    headlessInit();
+    headlessOnDrawScreen = OnDrawScreen;
+    soundInit();
+
+    printf("%-12s %6s %10s %10s %17s %17s %17s\n", "rom", "frames", "fps", "total ms", "cpu ms",
+           "ppu ms", "apu ms");
+
+    if (print_hashes) {
+        fputs(kGoldensHeader, stderr);
+    }
+
+    bool result = true;
+    if (builtin) {
+        for (const GbTestRom& rom : gbTestRoms()) {
+            if (!gbLoadRomData(reinterpret_cast<const char*>(rom.data.data()), rom.data.size())) {
+                fprintf(stderr, "%s: failed to load\n", rom.name);
+                result = false;
+                continue;
+            }
+            result &= Run(rom.name, frames, print_hashes, goldens_path ? &goldens : nullptr);
+            gbCleanUp();
+        }
+    }
+
+    for (const char* file : rom_files) {
+        if (!gbLoadRom(file)) {
+            fprintf(stderr, "%s: failed to load\n", file);
+            result = false;
+            continue;
+        }
+
+        std::string name = file;
+        const size_t separator = name.find_last_of("/\\");
+        if (separator != std::string::npos) {
+            name = name.substr(separator + 1);
+        }
+        result &= Run(name, frames, print_hashes, goldens_path ? &goldens : nullptr);
+        gbCleanUp();
+    }
+
+    soundShutdown();
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
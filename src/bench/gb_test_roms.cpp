@@ -0,0 +1,319 @@
+#include "bench/gb_test_roms.h"
+
+#include <cstring>
+#include <initializer_list>
+
+namespace {
+
+constexpr size_t kRomSize = 0x8000;
+constexpr uint16_t kCodeStart = 0x0150;
+constexpr uint16_t kPacketData = 0x3f00;
+
+// Opcodes of the relative jumps.
+constexpr uint8_t kJrNz = 0x20;
+constexpr uint8_t kJrZ = 0x28;
+
+// 3-byte absolute instructions.
+constexpr uint8_t kCall = 0xcd;
+constexpr uint8_t kJp = 0xc3;
+constexpr uint8_t kLdHl = 0x21;
+constexpr uint8_t kLdBc = 0x01;
+constexpr uint8_t kLdAFromMem = 0xfa;
+constexpr uint8_t kLdMemFromA = 0xea;
+
+constexpr uint8_t kNintendoLogo[0x30] = {
+    0xce, 0xed, 0x66, 0x66, 0xcc, 0x0d, 0x00, 0x0b, 0x03, 0x73, 0x00, 0x83,
+    0x00, 0x0c, 0x00, 0x0d, 0x00, 0x08, 0x11, 0x1f, 0x88, 0x89, 0x00, 0x0e,
+    0xdc, 0xcc, 0x6e, 0xe6, 0xdd, 0xdd, 0xd9, 0x99, 0xbb, 0xbb, 0x67, 0x63,
+    0x6e, 0x0e, 0xec, 0xcc, 0xdd, 0xdc, 0x99, 0x9f, 0xbb, 0xb9, 0x33, 0x3e,
+};
+
+// SGB packets. ATTR_DIV splits the screen in 4 palettes, the 2 PAL01 packets
+// are sent alternatively every 32 frames. Every 64 frames, one of the CHR_TRN
+// packets replaces half of the border tiles with the screen, then PCT_TRN
+// replaces the border map and palettes, so the border changes mid-run. Like
+// the games, the transfers are done with the screen frozen by MASK_EN.
+constexpr uint8_t kSgbAttrDiv[16] = {0x31, 0x1b, 0x09};
+constexpr uint8_t kSgbPal01A[16] = {0x01, 0xff, 0x7f, 0x1f, 0x00, 0xe0, 0x03, 0x00,
+                                    0x7c, 0x94, 0x52, 0x4a, 0x29, 0x00, 0x00};
+constexpr uint8_t kSgbPal01B[16] = {0x01, 0x00, 0x00, 0x00, 0x7c, 0xe0, 0x03, 0x1f,
+                                    0x00, 0xff, 0x7f, 0x10, 0x42, 0x08, 0x21};
+constexpr uint8_t kSgbChrTrnLow[16] = {0x99, 0x00};
+constexpr uint8_t kSgbChrTrnHigh[16] = {0x99, 0x01};
+constexpr uint8_t kSgbPctTrn[16] = {0xa1};
+constexpr uint8_t kSgbMaskFreeze[16] = {0xb9, 0x01};
+constexpr uint8_t kSgbMaskCancel[16] = {0xb9, 0x00};
+
+enum class Model {
+    kDmg,
+    kCgb,
+    kSgb,
+};
+
+// Minimal helper to write machine code to the ROM.
+class Assembler final {
+public:
+    explicit Assembler(std::vector<uint8_t>& rom, uint16_t origin) : rom_(rom), pc_(origin) {}
+    ~Assembler() = default;
+
+    uint16_t here() const { return pc_; }
+
+    void Emit(std::initializer_list<uint8_t> bytes) {
+        for (uint8_t byte : bytes) {
+            rom_[pc_++] = byte;
+        }
+    }
+
+    // Instruction with a 16-bit immediate operand.
+    void Emit16(uint8_t opcode, uint16_t operand) {
+        Emit({opcode, static_cast<uint8_t>(operand & 0xff), static_cast<uint8_t>(operand >> 8)});
+    }
+
+    // Relative jump to `target`, which must already be emitted.
+    void JumpBack(uint8_t opcode, uint16_t target) {
+        const int offset = target - (pc_ + 2);
+        Emit({opcode, static_cast<uint8_t>(offset)});
+    }
+
+    // Relative jump to a location set later with Bind().
+    uint16_t JumpForward(uint8_t opcode) {
+        Emit({opcode, 0x00});
+        return pc_;
+    }
+
+    void Bind(uint16_t jump) { rom_[jump - 1] = static_cast<uint8_t>(pc_ - jump); }
+
+    // Loops until LY == 144 (`opcode` = kJrNz) or LY != 144 (`opcode` = kJrZ).
+    void WaitVBlank(uint8_t opcode) {
+        const uint16_t loop = here();
+        Emit({0xf0, 0x44, 0xfe, 0x90});  // ldh a,(LY) ; cp 144
+        JumpBack(opcode, loop);
+    }
+
+private:
+    std::vector<uint8_t>& rom_;
+    uint16_t pc_;
+};
+
+// Sends the 16-byte packet at HL to the SGB, over P1.
+uint16_t EmitSgbSend(Assembler& a) {
+    const uint16_t send = a.here();
+    a.Emit({0xaf, 0xe0, 0x00, 0x3e, 0x30, 0xe0, 0x00});  // Reset pulse.
+    a.Emit({0x06, 0x10});                                // ld b,16
+
+    const uint16_t byte = a.here();
+    a.Emit({0x2a, 0x57, 0x0e, 0x08});  // ld a,(hl+) ; ld d,a ; ld c,8
+
+    // P15 low for a 1 bit, P14 low for a 0 bit, then release both.
+    const uint16_t bit = a.here();
+    a.Emit({0xcb, 0x1a, 0x3e, 0x10, 0x38, 0x02, 0x3e, 0x20});  // rr d ; 1 or 0
+    a.Emit({0xe0, 0x00, 0x3e, 0x30, 0xe0, 0x00, 0x0d});        // send ; dec c
+    a.JumpBack(kJrNz, bit);
+    a.Emit({0x05});  // dec b
+    a.JumpBack(kJrNz, byte);
+
+    a.Emit({0x3e, 0x20, 0xe0, 0x00, 0x3e, 0x30, 0xe0, 0x00});  // Stop bit.
+    a.Emit({0xc9});
+    return send;
+}
+
+std::vector<uint8_t> Assemble(Model model, const char* title) {
+    std::vector<uint8_t> rom(kRomSize, 0);
+
+    // Data read by the CPU checksum and the H-Blank DMA.
+    for (size_t i = 0x4000; i < kRomSize; i++) {
+        rom[i] = static_cast<uint8_t>((i * 7) ^ (i >> 8));
+    }
+    memcpy(&rom[kPacketData], kSgbAttrDiv, 16);
+    memcpy(&rom[kPacketData + 0x10], kSgbPal01A, 16);
+    memcpy(&rom[kPacketData + 0x20], kSgbPal01B, 16);
+    memcpy(&rom[kPacketData + 0x30], kSgbChrTrnLow, 16);
+    memcpy(&rom[kPacketData + 0x40], kSgbChrTrnHigh, 16);
+    memcpy(&rom[kPacketData + 0x50], kSgbPctTrn, 16);
+    memcpy(&rom[kPacketData + 0x60], kSgbMaskFreeze, 16);
+    memcpy(&rom[kPacketData + 0x70], kSgbMaskCancel, 16);
+
+    Assembler a(rom, kCodeStart);
+    const uint16_t send = model == Model::kSgb ? EmitSgbSend(a) : 0;
+
+    const uint16_t main = a.here();
+    a.Emit({0xf3, 0x31, 0xfe, 0xff, 0xaf, 0xe0, 0x80});  // di ; ld sp ; frame = 0
+    a.WaitVBlank(kJrNz);
+    a.Emit({0xaf, 0xe0, 0x40});  // LCD off.
+
+    // Tile data and both maps, VRAM[hl] = l ^ h.
+    a.Emit16(kLdHl, 0x8000);
+    uint16_t loop = a.here();
+    a.Emit({0x7d, 0xac, 0x22, 0x7c, 0xfe, 0xa0});
+    a.JumpBack(kJrNz, loop);
+
+    // OAM, OAM[l] = l.
+    a.Emit16(kLdHl, 0xfe00);
+    loop = a.here();
+    a.Emit({0x7d, 0x22, 0x7d, 0xfe, 0xa0});
+    a.JumpBack(kJrNz, loop);
+
+    // Palettes and window position.
+    a.Emit({0x3e, 0xe4, 0xe0, 0x47, 0x3e, 0xd2, 0xe0, 0x48, 0x3e, 0x1b, 0xe0, 0x49});
+    a.Emit({0x3e, 0x50, 0xe0, 0x4a, 0x3e, 0x57, 0xe0, 0x4b});
+
+    // Sound on, all channels on both outputs.
+    a.Emit({0x3e, 0x80, 0xe0, 0x26, 0x3e, 0x77, 0xe0, 0x24, 0x3e, 0xff, 0xe0, 0x25});
+    a.Emit({0x3e, 0x80, 0xe0, 0x11, 0x3e, 0xf0, 0xe0, 0x12, 0xaf, 0xe0, 0x13});
+    a.Emit({0x3e, 0x40, 0xe0, 0x16, 0x3e, 0xf0, 0xe0, 0x17, 0x3e, 0x80, 0xe0, 0x18});
+    a.Emit16(kLdHl, 0xff30);  // Wave RAM, WAVE[l] = swap(l).
+    loop = a.here();
+    a.Emit({0x7d, 0xcb, 0x37, 0x22, 0x7d, 0xfe, 0x40});
+    a.JumpBack(kJrNz, loop);
+    a.Emit({0x3e, 0x80, 0xe0, 0x1a, 0x3e, 0x20, 0xe0, 0x1c, 0xaf, 0xe0, 0x1d});
+    a.Emit({0x3e, 0xf0, 0xe0, 0x21, 0x3e, 0x55, 0xe0, 0x22});
+
+    if (model == Model::kCgb) {
+        // BG and OBJ palettes, with auto-increment.
+        a.Emit({0x3e, 0x80, 0xe0, 0x68, 0x06, 0x40});
+        loop = a.here();
+        a.Emit({0x78, 0x07, 0x07, 0xa8, 0xe0, 0x69, 0x05});
+        a.JumpBack(kJrNz, loop);
+        a.Emit({0x3e, 0x80, 0xe0, 0x6a, 0x06, 0x40});
+        loop = a.here();
+        a.Emit({0x78, 0x07, 0xa8, 0xe0, 0x6b, 0x05});
+        a.JumpBack(kJrNz, loop);
+
+        // VRAM bank 1, VRAM[hl] = ~l ^ h for the tiles and l & 0x2f for the
+        // attributes.
+        a.Emit({0x3e, 0x01, 0xe0, 0x4f});
+        a.Emit16(kLdHl, 0x8000);
+        loop = a.here();
+        a.Emit({0x7d, 0x2f, 0xac, 0x22, 0x7c, 0xfe, 0x98});
+        a.JumpBack(kJrNz, loop);
+        loop = a.here();
+        a.Emit({0x7d, 0xe6, 0x2f, 0x22, 0x7c, 0xfe, 0xa0});
+        a.JumpBack(kJrNz, loop);
+        a.Emit({0xaf, 0xe0, 0x4f});
+    }
+
+    if (model == Model::kSgb) {
+        a.Emit16(kLdHl, kPacketData);
+        a.Emit16(kCall, send);
+    }
+
+    // LCD on, window at 0x9c00, tiles at 0x8000, 8x16 sprites.
+    a.Emit({0x3e, 0xf7, 0xe0, 0x40});
+
+    const uint16_t frame = a.here();
+    a.WaitVBlank(kJrNz);
+
+    // Show the checksum of the previous frame in tile 0.
+    a.Emit16(kLdAFromMem, 0xc000);
+    a.Emit16(kLdMemFromA, 0x8000);
+    a.Emit16(kLdAFromMem, 0xc001);
+    a.Emit16(kLdMemFromA, 0x8001);
+
+    // Scroll the background and move the sprites to the right.
+    a.Emit({0xf0, 0x43, 0x3c, 0xe0, 0x43, 0xf0, 0x42, 0x3c, 0xe0, 0x42});
+    a.Emit16(kLdHl, 0xfe01);
+    a.Emit({0x06, 0x28});
+    loop = a.here();
+    a.Emit({0x7e, 0x3c, 0x77, 0x2c, 0x2c, 0x2c, 0x2c, 0x05});
+    a.JumpBack(kJrNz, loop);
+
+    // frame++, change the tone frequencies and restart the channels every 16
+    // frames.
+    a.Emit({0xf0, 0x80, 0x3c, 0xe0, 0x80, 0xe0, 0x13, 0x2f, 0xe0, 0x18});
+    a.Emit({0xf0, 0x80, 0xe6, 0x0f});
+    uint16_t skip = a.JumpForward(kJrNz);
+    a.Emit({0x3e, 0x87, 0xe0, 0x14, 0x3e, 0x86, 0xe0, 0x19});
+    a.Emit({0x3e, 0x87, 0xe0, 0x1e, 0x3e, 0x80, 0xe0, 0x23});
+    a.Bind(skip);
+
+    if (model == Model::kCgb) {
+        // H-Blank DMA of 256 bytes from ROM to 0x8800.
+        a.Emit({0xf0, 0x80, 0xe6, 0x3f, 0xf6, 0x40, 0xe0, 0x51, 0xaf, 0xe0, 0x52});
+        a.Emit({0x3e, 0x08, 0xe0, 0x53, 0xaf, 0xe0, 0x54, 0x3e, 0x8f, 0xe0, 0x55});
+    }
+
+    a.WaitVBlank(kJrZ);
+
+    if (model == Model::kSgb) {
+        a.Emit({0xf0, 0x80, 0xe6, 0x1f});
+        skip = a.JumpForward(kJrNz);
+        a.Emit({0xf0, 0x80, 0xe6, 0x20});
+        a.Emit16(kLdHl, kPacketData + 0x10);
+        a.Emit({kJrZ, 0x03});
+        a.Emit16(kLdHl, kPacketData + 0x20);
+        a.Emit16(kCall, send);
+        a.Bind(skip);
+
+        // Border transfer when frame & 0x3f == 0x10, the CHR_TRN half
+        // alternates.
+        a.Emit({0xf0, 0x80, 0xe6, 0x3f, 0xfe, 0x10});
+        skip = a.JumpForward(kJrNz);
+        a.Emit16(kLdHl, kPacketData + 0x60);
+        a.Emit16(kCall, send);
+        a.Emit({0xf0, 0x80, 0xe6, 0x40});
+        a.Emit16(kLdHl, kPacketData + 0x30);
+        a.Emit({kJrZ, 0x03});
+        a.Emit16(kLdHl, kPacketData + 0x40);
+        a.Emit16(kCall, send);
+        a.Emit16(kLdHl, kPacketData + 0x50);
+        a.Emit16(kCall, send);
+        a.Emit16(kLdHl, kPacketData + 0x70);
+        a.Emit16(kCall, send);
+        a.Bind(skip);
+    }
+
+    // Checksum of 512 ROM bytes, kept in DE across frames.
+    a.Emit16(kLdHl, kCodeStart);
+    a.Emit16(kLdBc, 0x0200);
+    loop = a.here();
+    a.Emit({0x2a, 0x83, 0x5f, 0x7a, 0xce, 0x00, 0xab, 0x07, 0x57, 0x0b, 0x78, 0xb1});
+    a.JumpBack(kJrNz, loop);
+    a.Emit({0x7a});
+    a.Emit16(kLdMemFromA, 0xc000);
+    a.Emit({0x7b});
+    a.Emit16(kLdMemFromA, 0xc001);
+    a.Emit16(kJp, frame);
+
+    // Entry point and header.
+    Assembler entry(rom, 0x0100);
+    entry.Emit({0x00});
+    entry.Emit16(kJp, main);
+    memcpy(&rom[0x104], kNintendoLogo, sizeof(kNintendoLogo));
+    memcpy(&rom[0x134], title, strlen(title));
+    if (model == Model::kCgb) {
+        rom[0x143] = 0xc0;
+    } else if (model == Model::kSgb) {
+        rom[0x146] = 0x03;
+        rom[0x14b] = 0x33;
+    }
+
+    uint8_t checksum = 0;
+    for (size_t i = 0x134; i <= 0x14c; i++) {
+        checksum = checksum - rom[i] - 1;
+    }
+    rom[0x14d] = checksum;
+
+    return rom;
+}
+
+}  // namespace
+
+GbTestRom gbTestRomDmg() {
+    return {"dmg", Assemble(Model::kDmg, "VBAM DMG")};
+}
+
+GbTestRom gbTestRomCgb() {
+    return {"cgb", Assemble(Model::kCgb, "VBAM CGB")};
+}
+
+GbTestRom gbTestRomSgb() {
+    return {"sgb", Assemble(Model::kSgb, "VBAM SGB")};
+}
+
+std::vector<GbTestRom> gbTestRoms() {
+    std::vector<GbTestRom> roms;
+    roms.push_back(gbTestRomDmg());
+    roms.push_back(gbTestRomCgb());
+    roms.push_back(gbTestRomSgb());
+    return roms;
+}
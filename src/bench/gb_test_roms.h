@@ -0,0 +1,29 @@
+#ifndef VBAM_BENCH_GB_TEST_ROMS_H_
+#define VBAM_BENCH_GB_TEST_ROMS_H_
+
+#include <cstdint>
+#include <vector>
+
+// Small Game Boy programs assembled at runtime, so the benchmarks do not depend
+// on any external ROM file. All of them run the same main loop:
+//   * A checksum over the ROM during the visible lines, stored in tile 0.
+//   * During V-Blank, the background, the window and the 40 sprites (8x16) are
+//     scrolled.
+//   * The 4 sound channels play tones that change every frame.
+struct GbTestRom {
+    const char* name;
+    std::vector<uint8_t> data;
+};
+
+// Plain DMG ROM.
+GbTestRom gbTestRomDmg();
+// CGB-only ROM, also using VRAM bank 1 attributes, CGB palettes and an H-Blank
+// DMA transfer every frame.
+GbTestRom gbTestRomCgb();
+// SGB ROM sending ATTR_DIV once and PAL01 packets every 32 frames.
+GbTestRom gbTestRomSgb();
+
+// All of the above.
+std::vector<GbTestRom> gbTestRoms();
+
+#endif  // VBAM_BENCH_GB_TEST_ROMS_H_
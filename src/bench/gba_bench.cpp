@@ -0,0 +1,265 @@
+// Headless benchmark for the GBA CPU core.
+//
+// Runs a ROM assembled at runtime, an ARM loop storing and loading to IWRAM
+// and EWRAM and calling a Thumb loop on every iteration, for a fixed number of
+// frames. The screen is blanked, so the time is spent in the interpreter and
+// its memory accesses. Reports the emulation speed and, on Linux, the host
+// IPC and L1 data cache misses from the hardware counters, when the kernel
+// allows reading them, and how much of the emulated memory got huge pages.
+//
+// The hash of the work RAMs at the end of the run identifies the emulated
+// state, to check that changes to the interpreter do not change its behavior.
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif  // defined(__linux__)
+
+#include "core/base/huge_pages.h"
+#include "core/base/sizes.h"
+#include "core/base/system.h"
+#include "core/gba/gba.h"
+#include "core/gba/gbaGlobals.h"
+#include "core/gba/gbaSound.h"
+#include "headless/headless_system.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kDefaultFrames = 3600;
+
+// Offset of the code, after the cartridge header.
+constexpr size_t kCodeOffset = 0xc0;
+
+void PutU32(std::vector<uint8_t>* rom, size_t offset, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        (*rom)[offset + i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+}
+
+void PutU16(std::vector<uint8_t>* rom, size_t offset, uint16_t value) {
+    (*rom)[offset] = static_cast<uint8_t>(value);
+    (*rom)[offset + 1] = static_cast<uint8_t>(value >> 8);
+}
+
+std::vector<uint8_t> AssembleRom() {
+    std::vector<uint8_t> rom(0x200);
+    // b start
+    PutU32(&rom, 0x00, 0xea000000 | ((kCodeOffset - 8) / 4));
+    memcpy(&rom[0xa0], "VBAM BENCH  ", 12);
+    rom[0xb2] = 0x96;
+
+    static const uint32_t kArm[] = {
+        0xe3a00403,  // 0c0:       mov r0, #0x03000000
+        0xe3a01402,  // 0c4:       mov r1, #0x02000000
+        0xe3a02000,  // 0c8:       mov r2, #0
+        0xe28f8024,  // 0cc:       add r8, pc, #0x24 (thumb)
+        0xe3888001,  // 0d0:       orr r8, r8, #1
+        0xe2822001,  // 0d4: loop: add r2, r2, #1
+        0xe20240ff,  // 0d8:       and r4, r2, #0xff
+        0xe7802104,  // 0dc:       str r2, [r0, r4, lsl #2]
+        0xe7915104,  // 0e0:       ldr r5, [r1, r4, lsl #2]
+        0xe0855002,  // 0e4:       add r5, r5, r2
+        0xe7815104,  // 0e8:       str r5, [r1, r4, lsl #2]
+        0xe1a0e00f,  // 0ec:       mov lr, pc
+        0xe12fff18,  // 0f0:       bx r8
+        0xeafffff6,  // 0f4:       b loop
+    };
+    static const uint16_t kThumb[] = {
+        0x2310,  // 0f8: thumb:  movs r3, #16
+        0x6806,  // 0fa: tloop:  ldr r6, [r0, #0]
+        0x18f6,  // 0fc:         adds r6, r6, r3
+        0x6046,  // 0fe:         str r6, [r0, #4]
+        0x3b01,  // 100:         subs r3, #1
+        0xd1fa,  // 102:         bne tloop
+        0x4770,  // 104:         bx lr
+    };
+
+    size_t offset = kCodeOffset;
+    for (uint32_t insn : kArm) {
+        PutU32(&rom, offset, insn);
+        offset += 4;
+    }
+    for (uint16_t insn : kThumb) {
+        PutU16(&rom, offset, insn);
+        offset += 2;
+    }
+    return rom;
+}
+
+// Host hardware counters of the calling thread, in user space.
+class HostCounters final {
+public:
+    HostCounters() {
+#if defined(__linux__)
+        Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        Open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#endif  // defined(__linux__)
+    }
+    ~HostCounters() {
+#if defined(__linux__)
+        for (int fd : fds_) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+#endif  // defined(__linux__)
+    }
+
+    // Disable copy constructor and assignment operator.
+    HostCounters(const HostCounters&) = delete;
+    HostCounters& operator=(const HostCounters&) = delete;
+
+    void Start() {
+#if defined(__linux__)
+        for (int fd : fds_) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif  // defined(__linux__)
+    }
+
+    // Stops counting and reads the counters, -1 for the unavailable ones.
+    void Stop(int64_t* cycles, int64_t* instructions, int64_t* l1d_misses) {
+        int64_t* values[] = {cycles, instructions, l1d_misses};
+        for (size_t i = 0; i < 3; i++) {
+            *values[i] = -1;
+#if defined(__linux__)
+            uint64_t value;
+            if (fds_[i] >= 0 && ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0) == 0 &&
+                read(fds_[i], &value, sizeof(value)) == sizeof(value)) {
+                *values[i] = static_cast<int64_t>(value);
+            }
+#endif  // defined(__linux__)
+        }
+    }
+
+private:
+#if defined(__linux__)
+    void Open(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fds_[count_++] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif  // defined(__linux__)
+
+    int fds_[3] = {-1, -1, -1};
+    size_t count_ = 0;
+};
+
+double ToMs(Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+uint64_t StateHash() {
+    std::vector<uint8_t> state(g_workRAM, g_workRAM + SIZE_WRAM);
+    state.insert(state.end(), g_internalRAM, g_internalRAM + SIZE_IRAM);
+    return headlessHash(state.data(), state.size());
+}
+
+void Usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Options:\n"
+            "  --frames N        Number of frames to run (default: %d)\n"
+            "  --check HASH      Fail unless the final state hashes to HASH\n",
+            program, kDefaultFrames);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int frames = kDefaultFrames;
+    bool check = false;
+    uint64_t expected = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--check") == 0 && i + 1 < argc) {
+            check = true;
+            expected = strtoull(argv[++i], nullptr, 16);
+        } else {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (frames <= 0) {
+        Usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    headlessInit();
+    soundInit();
+
+    const std::vector<uint8_t> rom = AssembleRom();
+    if (CPULoadRomData(reinterpret_cast<const char*>(rom.data()), static_cast<int>(rom.size())) ==
+        0) {
+        fprintf(stderr, "Failed to load the ROM\n");
+        return EXIT_FAILURE;
+    }
+    CPUInit(nullptr, false);
+    CPUReset();
+
+    HostCounters counters;
+    headlessFramesDrawn = 0;
+    const Clock::time_point start = Clock::now();
+    counters.Start();
+    while (headlessFramesDrawn < frames) {
+        GBASystem.emuMain(GBASystem.emuCount);
+    }
+    int64_t cycles, instructions, l1d_misses;
+    counters.Stop(&cycles, &instructions, &l1d_misses);
+    const Clock::duration total = Clock::now() - start;
+
+    const uint64_t hash = StateHash();
+    const HugePageStats huge_pages = hugePageStats();
+    CPUCleanUp();
+    soundShutdown();
+
+    printf("%6s %10s %10s %8s %16s %18s\n", "frames", "fps", "total ms", "ipc", "insns/frame",
+           "l1d misses/frame");
+    printf("%6d %10.1f %10.1f ", frames, frames * 1000.0 / ToMs(total), ToMs(total));
+    if (cycles > 0 && instructions >= 0) {
+        printf("%8.2f %16.0f ", static_cast<double>(instructions) / cycles,
+               static_cast<double>(instructions) / frames);
+    } else {
+        printf("%8s %16s ", "n/a", "n/a");
+    }
+    if (l1d_misses >= 0) {
+        printf("%18.1f\n", static_cast<double>(l1d_misses) / frames);
+    } else {
+        printf("%18s\n", "n/a");
+    }
+    printf("state hash %016" PRIx64 "\n", hash);
+    printf("huge pages %zu of %zu KiB\n",
+           (huge_pages.explicit_bytes + huge_pages.transparent_bytes) / 1024,
+           huge_pages.bytes / 1024);
+
+    if (check && hash != expected) {
+        fprintf(stderr, "State hash mismatch, expected %016" PRIx64 "\n", expected);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
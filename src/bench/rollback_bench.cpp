@@ -0,0 +1,258 @@
+// Headless test of the rollback session (see core/base/rollback.h).
+//
+// Runs two peers of a RollbackSession on a single machine, connected by a
+// LoopbackTransport with simulated latency and jitter. The core is not
+// reentrant, so the peers take turns on the single emulator instance, each
+// one swapping its own state in and out. The test ROM only reads one joypad,
+// so both players drive it: player 1 the buttons, player 2 the d-pad.
+//
+// Once every input is confirmed, the state of both peers is compared to a
+// reference run with all the inputs known in advance, and the rollback
+// statistics are reported.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "bench/gb_test_roms.h"
+#include "core/base/rollback.h"
+#include "core/base/system.h"
+#include "core/gb/gb.h"
+#include "core/gba/gbaSound.h"
+#include "headless/headless_system.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kDefaultFrames = 1200;
+constexpr int kDefaultMaxRollback = 8;
+constexpr uint32_t kDefaultLatencyMs = 50;
+constexpr uint32_t kDefaultJitterMs = 30;
+// Virtual time between two frames.
+constexpr uint64_t kFrameMs = 16;
+// The inputs of a player change at most every kInputPeriod frames.
+constexpr uint32_t kInputPeriod = 6;
+
+struct Peer {
+    int player;
+    std::unique_ptr<RollbackTransport> transport;
+    std::unique_ptr<RollbackSession> session;
+    // State of the peer while the other one runs.
+    std::vector<uint8_t> state;
+    uint64_t stalls = 0;
+    Clock::duration time{};
+};
+
+// Peer using the emulator, nullptr during the reference run.
+Peer* g_peer = nullptr;
+uint32_t g_reference_joypad = 0;
+uint64_t g_reference_frames = 0;
+// Virtual time of the latency simulators.
+uint64_t g_now_ms = 0;
+
+// Input of `player` for `frame`, a pseudo-random pattern that changes every
+// few frames.
+uint32_t PlayerInput(int player, uint32_t frame, uint32_t seed) {
+    uint32_t x = (frame / kInputPeriod) * 0x9e3779b9u ^ seed ^ (player + 1) * 0x85ebca6bu;
+    x ^= x >> 15;
+    x *= 0x2c1b3c6du;
+    x ^= x >> 12;
+    return player == 0 ? x & 0x0f : x & 0xf0;
+}
+
+uint32_t MergeInputs(uint32_t player1, uint32_t player2) {
+    return (player1 & 0x0f) | (player2 & 0xf0);
+}
+
+uint32_t ReadJoypad(int) {
+    if (g_peer == nullptr) {
+        return g_reference_joypad;
+    }
+    return MergeInputs(g_peer->session->joypad(0), g_peer->session->joypad(1));
+}
+
+void OnFrame() {
+    if (g_peer == nullptr) {
+        g_reference_frames++;
+    } else {
+        g_peer->session->OnFrame();
+    }
+}
+
+std::vector<uint8_t> SaveState() {
+    std::vector<uint8_t> state(GBSystem.emuMemStateSize());
+    long size = 0;
+    if (!GBSystem.emuWriteMemState(reinterpret_cast<char*>(state.data()),
+                                   static_cast<int>(state.size()), size)) {
+        return {};
+    }
+    state.resize(size);
+    return state;
+}
+
+bool LoadState(const std::vector<uint8_t>& state) {
+    return GBSystem.emuReadMemState(
+        const_cast<char*>(reinterpret_cast<const char*>(state.data())),
+        static_cast<int>(state.size()));
+}
+
+// Runs `frames` frames with the inputs known in advance.
+std::vector<uint8_t> RunReference(const std::vector<uint8_t>& initial, int frames, uint32_t seed) {
+    LoadState(initial);
+    for (uint32_t frame = 0; frame < static_cast<uint32_t>(frames); frame++) {
+        g_reference_joypad = MergeInputs(PlayerInput(0, frame, seed), PlayerInput(1, frame, seed));
+        const uint64_t start = g_reference_frames;
+        while (g_reference_frames == start) {
+            GBSystem.emuMain(GBSystem.emuCount);
+        }
+    }
+    return SaveState();
+}
+
+// Gives the emulator to `peer` for one step. Emulates the next frame if
+// `run`, only receives the remote inputs otherwise.
+bool Step(Peer* peer, bool run, uint32_t seed) {
+    if (!LoadState(peer->state)) {
+        return false;
+    }
+
+    g_peer = peer;
+    const Clock::time_point start = Clock::now();
+    bool result;
+    if (run) {
+        const uint32_t frame = peer->session->frame();
+        if (!peer->session->RunFrame(GBSystem, PlayerInput(peer->player, frame, seed))) {
+            peer->stalls++;
+        }
+        result = true;
+    } else {
+        result = peer->session->Poll(GBSystem);
+    }
+    peer->time += Clock::now() - start;
+    g_peer = nullptr;
+
+    peer->state = SaveState();
+    return result && !peer->state.empty();
+}
+
+void Usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Options:\n"
+            "  --frames N          Number of frames to run (default: %d)\n"
+            "  --max-rollback N    Maximum number of predicted frames (default: %d)\n"
+            "  --latency MS        Simulated one-way latency (default: %u)\n"
+            "  --jitter MS         Simulated jitter (default: %u)\n"
+            "  --seed N            Seed of the inputs and of the jitter (default: 1)\n",
+            program, kDefaultFrames, kDefaultMaxRollback, kDefaultLatencyMs, kDefaultJitterMs);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int frames = kDefaultFrames;
+    int max_rollback = kDefaultMaxRollback;
+    uint32_t latency_ms = kDefaultLatencyMs;
+    uint32_t jitter_ms = kDefaultJitterMs;
+    uint32_t seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-rollback") == 0 && i + 1 < argc) {
+            max_rollback = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            latency_ms = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--jitter") == 0 && i + 1 < argc) {
+            jitter_ms = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (frames <= 0 || max_rollback < 0) {
+        Usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    headlessInit();
+    headlessReadJoypad = ReadJoypad;
+    headlessOnFrame = OnFrame;
+    soundInit();
+
+    const GbTestRom rom = gbTestRomDmg();
+    if (!gbLoadRomData(reinterpret_cast<const char*>(rom.data.data()), rom.data.size())) {
+        fprintf(stderr, "%s: failed to load\n", rom.name);
+        return EXIT_FAILURE;
+    }
+    gbReset();
+
+    const std::vector<uint8_t> initial = SaveState();
+    const std::vector<uint8_t> reference = RunReference(initial, frames, seed);
+
+    std::unique_ptr<LoopbackTransport> a, b;
+    LoopbackTransport::CreatePair(&a, &b);
+    const LatencySimulator::Clock clock = [] { return g_now_ms; };
+
+    Peer peers[2];
+    peers[0].transport.reset(
+        new LatencySimulator(std::move(a), latency_ms, jitter_ms, seed, clock));
+    peers[1].transport.reset(
+        new LatencySimulator(std::move(b), latency_ms, jitter_ms, seed + 1, clock));
+    for (int i = 0; i < 2; i++) {
+        peers[i].player = i;
+        peers[i].session.reset(
+            new RollbackSession(i, max_rollback, peers[i].transport.get()));
+        peers[i].state = initial;
+    }
+
+    // Run both peers up to `frames`, then until every input is confirmed.
+    // The step limit only guards against a deadlock.
+    const uint64_t max_steps = static_cast<uint64_t>(frames) * 100 + 1000;
+    bool result = true;
+    uint64_t steps = 0;
+    for (; result && steps < max_steps; steps++) {
+        bool done = true;
+        for (Peer& peer : peers) {
+            const bool run = peer.session->frame() < static_cast<uint32_t>(frames);
+            if (run || peer.session->confirmed_frame() < static_cast<uint32_t>(frames)) {
+                result &= Step(&peer, run, seed);
+                done = false;
+            }
+        }
+        if (done) {
+            break;
+        }
+        g_now_ms += kFrameMs;
+    }
+
+    if (steps == max_steps) {
+        fprintf(stderr, "the peers did not converge after %llu steps\n",
+                static_cast<unsigned long long>(steps));
+        result = false;
+    }
+
+    printf("%-6s %6s %10s %12s %8s %10s %8s\n", "peer", "frames", "rollbacks", "resimulated",
+           "stalls", "fps", "synced");
+    for (const Peer& peer : peers) {
+        const double ms = std::chrono::duration<double, std::milli>(peer.time).count();
+        const bool synced = peer.state == reference;
+        printf("%-6d %6u %10llu %12llu %8llu %10.1f %8s\n", peer.player + 1,
+               peer.session->frame(), static_cast<unsigned long long>(peer.session->rollbacks()),
+               static_cast<unsigned long long>(peer.session->resimulated_frames()),
+               static_cast<unsigned long long>(peer.stalls),
+               ms > 0 ? peer.session->frame() * 1000.0 / ms : 0.0, synced ? "yes" : "NO");
+        result &= synced;
+    }
+
+    gbCleanUp();
+    soundShutdown();
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
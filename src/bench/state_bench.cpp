@@ -0,0 +1,400 @@
+// Headless benchmark of the savestate paths of the GB and GBA cores.
+//
+// For several captured states of every test ROM, measures the latency of the
+// in-memory savestates used by rewind and run-ahead, of their packing with
+// every flat state codec, of the encoding of savestate files with and without
+// compression, of their storage in a StateStore pack, and of the file
+// savestates themselves. Reports the latency
+// percentiles, the bytes produced and the throughput, relative to the size
+// of the flat state, so that rewind buffers can be sized from the results.
+//
+// A rewind buffer captures every frame along the way, incrementally for the
+// GBA, and the snapshots it decodes must match the states written in full.
+//
+// There is no GBA test ROM, the GBA states come from a small generated
+// program that keeps writing to EWRAM. It is loaded from a file, as
+// CPULoadRomData() allocates a frame buffer too small for the 32 bits per
+// pixel output. The GBA states are benchmarked first, as the GBA core does
+// not support being loaded after the GB core.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "bench/gb_test_roms.h"
+#include "core/base/flat_state.h"
+#include "core/base/rewind.h"
+#include "core/base/sizes.h"
+#include "core/base/snapshot_arena.h"
+#include "core/base/state_store.h"
+#include "core/base/system.h"
+#include "core/gb/gb.h"
+#include "core/gba/gba.h"
+#include "core/gba/gbaSound.h"
+#include "headless/headless_system.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kDefaultIterations = 100;
+// Frames at which the states are captured, after a reset.
+constexpr int kCaptureFrames[] = {60, 600, 3000};
+// Rewind buffer captured every frame, short groups so that the deltas are
+// computed against many keyframes.
+constexpr size_t kRewindBudget = k16MiB;
+constexpr size_t kRewindKeyframeInterval = 8;
+// Number of newest rewind snapshots checked at every capture frame.
+constexpr size_t kRewindChecked = 12;
+
+// ARM program filling EWRAM with an incrementing counter:
+//   mov r1, #0x02000000
+// loop:
+//   add r0, r0, #1
+//   mov r2, r0, lsl #16
+//   mov r2, r2, lsr #14
+//   str r0, [r1, r2]
+//   b loop
+constexpr uint32_t kGbaProgram[] = {0xe3a01402, 0xe2800001, 0xe1a02800,
+                                    0xe1a02722, 0xe7810002, 0xeafffffa};
+constexpr size_t kGbaRomSize = 0x1000;
+constexpr size_t kGbaRomTitleOffset = 0xa0;
+
+struct Result {
+    std::string state;
+    const char* operation;
+    size_t state_size;
+    size_t bytes;
+    double p50_us;
+    double p99_us;
+};
+
+std::vector<Result> g_results;
+int g_iterations = kDefaultIterations;
+
+std::vector<char> GbaTestRom() {
+    std::vector<char> rom(kGbaRomSize, 0);
+    memcpy(rom.data(), kGbaProgram, sizeof(kGbaProgram));
+    memcpy(rom.data() + kGbaRomTitleOffset, "STATEBENCHROM000", 16);
+    return rom;
+}
+
+// Returns the `percentile` of the sorted `samples`, in microseconds.
+double Percentile(const std::vector<Clock::duration>& samples, int percentile) {
+    const size_t rank = (samples.size() * percentile + 99) / 100;
+    const size_t index = std::min(samples.size() - 1, rank > 0 ? rank - 1 : 0);
+    return std::chrono::duration<double, std::micro>(samples[index]).count();
+}
+
+// Runs `operation` g_iterations times. `operation` returns the number of
+// bytes produced, 0 on failure.
+bool Measure(const std::string& state,
+             const char* operation_name,
+             size_t state_size,
+             const std::function<size_t()>& operation) {
+    std::vector<Clock::duration> samples;
+    samples.reserve(g_iterations);
+    size_t bytes = 0;
+    for (int i = 0; i < g_iterations; i++) {
+        const Clock::time_point start = Clock::now();
+        bytes = operation();
+        samples.push_back(Clock::now() - start);
+        if (bytes == 0) {
+            fprintf(stderr, "%s: %s failed\n", state.c_str(), operation_name);
+            return false;
+        }
+    }
+
+    std::sort(samples.begin(), samples.end());
+    g_results.push_back({state, operation_name, state_size, bytes, Percentile(samples, 50),
+                         Percentile(samples, 99)});
+    return true;
+}
+
+size_t FileSize(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return 0;
+    }
+    long size = 0;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        size = ftell(file);
+    }
+    fclose(file);
+    return size > 0 ? static_cast<size_t>(size) : 0;
+}
+
+std::vector<uint8_t> SaveState(const EmulatedSystem& system) {
+    std::vector<uint8_t> state(system.emuMemStateSize());
+    long size = 0;
+    if (!system.emuWriteMemState(reinterpret_cast<char*>(state.data()),
+                                 static_cast<int>(state.size()), size)) {
+        return {};
+    }
+    state.resize(size);
+    return state;
+}
+
+bool LoadState(const EmulatedSystem& system, const std::vector<uint8_t>& state) {
+    return system.emuReadMemState(const_cast<char*>(reinterpret_cast<const char*>(state.data())),
+                                  static_cast<int>(state.size()));
+}
+
+// Benchmarks every savestate path on the current state of `system`.
+bool BenchState(const EmulatedSystem& system, const std::string& name, const std::string& path) {
+    const std::vector<uint8_t> state = SaveState(system);
+    if (state.empty()) {
+        fprintf(stderr, "%s: failed to capture the state\n", name.c_str());
+        return false;
+    }
+    const size_t size = state.size();
+
+    std::vector<uint8_t> buffer(system.emuMemStateSize());
+    bool result = Measure(name, "mem-write", size, [&] {
+        long written = 0;
+        return system.emuWriteMemState(reinterpret_cast<char*>(buffer.data()),
+                                       static_cast<int>(buffer.size()), written)
+                   ? static_cast<size_t>(written)
+                   : 0;
+    });
+    result &= Measure(name, "mem-read", size, [&] { return LoadState(system, state) ? size : 0; });
+
+    const struct {
+        const FlatStateCodec* codec;
+        const char* pack;
+        const char* unpack;
+    } codecs[] = {
+        {flatStateCodecNone(), "pack-none", "unpack-none"},
+        {flatStateCodecZlib(), "pack-zlib", "unpack-zlib"},
+    };
+    for (const auto& codec : codecs) {
+        std::vector<uint8_t> packed(flatStatePackBound(codec.codec, size));
+        size_t packed_size = 0;
+        result &= Measure(name, codec.pack, size, [&] {
+            packed_size = flatStatePack(codec.codec, state.data(), size, packed.data(),
+                                        packed.size());
+            return packed_size;
+        });
+        result &= Measure(name, codec.unpack, size, [&] {
+            return flatStateUnpack(packed.data(), packed_size, buffer.data(), buffer.size());
+        });
+    }
+
+    std::vector<uint8_t> file;
+    result &= Measure(name, "encode-raw", size, [&] {
+        return flatStateEncodeFile(state.data(), size, nullptr, &file) ? file.size() : 0;
+    });
+    result &= Measure(name, "encode-zlib", size, [&] {
+        return flatStateEncodeFile(state.data(), size, flatStateCodecZlib(), &file) ? file.size()
+                                                                                     : 0;
+    });
+
+    // The files stored in a pack must be rebuilt as they were encoded, from
+    // the open store and after reopening it.
+    std::vector<uint8_t> encoded;
+    result &= flatStateEncodeFile(state.data(), size, nullptr, &encoded);
+    const std::string pack_path = path + ".vbpack";
+    std::vector<uint8_t> reference;
+    std::vector<uint8_t> loaded;
+    StateStore store;
+    if (!store.Open(pack_path.c_str(), true)) {
+        fprintf(stderr, "%s: failed to open the pack\n", name.c_str());
+        result = false;
+    } else {
+        result &= Measure(name, "store-write", size, [&] {
+            reference = encoded;
+            return store.Store(path.c_str(), &reference) ? reference.size() : 0;
+        });
+        result &= Measure(name, "store-read", size, [&] {
+            return store.Load(reference.data(), reference.size(), &loaded) && loaded == encoded
+                       ? loaded.size()
+                       : 0;
+        });
+        store.Close();
+        if (!stateStoreLoadFile(path.c_str(), reference.data(), reference.size(), &loaded) ||
+            loaded != encoded) {
+            fprintf(stderr, "%s: failed to reload the pack\n", name.c_str());
+            result = false;
+        }
+    }
+    remove(pack_path.c_str());
+    remove((pack_path + ".idx").c_str());
+
+    // g_writeBehind is not set, the files are written synchronously.
+    result &= Measure(name, "file-write", size, [&] {
+        return system.emuWriteState(path.c_str()) ? FileSize(path.c_str()) : 0;
+    });
+    result &= Measure(name, "file-read", size,
+                      [&] { return system.emuReadState(path.c_str()) ? size : 0; });
+
+    remove(path.c_str());
+    return result;
+}
+
+// Checks that the newest snapshots of `rewind` decode to the `recent` states,
+// the newest last, and that restoring the newest one restores the state.
+bool CheckRewind(const EmulatedSystem& system,
+                 RewindBuffer& rewind,
+                 const std::deque<std::vector<uint8_t>>& recent,
+                 const std::string& name) {
+    std::vector<uint8_t> decoded(system.emuMemStateSize());
+    for (size_t i = 0; i < recent.size(); i++) {
+        const std::vector<uint8_t>& expected = recent[recent.size() - 1 - i];
+        const size_t size = rewind.Read(i, decoded.data(), decoded.size());
+        if (size != expected.size() || memcmp(decoded.data(), expected.data(), size) != 0) {
+            fprintf(stderr, "%s: rewind snapshot %zu does not match\n", name.c_str(), i);
+            return false;
+        }
+    }
+
+    if (!rewind.Restore(system, 0) || SaveState(system) != recent.back()) {
+        fprintf(stderr, "%s: rewind restore does not match\n", name.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Runs `system` from its reset state and benchmarks the states captured at
+// kCaptureFrames.
+bool BenchCaptures(const EmulatedSystem& system, const char* rom_name, const std::string& dir) {
+    const std::string path = dir + "/vbam-state-bench-" + rom_name + ".sgm";
+    RewindBuffer rewind(kRewindBudget, kRewindKeyframeInterval, nullptr);
+    std::deque<std::vector<uint8_t>> recent;
+    bool result = true;
+    int frame = 0;
+    for (int capture_frame : kCaptureFrames) {
+        for (; frame < capture_frame; frame++) {
+            system.emuMain(system.emuCount);
+
+            if (!rewind.Capture(system)) {
+                fprintf(stderr, "%s: rewind capture failed\n", rom_name);
+                return false;
+            }
+            if (frame + kRewindChecked >= static_cast<size_t>(capture_frame)) {
+                recent.push_back(SaveState(system));
+            }
+        }
+        const std::string name = std::string(rom_name) + "@" + std::to_string(frame);
+        result &= CheckRewind(system, rewind, recent, name);
+        recent.clear();
+
+        // The file savestates restore the state, the next capture resumes
+        // from the same point.
+        const std::vector<uint8_t> state = SaveState(system);
+        result &= BenchState(system, name, path);
+        result &= LoadState(system, state);
+    }
+    return result;
+}
+
+bool BenchGba(const std::string& dir) {
+    const std::string rom_path = dir + "/vbam-state-bench.gba";
+    const std::vector<char> rom = GbaTestRom();
+    FILE* file = fopen(rom_path.c_str(), "wb");
+    const bool written = file != nullptr && fwrite(rom.data(), 1, rom.size(), file) == rom.size();
+    if (file != nullptr) {
+        fclose(file);
+    }
+    const bool loaded = written && CPULoadRom(rom_path.c_str()) != 0;
+    remove(rom_path.c_str());
+    if (!loaded) {
+        fprintf(stderr, "gba: failed to load\n");
+        return false;
+    }
+    CPUInit(nullptr, false);
+    CPUReset();
+
+    const bool result = BenchCaptures(GBASystem, "gba", dir);
+    CPUCleanUp();
+    return result;
+}
+
+bool BenchGb(const std::string& dir) {
+    bool result = true;
+    for (const GbTestRom& rom : gbTestRoms()) {
+        if (!gbLoadRomData(reinterpret_cast<const char*>(rom.data.data()), rom.data.size())) {
+            fprintf(stderr, "%s: failed to load\n", rom.name);
+            result = false;
+            continue;
+        }
+        gbReset();
+        result &= BenchCaptures(GBSystem, rom.name, dir);
+        gbCleanUp();
+    }
+    return result;
+}
+
+void Usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Options:\n"
+            "  --iterations N      Number of runs of every operation (default: %d)\n"
+            "  --system NAME       Only benchmark `gb` or `gba`\n"
+            "  --dir DIR           Directory of the savestate files (default: .)\n",
+            program, kDefaultIterations);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::string dir = ".";
+    bool gb = true;
+    bool gba = true;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            g_iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--system") == 0 && i + 1 < argc) {
+            const char* system = argv[++i];
+            gb = strcmp(system, "gb") == 0;
+            gba = strcmp(system, "gba") == 0;
+            if (!gb && !gba) {
+                Usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (g_iterations <= 0) {
+        Usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    headlessInit();
+    soundInit();
+
+    bool result = true;
+    if (gba) {
+        result &= BenchGba(dir);
+    }
+    if (gb) {
+        result &= BenchGb(dir);
+    }
+
+    printf("%-12s %-12s %10s %10s %10s %10s %10s\n", "state", "operation", "state", "bytes",
+           "p50 us", "p99 us", "MB/s");
+    for (const Result& r : g_results) {
+        printf("%-12s %-12s %10zu %10zu %10.1f %10.1f %10.1f\n", r.state.c_str(), r.operation,
+               r.state_size, r.bytes, r.p50_us, r.p99_us,
+               r.p50_us > 0 ? r.state_size / r.p50_us : 0.0);
+    }
+
+    const SnapshotArenaStats arena = snapshotArena().stats();
+    printf("\nsnapshot arena: %zu slabs of %zu bytes, %llu allocations, %llu reuses\n",
+           arena.slab_count, arena.slab_size, static_cast<unsigned long long>(arena.allocations),
+           static_cast<unsigned long long>(arena.reuses));
+
+    soundShutdown();
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,6 +1,7 @@
 #ifndef VBAM_CORE_BASE_FILE_UTIL_H_
 #define VBAM_CORE_BASE_FILE_UTIL_H_
 
+#include <cstddef>
 #include <cstdio>
 #include <cstdint>
 
@@ -27,8 +28,8 @@ IMAGE_TYPE utilFindType(const char *);
 bool utilIsGBAImage(const char *);
 bool utilIsGBImage(const char *);
 
-#if defined(__LIBRETRO__)
-
+// In-memory savestate helpers. These do not check bounds, the caller must
+// provide a large enough buffer.
 void utilWriteIntMem(uint8_t *&data, int);
 void utilWriteMem(uint8_t *&data, const void *in_data, unsigned size);
 void utilWriteDataMem(uint8_t *&data, variable_desc *);
@@ -36,8 +37,10 @@ void utilWriteDataMem(uint8_t *&data, variable_desc *);
 int utilReadIntMem(const uint8_t *&data);
 void utilReadMem(void *buf, const uint8_t *&data, unsigned size);
 void utilReadDataMem(const uint8_t *&data, variable_desc *);
+// Number of bytes written by utilWriteDataMem() for `desc`.
+size_t utilDataSize(const variable_desc *desc);
 
-#else  // !defined(__LIBRETRO__)
+#if !defined(__LIBRETRO__)
 
 // strip .gz or .z off end
 void utilStripDoubleExtension(const char *, char *);
@@ -56,6 +59,6 @@ void utilReadDataSkip(gzFile, variable_desc *);
 int utilReadInt(gzFile);
 void utilWriteInt(gzFile, int);
 
-#endif  // defined(__LIBRETRO__)
+#endif  // !defined(__LIBRETRO__)
 
 #endif  // VBAM_CORE_BASE_FILE_UTIL_H_
\ No newline at end of file
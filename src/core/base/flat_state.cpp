@@ -0,0 +1,413 @@
+#include "core/base/flat_state.h"
+
+#include <cstring>
+
+#if !defined(__LIBRETRO__)
+#include <zlib.h>
+#endif  // !defined(__LIBRETRO__)
+
+namespace {
+
+constexpr uint32_t kCodecNone = flatStateFourCC('N', 'O', 'N', 'E');
+constexpr uint32_t kCodecZlib = flatStateFourCC('Z', 'L', 'I', 'B');
+
+// Header of a buffer produced by flatStatePack().
+struct PackedHeader {
+    uint32_t magic;
+    uint32_t codec;
+    uint32_t state_size;
+    uint32_t packed_size;
+};
+
+size_t NoneBound(size_t size) {
+    return size;
+}
+
+size_t NoneCopy(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_capacity) {
+    if (src_size > dst_capacity) {
+        return 0;
+    }
+    memcpy(dst, src, src_size);
+    return src_size;
+}
+
+const FlatStateCodec kNoneCodec = {kCodecNone, "none", NoneBound, NoneCopy, NoneCopy};
+
+#if !defined(__LIBRETRO__)
+
+size_t ZlibBound(size_t size) {
+    return compressBound(static_cast<uLong>(size));
+}
+
+size_t ZlibCompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_capacity) {
+    uLongf dst_size = static_cast<uLongf>(dst_capacity);
+    if (compress2(dst, &dst_size, src, static_cast<uLong>(src_size), Z_BEST_SPEED) != Z_OK) {
+        return 0;
+    }
+    return dst_size;
+}
+
+size_t ZlibDecompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_capacity) {
+    uLongf dst_size = static_cast<uLongf>(dst_capacity);
+    if (uncompress(dst, &dst_size, src, static_cast<uLong>(src_size)) != Z_OK) {
+        return 0;
+    }
+    return dst_size;
+}
+
+const FlatStateCodec kZlibCodec = {kCodecZlib, "zlib", ZlibBound, ZlibCompress, ZlibDecompress};
+
+#endif  // !defined(__LIBRETRO__)
+
+// CRC-32 (IEEE 802.3) of the section contents. zlib is not available in all
+// builds, so this is computed here.
+uint32_t Crc32(const uint8_t* data, size_t size) {
+    static const struct Table {
+        Table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+                }
+                values[i] = crc;
+            }
+        }
+        uint32_t values[256];
+    } kTable;
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++) {
+        crc = kTable.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+}  // namespace
+
+FlatStateWriter::FlatStateWriter(uint8_t* buffer,
+                                 FlatStateSystem system,
+                                 uint32_t system_version)
+    : buffer_(buffer), cursor_(buffer + kFlatStateDataOffset) {
+    memset(buffer_, 0, kFlatStateDataOffset);
+
+    FlatStateHeader* header = reinterpret_cast<FlatStateHeader*>(buffer_);
+    header->magic = kFlatStateMagic;
+    header->version = kFlatStateVersion;
+    header->system = static_cast<uint16_t>(system);
+    header->system_version = system_version;
+}
+
+bool FlatStateWriter::BeginSection(uint32_t id) {
+    if (section_count_ >= kFlatStateMaxSections) {
+        return false;
+    }
+
+    current_ = reinterpret_cast<FlatStateSection*>(buffer_ + sizeof(FlatStateHeader)) +
+               section_count_++;
+    current_->id = id;
+    current_->offset = static_cast<uint32_t>(cursor_ - buffer_);
+    current_->codec = kFlatStateRawSection;
+    return true;
+}
+
+void FlatStateWriter::EndSection() {
+    if (current_ == nullptr) {
+        return;
+    }
+
+    current_->size = static_cast<uint32_t>(cursor_ - buffer_) - current_->offset;
+    current_->stored_size = current_->size;
+    current_ = nullptr;
+}
+
+size_t FlatStateWriter::Finish() {
+    EndSection();
+
+    FlatStateHeader* header = reinterpret_cast<FlatStateHeader*>(buffer_);
+    header->section_count = section_count_;
+    header->total_size = static_cast<uint32_t>(cursor_ - buffer_);
+    return header->total_size;
+}
+
+bool FlatStateReader::Open(const uint8_t* data,
+                           size_t size,
+                           FlatStateSystem system,
+                           size_t max_size) {
+    header_ = nullptr;
+    sections_ = nullptr;
+    current_ = nullptr;
+    current_contents_ = nullptr;
+
+    if (!flatStateIsFlat(data, size)) {
+        return false;
+    }
+
+    const FlatStateHeader* header = reinterpret_cast<const FlatStateHeader*>(data);
+    if (header->version != kFlatStateVersion ||
+        header->system != static_cast<uint16_t>(system) ||
+        header->section_count > kFlatStateMaxSections || header->total_size > size ||
+        header->total_size < kFlatStateDataOffset) {
+        return false;
+    }
+
+    const FlatStateSection* sections =
+        reinterpret_cast<const FlatStateSection*>(data + sizeof(FlatStateHeader));
+    // The sizes come from the state, they are bounded before anything is
+    // allocated for them.
+    size_t contents_size = 0;
+    size_t decoded_size = 0;
+    for (uint32_t i = 0; i < header->section_count; i++) {
+        if (sections[i].offset < kFlatStateDataOffset ||
+            sections[i].offset > header->total_size ||
+            sections[i].stored_size > header->total_size - sections[i].offset ||
+            sections[i].size > max_size - contents_size) {
+            return false;
+        }
+        contents_size += sections[i].size;
+
+        if (sections[i].codec == kFlatStateRawSection) {
+            if (sections[i].stored_size != sections[i].size) {
+                return false;
+            }
+        } else {
+            decoded_size += sections[i].size;
+        }
+    }
+
+    // Compressed sections are decoded up front, so that the emulator state is
+    // not modified if one of them is corrupted.
+    decoded_.resize(decoded_size);
+    size_t decoded_offset = 0;
+    for (uint32_t i = 0; i < header->section_count; i++) {
+        const FlatStateSection& section = sections[i];
+        if (section.codec == kFlatStateRawSection) {
+            contents_[i] = data + section.offset;
+        } else {
+            const FlatStateCodec* codec = flatStateFindCodec(section.codec);
+            if (codec == nullptr) {
+                return false;
+            }
+
+            uint8_t* dst = decoded_.data() + decoded_offset;
+            if (section.size > 0 &&
+                codec->decompress(data + section.offset, section.stored_size, dst,
+                                  section.size) != section.size) {
+                return false;
+            }
+            contents_[i] = dst;
+            decoded_offset += section.size;
+        }
+
+        if ((header->flags & kFlatStateFlagChecksums) &&
+            Crc32(contents_[i], section.size) != section.checksum) {
+            return false;
+        }
+    }
+
+    header_ = header;
+    sections_ = sections;
+    return true;
+}
+
+bool FlatStateReader::OpenSection(uint32_t id) {
+    current_ = nullptr;
+    current_contents_ = nullptr;
+    if (header_ == nullptr) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header_->section_count; i++) {
+        if (sections_[i].id == id) {
+            current_ = &sections_[i];
+            current_contents_ = contents_[i];
+            cursor_ = current_contents_;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool FlatStateReader::EndSection() const {
+    return current_ != nullptr && cursor_ == current_contents_ + current_->size;
+}
+
+bool flatStateIsFlat(const uint8_t* data, size_t size) {
+    if (data == nullptr || size < kFlatStateDataOffset) {
+        return false;
+    }
+
+    uint32_t magic;
+    memcpy(&magic, data, sizeof(magic));
+    return magic == kFlatStateMagic;
+}
+
+void flatStateMarkDirty(uint64_t* dirty, size_t offset, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    const size_t last = (offset + size - 1) / kFlatStateDirtyBlock;
+    for (size_t block = offset / kFlatStateDirtyBlock; block <= last; block++) {
+        dirty[block / 64] |= uint64_t{1} << (block % 64);
+    }
+}
+
+const FlatStateCodec* flatStateCodecNone() {
+    return &kNoneCodec;
+}
+
+#if !defined(__LIBRETRO__)
+const FlatStateCodec* flatStateCodecZlib() {
+    return &kZlibCodec;
+}
+#endif  // !defined(__LIBRETRO__)
+
+const FlatStateCodec* flatStateFindCodec(uint32_t id) {
+    switch (id) {
+        case kCodecNone:
+            return &kNoneCodec;
+#if !defined(__LIBRETRO__)
+        case kCodecZlib:
+            return &kZlibCodec;
+#endif  // !defined(__LIBRETRO__)
+        default:
+            return nullptr;
+    }
+}
+
+size_t flatStatePackBound(const FlatStateCodec* codec, size_t size) {
+    return sizeof(PackedHeader) + codec->bound(size);
+}
+
+size_t flatStatePack(const FlatStateCodec* codec,
+                     const uint8_t* state,
+                     size_t state_size,
+                     uint8_t* dst,
+                     size_t dst_capacity) {
+    if (dst_capacity < sizeof(PackedHeader)) {
+        return 0;
+    }
+
+    const size_t packed_size = codec->compress(state, state_size, dst + sizeof(PackedHeader),
+                                               dst_capacity - sizeof(PackedHeader));
+    if (packed_size == 0) {
+        return 0;
+    }
+
+    PackedHeader header;
+    header.magic = kFlatStatePackedMagic;
+    header.codec = codec->id;
+    header.state_size = static_cast<uint32_t>(state_size);
+    header.packed_size = static_cast<uint32_t>(packed_size);
+    memcpy(dst, &header, sizeof(header));
+
+    return sizeof(PackedHeader) + packed_size;
+}
+
+size_t flatStateUnpackedSize(const uint8_t* data, size_t size) {
+    if (data == nullptr || size < sizeof(PackedHeader)) {
+        return 0;
+    }
+
+    PackedHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != kFlatStatePackedMagic) {
+        return 0;
+    }
+    return header.state_size;
+}
+
+size_t flatStateUnpack(const uint8_t* data, size_t size, uint8_t* dst, size_t dst_capacity) {
+    const size_t state_size = flatStateUnpackedSize(data, size);
+    if (state_size == 0 || state_size > dst_capacity) {
+        return 0;
+    }
+
+    PackedHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.packed_size > size - sizeof(PackedHeader)) {
+        return 0;
+    }
+
+    const FlatStateCodec* codec = flatStateFindCodec(header.codec);
+    if (codec == nullptr) {
+        return 0;
+    }
+
+    if (codec->decompress(data + sizeof(PackedHeader), header.packed_size, dst, dst_capacity) !=
+        state_size) {
+        return 0;
+    }
+    return state_size;
+}
+
+#if !defined(__LIBRETRO__)
+
+bool flatStateEncodeFile(const uint8_t* state,
+                         size_t state_size,
+                         const FlatStateCodec* codec,
+                         std::vector<uint8_t>* file) {
+    if (!flatStateIsFlat(state, state_size)) {
+        return false;
+    }
+
+    FlatStateHeader header;
+    memcpy(&header, state, sizeof(header));
+    if (header.section_count > kFlatStateMaxSections || header.total_size > state_size) {
+        return false;
+    }
+
+    FlatStateSection sections[kFlatStateMaxSections] = {};
+    memcpy(sections, state + sizeof(FlatStateHeader),
+           header.section_count * sizeof(FlatStateSection));
+
+    if (codec != nullptr && codec->id == kCodecNone) {
+        codec = nullptr;
+    }
+
+    file->assign(kFlatStateDataOffset, 0);
+    std::vector<uint8_t> packed;
+    for (uint32_t i = 0; i < header.section_count; i++) {
+        FlatStateSection& section = sections[i];
+        if (section.codec != kFlatStateRawSection || section.offset > header.total_size ||
+            section.size > header.total_size - section.offset) {
+            return false;
+        }
+
+        const uint8_t* contents = state + section.offset;
+        const uint8_t* stored = contents;
+        section.checksum = Crc32(contents, section.size);
+        section.stored_size = section.size;
+
+        if (codec != nullptr && section.size > 0) {
+            packed.resize(codec->bound(section.size));
+            const size_t packed_size =
+                codec->compress(contents, section.size, packed.data(), packed.size());
+            if (packed_size > 0 && packed_size < section.size) {
+                section.codec = codec->id;
+                section.stored_size = static_cast<uint32_t>(packed_size);
+                stored = packed.data();
+            }
+        }
+
+        // Large uncompressed sections start on a page boundary, so that they
+        // can be copied from a mapped file one page at a time.
+        size_t offset = file->size();
+        if (section.codec == kFlatStateRawSection && section.size >= kFlatStateFileAlignment) {
+            offset = (offset + kFlatStateFileAlignment - 1) & ~(kFlatStateFileAlignment - 1);
+        }
+
+        section.offset = static_cast<uint32_t>(offset);
+        file->resize(offset + section.stored_size);
+        memcpy(file->data() + offset, stored, section.stored_size);
+    }
+
+    header.total_size = static_cast<uint32_t>(file->size());
+    header.flags |= kFlatStateFlagChecksums;
+    memcpy(file->data(), &header, sizeof(header));
+    memcpy(file->data() + sizeof(header), sections, sizeof(sections));
+    return true;
+}
+
+#endif  // !defined(__LIBRETRO__)
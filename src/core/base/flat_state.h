@@ -0,0 +1,213 @@
+#ifndef VBAM_CORE_BASE_FLAT_STATE_H_
+#define VBAM_CORE_BASE_FLAT_STATE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Flat savestate layout used for in-memory snapshots (rewind, run-ahead) and
+// savestate files. A flat state is produced in a single pass of memcpy() calls
+// and has the following layout:
+//
+//   +-----------------------------------------+
+//   | FlatStateHeader                         |
+//   | FlatStateSection[kFlatStateMaxSections] |
+//   | section data...                         |
+//   +-----------------------------------------+
+//
+// In-memory states store every section as-is. Files encoded with
+// flatStateEncodeFile() additionally carry a CRC-32 of every section, may
+// compress sections individually and align the large uncompressed sections to
+// kFlatStateFileAlignment, so that a memory-mapped file can be copied straight
+// into the emulated memory.
+//
+// Whole-buffer compression is a separate, optional stage applied to the
+// finished buffer with a FlatStateCodec, see flatStatePack().
+
+// Builds a section or magic identifier from 4 characters.
+constexpr uint32_t flatStateFourCC(char a, char b, char c, char d) {
+    return static_cast<uint32_t>(static_cast<uint8_t>(a)) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(b)) << 8) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(c)) << 16) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(d)) << 24);
+}
+
+constexpr uint32_t kFlatStateMagic = flatStateFourCC('V', 'B', 'F', 'S');
+constexpr uint32_t kFlatStatePackedMagic = flatStateFourCC('V', 'B', 'F', 'Z');
+constexpr uint16_t kFlatStateVersion = 2;
+constexpr size_t kFlatStateMaxSections = 32;
+
+// FlatStateHeader::flags bit set when FlatStateSection::checksum is valid.
+constexpr uint32_t kFlatStateFlagChecksums = 1 << 0;
+// FlatStateSection::codec of sections stored as-is.
+constexpr uint32_t kFlatStateRawSection = 0;
+// Alignment of the large uncompressed sections in files.
+constexpr size_t kFlatStateFileAlignment = 4096;
+
+enum class FlatStateSystem : uint16_t {
+    kGB = 1,
+    kGBA = 2,
+};
+
+struct FlatStateHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t system;
+    // Version of the emulated system state, e.g. GBSAVE_GAME_VERSION.
+    uint32_t system_version;
+    uint32_t section_count;
+    // Size of the whole state, including this header.
+    uint32_t total_size;
+    // kFlatStateFlag* bits.
+    uint32_t flags;
+};
+
+struct FlatStateSection {
+    uint32_t id;
+    // Offset from the start of the state.
+    uint32_t offset;
+    // Size of the section contents.
+    uint32_t size;
+    // Size of the section in the state, differs from `size` if compressed.
+    uint32_t stored_size;
+    // Identifier of the codec used for the section, or kFlatStateRawSection.
+    uint32_t codec;
+    // CRC-32 of the section contents, see kFlatStateFlagChecksums.
+    uint32_t checksum;
+};
+
+// Offset of the first section data byte.
+constexpr size_t kFlatStateDataOffset =
+    sizeof(FlatStateHeader) + kFlatStateMaxSections * sizeof(FlatStateSection);
+
+// Writes a flat state to a caller-provided buffer. Section contents are
+// written through cursor() with the utilWriteMem() family of functions, the
+// caller is responsible for providing a buffer large enough for the state.
+class FlatStateWriter final {
+public:
+    FlatStateWriter(uint8_t* buffer, FlatStateSystem system, uint32_t system_version);
+    ~FlatStateWriter() = default;
+
+    // Starts a new section. Returns false if there are too many sections.
+    bool BeginSection(uint32_t id);
+    // Closes the current section.
+    void EndSection();
+
+    // Write cursor for the current section.
+    uint8_t*& cursor() { return cursor_; }
+
+    // Finalizes the header. Returns the total size of the state.
+    size_t Finish();
+
+private:
+    uint8_t* const buffer_;
+    uint8_t* cursor_;
+    FlatStateSection* current_ = nullptr;
+    uint32_t section_count_ = 0;
+};
+
+// Reads a flat state written by FlatStateWriter or flatStateEncodeFile().
+// Uncompressed sections are read in place, `data` must outlive the reader.
+class FlatStateReader final {
+public:
+    FlatStateReader() = default;
+    ~FlatStateReader() = default;
+
+    // Disable copy constructor and assignment operator.
+    FlatStateReader(const FlatStateReader&) = delete;
+    FlatStateReader& operator=(const FlatStateReader&) = delete;
+
+    // Validates the header and the section table, decompresses the
+    // compressed sections and verifies the section checksums. Returns false
+    // if `data` is not a valid flat state for `system`, or if its sections
+    // hold more than `max_size` bytes, the largest state of the system.
+    bool Open(const uint8_t* data, size_t size, FlatStateSystem system, size_t max_size);
+
+    // Positions cursor() at the start of section `id`. Returns false if the
+    // section is not present.
+    bool OpenSection(uint32_t id);
+    // Returns false if the current section was not consumed exactly.
+    bool EndSection() const;
+
+    // Read cursor for the current section.
+    const uint8_t*& cursor() { return cursor_; }
+    // Size of the current section.
+    size_t section_size() const { return current_ ? current_->size : 0; }
+
+    uint32_t system_version() const { return header_ ? header_->system_version : 0; }
+
+private:
+    const uint8_t* cursor_ = nullptr;
+    const FlatStateHeader* header_ = nullptr;
+    const FlatStateSection* sections_ = nullptr;
+    const FlatStateSection* current_ = nullptr;
+    // Contents of every section, either in the state or in `decoded_`.
+    const uint8_t* contents_[kFlatStateMaxSections] = {};
+    const uint8_t* current_contents_ = nullptr;
+    // Decompressed contents of the compressed sections.
+    std::vector<uint8_t> decoded_;
+};
+
+// Returns true if `data` starts with a flat state header.
+bool flatStateIsFlat(const uint8_t* data, size_t size);
+
+// States captured incrementally, see EmulatedSystem::emuWriteIncrementalState,
+// flag the bytes that may have changed since the previous capture in a
+// bitmap, one bit per kFlatStateDirtyBlock bytes of the state.
+constexpr size_t kFlatStateDirtyBlock = 256;
+
+// Number of 64-bit words of the bitmap of a state of up to `size` bytes.
+constexpr size_t flatStateDirtyWords(size_t size) {
+    return (size + kFlatStateDirtyBlock * 64 - 1) / (kFlatStateDirtyBlock * 64);
+}
+
+// Flags the blocks holding the `size` bytes at `offset`.
+void flatStateMarkDirty(uint64_t* dirty, size_t offset, size_t size);
+
+// Compression stage for flat states. Codecs are identified by `id` in packed
+// buffers, so new codecs can be added without changing the flat layout.
+struct FlatStateCodec {
+    uint32_t id;
+    const char* name;
+    // Upper bound of the compressed size for `size` input bytes.
+    size_t (*bound)(size_t size);
+    // Returns the number of bytes written to `dst`, 0 on failure.
+    size_t (*compress)(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_capacity);
+    // Returns the number of bytes written to `dst`, 0 on failure.
+    size_t (*decompress)(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_capacity);
+};
+
+// Stores the state as-is.
+const FlatStateCodec* flatStateCodecNone();
+#if !defined(__LIBRETRO__)
+// zlib deflate, at the fastest compression level.
+const FlatStateCodec* flatStateCodecZlib();
+#endif  // !defined(__LIBRETRO__)
+// Returns the codec registered for `id`, nullptr if unknown.
+const FlatStateCodec* flatStateFindCodec(uint32_t id);
+
+// Upper bound of the packed size for a state of `size` bytes.
+size_t flatStatePackBound(const FlatStateCodec* codec, size_t size);
+// Compresses a flat state with `codec`. Returns the packed size, 0 on failure.
+size_t flatStatePack(const FlatStateCodec* codec,
+                     const uint8_t* state,
+                     size_t state_size,
+                     uint8_t* dst,
+                     size_t dst_capacity);
+// Returns the unpacked size of a packed buffer, 0 if `data` is not packed.
+size_t flatStateUnpackedSize(const uint8_t* data, size_t size);
+// Decompresses a packed buffer. Returns the state size, 0 on failure.
+size_t flatStateUnpack(const uint8_t* data, size_t size, uint8_t* dst, size_t dst_capacity);
+
+#if !defined(__LIBRETRO__)
+// Encodes the flat state `state` as the contents of a file, with section
+// checksums. Sections are compressed with `codec` when that makes them
+// smaller, `codec` may be nullptr to store every section as-is. Returns false
+// on failure.
+bool flatStateEncodeFile(const uint8_t* state,
+                         size_t state_size,
+                         const FlatStateCodec* codec,
+                         std::vector<uint8_t>* file);
+#endif  // !defined(__LIBRETRO__)
+
+#endif  // VBAM_CORE_BASE_FLAT_STATE_H_
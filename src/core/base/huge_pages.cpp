@@ -0,0 +1,218 @@
+#include "core/base/huge_pages.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif  // defined(_WIN32)
+
+namespace {
+
+#if defined(_WIN32)
+constexpr size_t kPageSize = 4096;
+#else
+const size_t kPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif  // defined(_WIN32)
+
+size_t RoundUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+struct Region {
+    uintptr_t start;
+    uintptr_t end;
+    bool explicit_pages;
+};
+
+// The live regions, for hugePageStats().
+class Registry final {
+public:
+    void Add(const uint8_t* data, size_t size, bool explicit_pages) {
+        const uintptr_t start = reinterpret_cast<uintptr_t>(data);
+        std::lock_guard<std::mutex> lock(mutex_);
+        regions_.push_back({start, start + size, explicit_pages});
+    }
+
+    void Remove(const uint8_t* data) {
+        const uintptr_t start = reinterpret_cast<uintptr_t>(data);
+        std::lock_guard<std::mutex> lock(mutex_);
+        regions_.erase(std::remove_if(regions_.begin(), regions_.end(),
+                                      [start](const Region& region) {
+                                          return region.start == start;
+                                      }),
+                       regions_.end());
+    }
+
+    std::vector<Region> regions() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return regions_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<Region> regions_;
+};
+
+// Never destroyed, the regions can be released by static destructors.
+Registry& registry() {
+    static Registry* registry = new Registry();
+    return *registry;
+}
+
+#if defined(__linux__)
+// Returns the bytes of transparent huge pages of the mappings overlapping the
+// `regions`.
+size_t TransparentHugeBytes(const std::vector<Region>& regions) {
+    FILE* file = fopen("/proc/self/smaps", "r");
+    if (file == nullptr) {
+        return 0;
+    }
+
+    size_t result = 0;
+    bool overlaps = false;
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        unsigned long long start, end, kib;
+        if (sscanf(line, "%llx-%llx ", &start, &end) == 2) {
+            overlaps = false;
+            for (const Region& region : regions) {
+                overlaps |= !region.explicit_pages && region.start < end && start < region.end;
+            }
+        } else if (overlaps && sscanf(line, "AnonHugePages: %llu kB", &kib) == 1) {
+            result += static_cast<size_t>(kib) * 1024;
+        }
+    }
+    fclose(file);
+    return result;
+}
+#endif  // defined(__linux__)
+
+}  // namespace
+
+uint8_t* hugePagesMap(size_t size) {
+    size = RoundUp(size, kPageSize);
+#if defined(_WIN32)
+    // Committed pages are zeroed on first access.
+    void* region = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (region == nullptr) {
+        return nullptr;
+    }
+    uint8_t* data = static_cast<uint8_t*>(region);
+#elif defined(__linux__)
+    // Map a huge page more, to trim the region to an aligned start.
+    void* region = mmap(nullptr, size + kHugePageSize, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        return nullptr;
+    }
+    const uintptr_t start = reinterpret_cast<uintptr_t>(region);
+    const uintptr_t aligned = RoundUp(start, kHugePageSize);
+    if (aligned > start) {
+        munmap(region, aligned - start);
+    }
+    if (start + kHugePageSize > aligned) {
+        munmap(reinterpret_cast<void*>(aligned + size), start + kHugePageSize - aligned);
+    }
+    uint8_t* data = reinterpret_cast<uint8_t*>(aligned);
+#if defined(MADV_HUGEPAGE)
+    // Fails if the kernel has no transparent huge pages, the region then
+    // keeps the regular pages.
+    madvise(data, size, MADV_HUGEPAGE);
+#endif  // defined(MADV_HUGEPAGE)
+#else
+    void* region =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        return nullptr;
+    }
+    uint8_t* data = static_cast<uint8_t*>(region);
+#endif  // defined(_WIN32)
+
+    registry().Add(data, size, false);
+    return data;
+}
+
+void hugePagesUnmap(uint8_t* data, size_t size) {
+    if (data == nullptr) {
+        return;
+    }
+
+    registry().Remove(data);
+#if defined(_WIN32)
+    (void)size;
+    VirtualFree(data, 0, MEM_RELEASE);
+#else
+    munmap(data, RoundUp(size, kPageSize));
+#endif  // defined(_WIN32)
+}
+
+HugePageBuffer::~HugePageBuffer() {
+    Release();
+}
+
+bool HugePageBuffer::Allocate(size_t size) {
+    Release();
+
+    size = RoundUp(std::max<size_t>(size, 1), kHugePageSize);
+#if defined(__linux__) && defined(MAP_HUGETLB)
+    // Only succeeds if the pool has the pages, they are reserved here so that
+    // writing to them cannot fail later.
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#if defined(MAP_HUGE_2MB)
+    flags |= MAP_HUGE_2MB;
+#endif  // defined(MAP_HUGE_2MB)
+    void* region = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (region != MAP_FAILED) {
+        data_ = static_cast<uint8_t*>(region);
+        size_ = size;
+        explicit_pages_ = true;
+        registry().Add(data_, size_, true);
+        return true;
+    }
+#endif  // defined(__linux__) && defined(MAP_HUGETLB)
+
+    data_ = hugePagesMap(size);
+    if (data_ == nullptr) {
+        return false;
+    }
+    size_ = size;
+    return true;
+}
+
+void HugePageBuffer::Release() {
+    if (explicit_pages_) {
+#if !defined(_WIN32)
+        registry().Remove(data_);
+        munmap(data_, size_);
+#endif  // !defined(_WIN32)
+    } else {
+        hugePagesUnmap(data_, size_);
+    }
+
+    data_ = nullptr;
+    size_ = 0;
+    explicit_pages_ = false;
+}
+
+HugePageStats hugePageStats() {
+    const std::vector<Region> regions = registry().regions();
+
+    HugePageStats stats;
+    stats.regions = regions.size();
+    for (const Region& region : regions) {
+        stats.bytes += region.end - region.start;
+        if (region.explicit_pages) {
+            stats.explicit_bytes += region.end - region.start;
+        }
+    }
+#if defined(__linux__)
+    stats.transparent_bytes = TransparentHugeBytes(regions);
+#endif  // defined(__linux__)
+    return stats;
+}
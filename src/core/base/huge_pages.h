@@ -0,0 +1,76 @@
+#ifndef VBAM_CORE_BASE_HUGE_PAGES_H_
+#define VBAM_CORE_BASE_HUGE_PAGES_H_
+
+#if defined(__LIBRETRO__)
+#error "This file is only for non-libretro builds"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+
+// Allocation of the large emulator buffers with 2 MiB pages, so that they take
+// fewer TLB entries than with the regular 4 KiB pages.
+//
+// On Linux, buffers are backed by explicit huge pages when the hugetlbfs pool
+// has enough of them, and otherwise advised for transparent huge pages, which
+// the kernel uses when it can. Elsewhere, they use the regular pages. Whether
+// huge pages were actually obtained is reported by hugePageStats().
+
+// Size of a huge page on x86-64 and arm64.
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+// Maps `size` bytes of zeroes, rounded up to the page size. Pages are only
+// committed when written to. On Linux, the region is aligned to kHugePageSize
+// and advised for transparent huge pages: each aligned 2 MiB that is still
+// anonymous memory can be backed by a huge page, while parts of the region can
+// be replaced with other mappings, e.g. files. Returns nullptr if out of
+// memory.
+uint8_t* hugePagesMap(size_t size);
+// Unmaps a region returned by hugePagesMap(), of the same `size`.
+void hugePagesUnmap(uint8_t* data, size_t size);
+
+// Buffer of zeroes backed by huge pages where available.
+class HugePageBuffer final {
+public:
+    HugePageBuffer() = default;
+    ~HugePageBuffer();
+
+    // Disable copy constructor and assignment operator.
+    HugePageBuffer(const HugePageBuffer&) = delete;
+    HugePageBuffer& operator=(const HugePageBuffer&) = delete;
+
+    // Allocates `size` bytes of zeroes, rounded up to a multiple of
+    // kHugePageSize, replacing the previous buffer. Explicit huge pages are
+    // reserved up front, the other pages are committed when written to.
+    // Returns false if out of memory.
+    bool Allocate(size_t size);
+    void Release();
+
+    uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    // Set if the buffer has explicit huge pages, its transparent huge pages
+    // are only known from hugePageStats().
+    bool explicit_pages() const { return explicit_pages_; }
+
+private:
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool explicit_pages_ = false;
+};
+
+struct HugePageStats {
+    // Regions mapped by hugePagesMap() and HugePageBuffer, and their size.
+    size_t regions = 0;
+    size_t bytes = 0;
+    // Bytes of the regions backed by explicit and transparent huge pages.
+    size_t explicit_bytes = 0;
+    size_t transparent_bytes = 0;
+};
+
+// Returns the huge pages backing the live regions. Transparent huge pages are
+// read from /proc/self/smaps, so this is slow and only meant for reporting.
+// The kernel can merge a region with an adjacent mapping, whose transparent
+// huge pages are then counted too.
+HugePageStats hugePageStats();
+
+#endif  // VBAM_CORE_BASE_HUGE_PAGES_H_
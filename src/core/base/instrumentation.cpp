@@ -0,0 +1,397 @@
+#include "core/base/instrumentation.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include "core/base/file_util.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr const char* kZoneNames[kInstrZoneCount] = {
+    "cpu",         "render", "sound",          "sound_flush", "audio_write",
+    "draw_screen", "filter", "texture_upload", "recording",   "present",
+    "audio_callback", "throttle", "savestate", "rewind",
+};
+constexpr const char* kCounterNames[kInstrCounterCount] = {"instructions", "dma_bytes", "irqs"};
+constexpr const char* kMarkerNames[kInstrMarkerCount] = {"frame", "link_transfer",
+                                                         "audio_buffer_end"};
+
+// Zones of the current frame, updated from any thread.
+std::array<std::atomic<uint64_t>, kInstrZoneCount> g_zone_ns;
+std::array<std::atomic<uint32_t>, kInstrZoneCount> g_zone_calls;
+
+std::mutex g_mutex;
+// Ring of the completed frames. `g_next_frame` is the number of frames
+// completed so far.
+std::vector<InstrFrame> g_history;
+uint64_t g_next_frame = 0;
+InstrFrame g_totals;
+// Frame at the time of the previous instrSummary() call.
+uint64_t g_summary_frame = 0;
+Clock::time_point g_frame_start = Clock::now();
+
+// Trace events, appended by every thread to its own list of chunks. The
+// chunks are only freed on exit, so that instrWriteTrace() can read them while
+// the threads still append.
+constexpr size_t kTraceChunkEvents = 4096;
+// Bounds the memory used by a trace to about 100 MB. Later events are dropped.
+constexpr size_t kTraceMaxChunks = 1024;
+
+struct TraceEvent {
+    // Nanoseconds since the start of the trace.
+    int64_t start_ns;
+    // Duration of a zone, 0 for a marker.
+    uint64_t duration_ns;
+    // InstrZone, or InstrMarker if `marker` is set.
+    uint32_t id;
+    bool marker;
+};
+
+struct TraceChunk {
+    TraceEvent events[kTraceChunkEvents];
+    // Number of written events, published once they are written.
+    std::atomic<size_t> count{0};
+    std::atomic<TraceChunk*> next{nullptr};
+};
+
+struct ThreadTrace {
+    uint32_t tid = 0;
+    // Guarded by g_trace_mutex.
+    std::string name;
+    std::atomic<TraceChunk*> head{nullptr};
+    // Only used by the thread itself.
+    TraceChunk* tail = nullptr;
+};
+
+std::atomic<bool> g_trace_started{false};
+std::atomic<bool> g_tracing{false};
+// Set before `g_tracing`.
+Clock::time_point g_trace_start;
+std::atomic<size_t> g_trace_chunks{0};
+std::atomic<uint64_t> g_trace_dropped{0};
+
+std::mutex g_trace_mutex;
+std::vector<std::unique_ptr<ThreadTrace>> g_trace_threads;
+thread_local ThreadTrace* t_trace_thread = nullptr;
+
+ThreadTrace* CurrentThreadTrace() {
+    if (t_trace_thread == nullptr) {
+        std::lock_guard<std::mutex> lock(g_trace_mutex);
+        g_trace_threads.push_back(std::make_unique<ThreadTrace>());
+        t_trace_thread = g_trace_threads.back().get();
+        t_trace_thread->tid = static_cast<uint32_t>(g_trace_threads.size());
+        t_trace_thread->name = "thread " + std::to_string(t_trace_thread->tid);
+    }
+    return t_trace_thread;
+}
+
+void AppendTraceEvent(const TraceEvent& event) {
+    ThreadTrace* thread = CurrentThreadTrace();
+    TraceChunk* chunk = thread->tail;
+    size_t count = chunk != nullptr ? chunk->count.load(std::memory_order_relaxed)
+                                    : kTraceChunkEvents;
+    if (count == kTraceChunkEvents) {
+        if (g_trace_chunks.fetch_add(1, std::memory_order_relaxed) >= kTraceMaxChunks) {
+            g_trace_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        TraceChunk* next = new TraceChunk();
+        if (chunk != nullptr) {
+            chunk->next.store(next, std::memory_order_release);
+        } else {
+            thread->head.store(next, std::memory_order_release);
+        }
+        thread->tail = chunk = next;
+        count = 0;
+    }
+    chunk->events[count] = event;
+    chunk->count.store(count + 1, std::memory_order_release);
+}
+
+int64_t TraceTime(Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time - g_trace_start).count();
+}
+
+void Accumulate(InstrFrame* sum, const InstrFrame& frame) {
+    sum->frame_ns += frame.frame_ns;
+    for (size_t i = 0; i < kInstrZoneCount; i++) {
+        sum->zone_ns[i] += frame.zone_ns[i];
+        sum->zone_calls[i] += frame.zone_calls[i];
+    }
+    for (size_t i = 0; i < kInstrCounterCount; i++) {
+        sum->counters[i] += frame.counters[i];
+    }
+}
+
+bool EndsWith(const char* value, const char* suffix) {
+    const size_t value_size = strlen(value);
+    const size_t suffix_size = strlen(suffix);
+    return value_size >= suffix_size && strcmp(value + value_size - suffix_size, suffix) == 0;
+}
+
+void AppendFrameJson(std::string* json, const InstrFrame& frame) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "{\"frame_ns\": %" PRIu64, frame.frame_ns);
+    *json += buffer;
+    for (size_t i = 0; i < kInstrZoneCount; i++) {
+        snprintf(buffer, sizeof(buffer), ", \"%s_ns\": %" PRIu64 ", \"%s_calls\": %u",
+                 kZoneNames[i], frame.zone_ns[i], kZoneNames[i], frame.zone_calls[i]);
+        *json += buffer;
+    }
+    for (size_t i = 0; i < kInstrCounterCount; i++) {
+        snprintf(buffer, sizeof(buffer), ", \"%s\": %" PRIu64, kCounterNames[i],
+                 frame.counters[i]);
+        *json += buffer;
+    }
+    *json += "}";
+}
+
+std::string DumpJson(const std::vector<InstrFrame>& frames,
+                     const InstrFrame& totals,
+                     uint64_t frame_count) {
+    std::string json = "{\n  \"frame_count\": " + std::to_string(frame_count) + ",\n";
+    json += "  \"totals\": ";
+    AppendFrameJson(&json, totals);
+    json += ",\n  \"frames\": [";
+    for (size_t i = 0; i < frames.size(); i++) {
+        json += i == 0 ? "\n    " : ",\n    ";
+        AppendFrameJson(&json, frames[i]);
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+bool WriteFile(const char* path, const std::string& data) {
+    FILE* file = utilOpenFile(path, "w");
+    if (file == nullptr) {
+        return false;
+    }
+    bool result = fwrite(data.data(), 1, data.size(), file) == data.size();
+    result &= fclose(file) == 0;
+    return result;
+}
+
+std::string DumpCsv(const std::vector<InstrFrame>& frames) {
+    std::string csv = "frame_ns";
+    for (const char* name : kZoneNames) {
+        csv += std::string(",") + name + "_ns," + name + "_calls";
+    }
+    for (const char* name : kCounterNames) {
+        csv += std::string(",") + name;
+    }
+    csv += "\n";
+
+    char buffer[64];
+    for (const InstrFrame& frame : frames) {
+        csv += std::to_string(frame.frame_ns);
+        for (size_t i = 0; i < kInstrZoneCount; i++) {
+            snprintf(buffer, sizeof(buffer), ",%" PRIu64 ",%u", frame.zone_ns[i],
+                     frame.zone_calls[i]);
+            csv += buffer;
+        }
+        for (size_t i = 0; i < kInstrCounterCount; i++) {
+            csv += "," + std::to_string(frame.counters[i]);
+        }
+        csv += "\n";
+    }
+    return csv;
+}
+
+}  // namespace
+
+uint64_t instrCounters[kInstrCounterCount] = {};
+
+const char* instrZoneName(InstrZone zone) {
+    return kZoneNames[static_cast<size_t>(zone)];
+}
+
+const char* instrCounterName(InstrCounter counter) {
+    return kCounterNames[static_cast<size_t>(counter)];
+}
+
+const char* instrMarkerName(InstrMarker marker) {
+    return kMarkerNames[static_cast<size_t>(marker)];
+}
+
+void instrZoneEnd(InstrZone zone, std::chrono::steady_clock::time_point start) {
+    const uint64_t ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    const size_t index = static_cast<size_t>(zone);
+    g_zone_ns[index].fetch_add(ns, std::memory_order_relaxed);
+    g_zone_calls[index].fetch_add(1, std::memory_order_relaxed);
+
+    if (g_tracing.load(std::memory_order_acquire)) {
+        AppendTraceEvent({TraceTime(start), ns, static_cast<uint32_t>(index), false});
+    }
+}
+
+void instrMark(InstrMarker marker) {
+    if (g_tracing.load(std::memory_order_acquire)) {
+        AppendTraceEvent({TraceTime(Clock::now()), 0, static_cast<uint32_t>(marker), true});
+    }
+}
+
+void instrEndFrame() {
+    const Clock::time_point now = Clock::now();
+    InstrFrame frame = {};
+    for (size_t i = 0; i < kInstrZoneCount; i++) {
+        frame.zone_ns[i] = g_zone_ns[i].exchange(0, std::memory_order_relaxed);
+        frame.zone_calls[i] = g_zone_calls[i].exchange(0, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < kInstrCounterCount; i++) {
+        frame.counters[i] = instrCounters[i];
+        instrCounters[i] = 0;
+    }
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    frame.frame_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - g_frame_start).count();
+    g_frame_start = now;
+
+    if (g_history.size() < kInstrHistoryFrames) {
+        g_history.push_back(frame);
+    } else {
+        g_history[g_next_frame % kInstrHistoryFrames] = frame;
+    }
+    g_next_frame++;
+    Accumulate(&g_totals, frame);
+
+    instrMark(InstrMarker::kFrame);
+}
+
+std::vector<InstrFrame> instrFrames() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_history.size() < kInstrHistoryFrames) {
+        return g_history;
+    }
+
+    // The oldest frame is the next one to be overwritten.
+    const size_t oldest = g_next_frame % kInstrHistoryFrames;
+    std::vector<InstrFrame> frames(g_history.begin() + oldest, g_history.end());
+    frames.insert(frames.end(), g_history.begin(), g_history.begin() + oldest);
+    return frames;
+}
+
+InstrFrame instrTotals(uint64_t* frame_count) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    *frame_count = g_next_frame;
+    return g_totals;
+}
+
+std::string instrSummary() {
+    if (!kInstrumentationEnabled) {
+        return "";
+    }
+
+    InstrFrame sum = {};
+    uint64_t count = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        count = std::min<uint64_t>(g_next_frame - g_summary_frame, g_history.size());
+        for (uint64_t frame = g_next_frame - count; frame < g_next_frame; frame++) {
+            Accumulate(&sum, g_history[frame % kInstrHistoryFrames]);
+        }
+        g_summary_frame = g_next_frame;
+    }
+    if (count == 0) {
+        return "";
+    }
+
+    const auto ms = [&](InstrZone zone) {
+        return sum.zone_ns[static_cast<size_t>(zone)] / 1e6 / count;
+    };
+    const auto per_frame = [&](InstrCounter counter) {
+        return static_cast<double>(sum.counters[static_cast<size_t>(counter)]) / count;
+    };
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "cpu %.2f render %.2f sound %.2f draw %.2f filter %.2f ms, %.0fk insn, %.0f B dma, "
+             "%.0f irq",
+             ms(InstrZone::kCpu), ms(InstrZone::kRender), ms(InstrZone::kSound),
+             ms(InstrZone::kDrawScreen), ms(InstrZone::kFilter),
+             per_frame(InstrCounter::kInstructions) / 1000, per_frame(InstrCounter::kDmaBytes),
+             per_frame(InstrCounter::kIrqs));
+    return buffer;
+}
+
+bool instrWriteDump(const char* path) {
+    const std::vector<InstrFrame> frames = instrFrames();
+    std::string dump;
+    if (EndsWith(path, ".json")) {
+        uint64_t frame_count = 0;
+        const InstrFrame totals = instrTotals(&frame_count);
+        dump = DumpJson(frames, totals, frame_count);
+    } else {
+        dump = DumpCsv(frames);
+    }
+    return WriteFile(path, dump);
+}
+
+void instrSetThreadName(const char* name) {
+    ThreadTrace* thread = CurrentThreadTrace();
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    thread->name = name;
+}
+
+void instrStartTrace() {
+    if (g_trace_started.exchange(true)) {
+        return;
+    }
+    g_trace_start = Clock::now();
+    g_tracing.store(true, std::memory_order_release);
+}
+
+bool instrWriteTrace(const char* path) {
+    g_tracing.store(false, std::memory_order_release);
+
+    std::string json = "{\n  \"displayTimeUnit\": \"ms\",\n  \"otherData\": {\"dropped_events\": " +
+                       std::to_string(g_trace_dropped.load()) + "},\n  \"traceEvents\": [";
+    bool first = true;
+    char buffer[192];
+    const auto append = [&]() {
+        json += first ? "\n    " : ",\n    ";
+        json += buffer;
+        first = false;
+    };
+
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    for (const std::unique_ptr<ThreadTrace>& thread : g_trace_threads) {
+        snprintf(buffer, sizeof(buffer),
+                 "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                 "\"args\": {\"name\": \"%s\"}}",
+                 thread->tid, thread->name.c_str());
+        append();
+
+        for (const TraceChunk* chunk = thread->head.load(std::memory_order_acquire);
+             chunk != nullptr; chunk = chunk->next.load(std::memory_order_acquire)) {
+            const size_t count = chunk->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; i++) {
+                const TraceEvent& event = chunk->events[i];
+                // Zones entered before the start of the trace start at 0.
+                const double ts = std::max<int64_t>(event.start_ns, 0) / 1000.0;
+                if (event.marker) {
+                    snprintf(buffer, sizeof(buffer),
+                             "{\"name\": \"%s\", \"cat\": \"marker\", \"ph\": \"i\", "
+                             "\"s\": \"t\", \"ts\": %.3f, \"pid\": 1, \"tid\": %u}",
+                             kMarkerNames[event.id], ts, thread->tid);
+                } else {
+                    snprintf(buffer, sizeof(buffer),
+                             "{\"name\": \"%s\", \"cat\": \"zone\", \"ph\": \"X\", "
+                             "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u}",
+                             kZoneNames[event.id], ts, event.duration_ns / 1000.0, thread->tid);
+                }
+                append();
+            }
+        }
+    }
+    json += "\n  ]\n}\n";
+    return WriteFile(path, json);
+}
@@ -0,0 +1,187 @@
+#ifndef VBAM_CORE_BASE_INSTRUMENTATION_H_
+#define VBAM_CORE_BASE_INSTRUMENTATION_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Per-frame timing of the emulation phases and counters of the emulated work,
+// to find out where a slow frame went.
+//
+// Zones time a scope and counters count events. Both are compiled out unless
+// VBAM_ENABLE_INSTRUMENTATION is defined, with the ENABLE_INSTRUMENTATION
+// CMake option. Otherwise, a zone costs two clock reads and a counted event an
+// addition. Zones may be entered from any thread and nest: kCpu includes the
+// kRender and kSound zones run by the cores. A zone is accounted to the frame
+// in which it ends. Counters must only be updated from the emulation thread.
+//
+// Once instrStartTrace() is called, every zone and marker is also recorded as
+// a trace event of its thread, for the timeline of instrWriteTrace(). Each
+// thread appends to its own buffer without locking.
+
+#if defined(VBAM_ENABLE_INSTRUMENTATION)
+constexpr bool kInstrumentationEnabled = true;
+#else
+constexpr bool kInstrumentationEnabled = false;
+#endif
+
+enum class InstrZone {
+    // CPULoop(), gbEmulate().
+    kCpu,
+    // renderLine(), gbRenderLine() and gbDrawSprites().
+    kRender,
+    // psoundTickfn(), gbSoundTick(), including flush_samples().
+    kSound,
+    // flush_samples().
+    kSoundFlush,
+    // SoundDriver::write() calls from flush_samples().
+    kAudioWrite,
+    // systemDrawScreen().
+    kDrawScreen,
+    // Filter threads of the frontends.
+    kFilter,
+    // Upload of the frame to the video driver.
+    kTextureUpload,
+    // Audio and video recording.
+    kRecording,
+    // Presentation of the frame: buffer swap or renderer present.
+    kPresent,
+    // Callbacks of the audio drivers pulling samples.
+    kAudioCallback,
+    // Waits of the audio drivers for a free buffer, which throttle the
+    // emulation.
+    kThrottle,
+    // Savestate reads and writes of the frontends.
+    kSaveState,
+    // Rewind snapshot captures and restores.
+    kRewind,
+    kLast,
+};
+
+enum class InstrMarker {
+    // End of an emulated frame, see instrEndFrame().
+    kFrame,
+    // Start of a serial transfer on the link port.
+    kLinkTransfer,
+    // An audio driver finished playing a buffer.
+    kAudioBufferEnd,
+    kLast,
+};
+
+enum class InstrCounter {
+    // Emulated CPU instructions.
+    kInstructions,
+    // Bytes copied by DMA and HDMA transfers.
+    kDmaBytes,
+    // Interrupts serviced by the emulated CPU.
+    kIrqs,
+    kLast,
+};
+
+constexpr size_t kInstrZoneCount = static_cast<size_t>(InstrZone::kLast);
+constexpr size_t kInstrCounterCount = static_cast<size_t>(InstrCounter::kLast);
+constexpr size_t kInstrMarkerCount = static_cast<size_t>(InstrMarker::kLast);
+
+// Number of frames kept by instrFrames().
+constexpr size_t kInstrHistoryFrames = 3600;
+
+struct InstrFrame {
+    // Wall-clock time since the end of the previous frame.
+    uint64_t frame_ns;
+    uint64_t zone_ns[kInstrZoneCount];
+    uint32_t zone_calls[kInstrZoneCount];
+    uint64_t counters[kInstrCounterCount];
+};
+
+// Short, stable names, used in the dumps.
+const char* instrZoneName(InstrZone zone);
+const char* instrCounterName(InstrCounter counter);
+const char* instrMarkerName(InstrMarker marker);
+
+// Counters of the current frame, updated with VBAM_INSTR_COUNT().
+extern uint64_t instrCounters[kInstrCounterCount];
+
+// Adds a run of `zone`, from `start` to now, to the current frame.
+void instrZoneEnd(InstrZone zone, std::chrono::steady_clock::time_point start);
+
+// Records `marker` in the trace of the calling thread.
+void instrMark(InstrMarker marker);
+
+// Times `zone` for the lifetime of the object.
+class InstrZoneScope final {
+public:
+    explicit InstrZoneScope(InstrZone zone)
+        : zone_(zone), start_(std::chrono::steady_clock::now()) {}
+    ~InstrZoneScope() { instrZoneEnd(zone_, start_); }
+
+    // Disable copy constructor and assignment operator.
+    InstrZoneScope(const InstrZoneScope&) = delete;
+    InstrZoneScope& operator=(const InstrZoneScope&) = delete;
+
+private:
+    const InstrZone zone_;
+    const std::chrono::steady_clock::time_point start_;
+};
+
+// Completes the current frame. Called by the cores after systemFrame().
+void instrEndFrame();
+
+// Returns the last kInstrHistoryFrames completed frames, oldest first.
+std::vector<InstrFrame> instrFrames();
+// Returns the sum of all the completed frames, and their number.
+InstrFrame instrTotals(uint64_t* frame_count);
+
+// Returns a one-line summary of the frames completed since the previous call,
+// averaged per frame, for the speed display of the frontends. Empty when the
+// instrumentation is compiled out or no frame completed.
+std::string instrSummary();
+
+// Writes the frames of instrFrames() to `path`, a UTF-8 path, as JSON if it
+// ends with ".json" and as CSV otherwise. The JSON dump also holds the totals.
+// Returns false on failure.
+bool instrWriteDump(const char* path);
+
+// Names the calling thread in the trace, e.g. "emulation" or "audio".
+void instrSetThreadName(const char* name);
+
+// Starts recording the trace events of all the threads, until
+// instrWriteTrace(). Only the first call has an effect.
+void instrStartTrace();
+
+// Stops recording and writes the trace to `path`, a UTF-8 path, in the Chrome
+// trace-event JSON format, which chrome://tracing and Perfetto open. Returns
+// false on failure.
+bool instrWriteTrace(const char* path);
+
+#define VBAM_INSTR_CONCAT_(a, b) a##b
+#define VBAM_INSTR_CONCAT(a, b) VBAM_INSTR_CONCAT_(a, b)
+
+#if defined(VBAM_ENABLE_INSTRUMENTATION)
+#define VBAM_INSTR_ZONE(zone) \
+    InstrZoneScope VBAM_INSTR_CONCAT(instr_zone_, __LINE__)(InstrZone::zone)
+#define VBAM_INSTR_COUNT(counter, n) \
+    (instrCounters[static_cast<size_t>(InstrCounter::counter)] += (n))
+#define VBAM_INSTR_END_FRAME() instrEndFrame()
+#define VBAM_INSTR_MARK(marker) instrMark(InstrMarker::marker)
+#define VBAM_INSTR_THREAD_NAME(name) instrSetThreadName(name)
+#else
+#define VBAM_INSTR_ZONE(zone) \
+    do {                      \
+    } while (0)
+#define VBAM_INSTR_COUNT(counter, n) \
+    do {                             \
+    } while (0)
+#define VBAM_INSTR_END_FRAME() \
+    do {                       \
+    } while (0)
+#define VBAM_INSTR_MARK(marker) \
+    do {                        \
+    } while (0)
+#define VBAM_INSTR_THREAD_NAME(name) \
+    do {                             \
+    } while (0)
+#endif  // defined(VBAM_ENABLE_INSTRUMENTATION)
+
+#endif  // VBAM_CORE_BASE_INSTRUMENTATION_H_
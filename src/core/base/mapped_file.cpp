@@ -0,0 +1,112 @@
+#include "core/base/mapped_file.h"
+
+#include <cstdio>
+
+#if defined(_WIN32)
+#include <windows.h>
+
+#include "core/base/internal/file_util_internal.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // defined(_WIN32)
+
+#include "core/base/file_util.h"
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const char* path) {
+    Close();
+
+#if defined(_WIN32)
+    const std::wstring wpath = core::internal::ToUTF16(path);
+    if (wpath.empty()) {
+        return false;
+    }
+
+    HANDLE file = CreateFileW(wpath.data(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0 &&
+            static_cast<uint64_t>(size.QuadPart) <= SIZE_MAX) {
+            mapping_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping_ != nullptr) {
+                void* view = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+                if (view != nullptr) {
+                    data_ = static_cast<const uint8_t*>(view);
+                    size_ = static_cast<size_t>(size.QuadPart);
+                    mapped_ = true;
+                } else {
+                    CloseHandle(mapping_);
+                    mapping_ = nullptr;
+                }
+            }
+        }
+        CloseHandle(file);
+    }
+#else
+    const int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE,
+                              fd, 0);
+            if (view != MAP_FAILED) {
+                data_ = static_cast<const uint8_t*>(view);
+                size_ = static_cast<size_t>(st.st_size);
+                mapped_ = true;
+            }
+        }
+        close(fd);
+    }
+#endif  // defined(_WIN32)
+
+    if (mapped_) {
+        return true;
+    }
+
+    // Fall back to reading the whole file, e.g. for pipes.
+    FILE* f = utilOpenFile(path, "rb");
+    if (f == nullptr) {
+        return false;
+    }
+
+    uint8_t chunk[16384];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        buffer_.insert(buffer_.end(), chunk, chunk + read);
+    }
+    const bool failed = ferror(f) != 0;
+    fclose(f);
+
+    if (failed) {
+        buffer_.clear();
+        return false;
+    }
+
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    return true;
+}
+
+void MappedFile::Close() {
+    if (mapped_) {
+#if defined(_WIN32)
+        UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+        mapping_ = nullptr;
+#else
+        munmap(const_cast<uint8_t*>(data_), size_);
+#endif  // defined(_WIN32)
+    }
+
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    buffer_.clear();
+}
@@ -0,0 +1,45 @@
+#ifndef VBAM_CORE_BASE_MAPPED_FILE_H_
+#define VBAM_CORE_BASE_MAPPED_FILE_H_
+
+#if defined(__LIBRETRO__)
+#error "This file is only for non-libretro builds"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Read-only view of a whole file. The file is mapped in memory, so that its
+// contents are only paged in when accessed. If mapping fails, the file is read
+// into a buffer instead.
+class MappedFile final {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    // Disable copy constructor and assignment operator.
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Opens `path`, a UTF-8 path. Returns false if the file cannot be read.
+    bool Open(const char* path);
+    void Close();
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    // Whether the contents are mapped rather than copied.
+    bool mapped() const { return mapped_; }
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+#if defined(_WIN32)
+    void* mapping_ = nullptr;
+#endif  // defined(_WIN32)
+
+    // Contents of the file when it could not be mapped.
+    std::vector<uint8_t> buffer_;
+};
+
+#endif  // VBAM_CORE_BASE_MAPPED_FILE_H_
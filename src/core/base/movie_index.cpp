@@ -0,0 +1,254 @@
+#include "core/base/movie_index.h"
+
+#include <zlib.h>
+
+#include "core/base/file_util.h"
+#include "core/base/flat_state.h"
+#include "core/base/snapshot_arena.h"
+#include "core/base/system.h"
+
+namespace {
+
+constexpr uint32_t kMovieIndexMagic = flatStateFourCC('V', 'B', 'M', 'I');
+constexpr uint32_t kMovieIndexVersion = 2;
+
+struct MovieIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t interval;
+    // Size and CRC-32 of the initial savestate of the movie.
+    uint32_t state_size;
+    uint32_t state_crc;
+    uint32_t reserved;
+};
+
+// Precedes the packed state of every keyframe.
+struct MovieIndexRecord {
+    uint32_t frame;
+    uint32_t log_frame;
+    uint32_t joypad;
+    uint32_t state_size;
+    uint64_t log_offset;
+};
+
+// Computes the size and CRC-32 of the file at `path`. Returns false if it
+// cannot be read.
+bool FileCrc(const char* path, uint32_t* size, uint32_t* crc) {
+    FILE* file = utilOpenFile(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    uint64_t total = 0;
+    uLong result = crc32(0L, Z_NULL, 0);
+    uint8_t buffer[16384];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        result = crc32(result, buffer, static_cast<uInt>(count));
+        total += count;
+    }
+    const bool read = !ferror(file) && total <= UINT32_MAX;
+    fclose(file);
+
+    *size = static_cast<uint32_t>(total);
+    *crc = static_cast<uint32_t>(result);
+    return read;
+}
+
+}  // namespace
+
+MovieIndex::~MovieIndex() {
+    Close();
+}
+
+bool MovieIndex::Open(const char* path, const char* state_path, uint32_t interval, bool truncate) {
+    Close();
+
+    uint32_t state_size = 0;
+    uint32_t state_crc = 0;
+    if (!FileCrc(state_path, &state_size, &state_crc)) {
+        return false;
+    }
+
+    if (!truncate) {
+        file_ = utilOpenFile(path, "r+b");
+    }
+
+    if (file_ != nullptr) {
+        MovieIndexHeader header;
+        long file_size = -1;
+        if (fseek(file_, 0, SEEK_END) == 0) {
+            file_size = ftell(file_);
+        }
+
+        if (file_size > 0 && fseek(file_, 0, SEEK_SET) == 0 &&
+            fread(&header, sizeof(header), 1, file_) == 1 && header.magic == kMovieIndexMagic &&
+            header.version == kMovieIndexVersion && header.interval != 0 &&
+            header.state_size == state_size && header.state_crc == state_crc) {
+            interval_ = header.interval;
+            end_ = sizeof(header);
+
+            MovieIndexRecord record;
+            while (fread(&record, sizeof(record), 1, file_) == 1) {
+                const uint64_t state_offset = end_ + sizeof(record);
+                if (record.state_size == 0 ||
+                    state_offset + record.state_size > static_cast<uint64_t>(file_size) ||
+                    (!entries_.empty() && record.frame <= entries_.back().keyframe.frame) ||
+                    fseek(file_, record.state_size, SEEK_CUR) != 0) {
+                    break;
+                }
+
+                Entry entry;
+                entry.keyframe.frame = record.frame;
+                entry.keyframe.log_offset = record.log_offset;
+                entry.keyframe.log_frame = record.log_frame;
+                entry.keyframe.joypad = record.joypad;
+                entry.state_offset = state_offset;
+                entry.state_size = record.state_size;
+                entries_.push_back(entry);
+                end_ = state_offset + record.state_size;
+            }
+            return true;
+        }
+
+        fclose(file_);
+        file_ = nullptr;
+        entries_.clear();
+    }
+
+    if (interval == 0) {
+        return false;
+    }
+
+    file_ = utilOpenFile(path, "w+b");
+    if (file_ == nullptr) {
+        return false;
+    }
+
+    const MovieIndexHeader header = {kMovieIndexMagic, kMovieIndexVersion, interval,
+                                     state_size,       state_crc,          0};
+    if (fwrite(&header, sizeof(header), 1, file_) != 1 || fflush(file_) != 0) {
+        Close();
+        return false;
+    }
+
+    interval_ = interval;
+    end_ = sizeof(header);
+    return true;
+}
+
+void MovieIndex::Close() {
+    if (file_ != nullptr) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+
+    interval_ = 0;
+    entries_.clear();
+    end_ = 0;
+}
+
+bool MovieIndex::Due(uint32_t frame) const {
+    if (file_ == nullptr) {
+        return false;
+    }
+
+    // Frame 0 is the initial state of the movie, which is not indexed.
+    const uint32_t last = entries_.empty() ? 0 : entries_.back().keyframe.frame;
+    return frame >= last - last % interval_ + interval_;
+}
+
+bool MovieIndex::Add(const MovieKeyframe& keyframe, const EmulatedSystem& system) {
+    if (file_ == nullptr || system.emuWriteMemState == nullptr ||
+        system.emuMemStateSize == nullptr) {
+        return false;
+    }
+
+    if (!entries_.empty() && keyframe.frame <= entries_.back().keyframe.frame) {
+        return true;
+    }
+
+    std::vector<uint8_t> state = snapshotArena().Acquire(system.emuMemStateSize());
+    long size = 0;
+    const bool saved = system.emuWriteMemState(reinterpret_cast<char*>(state.data()),
+                                               static_cast<int>(state.size()), size) &&
+                       size > 0;
+    size_t packed_size = 0;
+    if (saved) {
+        const FlatStateCodec* codec = flatStateCodecZlib();
+        packed_.resize(flatStatePackBound(codec, size));
+        packed_size = flatStatePack(codec, state.data(), size, packed_.data(), packed_.size());
+    }
+    state.resize(size > 0 ? size : 0);
+    snapshotArena().Release(std::move(state));
+
+    if (packed_size == 0) {
+        return false;
+    }
+
+    MovieIndexRecord record;
+    record.frame = keyframe.frame;
+    record.log_frame = keyframe.log_frame;
+    record.joypad = keyframe.joypad;
+    record.state_size = static_cast<uint32_t>(packed_size);
+    record.log_offset = keyframe.log_offset;
+
+    if (fseek(file_, static_cast<long>(end_), SEEK_SET) != 0 ||
+        fwrite(&record, sizeof(record), 1, file_) != 1 ||
+        fwrite(packed_.data(), 1, packed_size, file_) != packed_size || fflush(file_) != 0) {
+        return false;
+    }
+
+    Entry entry;
+    entry.keyframe = keyframe;
+    entry.state_offset = end_ + sizeof(record);
+    entry.state_size = record.state_size;
+    entries_.push_back(entry);
+    end_ = entry.state_offset + entry.state_size;
+    return true;
+}
+
+int MovieIndex::Find(uint32_t frame) const {
+    // Binary search for the first keyframe after `frame`.
+    size_t low = 0;
+    size_t high = entries_.size();
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        if (entries_[mid].keyframe.frame <= frame) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return static_cast<int>(low) - 1;
+}
+
+bool MovieIndex::Restore(int index, const EmulatedSystem& system) {
+    if (file_ == nullptr || index < 0 || static_cast<size_t>(index) >= entries_.size() ||
+        system.emuReadMemState == nullptr) {
+        return false;
+    }
+
+    const Entry& entry = entries_[index];
+    packed_.resize(entry.state_size);
+    if (fseek(file_, static_cast<long>(entry.state_offset), SEEK_SET) != 0 ||
+        fread(packed_.data(), 1, packed_.size(), file_) != packed_.size()) {
+        return false;
+    }
+
+    // The size comes from the file, it must not exceed the biggest state.
+    const size_t state_size = flatStateUnpackedSize(packed_.data(), packed_.size());
+    if (state_size == 0 ||
+        (system.emuMemStateSize != nullptr && state_size > system.emuMemStateSize())) {
+        return false;
+    }
+
+    std::vector<uint8_t> state = snapshotArena().Acquire(state_size);
+    const bool restored =
+        flatStateUnpack(packed_.data(), packed_.size(), state.data(), state.size()) ==
+            state_size &&
+        system.emuReadMemState(reinterpret_cast<char*>(state.data()),
+                               static_cast<int>(state_size));
+    snapshotArena().Release(std::move(state));
+    return restored;
+}
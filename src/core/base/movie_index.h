@@ -0,0 +1,88 @@
+#ifndef VBAM_CORE_BASE_MOVIE_INDEX_H_
+#define VBAM_CORE_BASE_MOVIE_INDEX_H_
+
+#if defined(__LIBRETRO__)
+#error "This file is only for non-libretro builds"
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+struct EmulatedSystem;
+
+// Position of a movie at a keyframe, along with what is needed to resume the
+// playback of the joypad log from there.
+struct MovieKeyframe {
+    // Frames since the start of the movie.
+    uint32_t frame = 0;
+    // Offset in the joypad log of the first entry not applied yet.
+    uint64_t log_offset = 0;
+    // Frame counter of the joypad log, its meaning depends on the log format.
+    uint32_t log_frame = 0;
+    // Joypad state at the keyframe.
+    uint32_t joypad = 0;
+};
+
+// Sidecar index of a movie, storing a compressed memory state every
+// `interval` frames, so that seeking in the movie only has to replay the
+// frames since the nearest keyframe.
+//
+// The index is a cache: it is rebuilt when a movie is recorded, and an index
+// that cannot be read, or that was built for another initial state of the
+// movie, is discarded. Keyframes are appended as the movie is recorded or
+// played back, a truncated last keyframe is ignored.
+class MovieIndex final {
+public:
+    MovieIndex() = default;
+    ~MovieIndex();
+
+    // Disable copy constructor and assignment operator.
+    MovieIndex(const MovieIndex&) = delete;
+    MovieIndex& operator=(const MovieIndex&) = delete;
+
+    // Opens the index at `path` of the movie starting from the savestate at
+    // `state_path`, both UTF-8 paths. An existing index is loaded unless
+    // `truncate` is set or it was built from another savestate, otherwise a
+    // new index is created, with `interval` frames between keyframes. Returns
+    // false if the index could neither be loaded nor created.
+    bool Open(const char* path, const char* state_path, uint32_t interval, bool truncate);
+    void Close();
+
+    bool is_open() const { return file_ != nullptr; }
+    uint32_t interval() const { return interval_; }
+    size_t count() const { return entries_.size(); }
+
+    // Whether a keyframe should be added at `frame`.
+    bool Due(uint32_t frame) const;
+    // Captures the state of `system` as the keyframe `keyframe`. Keyframes
+    // at or before the last one are ignored. Returns false on failure.
+    bool Add(const MovieKeyframe& keyframe, const EmulatedSystem& system);
+
+    // Returns the index of the last keyframe at or before `frame`, -1 if
+    // there is none.
+    int Find(uint32_t frame) const;
+    const MovieKeyframe& keyframe(int index) const { return entries_[index].keyframe; }
+    // Restores keyframe `index` into `system`. Returns false on failure, or
+    // if the state is larger than system.emuMemStateSize().
+    bool Restore(int index, const EmulatedSystem& system);
+
+private:
+    struct Entry {
+        MovieKeyframe keyframe;
+        // Position and size of the packed state in the index.
+        uint64_t state_offset;
+        uint32_t state_size;
+    };
+
+    FILE* file_ = nullptr;
+    uint32_t interval_ = 0;
+    std::vector<Entry> entries_;
+    // End of the last complete keyframe in the index.
+    uint64_t end_ = 0;
+
+    // Scratch buffer for the packed states.
+    std::vector<uint8_t> packed_;
+};
+
+#endif  // VBAM_CORE_BASE_MOVIE_INDEX_H_
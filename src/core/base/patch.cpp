@@ -199,8 +199,11 @@ static bool patchApplyIPS(const char* patchname, uint8_t** r, int* s)
                 b = -1;
             // check if we need to reallocate our ROM
             if ((offset + len) >= size) {
-                size *= 2;
+                const int old_size = size;
+                while ((offset + len) >= size)
+                    size *= 2;
                 rom = (uint8_t*)realloc(rom, size);
+                memset(rom + old_size, 0, size - old_size);
                 *r = rom;
                 *s = size;
             }
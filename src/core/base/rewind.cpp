@@ -0,0 +1,451 @@
+#include "core/base/rewind.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "core/base/flat_state.h"
+#include "core/base/instrumentation.h"
+#include "core/base/sizes.h"
+#include "core/base/snapshot_arena.h"
+#include "core/base/system.h"
+
+namespace {
+
+// Size of the buffer used to capture states with emuWriteMemState(), for
+// systems that do not report it. This is larger than the biggest GB and GBA
+// flat states.
+constexpr size_t kDefaultStateBufferSize = k1MiB;
+
+size_t StateBufferSize(const EmulatedSystem& system) {
+    return system.emuMemStateSize ? system.emuMemStateSize() : kDefaultStateBufferSize;
+}
+
+// Number of unchanged bytes that ends a run of changed bytes in a delta.
+// Shorter gaps are cheaper to store as part of the run.
+constexpr size_t kRunBreak = 8;
+
+// Upper bound of the size of a delta for a `size` bytes snapshot. Runs are
+// separated by at least kRunBreak unchanged bytes, and each run costs two
+// varints on top of its data.
+size_t DeltaBound(size_t size) {
+    return size + (size / kRunBreak + 1) * 20;
+}
+
+uint8_t* WriteVarint(uint8_t* out, size_t value) {
+    while (value >= 0x80) {
+        *out++ = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    *out++ = static_cast<uint8_t>(value);
+    return out;
+}
+
+bool ReadVarint(const uint8_t*& in, const uint8_t* end, size_t* value) {
+    size_t result = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        const uint8_t byte = *in++;
+        result |= static_cast<size_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Encodes `state` as a list of (skip, length, XOR data) runs against `key`.
+// The blocks of `state` not flagged in `dirty`, if set, are known to match
+// `key` and are not compared. Returns the size of the delta, which is never
+// empty.
+size_t EncodeDelta(const uint8_t* key,
+                   const uint8_t* state,
+                   size_t size,
+                   const uint64_t* dirty,
+                   uint8_t* out) {
+    uint8_t* cursor = out;
+    size_t last = 0;
+    size_t i = 0;
+
+    while (i < size) {
+        // Skip the clean blocks, then the unchanged bytes of the block, a
+        // word at a time first.
+        size_t limit = size;
+        if (dirty != nullptr) {
+            size_t block = i / kFlatStateDirtyBlock;
+            while (i < size) {
+                const uint64_t bits = dirty[block / 64] >> (block % 64);
+                if (bits & 1) {
+                    break;
+                }
+                block = bits == 0 ? (block / 64 + 1) * 64 : block + 1;
+                i = block * kFlatStateDirtyBlock;
+            }
+            if (i >= size) {
+                break;
+            }
+            limit = std::min(size, (block + 1) * kFlatStateDirtyBlock);
+        }
+
+        while (i + sizeof(uint64_t) <= limit) {
+            uint64_t a, b;
+            memcpy(&a, key + i, sizeof(a));
+            memcpy(&b, state + i, sizeof(b));
+            if (a != b) {
+                break;
+            }
+            i += sizeof(uint64_t);
+        }
+        while (i < limit && key[i] == state[i]) {
+            i++;
+        }
+        if (i == limit) {
+            continue;
+        }
+
+        // Extend the run until kRunBreak unchanged bytes are found.
+        const size_t start = i;
+        size_t end = i + 1;
+        size_t j = end;
+        while (j < size && j - end < kRunBreak) {
+            if (key[j] != state[j]) {
+                end = j + 1;
+            }
+            j++;
+        }
+
+        cursor = WriteVarint(cursor, start - last);
+        cursor = WriteVarint(cursor, end - start);
+        for (size_t k = start; k < end; k++) {
+            *cursor++ = key[k] ^ state[k];
+        }
+
+        last = end;
+        i = j;
+    }
+
+    // A lone skip is a valid, empty delta.
+    if (cursor == out) {
+        *cursor++ = 0;
+    }
+    return cursor - out;
+}
+
+// Applies a delta produced by EncodeDelta() to `out`, which holds the keyframe.
+bool ApplyDelta(const uint8_t* delta, size_t delta_size, uint8_t* out, size_t size) {
+    const uint8_t* end = delta + delta_size;
+    size_t pos = 0;
+
+    while (delta < end) {
+        size_t skip, length;
+        if (!ReadVarint(delta, end, &skip)) {
+            return false;
+        }
+        if (delta == end) {
+            break;
+        }
+        if (!ReadVarint(delta, end, &length)) {
+            return false;
+        }
+        if (skip > size - pos) {
+            return false;
+        }
+        pos += skip;
+        if (length > size - pos || length > static_cast<size_t>(end - delta)) {
+            return false;
+        }
+        for (size_t k = 0; k < length; k++) {
+            out[pos + k] ^= delta[k];
+        }
+        delta += length;
+        pos += length;
+    }
+
+    return true;
+}
+
+}  // namespace
+
+RewindBuffer::RewindBuffer(size_t budget, size_t keyframe_interval, const FlatStateCodec* codec)
+    : budget_(budget), keyframe_interval_(std::max<size_t>(keyframe_interval, 1)), codec_(codec) {}
+
+RewindBuffer::~RewindBuffer() {
+    snapshotArena().Release(std::move(state_));
+}
+
+bool RewindBuffer::Push(const uint8_t* state, size_t size) {
+    return Push(state, size, nullptr);
+}
+
+bool RewindBuffer::Push(const uint8_t* state, size_t size, const uint64_t* dirty) {
+    if (size == 0) {
+        return false;
+    }
+
+    if (ring_.data() == nullptr && !ring_.Allocate(budget_)) {
+        return false;
+    }
+
+    Entry entry;
+    entry.seq = next_seq_++;
+    entry.state_size = size;
+
+    const bool keyframe = !key_valid_ || entries_.empty() || key_.size() != size ||
+                          entries_.back().key_seq != key_seq_ ||
+                          entries_.back().group_index + 1 >= keyframe_interval_;
+
+    if (!keyframe) {
+        if (record_.size() < DeltaBound(size)) {
+            record_.resize(DeltaBound(size));
+        }
+
+        entry.key_seq = key_seq_;
+        entry.group_index = entries_.back().group_index + 1;
+        const size_t delta_size = EncodeDelta(key_.data(), state, size, dirty, record_.data());
+
+        // Storing the delta fails if it would evict its own keyframe, start a
+        // new group in that case.
+        if (Store(record_.data(), delta_size, key_seq_, &entry)) {
+            entries_.push_back(entry);
+            return true;
+        }
+    }
+
+    entry.key_seq = entry.seq;
+    entry.group_index = 0;
+    if (!Store(state, size, entry.seq, &entry)) {
+        Clear();
+        return false;
+    }
+
+    entries_.push_back(entry);
+    key_.assign(state, state + size);
+    key_seq_ = entry.seq;
+    key_valid_ = true;
+    // CaptureIncremental() tracks the changes from its own keyframes on.
+    std::fill(key_dirty_.begin(), key_dirty_.end(), 0);
+    key_dirty_valid_ = false;
+    return true;
+}
+
+size_t RewindBuffer::Read(size_t index, uint8_t* out, size_t capacity) {
+    if (index >= entries_.size()) {
+        return 0;
+    }
+
+    const size_t position = entries_.size() - 1 - index;
+    const Entry& entry = entries_[position];
+    if (entry.state_size > capacity) {
+        return 0;
+    }
+
+    const Entry& key = entries_[position - entry.group_index];
+    if (key_valid_ && key.seq == key_seq_ && key_.size() == key.state_size) {
+        memcpy(out, key_.data(), key.state_size);
+    } else if (!Load(key, out, capacity)) {
+        return 0;
+    }
+
+    if (entry.group_index == 0) {
+        return entry.state_size;
+    }
+
+    const uint8_t* delta = ring_.data() + entry.offset;
+    size_t delta_size = entry.record_size;
+    if (entry.packed) {
+        if (packed_.size() < DeltaBound(entry.state_size)) {
+            packed_.resize(DeltaBound(entry.state_size));
+        }
+        delta_size = codec_->decompress(delta, delta_size, packed_.data(), packed_.size());
+        if (delta_size == 0) {
+            return 0;
+        }
+        delta = packed_.data();
+    }
+
+    if (!ApplyDelta(delta, delta_size, out, entry.state_size)) {
+        return 0;
+    }
+    return entry.state_size;
+}
+
+void RewindBuffer::Drop(size_t count) {
+    count = std::min(count, entries_.size());
+    while (count--) {
+        used_ -= entries_.back().record_size;
+        entries_.pop_back();
+    }
+
+    write_ = entries_.empty() ? 0 : entries_.back().offset + entries_.back().record_size;
+}
+
+void RewindBuffer::Clear() {
+    entries_.clear();
+    write_ = 0;
+    used_ = 0;
+    key_valid_ = false;
+}
+
+bool RewindBuffer::Capture(const EmulatedSystem& system) {
+    if (system.emuWriteIncrementalState != nullptr) {
+        return CaptureIncremental(system);
+    }
+
+    if (system.emuWriteMemState == nullptr) {
+        return false;
+    }
+
+    VBAM_INSTR_ZONE(kRewind);
+    ReserveState(system);
+
+    long size = 0;
+    if (!system.emuWriteMemState(reinterpret_cast<char*>(state_.data()),
+                                 static_cast<int>(state_.size()), size) ||
+        size <= 0) {
+        return false;
+    }
+
+    return Push(state_.data(), static_cast<size_t>(size));
+}
+
+bool RewindBuffer::CaptureIncremental(const EmulatedSystem& system) {
+    VBAM_INSTR_ZONE(kRewind);
+    ReserveState(system);
+
+    const size_t words = flatStateDirtyWords(state_.size());
+    dirty_.assign(words, 0);
+    const size_t size = system.emuWriteIncrementalState(state_.data(), state_.size(),
+                                                        !capture_valid_, dirty_.data());
+    capture_valid_ = size != 0;
+    if (size == 0) {
+        return false;
+    }
+
+    if (key_dirty_.size() != words) {
+        key_dirty_.assign(words, 0);
+        key_dirty_valid_ = false;
+    }
+    for (size_t i = 0; i < words; i++) {
+        key_dirty_[i] |= dirty_[i];
+    }
+
+    if (!Push(state_.data(), size, key_dirty_valid_ ? key_dirty_.data() : nullptr)) {
+        return false;
+    }
+    if (entries_.back().group_index == 0) {
+        key_dirty_valid_ = true;
+    }
+    return true;
+}
+
+bool RewindBuffer::Restore(const EmulatedSystem& system, size_t index) {
+    if (system.emuReadMemState == nullptr) {
+        return false;
+    }
+
+    VBAM_INSTR_ZONE(kRewind);
+    ReserveState(system);
+
+    // `state_` no longer holds the last capture.
+    capture_valid_ = false;
+
+    const size_t size = Read(index, state_.data(), state_.size());
+    if (size == 0) {
+        return false;
+    }
+
+    return system.emuReadMemState(reinterpret_cast<char*>(state_.data()), static_cast<int>(size));
+}
+
+void RewindBuffer::ReserveState(const EmulatedSystem& system) {
+    const size_t size = StateBufferSize(system);
+    if (state_.size() < size) {
+        snapshotArena().Release(std::move(state_));
+        state_ = snapshotArena().Acquire(size);
+        capture_valid_ = false;
+    }
+}
+
+bool RewindBuffer::Allocate(size_t size, uint64_t keep_seq, size_t* offset) {
+    if (size > budget_) {
+        return false;
+    }
+
+    for (;;) {
+        if (entries_.empty()) {
+            write_ = 0;
+            *offset = 0;
+            return true;
+        }
+
+        const size_t tail = entries_.front().offset;
+        if (write_ > tail) {
+            // The free space is at the end of the ring, then at its start.
+            if (budget_ - write_ >= size) {
+                *offset = write_;
+                return true;
+            }
+            if (tail >= size) {
+                *offset = 0;
+                return true;
+            }
+        } else if (tail - write_ >= size) {
+            *offset = write_;
+            return true;
+        }
+
+        if (entries_.front().seq == keep_seq) {
+            return false;
+        }
+        EvictOldest();
+    }
+}
+
+void RewindBuffer::EvictOldest() {
+    used_ -= entries_.front().record_size;
+    entries_.pop_front();
+
+    while (!entries_.empty() && entries_.front().group_index != 0) {
+        used_ -= entries_.front().record_size;
+        entries_.pop_front();
+    }
+}
+
+bool RewindBuffer::Store(const uint8_t* record, size_t size, uint64_t keep_seq, Entry* entry) {
+    const uint8_t* data = record;
+    size_t data_size = size;
+    entry->packed = false;
+
+    if (codec_ != nullptr) {
+        if (packed_.size() < codec_->bound(size)) {
+            packed_.resize(codec_->bound(size));
+        }
+        const size_t packed_size = codec_->compress(record, size, packed_.data(), packed_.size());
+        if (packed_size != 0 && packed_size < size) {
+            data = packed_.data();
+            data_size = packed_size;
+            entry->packed = true;
+        }
+    }
+
+    size_t offset;
+    if (!Allocate(data_size, keep_seq, &offset)) {
+        return false;
+    }
+
+    memcpy(ring_.data() + offset, data, data_size);
+    entry->offset = offset;
+    entry->record_size = data_size;
+    write_ = offset + data_size;
+    used_ += data_size;
+    return true;
+}
+
+bool RewindBuffer::Load(const Entry& entry, uint8_t* out, size_t capacity) {
+    const uint8_t* record = ring_.data() + entry.offset;
+    if (!entry.packed) {
+        memcpy(out, record, entry.record_size);
+        return true;
+    }
+
+    return codec_->decompress(record, entry.record_size, out, capacity) == entry.state_size;
+}
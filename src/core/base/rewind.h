@@ -0,0 +1,134 @@
+#ifndef VBAM_CORE_BASE_REWIND_H_
+#define VBAM_CORE_BASE_REWIND_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "core/base/huge_pages.h"
+
+struct EmulatedSystem;
+struct FlatStateCodec;
+
+// Snapshot history used by the frontends to implement rewind.
+//
+// Snapshots are stored in a ring of `budget` bytes. Every `keyframe_interval`
+// snapshots a keyframe is stored in full, the snapshots in between are stored
+// as the XOR of the snapshot and its keyframe, run-length encoded so that the
+// unchanged bytes cost nothing. Both kinds of records are then optionally
+// compressed with `codec`. When the ring is full, the oldest keyframe and its
+// deltas are evicted to make room for new snapshots. The ring is allocated on
+// the first snapshot, backed by huge pages where available.
+//
+// Restoring a snapshot costs at most one keyframe decode and one delta
+// decode, independently of the position of the snapshot in the history.
+//
+// Systems that implement emuWriteIncrementalState() are captured
+// incrementally: only the memory written since the previous capture is
+// copied, and only the blocks that may have changed since the keyframe are
+// compared to compute the deltas.
+class RewindBuffer final {
+public:
+    // `codec` may be nullptr to store records uncompressed.
+    RewindBuffer(size_t budget, size_t keyframe_interval, const FlatStateCodec* codec);
+    ~RewindBuffer();
+
+    // Disable copy constructor and assignment operator.
+    RewindBuffer(const RewindBuffer&) = delete;
+    RewindBuffer& operator=(const RewindBuffer&) = delete;
+
+    // Adds a snapshot as the newest one. Returns false if the snapshot does
+    // not fit in the budget, in which case the history is left empty, or if
+    // the ring cannot be allocated.
+    bool Push(const uint8_t* state, size_t size);
+
+    // Decodes snapshot `index`, 0 being the newest, into `out`. Returns the
+    // size of the snapshot, 0 on failure.
+    size_t Read(size_t index, uint8_t* out, size_t capacity);
+
+    // Discards the `count` newest snapshots.
+    void Drop(size_t count);
+    // Discards all snapshots.
+    void Clear();
+
+    // Captures the current state of `system` with emuWriteIncrementalState()
+    // if available, emuWriteMemState() otherwise.
+    bool Capture(const EmulatedSystem& system);
+    // Restores snapshot `index` into `system` with emuReadMemState(). The
+    // snapshot is kept in the history.
+    bool Restore(const EmulatedSystem& system, size_t index);
+
+    // Number of snapshots in the history.
+    size_t count() const { return entries_.size(); }
+    // Number of ring bytes used by the snapshots.
+    size_t used() const { return used_; }
+    size_t budget() const { return budget_; }
+
+private:
+    struct Entry {
+        // Position of the record in the ring.
+        size_t offset;
+        size_t record_size;
+        // Size of the decoded snapshot.
+        size_t state_size;
+        // Sequence number of the snapshot and of its keyframe.
+        uint64_t seq;
+        uint64_t key_seq;
+        // Position of the snapshot in its keyframe group, 0 for keyframes.
+        size_t group_index;
+        // Whether the record went through `codec_`.
+        bool packed;
+    };
+
+    // Push() for a snapshot whose blocks not flagged in `dirty` match the
+    // keyframe. `dirty` may be nullptr to compare the whole snapshot.
+    bool Push(const uint8_t* state, size_t size, const uint64_t* dirty);
+    // Capture() with emuWriteIncrementalState().
+    bool CaptureIncremental(const EmulatedSystem& system);
+    // Makes `state_` large enough for the states of `system`.
+    void ReserveState(const EmulatedSystem& system);
+    // Reserves `size` bytes in the ring, evicting the oldest snapshots as
+    // needed. Returns false if `size` exceeds the budget or if the snapshot
+    // `keep_seq` would have to be evicted.
+    bool Allocate(size_t size, uint64_t keep_seq, size_t* offset);
+    // Removes the oldest snapshot, along with the deltas left without their
+    // keyframe.
+    void EvictOldest();
+    // Stores `size` bytes of `record`, compressing it if that saves space.
+    bool Store(const uint8_t* record, size_t size, uint64_t keep_seq, Entry* entry);
+    // Decodes the record of `entry` into `out`. Returns false on failure.
+    bool Load(const Entry& entry, uint8_t* out, size_t capacity);
+
+    const size_t budget_;
+    const size_t keyframe_interval_;
+    const FlatStateCodec* const codec_;
+
+    HugePageBuffer ring_;
+    std::deque<Entry> entries_;
+    // End of the newest record in the ring.
+    size_t write_ = 0;
+    size_t used_ = 0;
+    uint64_t next_seq_ = 0;
+
+    // Decoded copy of the newest keyframe, deltas are computed against it.
+    std::vector<uint8_t> key_;
+    uint64_t key_seq_ = 0;
+    bool key_valid_ = false;
+
+    // Scratch buffers for encoding and decoding records.
+    std::vector<uint8_t> record_;
+    std::vector<uint8_t> packed_;
+    // Captured or restored state, a slab of snapshotArena().
+    std::vector<uint8_t> state_;
+    // Whether `state_` holds the last incremental capture.
+    bool capture_valid_ = false;
+    // Blocks written by the last incremental capture, and since the keyframe.
+    std::vector<uint64_t> dirty_;
+    std::vector<uint64_t> key_dirty_;
+    // Whether `key_dirty_` covers every change since the keyframe, which is
+    // only the case if the keyframe was captured incrementally.
+    bool key_dirty_valid_ = false;
+};
+
+#endif  // VBAM_CORE_BASE_REWIND_H_
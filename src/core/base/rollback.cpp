@@ -0,0 +1,265 @@
+#include "core/base/rollback.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "core/base/sizes.h"
+#include "core/base/snapshot_arena.h"
+#include "core/base/system.h"
+
+namespace {
+
+// Size of the buffer used to save states with emuWriteMemState(), for systems
+// that do not report it. This is larger than the biggest GB and GBA flat
+// states.
+constexpr size_t kDefaultStateBufferSize = k1MiB;
+
+// Maximum number of emuMain() calls for a single frame. A frame normally ends
+// within one call, this only guards against games that never end a frame.
+constexpr int kMaxSlicesPerFrame = 8;
+
+uint64_t SystemClockMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+}  // namespace
+
+// static
+void LoopbackTransport::CreatePair(std::unique_ptr<LoopbackTransport>* a,
+                                   std::unique_ptr<LoopbackTransport>* b) {
+    std::shared_ptr<Channel> a_to_b = std::make_shared<Channel>();
+    std::shared_ptr<Channel> b_to_a = std::make_shared<Channel>();
+    a->reset(new LoopbackTransport(b_to_a, a_to_b));
+    b->reset(new LoopbackTransport(a_to_b, b_to_a));
+}
+
+LoopbackTransport::LoopbackTransport(std::shared_ptr<Channel> in, std::shared_ptr<Channel> out)
+    : in_(std::move(in)), out_(std::move(out)) {}
+
+void LoopbackTransport::Send(const RollbackInput& input) {
+    std::lock_guard<std::mutex> lock(out_->mutex);
+    out_->inputs.push_back(input);
+}
+
+bool LoopbackTransport::Receive(RollbackInput* input) {
+    std::lock_guard<std::mutex> lock(in_->mutex);
+    if (in_->inputs.empty()) {
+        return false;
+    }
+    *input = in_->inputs.front();
+    in_->inputs.pop_front();
+    return true;
+}
+
+LatencySimulator::LatencySimulator(std::unique_ptr<RollbackTransport> transport,
+                                   uint32_t latency_ms,
+                                   uint32_t jitter_ms,
+                                   uint32_t seed,
+                                   Clock clock)
+    : transport_(std::move(transport)),
+      latency_ms_(latency_ms),
+      jitter_ms_(jitter_ms),
+      random_(seed),
+      clock_(clock ? std::move(clock) : Clock(SystemClockMs)) {}
+
+void LatencySimulator::Send(const RollbackInput& input) {
+    transport_->Send(input);
+}
+
+bool LatencySimulator::Receive(RollbackInput* input) {
+    const uint64_t now = clock_();
+
+    RollbackInput received;
+    while (transport_->Receive(&received)) {
+        uint64_t delay = latency_ms_;
+        if (jitter_ms_ != 0) {
+            delay += random_() % (jitter_ms_ + 1);
+        }
+        pending_.push_back({now + delay, received});
+    }
+
+    auto due = std::min_element(pending_.begin(), pending_.end(),
+                                [](const Pending& a, const Pending& b) {
+                                    return a.deliver_at < b.deliver_at;
+                                });
+    if (due == pending_.end() || due->deliver_at > now) {
+        return false;
+    }
+
+    *input = due->input;
+    pending_.erase(due);
+    return true;
+}
+
+RollbackSession::RollbackSession(int local_player, int max_rollback, RollbackTransport* transport)
+    : local_player_(local_player & 1),
+      max_rollback_(std::max(max_rollback, 0)),
+      transport_(transport),
+      // States are needed for up to max_rollback frames, the remote peer
+      // can send its inputs up to max_rollback frames ahead.
+      slots_(2 * max_rollback_ + 2) {}
+
+RollbackSession::~RollbackSession() {
+    for (Slot& slot : slots_) {
+        snapshotArena().Release(std::move(slot.state));
+    }
+}
+
+bool RollbackSession::RunFrame(const EmulatedSystem& system, uint32_t joypad) {
+    if (system.emuWriteMemState == nullptr || system.emuReadMemState == nullptr) {
+        return false;
+    }
+
+    // The local input is sent even when stalling, the remote peer may be
+    // waiting for it.
+    if (sent_ == frame_) {
+        Slot& current = Touch(frame_);
+        current.local = joypad;
+        transport_->Send({frame_, joypad});
+        sent_++;
+    }
+
+    if (!Poll(system)) {
+        return false;
+    }
+
+    // Emulating this frame would predict more than max_rollback frames. The
+    // remote peer may also be ahead, with inputs confirmed past frame_.
+    if (frame_ + 1 > remote_confirmed_ + static_cast<uint32_t>(max_rollback_)) {
+        return false;
+    }
+
+    running_ = true;
+    const bool emulated = EmulateFrame(system, frame_);
+    running_ = false;
+    if (!emulated) {
+        return false;
+    }
+
+    frame_++;
+    return true;
+}
+
+bool RollbackSession::Poll(const EmulatedSystem& system) {
+    const uint32_t mispredicted = ReceiveInputs();
+    if (mispredicted == frame_) {
+        return true;
+    }
+
+    rollbacks_++;
+
+    // The state load resets the pending battery save, which still applies
+    // to the corrected frames, as do their own battery writes.
+    const int save_update_counter = systemSaveUpdateCounter;
+
+    Slot& first = slot(mispredicted);
+    if (first.state_size == 0 ||
+        !system.emuReadMemState(reinterpret_cast<char*>(first.state.data()),
+                                static_cast<int>(first.state_size))) {
+        return false;
+    }
+    systemSaveUpdateCounter = save_update_counter;
+
+    // Only the frame emulated by RunFrame() is presented and heard, the
+    // corrected frames were already counted when first emulated.
+    const bool mute_sound = coreOptions.muteSound;
+    const bool speculating = coreOptions.speculating;
+    running_ = true;
+    resimulating_ = true;
+    draw_screen_ = false;
+    coreOptions.muteSound = true;
+    coreOptions.speculating = true;
+    bool emulated = true;
+    for (uint32_t frame = mispredicted; emulated && frame < frame_; frame++) {
+        emulated = EmulateFrame(system, frame);
+        resimulated_frames_++;
+    }
+    coreOptions.speculating = speculating;
+    coreOptions.muteSound = mute_sound;
+    draw_screen_ = true;
+    resimulating_ = false;
+    running_ = false;
+    return emulated;
+}
+
+RollbackSession::Slot& RollbackSession::Touch(uint32_t frame) {
+    Slot& touched = slot(frame);
+    if (touched.frame != frame) {
+        touched.frame = frame;
+        touched.local = 0;
+        touched.remote_used = 0;
+        touched.remote = 0;
+        touched.remote_received = false;
+        touched.state_size = 0;
+    }
+    return touched;
+}
+
+uint32_t RollbackSession::ReceiveInputs() {
+    uint32_t mispredicted = frame_;
+
+    RollbackInput input;
+    while (transport_->Receive(&input)) {
+        // Inputs outside of the window of the slots are invalid.
+        const uint32_t first = std::min(frame_, remote_confirmed_);
+        if (input.frame < remote_confirmed_ || input.frame - first >= slots_.size()) {
+            continue;
+        }
+
+        Slot& received = Touch(input.frame);
+        received.remote = input.joypad;
+        received.remote_received = true;
+        if (input.frame < frame_ && received.remote_used != input.joypad) {
+            mispredicted = std::min(mispredicted, input.frame);
+        }
+    }
+
+    while (slot(remote_confirmed_).frame == remote_confirmed_ &&
+           slot(remote_confirmed_).remote_received) {
+        last_remote_ = slot(remote_confirmed_).remote;
+        remote_confirmed_++;
+    }
+
+    return mispredicted;
+}
+
+bool RollbackSession::EmulateFrame(const EmulatedSystem& system, uint32_t frame) {
+    Slot& current = slot(frame);
+
+    // Frames with the confirmed input of both players are never rolled back
+    // to, their state is not needed.
+    current.state_size = 0;
+    if (frame >= remote_confirmed_) {
+        const size_t state_size =
+            system.emuMemStateSize ? system.emuMemStateSize() : kDefaultStateBufferSize;
+        if (current.state.size() < state_size) {
+            snapshotArena().Release(std::move(current.state));
+            current.state = snapshotArena().Acquire(state_size);
+        }
+
+        long size = 0;
+        if (!system.emuWriteMemState(reinterpret_cast<char*>(current.state.data()),
+                                     static_cast<int>(current.state.size()), size) ||
+            size <= 0) {
+            return false;
+        }
+        current.state_size = static_cast<size_t>(size);
+    }
+
+    current.remote_used = current.remote_received ? current.remote : last_remote_;
+    joypads_[local_player_] = current.local;
+    joypads_[local_player_ ^ 1] = current.remote_used;
+
+    // Only one frame is emulated per call, skipping frames would only risk
+    // skipping the last one.
+    const int frame_skip = systemFrameSkip;
+    systemFrameSkip = 0;
+    const uint64_t start = frame_count_;
+    for (int i = 0; i < kMaxSlicesPerFrame && frame_count_ == start; i++) {
+        system.emuMain(system.emuCount);
+    }
+    systemFrameSkip = frame_skip;
+    return true;
+}
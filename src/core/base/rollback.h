@@ -0,0 +1,193 @@
+#ifndef VBAM_CORE_BASE_ROLLBACK_H_
+#define VBAM_CORE_BASE_ROLLBACK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+
+struct EmulatedSystem;
+
+// Input of one frame, exchanged between the peers of a RollbackSession.
+struct RollbackInput {
+    uint32_t frame;
+    uint32_t joypad;
+};
+
+// Carries the inputs between two peers. Inputs are delivered reliably, but
+// possibly late and out of order.
+class RollbackTransport {
+public:
+    virtual ~RollbackTransport() = default;
+
+    virtual void Send(const RollbackInput& input) = 0;
+    // Returns false if no input is available.
+    virtual bool Receive(RollbackInput* input) = 0;
+};
+
+// In-process transport, created in connected pairs. Both ends may be used
+// from different threads.
+class LoopbackTransport final : public RollbackTransport {
+public:
+    static void CreatePair(std::unique_ptr<LoopbackTransport>* a,
+                           std::unique_ptr<LoopbackTransport>* b);
+    ~LoopbackTransport() override = default;
+
+    void Send(const RollbackInput& input) override;
+    bool Receive(RollbackInput* input) override;
+
+private:
+    struct Channel {
+        std::mutex mutex;
+        std::deque<RollbackInput> inputs;
+    };
+
+    LoopbackTransport(std::shared_ptr<Channel> in, std::shared_ptr<Channel> out);
+
+    std::shared_ptr<Channel> in_;
+    std::shared_ptr<Channel> out_;
+};
+
+// Wraps a transport to delay the received inputs by `latency_ms`, plus a
+// random jitter of up to `jitter_ms`, so that sessions can be tested on a
+// single machine. Jitter may reorder the inputs.
+class LatencySimulator final : public RollbackTransport {
+public:
+    // Returns the current time in milliseconds.
+    using Clock = std::function<uint64_t()>;
+
+    // `clock` may be empty to use the system clock.
+    LatencySimulator(std::unique_ptr<RollbackTransport> transport,
+                     uint32_t latency_ms,
+                     uint32_t jitter_ms,
+                     uint32_t seed,
+                     Clock clock);
+    ~LatencySimulator() override = default;
+
+    void Send(const RollbackInput& input) override;
+    bool Receive(RollbackInput* input) override;
+
+private:
+    struct Pending {
+        uint64_t deliver_at;
+        RollbackInput input;
+    };
+
+    const std::unique_ptr<RollbackTransport> transport_;
+    const uint32_t latency_ms_;
+    const uint32_t jitter_ms_;
+    std::mt19937 random_;
+    Clock clock_;
+    std::vector<Pending> pending_;
+};
+
+// Rollback session for two players exchanging only joypad input.
+//
+// Every frame, the local input is sent to the remote peer and the frame is
+// emulated right away, predicting that the remote input did not change since
+// the last one received. The state before every predicted frame is kept in
+// memory.
+// When a remote input arrives that differs from the prediction, the state
+// before that frame is restored and the frames since are emulated again
+// with the corrected input, without presenting them and without sound.
+//
+// The frontends are responsible for honoring the hooks below, like for
+// RunAhead:
+// - systemFrame() must call OnFrame().
+// - The automatic frame skip must not be adjusted while running().
+// - systemPauseOnFrame() must return true while running().
+// - systemDrawScreen() must not present the frame unless draw_screen().
+// - systemReadJoypad() must return joypad() for the players.
+class RollbackSession final {
+public:
+    // `local_player` is 0 or 1. At most `max_rollback` frames are emulated
+    // ahead of the last input received from the remote peer.
+    RollbackSession(int local_player, int max_rollback, RollbackTransport* transport);
+    ~RollbackSession();
+
+    // Disable copy constructor and assignment operator.
+    RollbackSession(const RollbackSession&) = delete;
+    RollbackSession& operator=(const RollbackSession&) = delete;
+
+    // Emulates the next frame of `system` with `joypad` as the local input.
+    // Returns false without emulating if the remote peer is too far behind,
+    // or if the state could not be saved.
+    bool RunFrame(const EmulatedSystem& system, uint32_t joypad);
+    // Receives the pending remote inputs and corrects the mispredicted
+    // frames, without emulating a new frame.
+    bool Poll(const EmulatedSystem& system);
+
+    // Must be called from systemFrame().
+    void OnFrame() { frame_count_++; }
+
+    // Input of `player` for the frame being emulated.
+    uint32_t joypad(int player) const { return joypads_[player & 1]; }
+
+    // Whether a frame is being emulated.
+    bool running() const { return running_; }
+    // Whether the frame being emulated is emulated again after a rollback.
+    bool resimulating() const { return resimulating_; }
+    // Whether systemDrawScreen() should present the frame being emulated.
+    bool draw_screen() const { return draw_screen_; }
+
+    // Number of frames emulated, not counting the re-simulated ones.
+    uint32_t frame() const { return frame_; }
+    // Frames before this one have the confirmed input of both players.
+    uint32_t confirmed_frame() const { return remote_confirmed_; }
+    // Number of rollbacks, and of frames emulated again.
+    uint64_t rollbacks() const { return rollbacks_; }
+    uint64_t resimulated_frames() const { return resimulated_frames_; }
+
+private:
+    struct Slot {
+        uint32_t frame = UINT32_MAX;
+        uint32_t local = 0;
+        // Remote input used to emulate the frame, and the received one.
+        uint32_t remote_used = 0;
+        uint32_t remote = 0;
+        bool remote_received = false;
+        // State before the frame.
+        size_t state_size = 0;
+        std::vector<uint8_t> state;
+    };
+
+    Slot& slot(uint32_t frame) { return slots_[frame % slots_.size()]; }
+    // Returns the slot of `frame`, reset if it held an older frame.
+    Slot& Touch(uint32_t frame);
+
+    // Receives the remote inputs. Returns the first mispredicted frame,
+    // frame_ if there is none.
+    uint32_t ReceiveInputs();
+    // Saves the state before `frame` if it may be rolled back to, and
+    // emulates it.
+    bool EmulateFrame(const EmulatedSystem& system, uint32_t frame);
+
+    const int local_player_;
+    const int max_rollback_;
+    RollbackTransport* const transport_;
+
+    // Inputs and states of the last frames, enough to roll back
+    // `max_rollback` frames and to hold the inputs received early.
+    std::vector<Slot> slots_;
+    uint32_t frame_ = 0;
+    // Next frame to send the local input of.
+    uint32_t sent_ = 0;
+    uint32_t remote_confirmed_ = 0;
+    // Input of the last confirmed remote frame, used as the prediction.
+    uint32_t last_remote_ = 0;
+
+    uint64_t frame_count_ = 0;
+    uint32_t joypads_[2] = {};
+    bool running_ = false;
+    bool resimulating_ = false;
+    bool draw_screen_ = true;
+
+    uint64_t rollbacks_ = 0;
+    uint64_t resimulated_frames_ = 0;
+};
+
+#endif  // VBAM_CORE_BASE_ROLLBACK_H_
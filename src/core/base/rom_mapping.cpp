@@ -0,0 +1,305 @@
+#include "core/base/rom_mapping.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // !defined(_WIN32)
+
+#include <zlib.h>
+
+#include "core/base/huge_pages.h"
+
+namespace {
+
+#if defined(_WIN32)
+constexpr size_t kPageSize = 4096;
+#else
+const size_t kPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif  // defined(_WIN32)
+
+// Writes the pattern to [start, end) of `data`.
+void WritePattern(uint8_t* data, size_t start, size_t end, const uint8_t* pattern,
+                  size_t pattern_size) {
+    size_t i = start;
+    while (i < end) {
+        const size_t at = i % pattern_size;
+        const size_t length = std::min(pattern_size - at, end - i);
+        memcpy(data + i, pattern + at, length);
+        i += length;
+    }
+}
+
+#if !defined(_WIN32)
+// Number of copies kept in the ROM cache.
+constexpr size_t kMaxCachedRoms = 16;
+
+// Returns the ROM cache directory, or an empty string if there is none.
+std::string RomCacheDir() {
+    const char* dir = getenv("VBAM_ROM_CACHE");
+    if (dir != nullptr) {
+        return dir;
+    }
+
+    dir = getenv("XDG_CACHE_HOME");
+    if (dir != nullptr && dir[0] == '/') {
+        return std::string(dir) + "/visualboyadvance-m/roms";
+    }
+    dir = getenv("HOME");
+    if (dir != nullptr && dir[0] == '/') {
+        return std::string(dir) + "/.cache/visualboyadvance-m/roms";
+    }
+    return std::string();
+}
+
+// Creates `dir` and its missing parents.
+bool MakeDirs(const std::string& dir) {
+    for (size_t slash = dir.find('/', 1); slash != std::string::npos;
+         slash = dir.find('/', slash + 1)) {
+        mkdir(dir.substr(0, slash).c_str(), 0700);
+    }
+    return mkdir(dir.c_str(), 0700) == 0 || errno == EEXIST;
+}
+
+// Writes `size` bytes of `data` to a new read-only file at `path`. The file is
+// written under a temporary name and then renamed, so that it is never seen
+// partially written.
+bool WriteCacheFile(const std::string& path, const uint8_t* data, size_t size) {
+    const std::string temp = path + "." + std::to_string(getpid()) + ".tmp";
+    const int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool result = true;
+    for (size_t written = 0; result && written < size;) {
+        const ssize_t count = write(fd, data + written, size - written);
+        result = count > 0;
+        written += result ? static_cast<size_t>(count) : 0;
+    }
+    result &= close(fd) == 0;
+
+    if (!result || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Removes the least recently used copies past kMaxCachedRoms. The processes
+// still mapping them keep their pages.
+void PruneCache(const std::string& dir) {
+    DIR* entries = opendir(dir.c_str());
+    if (entries == nullptr) {
+        return;
+    }
+
+    std::vector<std::pair<time_t, std::string>> roms;
+    while (const dirent* entry = readdir(entries)) {
+        const std::string name = entry->d_name;
+        struct stat st;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".rom") == 0 &&
+            stat((dir + "/" + name).c_str(), &st) == 0) {
+            roms.emplace_back(st.st_mtime, name);
+        }
+    }
+    closedir(entries);
+
+    if (roms.size() <= kMaxCachedRoms) {
+        return;
+    }
+    std::sort(roms.begin(), roms.end());
+    for (size_t i = 0; i < roms.size() - kMaxCachedRoms; i++) {
+        unlink((dir + "/" + roms[i].second).c_str());
+    }
+}
+#endif  // !defined(_WIN32)
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+// Maps the pattern over [start, end) of `data`, page-aligned offsets, from an
+// anonymous file holding a single copy of it.
+bool MapPattern(uint8_t* data, size_t start, size_t end, const uint8_t* pattern,
+                size_t pattern_size) {
+    const int fd = memfd_create("vbam-rom-pattern", MFD_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool result = true;
+    for (size_t written = 0; result && written < pattern_size;) {
+        const ssize_t count = write(fd, pattern + written, pattern_size - written);
+        result = count > 0;
+        written += result ? static_cast<size_t>(count) : 0;
+    }
+
+    size_t i = start;
+    while (result && i < end) {
+        const size_t at = i % pattern_size;
+        const size_t length = std::min(pattern_size - at, end - i);
+        result = mmap(data + i, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+                      static_cast<off_t>(at)) != MAP_FAILED;
+        i += length;
+    }
+
+    // The mappings keep the file alive.
+    close(fd);
+    return result;
+}
+#endif  // defined(__linux__) && defined(MFD_CLOEXEC)
+
+}  // namespace
+
+RomMapping::~RomMapping() {
+    Release();
+}
+
+bool RomMapping::Reserve(size_t size) {
+    Release();
+
+    // The parts of a ROM loaded from an archive can use huge pages, those
+    // mapped from a file or the pattern keep the regular pages.
+    size = (size + kPageSize - 1) / kPageSize * kPageSize;
+    data_ = hugePagesMap(size);
+    if (data_ == nullptr) {
+        return false;
+    }
+    size_ = size;
+    return true;
+}
+
+void RomMapping::Release() {
+    hugePagesUnmap(data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+}
+
+size_t RomMapping::MapFile(const char* path) {
+#if defined(_WIN32)
+    // A view cannot replace part of an allocation.
+    (void)path;
+    return 0;
+#else
+    if (data_ == nullptr) {
+        return 0;
+    }
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    // Rewriting or truncating the file would change the mapped pages, or
+    // fault on access to them, so only the files nobody may write to are
+    // mapped.
+    size_t result = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        (st.st_mode & (S_IWUSR | S_IWGRP | S_IWOTH)) == 0 && st.st_size > 0 &&
+        static_cast<uint64_t>(st.st_size) <= size_) {
+        const size_t size = static_cast<size_t>(st.st_size);
+        if (mmap(data_, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) !=
+            MAP_FAILED) {
+            result = size;
+        } else {
+            // Restore the zeroes, in case the failed call dropped them.
+            mmap(data_, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                 -1, 0);
+        }
+    }
+    close(fd);
+    return result;
+#endif  // defined(_WIN32)
+}
+
+bool RomMapping::MapCached(size_t size) {
+#if defined(_WIN32)
+    (void)size;
+    return false;
+#else
+    if (data_ == nullptr || size == 0 || size > size_) {
+        return false;
+    }
+
+    const std::string dir = RomCacheDir();
+    if (dir.empty()) {
+        return false;
+    }
+
+    // A copy is found by the checksum and size of its contents, and compared
+    // in full before being mapped.
+    char name[32];
+    snprintf(name, sizeof(name), "%08lx-%zx.rom",
+             static_cast<unsigned long>(crc32(crc32(0, Z_NULL, 0), data_, static_cast<uInt>(size))),
+             size);
+    const std::string path = dir + "/" + name;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 && errno == ENOENT && MakeDirs(dir) && WriteCacheFile(path, data_, size)) {
+        PruneCache(dir);
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        return false;
+    }
+
+    // Same requirements as MapFile(), the copy must also belong to the user
+    // so that nobody else can make it writable.
+    bool result = false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == geteuid() &&
+        (st.st_mode & (S_IWUSR | S_IWGRP | S_IWOTH)) == 0 &&
+        static_cast<uint64_t>(st.st_size) == size) {
+        void* copy = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (copy != MAP_FAILED) {
+            if (memcmp(copy, data_, size) == 0) {
+                result = mmap(data_, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+                              0) != MAP_FAILED;
+                if (!result) {
+                    // The failed call may have dropped the loaded pages, load
+                    // them again.
+                    mmap(data_, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+                    memcpy(data_, copy, size);
+                }
+            }
+            munmap(copy, size);
+        }
+        if (result) {
+            // Marks the copy as used, for PruneCache().
+            futimens(fd, nullptr);
+        }
+    }
+    close(fd);
+    return result;
+#endif  // defined(_WIN32)
+}
+
+void RomMapping::FillPattern(size_t offset, const uint8_t* pattern, size_t pattern_size) {
+    if (offset >= size_ || pattern_size == 0) {
+        return;
+    }
+
+    // Pages from `shared` on map the pattern, the bytes before are written.
+    size_t shared = size_;
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    if (pattern_size % kPageSize == 0) {
+        const size_t start = (offset + kPageSize - 1) / kPageSize * kPageSize;
+        if (start < size_ && MapPattern(data_, start, size_, pattern, pattern_size)) {
+            shared = start;
+        }
+    }
+#endif  // defined(__linux__) && defined(MFD_CLOEXEC)
+
+    WritePattern(data_, offset, shared, pattern, pattern_size);
+}
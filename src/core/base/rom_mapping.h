@@ -0,0 +1,68 @@
+#ifndef VBAM_CORE_BASE_ROM_MAPPING_H_
+#define VBAM_CORE_BASE_ROM_MAPPING_H_
+
+#if defined(__LIBRETRO__)
+#error "This file is only for non-libretro builds"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+
+// Writable memory of a fixed size backing a cartridge ROM, where pages are
+// only committed when written to.
+//
+// A read-only ROM file can be mapped copy-on-write at the start of the region,
+// so that the processes running the same ROM share its pages through the page
+// cache. The other ROMs, once loaded, are mapped the same way from a read-only
+// copy in the ROM cache, see MapCached().
+// The rest of the region can be filled with a repeating pattern, stored only
+// once and mapped as many times as needed. Where this is not supported, e.g.
+// on Windows, the file is not mapped and the pattern is written.
+class RomMapping final {
+public:
+    RomMapping() = default;
+    ~RomMapping();
+
+    // Disable copy constructor and assignment operator.
+    RomMapping(const RomMapping&) = delete;
+    RomMapping& operator=(const RomMapping&) = delete;
+
+    // Reserves `size` bytes of zeroes, rounded up to the page size, replacing
+    // the previous region. Returns false if out of memory.
+    bool Reserve(size_t size);
+    void Release();
+
+    // Maps the file at `path`, a UTF-8 path, at the start of a freshly
+    // reserved region. Returns the size of the file, or 0 if it cannot be
+    // mapped, in which case the region is left as zeroes. The bytes past the
+    // end of the file, up to the end of its last page, are zeroes. Files with
+    // any write permission are not mapped, as they can be rebuilt in place
+    // while mapped, and must be loaded instead, then shared with MapCached().
+    size_t MapFile(const char* path);
+
+    // Replaces the first `size` bytes of the region, already loaded, with a
+    // copy-on-write mapping of a copy of them in the ROM cache, written there
+    // on the first use. Returns false if the region is left as loaded.
+    //
+    // The cache is the directory set by the VBAM_ROM_CACHE environment
+    // variable, or visualboyadvance-m/roms in $XDG_CACHE_HOME or
+    // $HOME/.cache. Setting VBAM_ROM_CACHE to an empty string disables it. Its
+    // copies are owned by the user running vbam and have no write
+    // permission, and only the most recently used ones are kept.
+    bool MapCached(size_t size);
+
+    // Fills the region from `offset` to its end with the `pattern_size` bytes
+    // of `pattern`, so that the byte at offset `i` is
+    // pattern[i % pattern_size]. The pattern is only shared if `pattern_size`
+    // is a multiple of the page size.
+    void FillPattern(size_t offset, const uint8_t* pattern, size_t pattern_size);
+
+    uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif  // VBAM_CORE_BASE_ROM_MAPPING_H_
@@ -0,0 +1,96 @@
+#include "core/base/run_ahead.h"
+
+#include "core/base/sizes.h"
+#include "core/base/snapshot_arena.h"
+#include "core/base/system.h"
+
+namespace {
+
+// Size of the buffer used to save states with emuWriteMemState(), for systems
+// that do not report it. This is larger than the biggest GB and GBA flat
+// states.
+constexpr size_t kDefaultStateBufferSize = k1MiB;
+
+// Maximum number of emuMain() calls for a single frame. A frame normally ends
+// within one call, this only guards against games that never end a frame.
+constexpr int kMaxSlicesPerFrame = 8;
+
+}  // namespace
+
+RunAhead::RunAhead(int frames) : frames_(frames) {}
+
+RunAhead::~RunAhead() {
+    snapshotArena().Release(std::move(state_));
+}
+
+bool RunAhead::RunFrame(const EmulatedSystem& system) {
+    if (frames_ <= 0 || failed_ || system.emuWriteMemState == nullptr ||
+        system.emuReadMemState == nullptr) {
+        EmulateFrame(system);
+        return false;
+    }
+
+    const size_t state_size =
+        system.emuMemStateSize ? system.emuMemStateSize() : kDefaultStateBufferSize;
+    if (state_.size() < state_size) {
+        snapshotArena().Release(std::move(state_));
+        state_ = snapshotArena().Acquire(state_size);
+    }
+
+    // Only one frame is presented per RunFrame() call, skipping frames would
+    // only risk skipping the presented one.
+    const int frame_skip = systemFrameSkip;
+    systemFrameSkip = 0;
+    running_ = true;
+
+    // The sound of the real frame is played, its picture is replaced by the
+    // one of the last speculative frame.
+    draw_screen_ = false;
+    EmulateFrame(system);
+
+    long size = 0;
+    const bool saved = system.emuWriteMemState(reinterpret_cast<char*>(state_.data()),
+                                               static_cast<int>(state_.size()), size) &&
+                       size > 0;
+
+    bool restored = false;
+    if (saved) {
+        // Neither the battery writes of the speculative frames nor the
+        // state load must touch the pending battery save of the real frame.
+        const int save_update_counter = systemSaveUpdateCounter;
+        const bool mute_sound = coreOptions.muteSound;
+
+        const bool speculating = coreOptions.speculating;
+
+        speculating_ = true;
+        coreOptions.muteSound = true;
+        coreOptions.speculating = true;
+        for (int i = 1; i <= frames_; i++) {
+            draw_screen_ = i == frames_;
+            EmulateFrame(system);
+        }
+        coreOptions.speculating = speculating;
+        coreOptions.muteSound = mute_sound;
+        speculating_ = false;
+
+        // Loading a state may redraw the screen, which must not replace the
+        // presented frame.
+        draw_screen_ = false;
+        restored = system.emuReadMemState(reinterpret_cast<char*>(state_.data()),
+                                          static_cast<int>(size));
+        systemSaveUpdateCounter = save_update_counter;
+        failed_ = !restored;
+    }
+
+    draw_screen_ = true;
+    running_ = false;
+    systemFrameSkip = frame_skip;
+    return restored;
+}
+
+void RunAhead::EmulateFrame(const EmulatedSystem& system) {
+    const uint64_t start = frame_count_;
+    for (int i = 0; i < kMaxSlicesPerFrame && frame_count_ == start; i++) {
+        system.emuMain(system.emuCount);
+    }
+}
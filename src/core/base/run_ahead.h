@@ -0,0 +1,79 @@
+#ifndef VBAM_CORE_BASE_RUN_AHEAD_H_
+#define VBAM_CORE_BASE_RUN_AHEAD_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct EmulatedSystem;
+
+// Run-ahead, used by the frontends to hide the input latency of the games.
+//
+// Every frame, the real frame is emulated and saved to a flat in-memory
+// state, then `frames` more frames are emulated with the same input and the
+// last one is presented before the saved state is restored. The game then
+// appears to react to the input `frames` frames earlier than it does.
+//
+// The frontends are responsible for honoring the hooks below:
+// - systemFrame() must call OnFrame().
+// - The automatic frame skip must not be adjusted while running(),
+//   RunFrame() emulates several frames without skipping any.
+// - systemReadJoypad() must return the input of the real frame while
+//   speculating(), so that autofire does not advance on speculative frames.
+// - systemPauseOnFrame() must return true while running(), so emuMain()
+//   returns at frame boundaries.
+// - systemDrawScreen() must not present the frame unless draw_screen().
+// The sound of the speculative frames is dropped by the core, and they are
+// not counted for system10Frames() and systemShowSpeed(), see
+// CoreOptions::muteSound and CoreOptions::speculating.
+//
+// The core is not reentrant, so the speculative frames are emulated on the
+// single emulator instance, between a save and a restore.
+class RunAhead final {
+public:
+    explicit RunAhead(int frames);
+    ~RunAhead();
+
+    // Disable copy constructor and assignment operator.
+    RunAhead(const RunAhead&) = delete;
+    RunAhead& operator=(const RunAhead&) = delete;
+
+    // Emulates one frame of `system` followed by the speculative frames.
+    // Returns false if the state could not be saved, in which case only the
+    // real frame was emulated, without presenting it, or if it could not be
+    // restored, in which case run-ahead is disabled, see failed().
+    bool RunFrame(const EmulatedSystem& system);
+
+    // Must be called from systemFrame().
+    void OnFrame() { frame_count_++; }
+
+    // Whether RunFrame() is emulating a frame.
+    bool running() const { return running_; }
+    // Whether the frame being emulated is rolled back after it is presented.
+    bool speculating() const { return speculating_; }
+    // Whether systemDrawScreen() should present the frame being emulated.
+    bool draw_screen() const { return draw_screen_; }
+
+    int frames() const { return frames_; }
+    void set_frames(int frames) { frames_ = frames; }
+
+    // Whether a state failed to restore. The emulator is then left in the
+    // speculative state, and RunFrame() only emulates the real frames.
+    bool failed() const { return failed_; }
+
+private:
+    // Emulates until the end of the current frame.
+    void EmulateFrame(const EmulatedSystem& system);
+
+    int frames_;
+    uint64_t frame_count_ = 0;
+    bool running_ = false;
+    bool speculating_ = false;
+    bool draw_screen_ = true;
+    bool failed_ = false;
+
+    // Flat state of the last real frame, a slab of snapshotArena().
+    std::vector<uint8_t> state_;
+};
+
+#endif  // VBAM_CORE_BASE_RUN_AHEAD_H_
@@ -22,6 +22,7 @@ constexpr size_t k4MiB = 2 * k2MiB;
 constexpr size_t k8MiB = 2 * k4MiB;
 constexpr size_t k16MiB = 2 * k8MiB;
 constexpr size_t k32MiB = 2 * k16MiB;
+constexpr size_t k64MiB = 2 * k32MiB;
 
 // Game Boy BIOS Sizes.
 constexpr size_t kGBBiosSize = k256B;
@@ -0,0 +1,98 @@
+#include "core/base/snapshot_arena.h"
+
+#include <algorithm>
+
+#include "core/base/sizes.h"
+
+namespace {
+
+// Slab sizes are rounded up to this size.
+constexpr size_t kSlabGranularity = k4KiB;
+
+// Maximum number of idle slabs kept in the pool. Snapshots are short-lived,
+// only a few are in flight at any time.
+constexpr size_t kMaxIdleSlabs = 4;
+
+}  // namespace
+
+std::vector<uint8_t> SnapshotArena::Acquire(size_t size) {
+    std::vector<uint8_t> slab;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (size > slab_size_) {
+            slab_size_ = (size + kSlabGranularity - 1) / kSlabGranularity * kSlabGranularity;
+            idle_.clear();
+        }
+
+        if (idle_.empty()) {
+            slab.reserve(slab_size_);
+            allocations_++;
+        } else {
+            slab = std::move(idle_.back());
+            idle_.pop_back();
+            reuses_++;
+        }
+
+        in_use_.push_back(slab.data());
+        used_bytes_ += slab.capacity();
+        peak_bytes_ = std::max(peak_bytes_, used_bytes_);
+    }
+
+    // Done outside of the lock, this touches the whole slab.
+    slab.resize(size);
+    return slab;
+}
+
+void SnapshotArena::Release(std::vector<uint8_t> slab) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = std::find(in_use_.begin(), in_use_.end(), slab.data());
+    if (slab.capacity() == 0 || it == in_use_.end()) {
+        return;
+    }
+    in_use_.erase(it);
+    used_bytes_ -= slab.capacity();
+
+    released_state_bytes_ += slab.size();
+    released_slab_bytes_ += slab.capacity();
+
+    // Slabs from before the last growth are too small to be reused.
+    if (slab.capacity() >= slab_size_ && idle_.size() < kMaxIdleSlabs) {
+        slab.clear();
+        idle_.push_back(std::move(slab));
+    }
+}
+
+void SnapshotArena::Trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.clear();
+    idle_.shrink_to_fit();
+}
+
+SnapshotArenaStats SnapshotArena::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    SnapshotArenaStats stats;
+    stats.slab_size = slab_size_;
+    stats.slab_count = in_use_.size() + idle_.size();
+    stats.slabs_in_use = in_use_.size();
+    stats.used_bytes = used_bytes_;
+    stats.peak_bytes = peak_bytes_;
+    stats.reserved_bytes = used_bytes_;
+    for (const std::vector<uint8_t>& slab : idle_) {
+        stats.reserved_bytes += slab.capacity();
+    }
+    stats.allocations = allocations_;
+    stats.reuses = reuses_;
+    if (released_slab_bytes_ != 0) {
+        stats.fragmentation =
+            1.0 - static_cast<double>(released_state_bytes_) / released_slab_bytes_;
+    }
+    return stats;
+}
+
+SnapshotArena& snapshotArena() {
+    static SnapshotArena arena;
+    return arena;
+}
@@ -0,0 +1,81 @@
+#ifndef VBAM_CORE_BASE_SNAPSHOT_ARENA_H_
+#define VBAM_CORE_BASE_SNAPSHOT_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Usage statistics of a SnapshotArena, for memory reporting.
+struct SnapshotArenaStats {
+    // Size of every slab.
+    size_t slab_size = 0;
+    // Slabs allocated, in use or idle.
+    size_t slab_count = 0;
+    size_t slabs_in_use = 0;
+    // Bytes of the slabs in use, and the highest value it reached.
+    size_t used_bytes = 0;
+    size_t peak_bytes = 0;
+    // Bytes of all the slabs, in use or idle.
+    size_t reserved_bytes = 0;
+    // Slabs obtained from the general allocator, and from the pool.
+    uint64_t allocations = 0;
+    uint64_t reuses = 0;
+    // Share of the bytes of the released slabs that did not hold state data,
+    // between 0 and 1.
+    double fragmentation = 0.0;
+};
+
+// Pool of fixed-size buffers ("slabs") for savestate snapshots, so that taking
+// and writing snapshots does not go through the general allocator once the
+// pool is warm.
+//
+// Slabs are sized to the largest state requested so far, rounded up to a page,
+// so every slab can hold any state of the running system. Requesting a larger
+// state grows the slab size and drops the smaller idle slabs.
+//
+// Slabs are handed out as std::vector<uint8_t>, so that they can be moved
+// around, e.g. to the write-behind service. A slab must not grow past its
+// capacity, it would no longer be recognized when released.
+//
+// This class is thread-safe.
+class SnapshotArena final {
+public:
+    SnapshotArena() = default;
+    ~SnapshotArena() = default;
+
+    // Disable copy constructor and assignment operator.
+    SnapshotArena(const SnapshotArena&) = delete;
+    SnapshotArena& operator=(const SnapshotArena&) = delete;
+
+    // Returns a slab resized to `size` bytes, with a capacity of slab_size().
+    std::vector<uint8_t> Acquire(size_t size);
+    // Returns `slab` to the pool. Its size is taken as the size of the state
+    // it held. Buffers that were not acquired from this arena are freed.
+    void Release(std::vector<uint8_t> slab);
+    // Frees the idle slabs.
+    void Trim();
+
+    SnapshotArenaStats stats();
+
+private:
+    std::mutex mutex_;
+    size_t slab_size_ = 0;
+    // Slabs ready to be handed out.
+    std::vector<std::vector<uint8_t>> idle_;
+    // Data of the slabs handed out.
+    std::vector<const uint8_t*> in_use_;
+
+    size_t used_bytes_ = 0;
+    size_t peak_bytes_ = 0;
+    uint64_t allocations_ = 0;
+    uint64_t reuses_ = 0;
+    // Totals of the released slabs, for the fragmentation statistic.
+    uint64_t released_state_bytes_ = 0;
+    uint64_t released_slab_bytes_ = 0;
+};
+
+// Arena shared by the cores and the frontends.
+SnapshotArena& snapshotArena();
+
+#endif  // VBAM_CORE_BASE_SNAPSHOT_ARENA_H_
@@ -0,0 +1,528 @@
+// The packs can grow past 2 GiB, the offsets must fit in off_t.
+#if !defined(_FILE_OFFSET_BITS)
+#define _FILE_OFFSET_BITS 64
+#endif  // !defined(_FILE_OFFSET_BITS)
+
+#include "core/base/state_store.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif  // defined(_WIN32)
+
+#include <zlib.h>
+
+#include "core/base/file_util.h"
+#include "core/base/flat_state.h"
+
+StateStore* g_stateStore = nullptr;
+
+namespace {
+
+constexpr uint32_t kPackMagic = flatStateFourCC('V', 'B', 'P', 'K');
+constexpr uint32_t kIndexMagic = flatStateFourCC('V', 'B', 'P', 'I');
+constexpr uint32_t kRecordMagic = flatStateFourCC('V', 'B', 'B', 'K');
+constexpr uint32_t kReferenceMagic = flatStateFourCC('V', 'B', 'S', 'R');
+constexpr uint32_t kStateStoreVersion = 1;
+
+// Size of the blocks the savestate files are split in. The flat state
+// sections are large and aligned, so most blocks fall within one section.
+constexpr size_t kBlockSize = 4096;
+
+constexpr uint64_t kInvalidOffset = UINT64_MAX;
+
+struct PackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t reserved[2];
+};
+
+// Precedes the stored data of every block in the pack.
+struct BlockRecord {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t stored_size;
+    uint32_t codec;
+    uint64_t hash;
+    uint32_t crc;
+    uint32_t reserved;
+};
+
+struct IndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t reserved[2];
+};
+
+struct IndexEntry {
+    uint64_t offset;
+    uint64_t hash;
+    uint32_t size;
+    uint32_t stored_size;
+    uint32_t codec;
+    uint32_t crc;
+};
+
+// Contents of a savestate file stored in a pack, followed by the name of the
+// pack and the offsets of the blocks in the pack.
+struct Reference {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t file_size;
+    uint32_t block_size;
+    uint32_t block_count;
+    uint32_t pack_name_size;
+    uint32_t crc;
+    uint32_t reserved;
+};
+
+uint64_t BlockHash(const uint8_t* data, size_t size) {
+    // FNV-1a over 64 bits words, with the high bits folded back in.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint32_t BlockCrc(const uint8_t* data, size_t size) {
+    return crc32(crc32(0L, Z_NULL, 0), data, static_cast<uInt>(size));
+}
+
+bool IsSeparator(char c) {
+#if defined(_WIN32)
+    return c == '/' || c == '\\';
+#else
+    return c == '/';
+#endif  // defined(_WIN32)
+}
+
+// Returns the directory of `path`, with the trailing separator.
+std::string DirName(const std::string& path) {
+    for (size_t i = path.size(); i > 0; i--) {
+        if (IsSeparator(path[i - 1])) {
+            return path.substr(0, i);
+        }
+    }
+    return std::string();
+}
+
+bool HasSeparator(const std::string& path) {
+    for (char c : path) {
+        if (IsSeparator(c)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SeekFile(FILE* f, uint64_t offset) {
+#if defined(_WIN32)
+    return _fseeki64(f, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+    return fseeko(f, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif  // defined(_WIN32)
+}
+
+// Returns the size of `f`, or -1 on failure.
+int64_t FileSize(FILE* f) {
+#if defined(_WIN32)
+    if (_fseeki64(f, 0, SEEK_END) != 0) {
+        return -1;
+    }
+    return _ftelli64(f);
+#else
+    if (fseeko(f, 0, SEEK_END) != 0) {
+        return -1;
+    }
+    return ftello(f);
+#endif  // defined(_WIN32)
+}
+
+bool SyncFile(FILE* f) {
+    if (fflush(f) != 0) {
+        return false;
+    }
+#if defined(_WIN32)
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif  // defined(_WIN32)
+}
+
+}  // namespace
+
+StateStore::~StateStore() {
+    Close();
+}
+
+bool StateStore::Open(const char* path, bool create) {
+    Close();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    pack_ = utilOpenFile(path, "r+b");
+    if (pack_ == nullptr) {
+        // Read-only packs can still be loaded from.
+        pack_ = utilOpenFile(path, create ? "w+b" : "rb");
+    }
+    if (pack_ == nullptr) {
+        return false;
+    }
+
+    PackHeader header;
+    if (fread(&header, sizeof(header), 1, pack_) != 1) {
+        const PackHeader new_header = {kPackMagic, kStateStoreVersion, {0, 0}};
+        if (!create || fseek(pack_, 0, SEEK_SET) != 0 ||
+            fwrite(&new_header, sizeof(new_header), 1, pack_) != 1 || !SyncFile(pack_)) {
+            fclose(pack_);
+            pack_ = nullptr;
+            return false;
+        }
+    } else if (header.magic != kPackMagic || header.version != kStateStoreVersion) {
+        fclose(pack_);
+        pack_ = nullptr;
+        return false;
+    }
+
+    path_ = path;
+    end_ = sizeof(PackHeader);
+    LoadIndex();
+    return true;
+}
+
+void StateStore::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pack_ != nullptr) {
+        fclose(pack_);
+        pack_ = nullptr;
+    }
+    if (index_ != nullptr) {
+        fclose(index_);
+        index_ = nullptr;
+    }
+
+    path_.clear();
+    end_ = 0;
+    blocks_.clear();
+    by_hash_.clear();
+    by_offset_.clear();
+}
+
+bool StateStore::is_open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pack_ != nullptr;
+}
+
+std::string StateStore::path() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return path_;
+}
+
+size_t StateStore::block_count() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return blocks_.size();
+}
+
+void StateStore::LoadIndex() {
+    const int64_t pack_size = FileSize(pack_);
+    if (pack_size < 0) {
+        return;
+    }
+
+    const std::string index_path = path_ + ".idx";
+    index_ = utilOpenFile(index_path.c_str(), "r+b");
+
+    // The indexed blocks must follow each other from the start of the pack.
+    bool rewrite = true;
+    IndexHeader header;
+    if (index_ != nullptr && fread(&header, sizeof(header), 1, index_) == 1 &&
+        header.magic == kIndexMagic && header.version == kStateStoreVersion) {
+        IndexEntry entry;
+        while (fread(&entry, sizeof(entry), 1, index_) == 1) {
+            const uint64_t block_end = entry.offset + sizeof(BlockRecord) + entry.stored_size;
+            if (entry.offset != end_ || block_end > static_cast<uint64_t>(pack_size)) {
+                break;
+            }
+            Insert({entry.offset, entry.hash, entry.size, entry.stored_size, entry.codec,
+                    entry.crc});
+            end_ = block_end;
+        }
+        rewrite = !feof(index_);
+    }
+
+    // Blocks appended to the pack after the index was last written.
+    std::vector<uint8_t> contents;
+    BlockRecord record;
+    while (SeekFile(pack_, end_) &&
+           fread(&record, sizeof(record), 1, pack_) == 1 && record.magic == kRecordMagic) {
+        contents.clear();
+        const Block block = {end_,         record.hash,  record.size,
+                             record.stored_size, record.codec, record.crc};
+        if (!ReadBlock(block, &contents)) {
+            break;
+        }
+        Insert(block);
+        end_ += sizeof(record) + record.stored_size;
+        rewrite = true;
+    }
+
+    if (!rewrite) {
+        return;
+    }
+
+    if (index_ != nullptr) {
+        fclose(index_);
+    }
+    index_ = utilOpenFile(index_path.c_str(), "w+b");
+    if (index_ == nullptr) {
+        return;
+    }
+
+    const IndexHeader new_header = {kIndexMagic, kStateStoreVersion, {0, 0}};
+    bool written = fwrite(&new_header, sizeof(new_header), 1, index_) == 1;
+    for (const Block& block : blocks_) {
+        const IndexEntry entry = {block.offset,      block.hash,  block.size,
+                                  block.stored_size, block.codec, block.crc};
+        written = written && fwrite(&entry, sizeof(entry), 1, index_) == 1;
+    }
+    if (!written || fflush(index_) != 0) {
+        fclose(index_);
+        index_ = nullptr;
+    }
+}
+
+void StateStore::Insert(const Block& block) {
+    by_hash_.emplace(block.hash, blocks_.size());
+    by_offset_.emplace(block.offset, blocks_.size());
+    blocks_.push_back(block);
+}
+
+bool StateStore::ReadBlock(const Block& block, std::vector<uint8_t>* contents) {
+    const FlatStateCodec* codec = flatStateFindCodec(block.codec);
+    if (codec == nullptr) {
+        return false;
+    }
+
+    stored_.resize(block.stored_size);
+    if (!SeekFile(pack_, block.offset + sizeof(BlockRecord)) ||
+        fread(stored_.data(), 1, stored_.size(), pack_) != stored_.size()) {
+        return false;
+    }
+
+    const size_t start = contents->size();
+    contents->resize(start + block.size);
+    uint8_t* dst = contents->data() + start;
+    if (codec->decompress(stored_.data(), stored_.size(), dst, block.size) != block.size ||
+        BlockCrc(dst, block.size) != block.crc) {
+        contents->resize(start);
+        return false;
+    }
+    return true;
+}
+
+uint64_t StateStore::Add(const uint8_t* data, size_t size) {
+    const uint64_t hash = BlockHash(data, size);
+    const uint32_t crc = BlockCrc(data, size);
+
+    // The hash and the CRC only select the candidates, a block is shared
+    // only if its contents are the same.
+    const auto range = by_hash_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        const Block& block = blocks_[it->second];
+        if (block.size != size || block.crc != crc) {
+            continue;
+        }
+        block_.clear();
+        if (ReadBlock(block, &block_) && memcmp(block_.data(), data, size) == 0) {
+            return block.offset;
+        }
+    }
+
+    const FlatStateCodec* codec = flatStateCodecZlib();
+    stored_.resize(codec->bound(size));
+    size_t stored_size = codec->compress(data, size, stored_.data(), stored_.size());
+    const uint8_t* stored = stored_.data();
+    if (stored_size == 0 || stored_size >= size) {
+        codec = flatStateCodecNone();
+        stored = data;
+        stored_size = size;
+    }
+
+    BlockRecord record;
+    record.magic = kRecordMagic;
+    record.size = static_cast<uint32_t>(size);
+    record.stored_size = static_cast<uint32_t>(stored_size);
+    record.codec = codec->id;
+    record.hash = hash;
+    record.crc = crc;
+    record.reserved = 0;
+
+    if (!SeekFile(pack_, end_) ||
+        fwrite(&record, sizeof(record), 1, pack_) != 1 ||
+        fwrite(stored, 1, stored_size, pack_) != stored_size) {
+        return kInvalidOffset;
+    }
+
+    const Block block = {end_, hash, record.size, record.stored_size, record.codec, crc};
+    Insert(block);
+    end_ += sizeof(record) + stored_size;
+
+    if (index_ != nullptr) {
+        const IndexEntry entry = {block.offset,      block.hash,  block.size,
+                                  block.stored_size, block.codec, block.crc};
+        if (fseek(index_, 0, SEEK_END) != 0 || fwrite(&entry, sizeof(entry), 1, index_) != 1) {
+            // The index is rebuilt from the pack on the next open.
+            fclose(index_);
+            index_ = nullptr;
+        }
+    }
+    return block.offset;
+}
+
+bool StateStore::Store(const char* state_path, std::vector<uint8_t>* contents) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pack_ == nullptr || contents->size() > UINT32_MAX) {
+        return false;
+    }
+
+    // The pack is referenced by name when it is next to the savestate, so
+    // that both can be moved together.
+    std::string pack_name = path_;
+    if (DirName(state_path) == DirName(path_)) {
+        pack_name = path_.substr(DirName(path_).size());
+    }
+
+    const size_t block_count = (contents->size() + kBlockSize - 1) / kBlockSize;
+    std::vector<uint64_t> offsets(block_count);
+    for (size_t i = 0; i < block_count; i++) {
+        const size_t start = i * kBlockSize;
+        const size_t size = std::min(kBlockSize, contents->size() - start);
+        offsets[i] = Add(contents->data() + start, size);
+        if (offsets[i] == kInvalidOffset) {
+            return false;
+        }
+    }
+
+    // The blocks must be in the pack before the reference is written.
+    if (!SyncFile(pack_)) {
+        return false;
+    }
+    if (index_ != nullptr) {
+        fflush(index_);
+    }
+
+    Reference reference;
+    reference.magic = kReferenceMagic;
+    reference.version = kStateStoreVersion;
+    reference.file_size = static_cast<uint32_t>(contents->size());
+    reference.block_size = kBlockSize;
+    reference.block_count = static_cast<uint32_t>(block_count);
+    reference.pack_name_size = static_cast<uint32_t>(pack_name.size());
+    reference.crc = BlockCrc(contents->data(), contents->size());
+    reference.reserved = 0;
+
+    contents->resize(sizeof(reference) + pack_name.size() + offsets.size() * sizeof(uint64_t));
+    uint8_t* cursor = contents->data();
+    memcpy(cursor, &reference, sizeof(reference));
+    cursor += sizeof(reference);
+    memcpy(cursor, pack_name.data(), pack_name.size());
+    cursor += pack_name.size();
+    memcpy(cursor, offsets.data(), offsets.size() * sizeof(uint64_t));
+    return true;
+}
+
+bool StateStore::Load(const uint8_t* data, size_t size, std::vector<uint8_t>* contents) {
+    if (!stateStoreIsReference(data, size)) {
+        return false;
+    }
+
+    Reference reference;
+    memcpy(&reference, data, sizeof(reference));
+    const uint8_t* offsets = data + sizeof(reference) + reference.pack_name_size;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pack_ == nullptr) {
+        return false;
+    }
+
+    contents->clear();
+    contents->reserve(reference.file_size);
+    for (uint32_t i = 0; i < reference.block_count; i++) {
+        uint64_t offset;
+        memcpy(&offset, offsets + i * sizeof(offset), sizeof(offset));
+        const auto it = by_offset_.find(offset);
+        if (it == by_offset_.end() || !ReadBlock(blocks_[it->second], contents)) {
+            return false;
+        }
+    }
+
+    return contents->size() == reference.file_size &&
+           BlockCrc(contents->data(), contents->size()) == reference.crc;
+}
+
+bool stateStoreIsReference(const uint8_t* data, size_t size) {
+    if (size < sizeof(Reference)) {
+        return false;
+    }
+
+    Reference reference;
+    memcpy(&reference, data, sizeof(reference));
+    return reference.magic == kReferenceMagic && reference.version == kStateStoreVersion &&
+           reference.block_size != 0 &&
+           reference.block_count ==
+               (static_cast<uint64_t>(reference.file_size) + reference.block_size - 1) /
+                   reference.block_size &&
+           size == sizeof(reference) + reference.pack_name_size +
+                       static_cast<uint64_t>(reference.block_count) * sizeof(uint64_t);
+}
+
+bool stateStoreEncodeFile(StateStore* store,
+                          const std::string& path,
+                          const uint8_t* state,
+                          size_t state_size,
+                          std::vector<uint8_t>* contents) {
+    if (!flatStateEncodeFile(state, state_size, nullptr, contents)) {
+        return false;
+    }
+
+    // A savestate that could not be stored is still written as-is.
+    if (store != nullptr) {
+        store->Store(path.c_str(), contents);
+    }
+    return true;
+}
+
+bool stateStoreLoadFile(const char* path,
+                        const uint8_t* data,
+                        size_t size,
+                        std::vector<uint8_t>* contents) {
+    if (!stateStoreIsReference(data, size)) {
+        return false;
+    }
+
+    Reference reference;
+    memcpy(&reference, data, sizeof(reference));
+    std::string pack_path(reinterpret_cast<const char*>(data) + sizeof(reference),
+                          reference.pack_name_size);
+    if (!HasSeparator(pack_path)) {
+        pack_path = DirName(path) + pack_path;
+    }
+
+    if (g_stateStore != nullptr && g_stateStore->path() == pack_path) {
+        return g_stateStore->Load(data, size, contents);
+    }
+
+    StateStore store;
+    return store.Open(pack_path.c_str(), false) && store.Load(data, size, contents);
+}
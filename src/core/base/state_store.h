@@ -0,0 +1,118 @@
+#ifndef VBAM_CORE_BASE_STATE_STORE_H_
+#define VBAM_CORE_BASE_STATE_STORE_H_
+
+#if defined(__LIBRETRO__)
+#error "This file is only for non-libretro builds"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Content-addressed store for the savestate files of a game.
+//
+// Savestate files are split in fixed-size blocks, identified by their
+// contents: blocks with the same hash are compared byte for byte. Every distinct block is stored once, compressed, in a pack file
+// shared by all the savestates of the game, and the savestate file itself
+// only holds a reference to its blocks. As the sections of flat states are at
+// fixed offsets, the VRAM, work RAM and header blocks that did not change
+// between two savestates are shared.
+//
+// The pack is append-only: blocks that are no longer referenced are not
+// reclaimed. It comes with a small index of its blocks, a cache that is
+// rebuilt from the pack when it is missing or incomplete. Blocks are synced
+// to the pack before the reference is written, so a reference never points
+// to missing blocks.
+//
+// All the methods may be called from any thread.
+class StateStore final {
+public:
+    StateStore() = default;
+    ~StateStore();
+
+    // Disable copy constructor and assignment operator.
+    StateStore(const StateStore&) = delete;
+    StateStore& operator=(const StateStore&) = delete;
+
+    // Opens the pack at `path`, a UTF-8 path, creating it if `create` is set.
+    // Returns false if the pack could not be opened.
+    bool Open(const char* path, bool create);
+    void Close();
+
+    bool is_open();
+    std::string path();
+    // Number of blocks in the pack.
+    size_t block_count();
+
+    // Stores the blocks of the savestate file `contents`, to be written at
+    // `state_path`, and replaces `contents` with a reference to them.
+    // Returns false on failure, `contents` is then left untouched.
+    bool Store(const char* state_path, std::vector<uint8_t>* contents);
+    // Rebuilds the savestate file from the reference `data`. Returns false
+    // if the reference is invalid or if a block is missing.
+    bool Load(const uint8_t* data, size_t size, std::vector<uint8_t>* contents);
+
+private:
+    struct Block {
+        uint64_t offset;
+        uint64_t hash;
+        uint32_t size;
+        uint32_t stored_size;
+        uint32_t codec;
+        uint32_t crc;
+    };
+
+    // Loads the index, then the blocks of the pack that are not indexed.
+    void LoadIndex();
+    // Returns the offset of the stored `data` block, appending it to the
+    // pack if it is new. Returns UINT64_MAX on failure.
+    uint64_t Add(const uint8_t* data, size_t size);
+    void Insert(const Block& block);
+    bool ReadBlock(const Block& block, std::vector<uint8_t>* contents);
+
+    std::mutex mutex_;
+    std::string path_;
+    FILE* pack_ = nullptr;
+    FILE* index_ = nullptr;
+    // End of the last valid block of the pack.
+    uint64_t end_ = 0;
+
+    std::vector<Block> blocks_;
+    // Blocks by hash, and by offset.
+    std::unordered_multimap<uint64_t, size_t> by_hash_;
+    std::unordered_map<uint64_t, size_t> by_offset_;
+
+    // Scratch buffers for the stored blocks, and for the contents of the
+    // blocks compared to a new one.
+    std::vector<uint8_t> stored_;
+    std::vector<uint8_t> block_;
+};
+
+// Store of the savestates of the loaded game, set by the frontends. Savestate
+// files are written as-is if null. g_writeBehind must be flushed before
+// changing it, as the pending writes may use it.
+extern StateStore* g_stateStore;
+
+// Returns true if `data` is a reference to blocks of a StateStore.
+bool stateStoreIsReference(const uint8_t* data, size_t size);
+
+// Encodes the flat state `state` as the contents of a savestate file to be
+// written at `path`, stored in `store` if not null. Returns false on failure.
+bool stateStoreEncodeFile(StateStore* store,
+                          const std::string& path,
+                          const uint8_t* state,
+                          size_t state_size,
+                          std::vector<uint8_t>* contents);
+
+// Rebuilds the contents of the savestate file at `path`, the reference
+// `data`, from the pack it references. Returns false on failure.
+bool stateStoreLoadFile(const char* path,
+                        const uint8_t* data,
+                        size_t size,
+                        std::vector<uint8_t>* contents);
+
+#endif  // VBAM_CORE_BASE_STATE_STORE_H_
@@ -1,6 +1,7 @@
 #ifndef VBAM_CORE_BASE_SYSTEM_H_
 #define VBAM_CORE_BASE_SYSTEM_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 
@@ -38,6 +39,14 @@ struct EmulatedSystem {
     bool (*emuReadMemState)(char*, int);
     // write memory state (rewind)
     bool (*emuWriteMemState)(char*, int, long&);
+    // size of the buffer needed by emuWriteMemState
+    size_t (*emuMemStateSize)();
+    // write memory state (rewind), only updating what changed since the
+    // previous call. Unless `full` is set, `data` must hold the state written
+    // by that call. The blocks of the state that may have changed are flagged
+    // in `dirty`, see flatStateMarkDirty(). Returns the size of the state, 0
+    // on failure.
+    size_t (*emuWriteIncrementalState)(uint8_t* data, size_t size, bool full, uint64_t* dirty);
     // write PNG file
     bool (*emuWritePNG)(const char*);
     // write BMP file
@@ -58,6 +67,12 @@ extern struct CoreOptions {
     bool parseDebug = true;
     bool speedHack = false;
     bool speedup = false;
+    // Drops the sound samples instead of writing them to the sound driver,
+    // for the frames that are rolled back (run-ahead).
+    bool muteSound = false;
+    // Set for the same frames: they are not counted for system10Frames()
+    // and systemShowSpeed(), as they are emulated on top of the real ones.
+    bool speculating = false;
     bool speedup_throttle_frame_skip = false;
     int cheatsEnabled = 1;
     int cpuDisableSfx = 0;
@@ -0,0 +1,201 @@
+#include "core/base/write_behind.h"
+
+#include <cstdio>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <windows.h>
+
+#include "core/base/internal/file_util_internal.h"
+#else
+#include <unistd.h>
+#endif  // defined(_WIN32)
+
+#include "core/base/file_util.h"
+#include "core/base/snapshot_arena.h"
+
+WriteBehind* g_writeBehind = nullptr;
+
+WriteBehind::WriteBehind() : worker_(&WriteBehind::Run, this) {}
+
+WriteBehind::~WriteBehind() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    queued_cv_.notify_one();
+    worker_.join();
+}
+
+void WriteBehind::Submit(const std::string& path,
+                         std::vector<uint8_t> data,
+                         Encoder encode,
+                         Callback done) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // Replace the data of a queued write to the same file. The write in
+        // progress, if any, is left alone and this one is queued after it.
+        for (size_t i = running_job_ ? 1 : 0; i < queue_.size(); i++) {
+            Job& job = queue_[i];
+            if (job.path == path) {
+                snapshotArena().Release(std::move(job.data));
+                job.data = std::move(data);
+                job.encode = std::move(encode);
+                if (done) {
+                    job.callbacks.push_back(std::move(done));
+                }
+                return;
+            }
+        }
+
+        Job job;
+        job.path = path;
+        job.data = std::move(data);
+        job.encode = std::move(encode);
+        if (done) {
+            job.callbacks.push_back(std::move(done));
+        }
+        queue_.push_back(std::move(job));
+    }
+    queued_cv_.notify_one();
+}
+
+void WriteBehind::Notify(const std::string& path, Callback done) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = queue_.rbegin(); it != queue_.rend(); ++it) {
+            if (it->path == path) {
+                it->callbacks.push_back(std::move(done));
+                return;
+            }
+        }
+        for (auto it = completed_.rbegin(); it != completed_.rend(); ++it) {
+            if (it->path == path) {
+                it->callbacks.push_back(std::move(done));
+                return;
+            }
+        }
+    }
+    done(true);
+}
+
+void WriteBehind::Poll() {
+    std::deque<Job> completed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        completed.swap(completed_);
+    }
+
+    for (Job& job : completed) {
+        for (Callback& callback : job.callbacks) {
+            callback(job.written);
+        }
+    }
+}
+
+bool WriteBehind::Pending() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !queue_.empty() || !completed_.empty();
+}
+
+void WriteBehind::Flush() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        completed_cv_.wait(lock, [this] { return queue_.empty(); });
+    }
+    Poll();
+}
+
+void WriteBehind::Run() {
+    // Encoded file contents, kept across jobs to reuse the allocation.
+    std::vector<uint8_t> contents;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        queued_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return;
+        }
+
+        running_job_ = true;
+        const std::string path = queue_.front().path;
+        std::vector<uint8_t> data = std::move(queue_.front().data);
+        const Encoder encode = std::move(queue_.front().encode);
+        lock.unlock();
+
+        bool written;
+        if (encode) {
+            contents.clear();
+            written = encode(data, &contents) && WriteFile(path, contents);
+        } else {
+            written = WriteFile(path, data);
+        }
+        snapshotArena().Release(std::move(data));
+
+        lock.lock();
+        queue_.front().written = written;
+        completed_.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+        running_job_ = false;
+        completed_cv_.notify_all();
+    }
+}
+
+// static
+bool WriteBehind::WriteFile(const std::string& path, const std::vector<uint8_t>& contents) {
+    const std::string temp_path = path + ".tmp";
+
+    FILE* f = utilOpenFile(temp_path.c_str(), "wb");
+    if (f == nullptr) {
+        return false;
+    }
+
+    bool written = fwrite(contents.data(), 1, contents.size(), f) == contents.size() &&
+                   fflush(f) == 0;
+#if defined(_WIN32)
+    written = written && _commit(_fileno(f)) == 0;
+#else
+    written = written && fsync(fileno(f)) == 0;
+#endif  // defined(_WIN32)
+    written = fclose(f) == 0 && written;
+
+    if (written) {
+#if defined(_WIN32)
+        written = MoveFileExW(core::internal::ToUTF16(temp_path.c_str()).c_str(),
+                              core::internal::ToUTF16(path.c_str()).c_str(),
+                              MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        written = rename(temp_path.c_str(), path.c_str()) == 0;
+#endif  // defined(_WIN32)
+    }
+
+    if (!written) {
+        remove(temp_path.c_str());
+    }
+    return written;
+}
+
+bool writeBehindSubmit(const char* path,
+                       std::vector<uint8_t> data,
+                       WriteBehind::Encoder encode,
+                       WriteBehind::Callback done) {
+    if (g_writeBehind != nullptr) {
+        g_writeBehind->Submit(path, std::move(data), std::move(encode), std::move(done));
+        return true;
+    }
+
+    bool written;
+    if (encode) {
+        std::vector<uint8_t> contents;
+        written = encode(data, &contents) && WriteBehind::WriteFile(path, contents);
+    } else {
+        written = WriteBehind::WriteFile(path, data);
+    }
+    snapshotArena().Release(std::move(data));
+
+    if (done) {
+        done(written);
+    }
+    return written;
+}
@@ -0,0 +1,103 @@
+#ifndef VBAM_CORE_BASE_WRITE_BEHIND_H_
+#define VBAM_CORE_BASE_WRITE_BEHIND_H_
+
+#if defined(__LIBRETRO__)
+#error "This file is only for non-libretro builds"
+#endif
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Write-behind service for savestate and battery files, so that encoding and
+// writing them does not stall the emulation thread.
+//
+// The emulation thread submits a plain copy of the data to write, a worker
+// thread encodes it and writes it to a temporary file, which is synced and
+// renamed over the destination. The data is then returned to snapshotArena()
+// if it is one of its slabs. Writes are processed in submission order and
+// a write that has not started yet is replaced by a later write to the same
+// file, so a later save never loses to an earlier one.
+//
+// Completion callbacks run on the thread calling Poll() or Flush(), normally
+// the emulation thread, where it is safe to display messages.
+class WriteBehind final {
+public:
+    // Produces the file contents from the submitted data, on the worker
+    // thread. Returns false on failure.
+    using Encoder = std::function<bool(const std::vector<uint8_t>& data,
+                                       std::vector<uint8_t>* contents)>;
+    // Called with whether the file was written.
+    using Callback = std::function<void(bool written)>;
+
+    WriteBehind();
+    // Completes the queued writes. Their callbacks are not called.
+    ~WriteBehind();
+
+    // Disable copy constructor and assignment operator.
+    WriteBehind(const WriteBehind&) = delete;
+    WriteBehind& operator=(const WriteBehind&) = delete;
+
+    // Queues a write of `data` to `path`. `encode` may be empty to write
+    // `data` as-is, `done` may be empty.
+    void Submit(const std::string& path, std::vector<uint8_t> data, Encoder encode, Callback done);
+
+    // Calls `done` once the last write to `path` submitted so far completed,
+    // with the result of that write. If that write already called its
+    // callbacks, `done` is called immediately with true.
+    void Notify(const std::string& path, Callback done);
+
+    // Calls the callbacks of the completed writes.
+    void Poll();
+    // Whether writes are queued or callbacks are waiting for Poll().
+    bool Pending();
+    // Waits for all the queued writes to complete and calls their callbacks.
+    // Must be called before reading back or renaming a submitted file.
+    void Flush();
+
+    // Writes `contents` to `path` through a synced temporary file, so that
+    // `path` is either left untouched or fully written.
+    static bool WriteFile(const std::string& path, const std::vector<uint8_t>& contents);
+
+private:
+    struct Job {
+        std::string path;
+        std::vector<uint8_t> data;
+        Encoder encode;
+        std::vector<Callback> callbacks;
+        bool written = false;
+    };
+
+    void Run();
+
+    std::mutex mutex_;
+    std::condition_variable queued_cv_;
+    std::condition_variable completed_cv_;
+    // Jobs waiting for the worker, the front one may be in progress.
+    std::deque<Job> queue_;
+    bool running_job_ = false;
+    // Jobs waiting for their callbacks.
+    std::deque<Job> completed_;
+    bool stop_ = false;
+
+    std::thread worker_;
+};
+
+// Write-behind service used by the cores to write savestate and battery
+// files, set by the frontends. The files are written synchronously if null.
+extern WriteBehind* g_writeBehind;
+
+// Writes `data` to `path` with g_writeBehind if set, synchronously otherwise,
+// in which case `done` is called before returning. Returns false if the file
+// could not be written synchronously.
+bool writeBehindSubmit(const char* path,
+                       std::vector<uint8_t> data,
+                       WriteBehind::Encoder encode,
+                       WriteBehind::Callback done);
+
+#endif  // VBAM_CORE_BASE_WRITE_BEHIND_H_
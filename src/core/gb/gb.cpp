@@ -6,9 +6,12 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
 #include <vector>
 
 #include "core/base/file_util.h"
+#include "core/base/flat_state.h"
+#include "core/base/instrumentation.h"
 #include "core/base/message.h"
 #include "core/base/sizes.h"
 #include "core/base/system.h"
@@ -26,7 +29,11 @@
 
 #if !defined(__LIBRETRO__)
 #include "core/base/image_util.h"
+#include "core/base/mapped_file.h"
 #include "core/base/patch.h"
+#include "core/base/snapshot_arena.h"
+#include "core/base/state_store.h"
+#include "core/base/write_behind.h"
 #endif  // defined(__LIBRETRO__)
 
 #ifdef __GNUC__
@@ -122,22 +129,27 @@ bool WriteBatteryFile(const char* file_name) {
         return true;
     }
 
-    FILE* file = utilOpenFile(file_name, "wb");
-    if (file == nullptr) {
-        systemMessage(MSG_ERROR_CREATING_FILE, N_("Error creating file %s"),
-                      file_name);
-        return false;
-    }
-
+    std::vector<uint8_t> data;
     for (const VBamIoVec& vec : g_vbamIoVecs) {
-        fwrite(vec.data, 1, vec.length, file);
+        const uint8_t* bytes = static_cast<const uint8_t*>(vec.data);
+        data.insert(data.end(), bytes, bytes + vec.length);
     }
 
-    fclose(file);
-    return true;
+    const std::string name = file_name;
+    return writeBehindSubmit(file_name, std::move(data), nullptr, [name](bool written) {
+        if (!written) {
+            systemMessage(MSG_ERROR_CREATING_FILE, N_("Error creating file %s"),
+                          name.c_str());
+        }
+    });
 }
 
 bool ReadBatteryFile(const char* file_name) {
+    // The file may still be queued for writing.
+    if (g_writeBehind != nullptr) {
+        g_writeBehind->Flush();
+    }
+
     systemSaveUpdateCounter = SYSTEM_SAVE_NOT_UPDATED;
     if (!g_gbCartData.has_battery()) {
         return false;
@@ -280,6 +292,7 @@ void gbGenFilter() {
             }
         }
     }
+    gbInvalidatePaletteMix();
 }
 
 // Initializes the `g_gbCartData` variable with the data in `gbRom`, expecting a
@@ -493,7 +506,7 @@ bool gbInitializeRom(size_t romSize) {
 
 bool inBios = false;
 
-extern uint16_t gbLineMix[kGBWidth];
+extern uint32_t gbLineMix[kGBWidth];
 
 // registers
 gbRegister PC;
@@ -1257,11 +1270,33 @@ bool gbIsGameboyRom(char* file)
 
 void gbCopyMemory(uint16_t d, uint16_t s, int count)
 {
-    while (count) {
-        gbMemoryMap[d >> 12][d & 0x0fff] = gbMemoryMap[s >> 12][s & 0x0fff];
-        s++;
-        d++;
-        count--;
+    VBAM_INSTR_COUNT(kDmaBytes, count);
+
+    // Copy in spans that stay within a single 4KB page on both sides, so the
+    // page lookup is done once per span instead of once per byte. This covers
+    // the usual ROM/WRAM to VRAM transfers with a single memcpy.
+    while (count > 0) {
+        int span = 0x1000 - (d & 0x0fff);
+        const int srcSpan = 0x1000 - (s & 0x0fff);
+        if (srcSpan < span)
+            span = srcSpan;
+        if (count < span)
+            span = count;
+
+        uint8_t* dst = &gbMemoryMap[d >> 12][d & 0x0fff];
+        const uint8_t* src = &gbMemoryMap[s >> 12][s & 0x0fff];
+
+        if (dst + span <= src || src + span <= dst) {
+            memcpy(dst, src, span);
+        } else {
+            // Overlapping spans must keep the byte-by-byte forward semantics.
+            for (int i = 0; i < span; i++)
+                dst[i] = src[i];
+        }
+
+        s += span;
+        d += span;
+        count -= span;
     }
 }
 
@@ -2684,7 +2719,10 @@ void gbResetPalette() {
     }
 }
 
-void gbReset()
+// Resets the emulated system. When `loading_state`, the state loaded next
+// replaces the APU state, so the APU and the samples it buffered are left
+// alone, and the frame counters driving system10Frames() keep running.
+static void gbResetSystem(bool loading_state)
 {
 #ifndef NO_LINK
     if (GetLinkMode() == LINK_GAMEBOY_IPC || GetLinkMode() == LINK_GAMEBOY_SOCKET) {
@@ -3128,12 +3166,15 @@ void gbReset()
         gbMemoryMap[0x0b] = &gbRam[0x1000];
     }
 
-    gbSoundReset();
+    if (!loading_state)
+        gbSoundReset();
 
     systemSaveUpdateCounter = SYSTEM_SAVE_NOT_UPDATED;
 
-    gbLastTime = systemGetClock();
-    gbFrameCount = 0;
+    if (!loading_state) {
+        gbLastTime = systemGetClock();
+        gbFrameCount = 0;
+    }
 
     gbScreenOn = true;
     gbSystemMessage = false;
@@ -3141,6 +3182,11 @@ void gbReset()
     gbCheatWrite(true); // Emulates GS codes.
 }
 
+void gbReset()
+{
+    gbResetSystem(false);
+}
+
 bool gbReadGSASnapshot(const char* fileName)
 {
     FILE* file = utilOpenFile(fileName, "rb");
@@ -3271,102 +3317,521 @@ variable_desc gbSaveGameStruct[] = {
     { NULL, 0 }
 };
 
-#ifndef __LIBRETRO__
-static bool gbWriteSaveState(gzFile gzFile)
+// Allocates or frees the CGB VRAM and WRAM to match the loaded gbCgbMode.
+static bool gbStateUpdateCgbMemory()
 {
+    // Correct crash when loading color gameboy save in regular gameboy type.
+    if (gbCgbMode) {
+        if (gbVram == nullptr) {
+            gbVram = (uint8_t*)calloc(1, kGBVRamSize);
+            if (gbVram == nullptr) {
+                return false;
+            }
+        }
+        if (gbWram == nullptr) {
+            gbWram = (uint8_t*)malloc(kGBWRamSize);
+            if (gbWram == nullptr) {
+                return false;
+            }
+        }
+        memset(gbPalette, 0, sizeof(gbPalette));
+    } else {
+        if (gbVram != nullptr) {
+            free(gbVram);
+            gbVram = nullptr;
+        }
+        if (gbWram != nullptr) {
+            free(gbWram);
+            gbWram = nullptr;
+        }
+    }
 
-    utilWriteInt(gzFile, GBSAVE_GAME_VERSION);
-
-    utilGzWrite(gzFile, &gbRom[0x134], 15);
+    return true;
+}
 
-    utilWriteInt(gzFile, coreOptions.useBios);
-    utilWriteInt(gzFile, inBios);
+// Rebuilds the per-line register caches and the memory map after a state has
+// been loaded.
+static void gbStateUpdateMemoryMap()
+{
+    memset(gbSCYLine, register_SCY, sizeof(gbSCYLine));
+    memset(gbSCXLine, register_SCX, sizeof(gbSCXLine));
+    memset(gbBgpLine, (gbBgp[0] | (gbBgp[1] << 2) | (gbBgp[2] << 4) | (gbBgp[3] << 6)), sizeof(gbBgpLine));
+    memset(gbObp0Line, (gbObp0[0] | (gbObp0[1] << 2) | (gbObp0[2] << 4) | (gbObp0[3] << 6)), sizeof(gbObp0Line));
+    memset(gbObp1Line, (gbObp1[0] | (gbObp1[1] << 2) | (gbObp1[2] << 4) | (gbObp1[3] << 6)), sizeof(gbObp1Line));
+    memset(gbSpritesTicks, 0x0, sizeof(gbSpritesTicks));
 
-    utilWriteData(gzFile, gbSaveGameStruct);
+    if (inBios) {
+        gbMemoryMap[0x00] = &gbMemory[0x0000];
+        if (gbHardware & 5) {
+            memcpy((uint8_t*)(gbMemory), (uint8_t*)(gbRom), 0x1000);
+            memcpy((uint8_t*)(gbMemory), (uint8_t*)(g_bios), kGBBiosSize);
+        } else if (gbHardware & 2) {
+            memcpy((uint8_t*)(gbMemory), (uint8_t*)(g_bios), kCGBBiosSize);
+            memcpy((uint8_t*)(gbMemory + 0x100), (uint8_t*)(gbRom + 0x100), 0x100);
+        }
 
-    utilGzWrite(gzFile, &IFF, 2);
+    } else
+        gbMemoryMap[0x00] = &gbRom[0x0000];
+    gbMemoryMap[0x01] = &gbRom[0x1000];
+    gbMemoryMap[0x02] = &gbRom[0x2000];
+    gbMemoryMap[0x03] = &gbRom[0x3000];
+    gbMemoryMap[0x04] = &gbRom[0x4000];
+    gbMemoryMap[0x05] = &gbRom[0x5000];
+    gbMemoryMap[0x06] = &gbRom[0x6000];
+    gbMemoryMap[0x07] = &gbRom[0x7000];
+    gbMemoryMap[0x08] = &gbMemory[0x8000];
+    gbMemoryMap[0x09] = &gbMemory[0x9000];
+    gbMemoryMap[0x0a] = &gbMemory[0xa000];
+    gbMemoryMap[0x0b] = &gbMemory[0xb000];
+    gbMemoryMap[0x0c] = &gbMemory[0xc000];
+    gbMemoryMap[0x0d] = &gbMemory[0xd000];
+    gbMemoryMap[0x0e] = &gbMemory[0xe000];
+    gbMemoryMap[0x0f] = &gbMemory[0xf000];
 
-    if (gbSgbMode) {
-        gbSgbSaveGame(gzFile);
+    switch (g_gbCartData.mapper_type()) {
+        case gbCartData::MapperType::kNone:
+        case gbCartData::MapperType::kMbc1:
+            memoryUpdateMapMBC1();
+            break;
+        case gbCartData::MapperType::kMbc2:
+            memoryUpdateMapMBC2();
+            break;
+        case gbCartData::MapperType::kMmm01:
+            memoryUpdateMapMMM01();
+            break;
+        case gbCartData::MapperType::kMbc3:
+            memoryUpdateMapMBC3();
+            break;
+        case gbCartData::MapperType::kMbc5:
+            memoryUpdateMapMBC5();
+            break;
+        case gbCartData::MapperType::kMbc7:
+            memoryUpdateMapMBC7();
+            break;
+        case gbCartData::MapperType::kGameShark:
+            memoryUpdateMapGS3();
+            break;
+        case gbCartData::MapperType::kTama5:
+            memoryUpdateMapTAMA5();
+            break;
+        case gbCartData::MapperType::kHuC3:
+            memoryUpdateMapHuC3();
+            break;
+        case gbCartData::MapperType::kHuC1:
+            memoryUpdateMapHuC1();
+            break;
+        case gbCartData::MapperType::kMbc6:
+        case gbCartData::MapperType::kPocketCamera:
+        case gbCartData::MapperType::kGameGenie:
+        case gbCartData::MapperType::kUnknown:
+            // Do nothing.
+            break;
     }
+}
 
-    utilGzWrite(gzFile, &gbDataMBC1, sizeof(gbDataMBC1));
-    utilGzWrite(gzFile, &gbDataMBC2, sizeof(gbDataMBC2));
-    utilGzWrite(gzFile, &gbDataMBC3, sizeof(gbDataMBC3));
-    utilGzWrite(gzFile, &gbDataMBC5, sizeof(gbDataMBC5));
-    utilGzWrite(gzFile, &gbDataHuC1, sizeof(gbDataHuC1));
-    utilGzWrite(gzFile, &gbDataHuC3, sizeof(gbDataHuC3));
-    utilGzWrite(gzFile, &gbDataTAMA5, sizeof(gbDataTAMA5));
-    if (gbTAMA5ram != NULL)
-        utilGzWrite(gzFile, gbTAMA5ram, kTama5RamSize);
-    utilGzWrite(gzFile, &gbDataMMM01, sizeof(gbDataMMM01));
+// Flat state section identifiers.
+static constexpr uint32_t kGbSectionHeader = flatStateFourCC('G', 'B', 'H', 'D');
+static constexpr uint32_t kGbSectionCpu = flatStateFourCC('G', 'C', 'P', 'U');
+static constexpr uint32_t kGbSectionSgb = flatStateFourCC('G', 'S', 'G', 'B');
+static constexpr uint32_t kGbSectionMapper = flatStateFourCC('G', 'M', 'B', 'C');
+static constexpr uint32_t kGbSectionPalette = flatStateFourCC('G', 'P', 'A', 'L');
+static constexpr uint32_t kGbSectionMemory = flatStateFourCC('G', 'M', 'E', 'M');
+static constexpr uint32_t kGbSectionCartRam = flatStateFourCC('G', 'R', 'A', 'M');
+static constexpr uint32_t kGbSectionVram = flatStateFourCC('G', 'V', 'R', 'M');
+static constexpr uint32_t kGbSectionWram = flatStateFourCC('G', 'W', 'R', 'M');
+static constexpr uint32_t kGbSectionApu = flatStateFourCC('G', 'A', 'P', 'U');
+static constexpr uint32_t kGbSectionLcd = flatStateFourCC('G', 'L', 'C', 'D');
+static constexpr uint32_t kGbSectionCheats = flatStateFourCC('G', 'C', 'H', 'T');
+
+size_t gbFlatStateMaxSize()
+{
+    // Everything not listed here (registers, mapper and APU state) is well
+    // below the slack added at the end.
+    return kFlatStateDataOffset + sizeof(gbPalette) + 0x8000 + kGBVRamSize + kGBWRamSize +
+        g_gbCartData.ram_size() + kTama5RamSize + k32KiB /* SGB */ + k16KiB;
+}
 
-    utilGzWrite(gzFile, gbPalette, sizeof(gbPalette));
+// Size of the buffer needed by the file states, which also hold the cheat
+// list.
+static size_t gbFlatStateFileMaxSize()
+{
+#ifndef __LIBRETRO__
+    return gbFlatStateMaxSize() + sizeof(int) + sizeof(gbCheatList);
+#else
+    return gbFlatStateMaxSize();
+#endif
+}
+
+// Writes a flat state. The cheat list is only saved in files.
+static size_t gbWriteFlatState(uint8_t* data, bool cheats)
+{
+    FlatStateWriter writer(data, FlatStateSystem::kGB, GBSAVE_GAME_VERSION);
+
+    writer.BeginSection(kGbSectionHeader);
+    utilWriteMem(writer.cursor(), &gbRom[0x134], 15);
+    utilWriteIntMem(writer.cursor(), coreOptions.useBios);
+    utilWriteIntMem(writer.cursor(), inBios);
+    writer.EndSection();
 
-    utilGzWrite(gzFile, &gbMemory[0x8000], 0x8000);
+    writer.BeginSection(kGbSectionCpu);
+    utilWriteDataMem(writer.cursor(), gbSaveGameStruct);
+    utilWriteMem(writer.cursor(), &IFF, 2);
+    writer.EndSection();
+
+    if (gbSgbMode) {
+        writer.BeginSection(kGbSectionSgb);
+        gbSgbSaveGame(writer.cursor());
+        writer.EndSection();
+    }
+
+    writer.BeginSection(kGbSectionMapper);
+    utilWriteMem(writer.cursor(), &gbDataMBC1, sizeof(gbDataMBC1));
+    utilWriteMem(writer.cursor(), &gbDataMBC2, sizeof(gbDataMBC2));
+    utilWriteMem(writer.cursor(), &gbDataMBC3, sizeof(gbDataMBC3));
+    utilWriteMem(writer.cursor(), &gbDataMBC5, sizeof(gbDataMBC5));
+    utilWriteMem(writer.cursor(), &gbDataHuC1, sizeof(gbDataHuC1));
+    utilWriteMem(writer.cursor(), &gbDataHuC3, sizeof(gbDataHuC3));
+    utilWriteMem(writer.cursor(), &gbRTCHuC3, sizeof(gbRTCHuC3));
+    utilWriteMem(writer.cursor(), &gbDataTAMA5, sizeof(gbDataTAMA5));
+    if (gbTAMA5ram != nullptr)
+        utilWriteMem(writer.cursor(), gbTAMA5ram, kTama5RamSize);
+    utilWriteMem(writer.cursor(), &gbDataMMM01, sizeof(gbDataMMM01));
+    writer.EndSection();
+
+    writer.BeginSection(kGbSectionPalette);
+    utilWriteMem(writer.cursor(), gbPalette, sizeof(gbPalette));
+    writer.EndSection();
+
+    writer.BeginSection(kGbSectionMemory);
+    utilWriteMem(writer.cursor(), &gbMemory[0x8000], 0x8000);
+    writer.EndSection();
 
     if (g_gbCartData.HasRam()) {
-        const size_t ramSize = g_gbCartData.ram_size();
-        utilWriteInt(gzFile, ramSize);
-        utilGzWrite(gzFile, gbRam, ramSize);
+        writer.BeginSection(kGbSectionCartRam);
+        utilWriteMem(writer.cursor(), gbRam, g_gbCartData.ram_size());
+        writer.EndSection();
     }
 
     if (gbCgbMode) {
-        utilGzWrite(gzFile, gbVram, kGBVRamSize);
-        utilGzWrite(gzFile, gbWram, kGBWRamSize);
-    }
-
-    gbSoundSaveGame(gzFile);
-
-    gbCheatsSaveGame(gzFile);
-
-    utilWriteInt(gzFile, gbLcdModeDelayed);
-    utilWriteInt(gzFile, gbLcdTicksDelayed);
-    utilWriteInt(gzFile, gbLcdLYIncrementTicksDelayed);
-    utilWriteInt(gzFile, gbSpritesTicks[299]);
-    utilWriteInt(gzFile, gbTimerModeChange);
-    utilWriteInt(gzFile, gbTimerOnChange);
-    utilWriteInt(gzFile, gbHardware);
-    utilWriteInt(gzFile, gbBlackScreen);
-    utilWriteInt(gzFile, oldRegister_WY);
-    utilWriteInt(gzFile, gbWindowLine);
-    utilWriteInt(gzFile, inUseRegister_WY);
-    utilWriteInt(gzFile, gbScreenOn);
-    utilWriteInt(gzFile, 0x12345678); // end marker
-    return true;
+        writer.BeginSection(kGbSectionVram);
+        utilWriteMem(writer.cursor(), gbVram, kGBVRamSize);
+        writer.EndSection();
+
+        writer.BeginSection(kGbSectionWram);
+        utilWriteMem(writer.cursor(), gbWram, kGBWRamSize);
+        writer.EndSection();
+    }
+
+    writer.BeginSection(kGbSectionApu);
+    gbSoundSaveGame(writer.cursor());
+    writer.EndSection();
+
+    writer.BeginSection(kGbSectionLcd);
+    utilWriteIntMem(writer.cursor(), gbLcdModeDelayed);
+    utilWriteIntMem(writer.cursor(), gbLcdTicksDelayed);
+    utilWriteIntMem(writer.cursor(), gbLcdLYIncrementTicksDelayed);
+    utilWriteIntMem(writer.cursor(), gbSpritesTicks[299]);
+    utilWriteIntMem(writer.cursor(), gbTimerModeChange);
+    utilWriteIntMem(writer.cursor(), gbTimerOnChange);
+    utilWriteIntMem(writer.cursor(), gbHardware);
+    utilWriteIntMem(writer.cursor(), gbBlackScreen);
+    utilWriteIntMem(writer.cursor(), oldRegister_WY);
+    utilWriteIntMem(writer.cursor(), gbWindowLine);
+    utilWriteIntMem(writer.cursor(), inUseRegister_WY);
+    utilWriteIntMem(writer.cursor(), gbScreenOn);
+    writer.EndSection();
+
+#ifndef __LIBRETRO__
+    if (cheats) {
+        writer.BeginSection(kGbSectionCheats);
+        gbCheatsSaveGame(writer.cursor());
+        writer.EndSection();
+    }
+#else
+    (void)cheats;
+#endif
+
+    return writer.Finish();
 }
 
-bool gbWriteMemSaveState(char* memory, int available, long& reserved)
+size_t gbWriteFlatState(uint8_t* data)
 {
-    gzFile gzFile = utilMemGzOpen(memory, available, "w");
+    return gbWriteFlatState(data, false);
+}
 
-    if (gzFile == NULL) {
+// Size of the mapper section of the running cartridge.
+static size_t gbFlatStateMapperSize()
+{
+    return sizeof(gbDataMBC1) + sizeof(gbDataMBC2) + sizeof(gbDataMBC3) + sizeof(gbDataMBC5) +
+        sizeof(gbDataHuC1) + sizeof(gbDataHuC3) + sizeof(gbRTCHuC3) + sizeof(gbDataTAMA5) +
+        (gbTAMA5ram != nullptr ? kTama5RamSize : 0) + sizeof(gbDataMMM01);
+}
+
+// Returns the bool at `address` in the gbSaveGameStruct data at `data`,
+// without loading it. The flags are saved with the 3 bytes after them.
+static bool gbPeekSaveGameFlag(const uint8_t* data, const bool* address)
+{
+    for (const variable_desc* desc = gbSaveGameStruct; desc->address != nullptr; desc++) {
+        if (desc->address == address) {
+            return data[0] != 0;
+        }
+        data += desc->size;
+    }
+    return false;
+}
+
+bool gbReadFlatState(const uint8_t* data, size_t size)
+{
+    FlatStateReader reader;
+    if (!reader.Open(data, size, FlatStateSystem::kGB, gbFlatStateFileMaxSize()) ||
+        reader.system_version() != GBSAVE_GAME_VERSION) {
+        return false;
+    }
+
+    if (!reader.OpenSection(kGbSectionHeader) || reader.section_size() != 15 + 2 * sizeof(int)) {
+        return false;
+    }
+
+    uint8_t romname[16] = {};
+    utilReadMem(romname, reader.cursor(), 15);
+    if (memcmp(&gbRom[0x134], romname, 15) != 0) {
+        systemMessage(MSG_CANNOT_LOAD_SGM_FOR,
+            N_("Cannot load save game for %s. Playing %s"),
+            romname, &gbRom[0x134]);
+        return false;
+    }
+
+    const bool ub = utilReadIntMem(reader.cursor()) ? true : false;
+    const bool ib = utilReadIntMem(reader.cursor()) ? true : false;
+    if ((ub != (bool)(coreOptions.useBios)) && ib) {
+        if (coreOptions.useBios)
+            systemMessage(MSG_SAVE_GAME_NOT_USING_BIOS,
+                N_("Save game is not using the BIOS files"));
+        else
+            systemMessage(MSG_SAVE_GAME_USING_BIOS,
+                N_("Save game is using the BIOS file"));
+        return false;
+    }
+
+    // Validate the size of every section before touching any of the emulator
+    // state. The SGB and CGB sections depend on the modes saved in the state.
+    if (!reader.OpenSection(kGbSectionCpu) ||
+        reader.section_size() != utilDataSize(gbSaveGameStruct) + 2) {
+        return false;
+    }
+    const bool cgb = gbPeekSaveGameFlag(reader.cursor(), &gbCgbMode);
+    const bool sgb = gbPeekSaveGameFlag(reader.cursor(), &gbSgbMode);
+
+    if (sgb && (!reader.OpenSection(kGbSectionSgb) ||
+                reader.section_size() != gbSgbSaveGameSize())) {
+        return false;
+    }
+    if (!reader.OpenSection(kGbSectionMapper) ||
+        reader.section_size() != gbFlatStateMapperSize()) {
+        return false;
+    }
+    if (!reader.OpenSection(kGbSectionPalette) || reader.section_size() != sizeof(gbPalette)) {
+        return false;
+    }
+    if (!reader.OpenSection(kGbSectionMemory) || reader.section_size() != 0x8000) {
+        return false;
+    }
+    if (cgb) {
+        if (!reader.OpenSection(kGbSectionVram) || reader.section_size() != kGBVRamSize ||
+            !reader.OpenSection(kGbSectionWram) || reader.section_size() != kGBWRamSize) {
+            return false;
+        }
+    }
+    if (!reader.OpenSection(kGbSectionApu) || reader.section_size() != gbSoundSaveGameSize()) {
+        return false;
+    }
+    if (!reader.OpenSection(kGbSectionLcd) || reader.section_size() != 12 * sizeof(int)) {
         return false;
     }
+#ifndef __LIBRETRO__
+    if (reader.OpenSection(kGbSectionCheats)) {
+        const int count = utilReadIntMem(reader.cursor());
+        if (count < 0 || count > MAX_CHEATS ||
+            reader.section_size() != sizeof(int) + count * sizeof(gbCheat)) {
+            return false;
+        }
+    }
+#endif
 
-    bool res = gbWriteSaveState(gzFile);
+    // The reset frees the CGB memory of the GB games, it is allocated up
+    // front so that running out of memory leaves the emulator untouched.
+    uint8_t* cgbVram = nullptr;
+    uint8_t* cgbWram = nullptr;
+    if (cgb) {
+        cgbVram = (uint8_t*)calloc(1, kGBVRamSize);
+        cgbWram = (uint8_t*)malloc(kGBWRamSize);
+        if (cgbVram == nullptr || cgbWram == nullptr) {
+            free(cgbVram);
+            free(cgbWram);
+            return false;
+        }
+    }
 
-    reserved = utilGzMemTell(gzFile) + 8;
+    gbResetSystem(true);
 
-    if (reserved >= (available))
-        res = false;
+    inBios = ib;
 
-    utilGzClose(gzFile);
+    reader.OpenSection(kGbSectionCpu);
+    utilReadDataMem(reader.cursor(), gbSaveGameStruct);
+    utilReadMem(&IFF, reader.cursor(), 2);
 
-    return res;
+    if (cgb) {
+        if (gbVram == nullptr) {
+            gbVram = cgbVram;
+        } else {
+            free(cgbVram);
+        }
+        if (gbWram == nullptr) {
+            gbWram = cgbWram;
+        } else {
+            free(cgbWram);
+        }
+    }
+    // Cannot fail, the memory is allocated.
+    gbStateUpdateCgbMemory();
+
+    if (gbSgbMode) {
+        reader.OpenSection(kGbSectionSgb);
+        gbSgbReadGame(reader.cursor());
+    } else {
+        gbSgbMask = 0; // loading a game at the wrong time causes no display
+    }
+
+    reader.OpenSection(kGbSectionMapper);
+    utilReadMem(&gbDataMBC1, reader.cursor(), sizeof(gbDataMBC1));
+    utilReadMem(&gbDataMBC2, reader.cursor(), sizeof(gbDataMBC2));
+    utilReadMem(&gbDataMBC3, reader.cursor(), sizeof(gbDataMBC3));
+    utilReadMem(&gbDataMBC5, reader.cursor(), sizeof(gbDataMBC5));
+    utilReadMem(&gbDataHuC1, reader.cursor(), sizeof(gbDataHuC1));
+    utilReadMem(&gbDataHuC3, reader.cursor(), sizeof(gbDataHuC3));
+    utilReadMem(&gbRTCHuC3, reader.cursor(), sizeof(gbRTCHuC3));
+    utilReadMem(&gbDataTAMA5, reader.cursor(), sizeof(gbDataTAMA5));
+    if (gbTAMA5ram != nullptr) {
+        if (coreOptions.skipSaveGameBattery) {
+            reader.cursor() += kTama5RamSize;
+        } else {
+            utilReadMem(gbTAMA5ram, reader.cursor(), kTama5RamSize);
+        }
+    }
+    utilReadMem(&gbDataMMM01, reader.cursor(), sizeof(gbDataMMM01));
+
+    memset(g_pix, 0, kGBPixSize);
+
+    reader.OpenSection(kGbSectionPalette);
+    utilReadMem(gbPalette, reader.cursor(), sizeof(gbPalette));
+
+    // This is necessary for GB games (not GBC or SGB) to have them load with
+    // the user-defined palette and not the saved palette.
+    gbResetPalette();
+
+    reader.OpenSection(kGbSectionMemory);
+    utilReadMem(&gbMemory[0x8000], reader.cursor(), 0x8000);
+
+    if (g_gbCartData.HasRam() && !coreOptions.skipSaveGameBattery &&
+        reader.OpenSection(kGbSectionCartRam)) {
+        utilReadMem(gbRam, reader.cursor(), std::min(g_gbCartData.ram_size(), reader.section_size()));
+    }
+
+    gbStateUpdateMemoryMap();
+
+    if (gbCgbMode) {
+        reader.OpenSection(kGbSectionVram);
+        utilReadMem(gbVram, reader.cursor(), kGBVRamSize);
+
+        reader.OpenSection(kGbSectionWram);
+        utilReadMem(gbWram, reader.cursor(), kGBWRamSize);
+
+        int value = register_SVBK;
+        if (value == 0)
+            value = 1;
+
+        gbMemoryMap[0x08] = &gbVram[register_VBK * 0x2000];
+        gbMemoryMap[0x09] = &gbVram[register_VBK * 0x2000 + 0x1000];
+        gbMemoryMap[0x0d] = &gbWram[value * 0x1000];
+    }
+
+    reader.OpenSection(kGbSectionApu);
+    gbSoundReadGame(reader.cursor());
+
+#ifndef __LIBRETRO__
+    if (!coreOptions.skipSaveGameCheats && reader.OpenSection(kGbSectionCheats)) {
+        gbCheatsReadGame(reader.cursor());
+    }
+#endif
+
+    if (gbCgbMode && gbSgbMode) {
+        gbSgbMode = false;
+    }
+
+    if (gbBorderOn && !gbSgbMask) {
+        gbSgbRenderBorder();
+    }
+
+    systemDrawScreen();
+
+    reader.OpenSection(kGbSectionLcd);
+    gbLcdModeDelayed = utilReadIntMem(reader.cursor());
+    gbLcdTicksDelayed = utilReadIntMem(reader.cursor());
+    gbLcdLYIncrementTicksDelayed = utilReadIntMem(reader.cursor());
+    gbSpritesTicks[299] = utilReadIntMem(reader.cursor()) & 0xff;
+    gbTimerModeChange = (utilReadIntMem(reader.cursor()) ? true : false);
+    gbTimerOnChange = (utilReadIntMem(reader.cursor()) ? true : false);
+    gbHardware = utilReadIntMem(reader.cursor());
+    gbBlackScreen = (utilReadIntMem(reader.cursor()) ? true : false);
+    oldRegister_WY = utilReadIntMem(reader.cursor());
+    gbWindowLine = utilReadIntMem(reader.cursor());
+    inUseRegister_WY = utilReadIntMem(reader.cursor());
+    gbScreenOn = (utilReadIntMem(reader.cursor()) ? true : false);
+
+    if (gbSpeed)
+        gbLine99Ticks *= 2;
+
+    systemSaveUpdateCounter = SYSTEM_SAVE_NOT_UPDATED;
+
+    return true;
 }
 
-bool gbWriteSaveState(const char* name)
+#ifndef __LIBRETRO__
+bool gbWriteMemSaveState(char* memory, int available, long& reserved)
 {
-    gzFile gzFile = utilGzOpen(name, "wb");
-
-    if (gzFile == NULL)
+    // Memory states are only used for rewind, so they are written as flat,
+    // uncompressed states.
+    if (available < 0 || (size_t)available < gbFlatStateMaxSize()) {
         return false;
+    }
 
-    bool res = gbWriteSaveState(gzFile);
+    reserved = gbWriteFlatState((uint8_t*)memory);
+    return true;
+}
 
-    utilGzClose(gzFile);
-    return res;
+bool gbWriteSaveState(const char* name)
+{
+    // Save states are written as flat states with every section stored
+    // as-is, so that loading them can copy the sections straight from the
+    // mapped file, or in g_stateStore when set. Only the flat state is
+    // written on the emulation thread.
+    std::vector<uint8_t> state =
+        snapshotArena().Acquire(gbFlatStateFileMaxSize());
+    state.resize(gbWriteFlatState(state.data(), true));
+
+    const std::string file_name = name;
+    return writeBehindSubmit(
+        name, std::move(state),
+        [store = g_stateStore, file_name](const std::vector<uint8_t>& data,
+                                          std::vector<uint8_t>* contents) {
+            return stateStoreEncodeFile(store, file_name, data.data(), data.size(), contents);
+        },
+        [file_name](bool written) {
+            if (!written) {
+                systemMessage(MSG_ERROR_CREATING_FILE, N_("Error creating file %s"),
+                              file_name.c_str());
+            }
+        });
 }
 
 static bool gbReadSaveState(gzFile gzFile)
@@ -3414,30 +3879,8 @@ static bool gbReadSaveState(gzFile gzFile)
 
     utilReadData(gzFile, gbSaveGameStruct);
 
-    // Correct crash when loading color gameboy save in regular gameboy type.
-    if (gbCgbMode) {
-        if (gbVram == nullptr) {
-            gbVram = (uint8_t*)calloc(1, kGBVRamSize);
-            if (gbVram == nullptr) {
-                return false;
-            }
-        }
-        if (gbWram == nullptr) {
-            gbWram = (uint8_t*)malloc(kGBWRamSize);
-            if (gbWram == nullptr) {
-                return false;
-            }
-        }
-        memset(gbPalette, 0, sizeof(gbPalette));
-    } else {
-        if (gbVram != nullptr) {
-            free(gbVram);
-            gbVram = nullptr;
-        }
-        if (gbWram != nullptr) {
-            free(gbWram);
-            gbWram = nullptr;
-        }
+    if (!gbStateUpdateCgbMemory()) {
+        return false;
     }
 
     if (version >= GBSAVE_GAME_VERSION_7) {
@@ -3512,80 +3955,7 @@ static bool gbReadSaveState(gzFile gzFile)
         }
     }
 
-    memset(gbSCYLine, register_SCY, sizeof(gbSCYLine));
-    memset(gbSCXLine, register_SCX, sizeof(gbSCXLine));
-    memset(gbBgpLine, (gbBgp[0] | (gbBgp[1] << 2) | (gbBgp[2] << 4) | (gbBgp[3] << 6)), sizeof(gbBgpLine));
-    memset(gbObp0Line, (gbObp0[0] | (gbObp0[1] << 2) | (gbObp0[2] << 4) | (gbObp0[3] << 6)), sizeof(gbObp0Line));
-    memset(gbObp1Line, (gbObp1[0] | (gbObp1[1] << 2) | (gbObp1[2] << 4) | (gbObp1[3] << 6)), sizeof(gbObp1Line));
-    memset(gbSpritesTicks, 0x0, sizeof(gbSpritesTicks));
-
-    if (inBios) {
-        gbMemoryMap[0x00] = &gbMemory[0x0000];
-        if (gbHardware & 5) {
-            memcpy((uint8_t*)(gbMemory), (uint8_t*)(gbRom), 0x1000);
-            memcpy((uint8_t*)(gbMemory), (uint8_t*)(g_bios), kGBBiosSize);
-        } else if (gbHardware & 2) {
-            memcpy((uint8_t*)(gbMemory), (uint8_t*)(g_bios), kCGBBiosSize);
-            memcpy((uint8_t*)(gbMemory + 0x100), (uint8_t*)(gbRom + 0x100), 0x100);
-        }
-
-    } else
-        gbMemoryMap[0x00] = &gbRom[0x0000];
-    gbMemoryMap[0x01] = &gbRom[0x1000];
-    gbMemoryMap[0x02] = &gbRom[0x2000];
-    gbMemoryMap[0x03] = &gbRom[0x3000];
-    gbMemoryMap[0x04] = &gbRom[0x4000];
-    gbMemoryMap[0x05] = &gbRom[0x5000];
-    gbMemoryMap[0x06] = &gbRom[0x6000];
-    gbMemoryMap[0x07] = &gbRom[0x7000];
-    gbMemoryMap[0x08] = &gbMemory[0x8000];
-    gbMemoryMap[0x09] = &gbMemory[0x9000];
-    gbMemoryMap[0x0a] = &gbMemory[0xa000];
-    gbMemoryMap[0x0b] = &gbMemory[0xb000];
-    gbMemoryMap[0x0c] = &gbMemory[0xc000];
-    gbMemoryMap[0x0d] = &gbMemory[0xd000];
-    gbMemoryMap[0x0e] = &gbMemory[0xe000];
-    gbMemoryMap[0x0f] = &gbMemory[0xf000];
-
-    switch (g_gbCartData.mapper_type()) {
-        case gbCartData::MapperType::kNone:
-        case gbCartData::MapperType::kMbc1:
-            memoryUpdateMapMBC1();
-            break;
-        case gbCartData::MapperType::kMbc2:
-            memoryUpdateMapMBC2();
-            break;
-        case gbCartData::MapperType::kMmm01:
-            memoryUpdateMapMMM01();
-            break;
-        case gbCartData::MapperType::kMbc3:
-            memoryUpdateMapMBC3();
-            break;
-        case gbCartData::MapperType::kMbc5:
-            memoryUpdateMapMBC5();
-            break;
-        case gbCartData::MapperType::kMbc7:
-            memoryUpdateMapMBC7();
-            break;
-        case gbCartData::MapperType::kGameShark:
-            memoryUpdateMapGS3();
-            break;
-        case gbCartData::MapperType::kTama5:
-            memoryUpdateMapTAMA5();
-            break;
-        case gbCartData::MapperType::kHuC3:
-            memoryUpdateMapHuC3();
-            break;
-        case gbCartData::MapperType::kHuC1:
-            memoryUpdateMapHuC1();
-            break;
-        case gbCartData::MapperType::kMbc6:
-        case gbCartData::MapperType::kPocketCamera:
-        case gbCartData::MapperType::kGameGenie:
-        case gbCartData::MapperType::kUnknown:
-            // Do nothing.
-            break;
-    }
+    gbStateUpdateMemoryMap();
 
     if (gbCgbMode) {
         utilGzRead(gzFile, gbVram, kGBVRamSize);
@@ -3707,6 +4077,10 @@ static bool gbReadSaveState(gzFile gzFile)
 
 bool gbReadMemSaveState(char* memory, int available)
 {
+    if (flatStateIsFlat((const uint8_t*)memory, available)) {
+        return gbReadFlatState((const uint8_t*)memory, available);
+    }
+
     gzFile gzFile = utilMemGzOpen(memory, available, "r");
 
     bool res = gbReadSaveState(gzFile);
@@ -3718,6 +4092,36 @@ bool gbReadMemSaveState(char* memory, int available)
 
 bool gbReadSaveState(const char* name)
 {
+    // The file may still be queued for writing.
+    if (g_writeBehind != nullptr) {
+        g_writeBehind->Flush();
+    }
+
+    MappedFile mapped;
+    if (!mapped.Open(name)) {
+        return false;
+    }
+
+    if (stateStoreIsReference(mapped.data(), mapped.size())) {
+        std::vector<uint8_t> contents;
+        if (!stateStoreLoadFile(name, mapped.data(), mapped.size(), &contents) ||
+            !gbReadFlatState(contents.data(), contents.size())) {
+            systemMessage(MSG_FAILED_TO_READ_SGM, N_("Failed to read save game %s"), name);
+            return false;
+        }
+        return true;
+    }
+
+    if (flatStateIsFlat(mapped.data(), mapped.size())) {
+        if (!gbReadFlatState(mapped.data(), mapped.size())) {
+            systemMessage(MSG_FAILED_TO_READ_SGM, N_("Failed to read save game %s"), name);
+            return false;
+        }
+        return true;
+    }
+    mapped.Close();
+
+    // Save states written before flat states are gzip streams.
     gzFile gzFile = utilGzOpen(name, "rb");
 
     if (gzFile == NULL) {
@@ -3880,6 +4284,7 @@ int gbGetNextEvent(int _clockTicks)
     return _clockTicks;
 }
 
+// gbLineMix already holds the pixels in the output format.
 void gbDrawLine()
 {
     switch (systemColorDepth) {
@@ -3892,25 +4297,25 @@ void gbDrawLine()
             + gbBorderColumnSkip;
 #endif
         for (size_t x = 0; x < kGBWidth;) {
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-            *dest++ = systemColorMap16[gbLineMix[x++]];
-            *dest++ = systemColorMap16[gbLineMix[x++]];
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
+            *dest++ = static_cast<uint16_t>(gbLineMix[x++]);
         }
         if (gbBorderOn)
             dest += gbBorderColumnSkip;
@@ -3922,40 +4327,40 @@ void gbDrawLine()
     case 24: {
         uint8_t* dest = (uint8_t*)g_pix + 3 * (gbBorderLineSkip * (register_LY + gbBorderRowSkip) + gbBorderColumnSkip);
         for (size_t x = 0; x < kGBWidth;) {
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
 
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
 
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
 
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
-            *((uint32_t*)dest) = systemColorMap32[gbLineMix[x++]];
+            *((uint32_t*)dest) = gbLineMix[x++];
             dest += 3;
         }
     } break;
@@ -3968,27 +4373,7 @@ void gbDrawLine()
         uint32_t* dest = (uint32_t*)g_pix + (gbBorderLineSkip + 1) * (register_LY + gbBorderRowSkip + 1)
             + gbBorderColumnSkip;
 #endif
-        for (size_t x = 0; x < kGBWidth;) {
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-            *dest++ = systemColorMap32[gbLineMix[x++]];
-        }
+        memcpy(dest, gbLineMix, sizeof(gbLineMix));
     } break;
     }
 }
@@ -4018,10 +4403,13 @@ static void gbUpdateJoypads() {
 
 void gbEmulate(int ticksToStop)
 {
+    VBAM_INSTR_ZONE(kCpu);
     gbRegister tempRegister;
     uint8_t tempValue;
     int8_t offset;
 
+    // The frontends can have changed the colour maps since the last call.
+    gbInvalidatePaletteMix();
 
     clockTicks = 0;
     gbDmaTicks = 0;
@@ -4282,7 +4670,10 @@ void gbEmulate(int ticksToStop)
                         // OAM being accessed mode
                         // next mode is OAM and VRAM in use
                         if ((gbScreenOn) && (register_LCDC & 0x80)) {
-                            gbDrawSprites(false);
+                            {
+                                VBAM_INSTR_ZONE(kRender);
+                                gbDrawSprites(false);
+                            }
                             // Used to add a one tick delay when a window line is drawn.
                             //(fixes a part of Carmaggedon problem)
                             if ((register_LCDC & 0x01 || gbCgbMode) && (register_LCDC & 0x20) && (gbWindowLine != -2)) {
@@ -4412,21 +4803,27 @@ void gbEmulate(int ticksToStop)
                             gbLcdTicksDelayed += GBLCD_MODE_1_CLOCK_TICKS;
                             gbLcdModeDelayed = 1;
 
-                            gbFrameCount++;
                             systemFrame();
-                            gbSoundTick(soundTicks);
-
-                            if ((gbFrameCount % 10) == 0)
-                                system10Frames();
+                            VBAM_INSTR_END_FRAME();
+                            {
+                                VBAM_INSTR_ZONE(kSound);
+                                gbSoundTick(soundTicks);
+                            }
 
-                            if (gbFrameCount >= 60) {
-                                uint32_t currentTime = systemGetClock();
-                                if (currentTime != gbLastTime)
-                                    systemShowSpeed(100000 / (currentTime - gbLastTime));
-                                else
-                                    systemShowSpeed(0);
-                                gbLastTime = currentTime;
-                                gbFrameCount = 0;
+                            if (!coreOptions.speculating) {
+                                gbFrameCount++;
+                                if ((gbFrameCount % 10) == 0)
+                                    system10Frames();
+
+                                if (gbFrameCount >= 60) {
+                                    uint32_t currentTime = systemGetClock();
+                                    if (currentTime != gbLastTime)
+                                        systemShowSpeed(100000 / (currentTime - gbLastTime));
+                                    else
+                                        systemShowSpeed(0);
+                                    gbLastTime = currentTime;
+                                    gbFrameCount = 0;
+                                }
                             }
 
                             int newmask = gbJoymask[0] & 255;
@@ -4454,7 +4851,7 @@ void gbEmulate(int ticksToStop)
 
                                 if (!gbSgbMask) {
                                     if (gbBorderOn)
-                                        gbSgbRenderBorder();
+                                        gbSgbUpdateBorder();
                                     //if (gbScreenOn)
                                     systemDrawScreen();
                                     if (systemPauseOnFrame())
@@ -4502,6 +4899,7 @@ void gbEmulate(int ticksToStop)
                         if ((register_LY < kGBHeight) && (register_LCDC & 0x80) && gbScreenOn) {
                             if (!gbSgbMask) {
                                 if (gbFrameSkipCount >= framesToSkip) {
+                                    VBAM_INSTR_ZONE(kRender);
                                     if (!gbBlackScreen) {
                                         gbRenderLine();
                                         gbDrawSprites(true);
@@ -4509,8 +4907,9 @@ void gbEmulate(int ticksToStop)
                                         uint16_t color = gbColorOption ? gbColorFilter[0] : 0;
                                         if (!gbCgbMode)
                                             color = gbColorOption ? gbColorFilter[gbPalette[3] & 0x7FFF] : gbPalette[3] & 0x7FFF;
+                                        const uint32_t pixel = gbMapColor(color);
                                         for (size_t i = 0; i < kGBWidth; i++) {
-                                            gbLineMix[i] = color;
+                                            gbLineMix[i] = pixel;
                                             gbLineBuffer[i] = 0;
                                         }
                                     }
@@ -4574,8 +4973,9 @@ void gbEmulate(int ticksToStop)
                         uint16_t color = gbColorOption ? gbColorFilter[0x7FFF] : 0x7FFF;
                         if (!gbCgbMode)
                             color = gbColorOption ? gbColorFilter[gbPalette[0] & 0x7FFF] : gbPalette[0] & 0x7FFF;
+                        const uint32_t pixel = gbMapColor(color);
                         for (size_t i = 0; i < kGBWidth; i++) {
-                            gbLineMix[i] = color;
+                            gbLineMix[i] = pixel;
                             gbLineBuffer[i] = 0;
                         }
                         gbDrawLine();
@@ -4595,8 +4995,9 @@ void gbEmulate(int ticksToStop)
                         uint16_t color = gbColorOption ? gbColorFilter[0x7FFF] : 0x7FFF;
                         if (!gbCgbMode)
                             color = gbColorOption ? gbColorFilter[gbPalette[0] & 0x7FFF] : gbPalette[0] & 0x7FFF;
+                        const uint32_t pixel = gbMapColor(color);
                         for (size_t i = 0; i < kGBWidth; i++) {
-                            gbLineMix[i] = color;
+                            gbLineMix[i] = pixel;
                             gbLineBuffer[i] = 0;
                         }
                         gbDrawLine();
@@ -4609,7 +5010,7 @@ void gbEmulate(int ticksToStop)
 
                             if (!gbSgbMask) {
                                 if (gbBorderOn)
-                                    gbSgbRenderBorder();
+                                    gbSgbUpdateBorder();
                                 //if (gbScreenOn)
                                 systemDrawScreen();
                                 if (systemPauseOnFrame())
@@ -4619,22 +5020,27 @@ void gbEmulate(int ticksToStop)
                             systemSendScreen();
                         }
 
-                        gbFrameCount++;
-
                         systemFrame();
-                        gbSoundTick(soundTicks);
-
-                        if ((gbFrameCount % 10) == 0)
-                            system10Frames();
-
-                        if (gbFrameCount >= 60) {
-                            uint32_t currentTime = systemGetClock();
-                            if (currentTime != gbLastTime)
-                                systemShowSpeed(100000 / (currentTime - gbLastTime));
-                            else
-                                systemShowSpeed(0);
-                            gbLastTime = currentTime;
-                            gbFrameCount = 0;
+                        VBAM_INSTR_END_FRAME();
+                        {
+                            VBAM_INSTR_ZONE(kSound);
+                            gbSoundTick(soundTicks);
+                        }
+
+                        if (!coreOptions.speculating) {
+                            gbFrameCount++;
+                            if ((gbFrameCount % 10) == 0)
+                                system10Frames();
+
+                            if (gbFrameCount >= 60) {
+                                uint32_t currentTime = systemGetClock();
+                                if (currentTime != gbLastTime)
+                                    systemShowSpeed(100000 / (currentTime - gbLastTime));
+                                else
+                                    systemShowSpeed(0);
+                                gbLastTime = currentTime;
+                                gbFrameCount = 0;
+                            }
                         }
                         frameDone = true;
                     }
@@ -4760,6 +5166,7 @@ void gbEmulate(int ticksToStop)
         // This forces core to flush sound buffers when expected sound ticks has passed and no frame is done yet.which then ends cpuloop
         if ((soundTicks > SOUND_CLOCK_TICKS) && !frameDone) {
             int last_st = soundTicks;
+            VBAM_INSTR_ZONE(kSound);
             gbSoundTick(soundTicks);
             soundTicks = (last_st - SOUND_CLOCK_TICKS);
         }
@@ -4809,6 +5216,7 @@ void gbEmulate(int ticksToStop)
 
         // Executes the opcode(s), and apply the instruction's remaining clockTicks (if any).
         if (execute) {
+            VBAM_INSTR_COUNT(kInstructions, 1);
             switch (opcode1) {
             case 0xCB:
                 // extended opcode
@@ -4846,6 +5254,8 @@ void gbEmulate(int ticksToStop)
         if ((register_IE & register_IF & 0x1f) && (IFF & 0x81) && (!gbInterruptWait)) {
 
             if (IFF & 1) {
+                VBAM_INSTR_COUNT(kIrqs, 1);
+
                 // Add 5 ticks for the interrupt execution time
                 gbDmaTicks += 5;
 
@@ -5058,7 +5468,7 @@ bool gbReadSaveState(const uint8_t* data)
         return false;
     }
 
-    gbReset();
+    gbResetSystem(true);
 
     inBios = ib;
 
@@ -5265,6 +5675,8 @@ struct EmulatedSystem GBSystem = {
     gbWriteSaveState,   // emuWriteState
     NULL,               // emuReadMemState
     NULL,               // emuWriteMemState
+    NULL,               // emuMemStateSize
+    NULL,               // emuWriteIncrementalState
     NULL,               // emuWritePNG
     NULL,               // emuWriteBMP
 #else    
@@ -5280,6 +5692,10 @@ struct EmulatedSystem GBSystem = {
     gbReadMemSaveState,
     // emuWriteMemState
     gbWriteMemSaveState,
+    // emuMemStateSize
+    gbFlatStateMaxSize,
+    // emuWriteIncrementalState
+    NULL,
     // emuWritePNG
     gbWritePNGFile,
     // emuWriteBMP
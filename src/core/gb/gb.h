@@ -1,6 +1,7 @@
 #ifndef VBAM_CORE_GB_GB_H_
 #define VBAM_CORE_GB_GB_H_
 
+#include <cstddef>
 #include <cstdint>
 
 #include "core/gb/gbCartData.h"
@@ -36,7 +37,14 @@ bool gbLoadRomData(const char* romData, size_t romSize);
 bool gbApplyPatch(const char* patchName);
 #endif  // __LIBRETRO__
 
+// Flat, uncompressed in-memory states. gbWriteFlatState() requires a buffer of
+// at least gbFlatStateMaxSize() bytes and returns the size of the state.
+size_t gbFlatStateMaxSize();
+size_t gbWriteFlatState(uint8_t* data);
+bool gbReadFlatState(const uint8_t* data, size_t size);
+
 void gbEmulate(int);
+
 void gbWriteMemory(uint16_t, uint8_t);
 bool gbIsGameboyRom(const char*);
 void gbGetHardwareType();
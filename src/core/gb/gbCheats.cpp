@@ -71,6 +71,24 @@ void gbCheatsReadGame(gzFile gzFile, int version)
     gbCheatUpdateMap();
 }
 
+void gbCheatsSaveGame(uint8_t*& data)
+{
+    utilWriteIntMem(data, gbCheatNumber);
+    utilWriteMem(data, &gbCheatList[0], sizeof(gbCheat) * gbCheatNumber);
+}
+
+void gbCheatsReadGame(const uint8_t*& data)
+{
+    gbCheatNumber = utilReadIntMem(data);
+
+    if (gbCheatNumber < 0 || gbCheatNumber > MAX_CHEATS)
+        gbCheatNumber = 0;
+
+    utilReadMem(&gbCheatList[0], data, sizeof(gbCheat) * gbCheatNumber);
+
+    gbCheatUpdateMap();
+}
+
 void gbCheatsReadGameSkip(gzFile gzFile, int version)
 {
     if (version <= 8) {
@@ -28,6 +28,8 @@ struct gbCheat {
 void gbCheatsSaveGame(gzFile);
 void gbCheatsReadGame(gzFile, int);
 void gbCheatsReadGameSkip(gzFile, int);
+void gbCheatsSaveGame(uint8_t*&);
+void gbCheatsReadGame(const uint8_t*&);
 #endif
 void gbCheatsSaveCheatList(const char*);
 bool gbCheatsLoadCheatList(const char*);
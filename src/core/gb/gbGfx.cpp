@@ -41,13 +41,59 @@ uint8_t gbInvertTab[256] = {
     0x1f, 0x9f, 0x5f, 0xdf, 0x3f, 0xbf, 0x7f, 0xff
 };
 
-uint16_t gbLineMix[160];
+uint32_t gbLineMix[160];
 uint16_t gbWindowColor[160];
 extern int inUseRegister_WY;
 
+// gbPalette with gbColorFilter applied when gbColorOption is set, then mapped
+// through systemColorMap16/32, so the renderer writes final pixels with a
+// single lookup. The palette and the option can be changed from many places
+// (I/O registers, SGB commands, savestates and the frontends), so instead of
+// tracking every write, the table is compared with a copy of its sources once
+// per line and only rebuilt when they differ. The colour maps and depth are
+// only changed by the frontends between calls to gbEmulate(), which
+// invalidates the table.
+static uint32_t gbPaletteMix[128];
+static uint16_t gbPaletteMixSource[128];
+static bool gbPaletteMixOption = false;
+static bool gbPaletteMixValid = false;
+
+void gbInvalidatePaletteMix()
+{
+    gbPaletteMixValid = false;
+}
+
+uint32_t gbMapColor(uint16_t color)
+{
+    if (systemColorDepth == 16)
+        return systemColorMap16[color];
+    return systemColorMap32[color];
+}
+
+static void gbUpdatePaletteMix()
+{
+    if (gbPaletteMixValid && gbPaletteMixOption == gbColorOption && !memcmp(gbPaletteMixSource, gbPalette, sizeof(gbPalette)))
+        return;
+
+    memcpy(gbPaletteMixSource, gbPalette, sizeof(gbPalette));
+    gbPaletteMixOption = gbColorOption;
+    gbPaletteMixValid = true;
+
+    for (int i = 0; i < 128; i++) {
+        const uint16_t color = gbPalette[i] & 0x7FFF;
+        gbPaletteMix[i] = gbMapColor(gbColorOption ? gbColorFilter[color] : color);
+    }
+}
+
 void gbRenderLine()
 {
-    memset(gbLineMix, 0, sizeof(gbLineMix));
+    // gbDrawSprites() always runs after this for the same line, so this also
+    // covers the sprite pixels.
+    gbUpdatePaletteMix();
+
+    const uint32_t black = gbMapColor(0);
+    for (int i = 0; i < 160; i++)
+        gbLineMix[i] = black;
     uint8_t* bank0;
     uint8_t* bank1;
     if (gbCgbMode) {
@@ -158,7 +204,7 @@ void gbRenderLine()
                             c = c + 4 * palette;
                         }
                     }
-                    gbLineMix[x] = gbColorOption ? gbColorFilter[gbPalette[c] & 0x7FFF] : gbPalette[c] & 0x7FFF;
+                    gbLineMix[x] = gbPaletteMix[c];
                     x++;
                     if (x >= 160)
                         break;
@@ -203,10 +249,11 @@ void gbRenderLine()
             // Use gbBgp[0] instead of 0 (?)
             // (this fixes white flashes on Last Bible II)
             // Also added the gbColorOption (fixes Dracula Densetsu II color problems)
+            const uint32_t white = gbMapColor(gbColorOption ? gbColorFilter[0x7FFF] : 0x7FFF);
             for (int i = 0; i < 160; i++) {
-                uint16_t color = gbColorOption ? gbColorFilter[0x7FFF] : 0x7FFF;
+                uint32_t color = white;
                 if (!gbCgbMode)
-                    color = gbColorOption ? gbColorFilter[gbPalette[gbBgpLine[i + (gbSpeed ? 5 : 11) + gbSpritesTicks[i] * (gbSpeed ? 2 : 4)] & 3] & 0x7FFF] : gbPalette[gbBgpLine[i + (gbSpeed ? 5 : 11) + gbSpritesTicks[i] * (gbSpeed ? 2 : 4)] & 3] & 0x7FFF;
+                    color = gbPaletteMix[gbBgpLine[i + (gbSpeed ? 5 : 11) + gbSpritesTicks[i] * (gbSpeed ? 2 : 4)] & 3];
                 gbLineMix[i] = color;
                 gbLineBuffer[i] = 0;
             }
@@ -295,7 +342,7 @@ void gbRenderLine()
 
                     if (wx)
                         for (i = 0; i < swx; i++)
-                            gbLineMix[i] = gbWindowColor[i];
+                            gbLineMix[i] = gbMapColor(gbWindowColor[i]);
 
                     while (x < 160) {
                         uint8_t tile_a = 0;
@@ -349,7 +396,7 @@ void gbRenderLine()
                                         c = c + 4 * palette;
                                     }
                                 }
-                                gbLineMix[x] = gbColorOption ? gbColorFilter[gbPalette[c] & 0x7FFF] : gbPalette[c] & 0x7FFF;
+                                gbLineMix[x] = gbPaletteMix[c];
                             }
                             x++;
                             if (x >= 160)
@@ -386,9 +433,9 @@ void gbRenderLine()
                 gbWindowLine = 0;
         }
     } else {
-        uint16_t color = gbColorOption ? gbColorFilter[0x7FFF] : 0x7FFF;
-        if (!gbCgbMode)
-            color = gbColorOption ? gbColorFilter[gbPalette[0] & 0x7FFF] : gbPalette[0] & 0x7FFF;
+        uint32_t color = gbPaletteMix[0];
+        if (gbCgbMode)
+            color = gbMapColor(gbColorOption ? gbColorFilter[0x7FFF] : 0x7FFF);
         for (int i = 0; i < 160; i++) {
             gbLineMix[i] = color;
             gbLineBuffer[i] = 0;
@@ -519,7 +566,7 @@ void gbDrawSpriteTile(int tile, int x, int y, int t, int flags,
             }
         }
 
-        gbLineMix[xxx] = gbColorOption ? gbColorFilter[gbPalette[c] & 0x7FFF] : gbPalette[c] & 0x7FFF;
+        gbLineMix[xxx] = gbPaletteMix[c];
     }
 }
 
@@ -1,6 +1,15 @@
 #ifndef VBAM_CORE_GB_GBGFX_H_
 #define VBAM_CORE_GB_GBGFX_H_
 
+#include <cstdint>
+
+// Forces the palette lookup table used by gbRenderLine() to be rebuilt. Needed
+// when gbColorFilter or the colour maps change, gbPalette and gbColorOption
+// changes are picked up automatically.
+void gbInvalidatePaletteMix();
+// Returns the 15-bit `color` in the pixel format of systemColorDepth, as
+// stored in gbLineMix.
+uint32_t gbMapColor(uint16_t color);
 void gbRenderLine();
 void gbDrawSprites(bool);
 
@@ -2,6 +2,7 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "core/base/file_util.h"
 #include "core/base/port.h"
@@ -39,6 +40,30 @@ uint8_t gbSgbATF[20 * 18];
 uint8_t gbSgbATFList[45 * 20 * 18];
 uint8_t gbSgbScreenBuffer[4160];
 
+// The SGB border only changes on CHR_TRN/PCT_TRN transfers, palette updates
+// and state loads, so it is rendered once into g_pix and the result is kept
+// here. gbSgbUpdateBorder() then restores it with memcpy() every frame instead
+// of decoding all 896 border tiles again.
+struct gbSgbBorderCache {
+    // Copy of the border rows of g_pix after the last full render.
+    std::vector<uint8_t> pixels;
+    // Byte offsets of the opaque border pixels drawn over the game window.
+    std::vector<uint32_t> overlay;
+    // Render parameters, the cache is stale if any of these changed.
+    const uint8_t* pix = nullptr;
+    int colorDepth = 0;
+    // Output colors of gbPalette[0] and of the border palettes 4-7.
+    uint32_t colors[65];
+    bool valid = false;
+};
+
+static gbSgbBorderCache g_sgbBorderCache;
+
+static void gbSgbInvalidateBorder()
+{
+    g_sgbBorderCache.valid = false;
+}
+
 inline void gbSgbDraw24Bit(uint8_t* p, uint16_t v)
 {
     memcpy(p, &systemColorMap32[v], 3);
@@ -74,6 +99,7 @@ void gbSgbReset()
     memset(gbSgbPacket, 0, 16 * 7);
     memset(gbSgbBorderChar, 0, 32 * 256);
     memset(gbSgbBorder, 0, 2048);
+    gbSgbInvalidateBorder();
 
     int i;
     for (i = 1; i < 2048; i += 2) {
@@ -188,6 +214,53 @@ void gbSgbRenderScreenToBuffer()
     }
 }
 
+// Byte offset of border pixel (`x`, `y`) in g_pix.
+static size_t gbSgbBorderOffset(int x, int y)
+{
+    switch (systemColorDepth) {
+    case 16:
+#ifdef __LIBRETRO__
+        return ((y * 256) + x) * 2;
+#else
+        return (((y + 1) * (256 + 2)) + x) * 2;
+#endif
+    case 24:
+        return ((y * 256) + x) * 3;
+    case 32:
+#ifdef __LIBRETRO__
+        return ((y * 256) + x) * 4;
+#else
+        return (((y + 1) * (256 + 1)) + x) * 4;
+#endif
+    }
+    return 0;
+}
+
+// Fills `colors` with the output colors used by the border.
+static void gbSgbBorderColors(uint32_t* colors)
+{
+    if (systemColorDepth == 16) {
+        colors[0] = systemColorMap16[gbPalette[0]];
+        for (int i = 0; i < 64; i++)
+            colors[i + 1] = systemColorMap16[gbPalette[64 + i]];
+    } else {
+        colors[0] = systemColorMap32[gbPalette[0]];
+        for (int i = 0; i < 64; i++)
+            colors[i + 1] = systemColorMap32[gbPalette[64 + i]];
+    }
+}
+
+static bool gbSgbBorderCacheIsValid()
+{
+    if (!g_sgbBorderCache.valid || g_sgbBorderCache.pix != g_pix ||
+        g_sgbBorderCache.colorDepth != systemColorDepth)
+        return false;
+
+    uint32_t colors[65];
+    gbSgbBorderColors(colors);
+    return memcmp(colors, g_sgbBorderCache.colors, sizeof(colors)) == 0;
+}
+
 void gbSgbDrawBorderTile(int x, int y, int tile, int attr)
 {
 #ifdef __LIBRETRO__
@@ -257,6 +330,9 @@ void gbSgbDrawBorderTile(int x, int y, int tile, int attr)
                     cc = gbPalette[0];
                 }
 
+                if ((y + yyy >= 40 && y + yyy < 184) && (x + xxx >= 48 && x + xxx < 208))
+                    g_sgbBorderCache.overlay.push_back(gbSgbBorderOffset(x + xxx, y + yyy));
+
                 switch (systemColorDepth) {
                 case 16:
 #ifdef __LIBRETRO__
@@ -294,6 +370,8 @@ void gbSgbRenderBorder()
     if (gbBorderOn) {
         uint8_t* fromAddress = gbSgbBorder;
 
+        g_sgbBorderCache.overlay.clear();
+
         for (uint8_t y = 0; y < 28; y++) {
             for (uint8_t x = 0; x < 32; x++) {
                 uint8_t tile = *fromAddress++;
@@ -302,14 +380,52 @@ void gbSgbRenderBorder()
                 gbSgbDrawBorderTile(x * 8, y * 8, tile, attr);
             }
         }
+
+        const size_t size = gbSgbBorderOffset(0, 224);
+        g_sgbBorderCache.pixels.assign(g_pix, g_pix + size);
+        g_sgbBorderCache.pix = g_pix;
+        g_sgbBorderCache.colorDepth = systemColorDepth;
+        gbSgbBorderColors(g_sgbBorderCache.colors);
+        g_sgbBorderCache.valid = true;
     }
 }
 
+void gbSgbUpdateBorder()
+{
+    if (!gbBorderOn)
+        return;
+
+    if (!gbSgbBorderCacheIsValid()) {
+        gbSgbRenderBorder();
+        return;
+    }
+
+    const uint8_t* cache = g_sgbBorderCache.pixels.data();
+    const size_t bpp = systemColorDepth >> 3;
+
+    // Restore everything around the game window, then the opaque border
+    // pixels drawn over it.
+    for (int y = 0; y < 224; y++) {
+        const size_t line = gbSgbBorderOffset(0, y);
+        if (y < 40 || y >= 184) {
+            memcpy(g_pix + line, cache + line, 256 * bpp);
+        } else {
+            const size_t right = gbSgbBorderOffset(208, y);
+            memcpy(g_pix + line, cache + line, 48 * bpp);
+            memcpy(g_pix + right, cache + right, 48 * bpp);
+        }
+    }
+
+    for (const uint32_t offset : g_sgbBorderCache.overlay)
+        memcpy(g_pix + offset, cache + offset, bpp);
+}
+
 void gbSgbPicture()
 {
     gbSgbRenderScreenToBuffer();
 
     memcpy(gbSgbBorder, gbSgbScreenBuffer, 2048);
+    gbSgbInvalidateBorder();
 
     uint16_t* paletteAddr = (uint16_t*)&gbSgbScreenBuffer[2048];
 
@@ -662,6 +778,7 @@ void gbSgbChrTransfer()
         gbSgbCGBSupport |= 1;
 
     memcpy(&gbSgbBorderChar[address], gbSgbScreenBuffer, 128 * 32);
+    gbSgbInvalidateBorder();
 
     if (gbBorderAutomatic && !gbBorderOn && gbSgbCGBSupport > 4) {
         gbBorderOn = true;
@@ -882,7 +999,6 @@ variable_desc gbSgbSaveStructV3[] = {
     { NULL, 0 }
 };
 
-#ifdef __LIBRETRO__
 void gbSgbSaveGame(uint8_t*& data)
 {
     utilWriteDataMem(data, gbSgbSaveStructV3);
@@ -909,9 +1025,17 @@ void gbSgbReadGame(const uint8_t*& data)
     utilReadMem(gbSgbSCPPalette, data, 4 * 512 * sizeof(uint16_t));
     utilReadMem(gbSgbATF, data, 20 * 18);
     utilReadMem(gbSgbATFList, data, 45 * 20 * 18);
+
+    gbSgbInvalidateBorder();
 }
 
-#else // !__LIBRETRO__
+size_t gbSgbSaveGameSize()
+{
+    return utilDataSize(gbSgbSaveStructV3) + 2048 + 32 * 256 + 16 * 7 +
+           4 * 512 * sizeof(uint16_t) + 20 * 18 + 45 * 20 * 18;
+}
+
+#ifndef __LIBRETRO__
 void gbSgbSaveGame(gzFile gzFile)
 {
     utilWriteData(gzFile, gbSgbSaveStructV3);
@@ -945,5 +1069,7 @@ void gbSgbReadGame(gzFile gzFile, int version)
     utilGzRead(gzFile, gbSgbSCPPalette, 4 * 512 * sizeof(uint16_t));
     utilGzRead(gzFile, gbSgbATF, 20 * 18);
     utilGzRead(gzFile, gbSgbATFList, 45 * 20 * 18);
+
+    gbSgbInvalidateBorder();
 }
 #endif // !__LIBRETRO__
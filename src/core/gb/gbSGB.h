@@ -1,6 +1,7 @@
 #ifndef VBAM_CORE_GB_GBSGB_H_
 #define VBAM_CORE_GB_GBSGB_H_
 
+#include <cstddef>
 #include <cstdint>
 
 #if !defined(__LIBRETRO__)
@@ -14,10 +15,13 @@ void gbSgbResetPacketState();
 void gbSgbReset();
 void gbSgbDoBitTransfer(uint8_t);
 void gbSgbRenderBorder();
-#ifdef __LIBRETRO__
+// Redraws the border for a new frame, from the cached render when possible.
+void gbSgbUpdateBorder();
 void gbSgbSaveGame(uint8_t*&);
 void gbSgbReadGame(const uint8_t*&);
-#else
+// Number of bytes written by gbSgbSaveGame().
+size_t gbSgbSaveGameSize();
+#ifndef __LIBRETRO__
 void gbSgbSaveGame(gzFile);
 void gbSgbReadGame(gzFile, int version);
 #endif
@@ -101,7 +101,9 @@ void gbSoundTick(int st)
     soundTicks = 0;
 }
 
-static void reset_apu()
+// Resets the APU, dropping the samples in the output buffer unless
+// `keep_buffer`.
+static void reset_apu(bool keep_buffer = false)
 {
     Gb_Apu::mode_t mode = Gb_Apu::mode_dmg;
     if (gbHardware & 2)
@@ -111,7 +113,7 @@ static void reset_apu()
     gb_apu->reset(mode);
     gb_apu->reduce_clicks(declicking);
 
-    if (stereo_buffer)
+    if (stereo_buffer && !keep_buffer)
         stereo_buffer->clear();
 
     soundTicks = 0;
@@ -458,7 +460,6 @@ void gbSoundReadGame(int version, gzFile in)
 }
 #endif // ! __LIBRETRO__
 
-#ifdef __LIBRETRO__
 void gbSoundSaveGame(uint8_t*& out)
 {
     gb_apu->save_state(&state.apu);
@@ -472,11 +473,16 @@ void gbSoundSaveGame(uint8_t*& out)
 
 void gbSoundReadGame(const uint8_t*& in)
 {
-    // Prepare APU and default state
-    reset_apu();
+    // Prepare APU and default state. The buffered samples are kept, run-ahead
+    // and rollback restore a state every frame.
+    reset_apu(true);
     gb_apu->save_state(&state.apu);
 
     utilReadDataMem(in, gb_state);
     gb_apu->load_state(state.apu);
 }
-#endif // __LIBRETRO__
+
+size_t gbSoundSaveGameSize()
+{
+    return utilDataSize(gb_state);
+}
@@ -1,6 +1,7 @@
 #ifndef VBAM_CORE_GB_GBSOUND_H_
 #define VBAM_CORE_GB_GBSOUND_H_
 
+#include <cstddef>
 #include <cstdint>
 
 #if !defined(__LIBRETRO__)
@@ -74,10 +75,11 @@ extern int SOUND_CLOCK_TICKS; // Number of 16.8 MHz clocks between calls to gbSo
 extern int soundTicks; // Number of 16.8 MHz clocks until gbSoundTick() will be called
 
 // Saves/loads emulator state
-#ifdef __LIBRETRO__
 void gbSoundSaveGame(uint8_t*&);
 void gbSoundReadGame(const uint8_t*&);
-#else
+// Number of bytes written by gbSoundSaveGame().
+size_t gbSoundSaveGameSize();
+#ifndef __LIBRETRO__
 void gbSoundSaveGame(gzFile out);
 void gbSoundReadGame(int version, gzFile in);
 #endif
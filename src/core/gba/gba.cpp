@@ -5,18 +5,23 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
 
 #ifndef _MSC_VER
 #include <strings.h>
 #endif
 
 #include "core/base/file_util.h"
+#include "core/base/flat_state.h"
+#include "core/base/instrumentation.h"
 #include "core/base/message.h"
 #include "core/base/port.h"
 #include "core/base/sizes.h"
 #include "core/base/system.h"
 #include "core/gba/gbaCheats.h"
 #include "core/gba/gbaCpu.h"
+#include "core/gba/gbaDirty.h"
 #include "core/gba/gbaEeprom.h"
 #include "core/gba/gbaFlash.h"
 #include "core/gba/gbaGlobals.h"
@@ -30,6 +35,7 @@
 
 #if defined(VBAM_ENABLE_DEBUGGER)
 #include "core/gba/gbaElf.h"
+#include "core/gba/gbaProfiler.h"
 #endif  // defined(VBAM_ENABLE_DEBUGGER)
 
 #if !defined(NO_LINK)
@@ -37,13 +43,16 @@
 #endif  // !defined(NOLINK)
 
 #if !defined(__LIBRETRO__)
+#include "core/base/huge_pages.h"
 #include "core/base/image_util.h"
+#include "core/base/mapped_file.h"
+#include "core/base/patch.h"
+#include "core/base/rom_mapping.h"
+#include "core/base/snapshot_arena.h"
+#include "core/base/state_store.h"
+#include "core/base/write_behind.h"
 #endif // !__LIBRETRO__
 
-#ifdef PROFILING
-#include "prof/prof.h"
-#endif
-
 #ifdef __GNUC__
 #define _stricmp strcasecmp
 #endif
@@ -55,14 +64,10 @@
 extern int emulating;
 bool debugger = false;
 
-int SWITicks = 0;
 int IRQTicks = 0;
 
 uint32_t mastercode = 0;
 int layerEnableDelay = 0;
-bool busPrefetch = false;
-bool busPrefetchEnable = false;
-uint32_t busPrefetchCount = 0;
 int cpuDmaTicksToUpdate = 0;
 int cpuDmaCount = 0;
 bool cpuDmaRunning = false;
@@ -71,25 +76,15 @@ uint32_t cpuDmaPC = 0;
 int dummyAddress = 0;
 
 bool cpuBreakLoop = false;
-int cpuNextEvent = 0;
 
 bool intState = false;
 bool stopState = false;
-bool holdState = false;
 int holdType = 0;
 bool cpuSramEnabled = true;
 bool cpuFlashEnabled = true;
 bool cpuEEPROMEnabled = true;
 bool cpuEEPROMSensorEnabled = false;
 
-uint32_t cpuPrefetch[2];
-
-int cpuTotalTicks = 0;
-#ifdef PROFILING
-int profilingTicks = 0;
-int profilingTicksReload = 0;
-static profile_segment* profilSegment = NULL;
-#endif
 
 #ifdef VBAM_ENABLE_DEBUGGER
 uint8_t freezeWorkRAM[SIZE_WRAM];
@@ -160,10 +155,6 @@ const uint8_t gamepakWaitState0[2] = { 2, 1 };
 const uint8_t gamepakWaitState1[2] = { 4, 1 };
 const uint8_t gamepakWaitState2[2] = { 8, 1 };
 
-uint8_t memoryWait[16] = { 0, 0, 2, 0, 0, 0, 0, 0, 4, 4, 4, 4, 4, 4, 4, 0 };
-uint8_t memoryWait32[16] = { 0, 0, 5, 0, 0, 1, 1, 0, 7, 7, 9, 9, 13, 13, 4, 0 };
-uint8_t memoryWaitSeq[16] = { 0, 0, 2, 0, 0, 0, 0, 0, 2, 2, 4, 4, 8, 8, 4, 0 };
-uint8_t memoryWaitSeq32[16] = { 0, 0, 5, 0, 0, 1, 1, 0, 5, 5, 9, 9, 17, 17, 4, 0 };
 
 // The videoMemoryWait constants are used to add some waitstates
 // if the opcode access video memory data outside of vblank/hblank
@@ -475,37 +466,166 @@ variable_desc saveGameStruct[] = {
 
 static int romSize = SIZE_ROM;
 
-void gbaUpdateRomSize(int size)
+#if !defined(__LIBRETRO__)
+// Backing memory of g_rom, see CPULoadRom().
+static RomMapping romMapping;
+#endif  // !defined(__LIBRETRO__)
+
+// Allocates g_rom. Its pages are only committed when written to.
+static bool CPUAllocateRom()
 {
-    // Only change memory block if new size is larger
-    if (size > romSize) {
-        romSize = size;
+#if defined(__LIBRETRO__)
+    g_rom = (uint8_t*)malloc(SIZE_ROM);
+#else
+    g_rom = romMapping.Reserve(SIZE_ROM) ? romMapping.data() : NULL;
+#endif  // defined(__LIBRETRO__)
+    return g_rom != NULL;
+}
 
-        uint8_t* tmp = (uint8_t*)realloc(g_rom, SIZE_ROM);
-        g_rom = tmp;
+static void CPUFreeRom()
+{
+#if !defined(__LIBRETRO__)
+    if (g_rom == romMapping.data()) {
+        romMapping.Release();
+        g_rom = NULL;
+        return;
+    }
+#endif  // !defined(__LIBRETRO__)
+    // Allocated by the frontend, e.g. the SDL debugger stub.
+    free(g_rom);
+    g_rom = NULL;
+}
+
+#if !defined(__LIBRETRO__)
+// Backing memory of the RAMs and I/O registers, a single huge page where
+// available, so that the CPU reaches all of them through one TLB entry.
+static HugePageBuffer memoryArena;
+static size_t memoryArenaUsed = 0;
+// Buffers allocated from memoryArena and not freed yet.
+static int memoryArenaBlocks = 0;
+#endif  // !defined(__LIBRETRO__)
+
+// Allocates `size` bytes of zeroes for the emulated memory.
+static uint8_t* CPUAllocateMemory(size_t size)
+{
+#if !defined(__LIBRETRO__)
+    // The arena is released with its last buffer, so it is still zeroed.
+    if (memoryArena.data() != NULL || memoryArena.Allocate(kHugePageSize)) {
+        if (memoryArenaUsed + size <= memoryArena.size()) {
+            uint8_t* data = memoryArena.data() + memoryArenaUsed;
+            memoryArenaUsed += size;
+            memoryArenaBlocks++;
+            return data;
+        }
+    }
+#endif  // !defined(__LIBRETRO__)
+    return (uint8_t*)calloc(1, size);
+}
 
-        uint16_t* temp = (uint16_t*)(g_rom + ((romSize + 1) & ~1));
-        for (int i = (romSize + 1) & ~1; i < SIZE_ROM; i += 2) {
-            WRITE16LE(temp, (i >> 1) & 0xFFFF);
-            temp++;
+static void CPUFreeMemory(uint8_t* data)
+{
+#if !defined(__LIBRETRO__)
+    if (data >= memoryArena.data() && data < memoryArena.data() + memoryArena.size()) {
+        if (--memoryArenaBlocks == 0) {
+            memoryArena.Release();
+            memoryArenaUsed = 0;
         }
+        return;
     }
+#endif  // !defined(__LIBRETRO__)
+    // Also allocated by the frontend, e.g. the SDL debugger stub.
+    free(data);
 }
 
-#ifdef PROFILING
-void cpuProfil(profile_segment* seg)
+// Fills the ROM space past `size` bytes with the values read from the open
+// bus: the low halfword of the address divided by 2.
+static void CPUFillRomOpenBus(int size)
 {
-    profilSegment = seg;
+#if defined(__LIBRETRO__)
+    uint16_t* temp = (uint16_t*)(g_rom + ((size + 1) & ~1));
+    for (int i = (size + 1) & ~1; i < SIZE_ROM; i += 2) {
+        WRITE16LE(temp, (i >> 1) & 0xFFFF);
+        temp++;
+    }
+#else
+    // The values repeat every 128 KiB, so the pattern is only stored once
+    // instead of committing the whole 32 MiB.
+    std::vector<uint8_t> pattern(0x20000);
+    for (size_t i = 0; i < pattern.size(); i += 2) {
+        WRITE16LE(&pattern[i], (i >> 1) & 0xFFFF);
+    }
+    romMapping.FillPattern((size + 1) & ~1, pattern.data(), pattern.size());
+#endif  // defined(__LIBRETRO__)
 }
 
-void cpuEnableProfiling(int hz)
+bool CPUIsELF(const char* file);
+
+// Maps the uncompressed, read-only ROM images copy-on-write, so that the
+// processes running the same ROM share its pages. Returns false if the image
+// must be loaded instead.
+static bool CPUMapRom(const char* szFile)
 {
-    if (hz == 0)
-        hz = 100;
-    profilingTicks = profilingTicksReload = 16777216 / hz;
-    profSetHertz(hz);
+#if defined(__LIBRETRO__)
+    (void)szFile;
+    return false;
+#else
+    // This also flags the multiboot images, loaded in WRAM. ELF images are
+    // development builds, rewritten by every build.
+    if (!utilIsGBAImage(szFile) || coreOptions.cpuIsMultiBoot || CPUIsELF(szFile))
+        return false;
+
+    const size_t size = romMapping.MapFile(szFile);
+    if (size == 0)
+        return false;
+    romSize = (int)size;
+    return true;
+#endif  // defined(__LIBRETRO__)
 }
-#endif
+
+// Shares the pages of the ROM images loaded by utilLoad(), e.g. writable or
+// compressed files, through a read-only copy in the ROM cache.
+static void CPUShareLoadedRom(const char* szFile)
+{
+#if defined(__LIBRETRO__)
+    (void)szFile;
+#else
+    // ELF images are development builds, each would add a copy to the cache.
+    if (coreOptions.cpuIsMultiBoot || CPUIsELF(szFile))
+        return;
+
+    romMapping.MapCached(romSize);
+#endif  // defined(__LIBRETRO__)
+}
+
+#if !defined(__LIBRETRO__)
+bool CPUApplyPatch(const char* patchName)
+{
+    // The patchers reallocate the ROM to grow it, so they work on a copy of
+    // the ROM only.
+    int size = romSize < SIZE_ROM ? romSize : SIZE_ROM;
+    uint8_t* rom = (uint8_t*)malloc(size);
+    if (rom == NULL)
+        return false;
+    memcpy(rom, g_rom, size);
+
+    const bool result = applyPatch(patchName, &rom, &size);
+    if (result) {
+        if (size > SIZE_ROM)
+            size = SIZE_ROM;
+        // Only the modified pages are written, the others stay shared.
+        for (int i = 0; i < size; i += 0x1000) {
+            const int length = size - i < 0x1000 ? size - i : 0x1000;
+            if (memcmp(g_rom + i, rom + i, length) != 0)
+                memcpy(g_rom + i, rom + i, length);
+        }
+        if (size > romSize)
+            romSize = size;
+    }
+
+    free(rom);
+    return result;
+}
+#endif  // !defined(__LIBRETRO__)
 
 inline int CPUUpdateTicks()
 {
@@ -526,13 +646,11 @@ inline int CPUUpdateTicks()
     if (timer3On && !(TM3CNT & 4) && (timer3Ticks < cpuLoopTicks)) {
         cpuLoopTicks = timer3Ticks;
     }
-#ifdef PROFILING
-    if (profilingTicksReload != 0) {
-        if (profilingTicks < cpuLoopTicks) {
-            cpuLoopTicks = profilingTicks;
-        }
+#if defined(VBAM_ENABLE_DEBUGGER)
+    if (gbaProfilerInterval != 0 && gbaProfilerTicks < cpuLoopTicks) {
+        cpuLoopTicks = gbaProfilerTicks;
     }
-#endif
+#endif  // defined(VBAM_ENABLE_DEBUGGER)
 
     if (SWITicks) {
         if (SWITicks < cpuLoopTicks)
@@ -608,6 +726,336 @@ void CPUUpdateRenderBuffers(bool force)
     }
 }
 
+// Rebuilds the derived emulator state after the state variables were loaded.
+static void CPUUpdateLoadedState()
+{
+    // The whole memory was replaced.
+    gbaDirtyMarkAll();
+
+    // set pointers!
+    coreOptions.layerEnable = coreOptions.layerSettings & DISPCNT;
+
+    CPUUpdateRender();
+    CPUUpdateRenderBuffers(true);
+    CPUUpdateWindow0();
+    CPUUpdateWindow1();
+
+    SetSaveType(coreOptions.saveType);
+
+    systemSaveUpdateCounter = SYSTEM_SAVE_NOT_UPDATED;
+    if (armState) {
+        ARM_PREFETCH;
+    } else {
+        THUMB_PREFETCH;
+    }
+
+    CPUUpdateRegister(0x204, CPUReadHalfWordQuick(0x4000204));
+}
+
+// Flat state section identifiers.
+static constexpr uint32_t kGbaSectionHeader = flatStateFourCC('A', 'H', 'D', 'R');
+static constexpr uint32_t kGbaSectionCpu = flatStateFourCC('A', 'C', 'P', 'U');
+static constexpr uint32_t kGbaSectionIram = flatStateFourCC('A', 'I', 'R', 'M');
+static constexpr uint32_t kGbaSectionPram = flatStateFourCC('A', 'P', 'R', 'M');
+static constexpr uint32_t kGbaSectionWram = flatStateFourCC('A', 'W', 'R', 'M');
+static constexpr uint32_t kGbaSectionVram = flatStateFourCC('A', 'V', 'R', 'M');
+static constexpr uint32_t kGbaSectionOam = flatStateFourCC('A', 'O', 'A', 'M');
+static constexpr uint32_t kGbaSectionIo = flatStateFourCC('A', 'I', 'O', 'M');
+static constexpr uint32_t kGbaSectionEeprom = flatStateFourCC('A', 'E', 'E', 'P');
+static constexpr uint32_t kGbaSectionFlash = flatStateFourCC('A', 'F', 'L', 'A');
+static constexpr uint32_t kGbaSectionSound = flatStateFourCC('A', 'S', 'N', 'D');
+static constexpr uint32_t kGbaSectionRtc = flatStateFourCC('A', 'R', 'T', 'C');
+static constexpr uint32_t kGbaSectionCheats = flatStateFourCC('A', 'C', 'H', 'T');
+static constexpr uint32_t kGbaSectionPix = flatStateFourCC('A', 'P', 'I', 'X');
+
+size_t CPUFlatStateMaxSize()
+{
+    // The registers, EEPROM, flash, sound and RTC state are well below the
+    // slack added at the end.
+    return kFlatStateDataOffset + sizeof(reg) + SIZE_IRAM + SIZE_PRAM + SIZE_WRAM + SIZE_VRAM +
+        SIZE_OAM + SIZE_IOMEM + SIZE_EEPROM_8K + SIZE_FLASH1M + k16KiB;
+}
+
+// Size of the buffer needed by the file states, which also hold the frame
+// buffer and the cheat list.
+static size_t CPUFlatStateFileMaxSize()
+{
+#ifndef __LIBRETRO__
+    return CPUFlatStateMaxSize() + SIZE_PIX + sizeof(int) + sizeof(cheatsList);
+#else
+    return CPUFlatStateMaxSize();
+#endif
+}
+
+// Copies the pages of `memory` flagged in `pages` to `out`, which is at
+// `offset` in the state, and flags the state blocks they land in.
+static void CPUWriteDirtyPages(uint8_t* out, const uint8_t* memory, const uint64_t* pages,
+    size_t words, size_t offset, uint64_t* dirty)
+{
+    for (size_t word = 0; word < words; word++) {
+        if (pages[word] == 0)
+            continue;
+
+        for (size_t bit = 0; bit < 64; bit++) {
+            if ((pages[word] >> bit) & 1) {
+                const size_t page = (word * 64 + bit) * kGbaDirtyPageSize;
+                memcpy(out + page, memory + page, kGbaDirtyPageSize);
+                flatStateMarkDirty(dirty, offset + page, kGbaDirtyPageSize);
+            }
+        }
+    }
+}
+
+// Writes a flat state. The frame buffer and the cheat list are only saved in
+// files, the memory states are restored before the next frame is emulated.
+//
+// With `dirty`, only the WRAM and VRAM pages flagged in gbaDirtyWram and
+// gbaDirtyVram are copied, over the previous state left in `data`, and the
+// blocks of the state that were written are flagged in `dirty`.
+static size_t CPUWriteFlatState(uint8_t* data, bool file, uint64_t* dirty = nullptr)
+{
+    FlatStateWriter writer(data, FlatStateSystem::kGBA, SAVE_GAME_VERSION);
+
+    writer.BeginSection(kGbaSectionHeader);
+    utilWriteMem(writer.cursor(), &g_rom[0xa0], 16);
+    utilWriteIntMem(writer.cursor(), coreOptions.useBios);
+    writer.EndSection();
+
+    writer.BeginSection(kGbaSectionCpu);
+    utilWriteMem(writer.cursor(), &reg[0], sizeof(reg));
+    utilWriteDataMem(writer.cursor(), saveGameStruct);
+    utilWriteIntMem(writer.cursor(), stopState);
+    utilWriteIntMem(writer.cursor(), IRQTicks);
+    writer.EndSection();
+
+    writer.BeginSection(kGbaSectionIram);
+    utilWriteMem(writer.cursor(), g_internalRAM, SIZE_IRAM);
+    writer.EndSection();
+
+    writer.BeginSection(kGbaSectionPram);
+    utilWriteMem(writer.cursor(), g_paletteRAM, SIZE_PRAM);
+    writer.EndSection();
+
+    writer.BeginSection(kGbaSectionWram);
+    const size_t wram_offset = writer.cursor() - data;
+    if (dirty) {
+        CPUWriteDirtyPages(writer.cursor(), g_workRAM, gbaDirtyWram, kGbaDirtyWramWords,
+            wram_offset, dirty);
+        writer.cursor() += SIZE_WRAM;
+    } else {
+        utilWriteMem(writer.cursor(), g_workRAM, SIZE_WRAM);
+    }
+    writer.EndSection();
+
+    writer.BeginSection(kGbaSectionVram);
+    const size_t vram_offset = writer.cursor() - data;
+    if (dirty) {
+        CPUWriteDirtyPages(writer.cursor(), g_vram, gbaDirtyVram, kGbaDirtyVramWords,
+            vram_offset, dirty);
+        writer.cursor() += SIZE_VRAM;
+    } else {
+        utilWriteMem(writer.cursor(), g_vram, SIZE_VRAM);
+    }
+    writer.EndSection();
+    const size_t vram_end = writer.cursor() - data;
+
+    writer.BeginSection(kGbaSectionOam);
+    utilWriteMem(writer.cursor(), g_oam, SIZE_OAM);
+    writer.EndSection();
+
+    writer.BeginSection(kGbaSectionIo);
+    utilWriteMem(writer.cursor(), g_ioMem, SIZE_IOMEM);
+    writer.EndSection();
+
+    writer.BeginSection(kGbaSectionEeprom);
+    eepromSaveGame(writer.cursor());
+    writer.EndSection();
+
+    writer.BeginSection(kGbaSectionFlash);
+    flashSaveGame(writer.cursor());
+    writer.EndSection();
+
+    writer.BeginSection(kGbaSectionSound);
+    soundSaveGame(writer.cursor());
+    writer.EndSection();
+
+    writer.BeginSection(kGbaSectionRtc);
+    rtcSaveGame(writer.cursor());
+    writer.EndSection();
+
+#ifndef __LIBRETRO__
+    if (file) {
+        // The frontends present the frame buffer once the state is loaded.
+        writer.BeginSection(kGbaSectionPix);
+        utilWriteMem(writer.cursor(), g_pix, SIZE_PIX);
+        writer.EndSection();
+
+        writer.BeginSection(kGbaSectionCheats);
+        cheatsSaveGame(writer.cursor());
+        writer.EndSection();
+    }
+#else
+    (void)file;
+#endif
+
+    const size_t size = writer.Finish();
+    if (dirty) {
+        // Everything but WRAM and VRAM is small and copied in full, the
+        // header and the section table included.
+        flatStateMarkDirty(dirty, 0, wram_offset);
+        flatStateMarkDirty(dirty, vram_end, size - vram_end);
+    }
+    return size;
+}
+
+size_t CPUWriteFlatState(uint8_t* data)
+{
+    return CPUWriteFlatState(data, false);
+}
+
+size_t CPUWriteIncrementalState(uint8_t* data, size_t size, bool full, uint64_t* dirty)
+{
+    if (size < CPUFlatStateMaxSize()) {
+        return 0;
+    }
+
+    // `data` does not hold the previous state, every page has to be copied.
+    if (full) {
+        gbaDirtyMarkAll();
+    }
+
+    const size_t written = CPUWriteFlatState(data, false, dirty);
+    gbaDirtyClear();
+    return written;
+}
+
+// Returns true if section `id` is present and contains exactly `size` bytes.
+static bool CPUCheckFlatSection(FlatStateReader& reader, uint32_t id, size_t size)
+{
+    return reader.OpenSection(id) && reader.section_size() == size;
+}
+
+// Reads a section of raw memory validated by CPUCheckFlatSection().
+static void CPUReadFlatMemory(FlatStateReader& reader, uint32_t id, uint8_t* dst, size_t size)
+{
+    reader.OpenSection(id);
+    utilReadMem(dst, reader.cursor(), (unsigned)size);
+}
+
+bool CPUReadFlatState(const uint8_t* data, size_t size)
+{
+    FlatStateReader reader;
+    if (!reader.Open(data, size, FlatStateSystem::kGBA, CPUFlatStateFileMaxSize()) ||
+        reader.system_version() != SAVE_GAME_VERSION) {
+        return false;
+    }
+
+    if (!CPUCheckFlatSection(reader, kGbaSectionHeader, 16 + sizeof(int))) {
+        return false;
+    }
+
+    uint8_t romname[17];
+    utilReadMem(romname, reader.cursor(), 16);
+    if (memcmp(&g_rom[0xa0], romname, 16) != 0) {
+        romname[16] = 0;
+        for (int i = 0; i < 16; i++)
+            if (romname[i] < 32)
+                romname[i] = 32;
+        systemMessage(MSG_CANNOT_LOAD_SGM, N_("Cannot load save game for %s"), romname);
+        return false;
+    }
+
+    const bool ub = utilReadIntMem(reader.cursor()) ? true : false;
+    if (ub != (bool)(coreOptions.useBios)) {
+        if (coreOptions.useBios)
+            systemMessage(MSG_SAVE_GAME_NOT_USING_BIOS,
+                N_("Save game is not using the BIOS files"));
+        else
+            systemMessage(MSG_SAVE_GAME_USING_BIOS,
+                N_("Save game is using the BIOS file"));
+        return false;
+    }
+
+    // Validate the size of every section before touching any of the emulator
+    // state.
+    if (!CPUCheckFlatSection(reader, kGbaSectionCpu,
+                             sizeof(reg) + utilDataSize(saveGameStruct) + 2 * sizeof(int)) ||
+        !CPUCheckFlatSection(reader, kGbaSectionIram, SIZE_IRAM) ||
+        !CPUCheckFlatSection(reader, kGbaSectionPram, SIZE_PRAM) ||
+        !CPUCheckFlatSection(reader, kGbaSectionWram, SIZE_WRAM) ||
+        !CPUCheckFlatSection(reader, kGbaSectionVram, SIZE_VRAM) ||
+        !CPUCheckFlatSection(reader, kGbaSectionOam, SIZE_OAM) ||
+        !CPUCheckFlatSection(reader, kGbaSectionIo, SIZE_IOMEM) ||
+        !CPUCheckFlatSection(reader, kGbaSectionEeprom, eepromSaveGameSize()) ||
+        !CPUCheckFlatSection(reader, kGbaSectionFlash, flashSaveGameSize()) ||
+        !CPUCheckFlatSection(reader, kGbaSectionSound, soundSaveGameSize()) ||
+        !CPUCheckFlatSection(reader, kGbaSectionRtc, rtcSaveGameSize())) {
+        return false;
+    }
+
+#ifndef __LIBRETRO__
+    if (reader.OpenSection(kGbaSectionCheats)) {
+        const int count = utilReadIntMem(reader.cursor());
+        if (count < 0 || count > MAX_CHEATS ||
+            reader.section_size() != sizeof(int) + count * sizeof(CheatsData)) {
+            return false;
+        }
+    }
+    if (reader.OpenSection(kGbaSectionPix) && reader.section_size() != SIZE_PIX) {
+        return false;
+    }
+#endif
+
+    // From here on, the load cannot fail: every section has the size its
+    // reader consumes.
+    reader.OpenSection(kGbaSectionCpu);
+    utilReadMem(&reg[0], reader.cursor(), sizeof(reg));
+    utilReadDataMem(reader.cursor(), saveGameStruct);
+    stopState = utilReadIntMem(reader.cursor()) ? true : false;
+    IRQTicks = utilReadIntMem(reader.cursor());
+    if (IRQTicks > 0)
+        intState = true;
+    else {
+        intState = false;
+        IRQTicks = 0;
+    }
+
+    CPUReadFlatMemory(reader, kGbaSectionIram, g_internalRAM, SIZE_IRAM);
+    CPUReadFlatMemory(reader, kGbaSectionPram, g_paletteRAM, SIZE_PRAM);
+    CPUReadFlatMemory(reader, kGbaSectionWram, g_workRAM, SIZE_WRAM);
+    CPUReadFlatMemory(reader, kGbaSectionVram, g_vram, SIZE_VRAM);
+    CPUReadFlatMemory(reader, kGbaSectionOam, g_oam, SIZE_OAM);
+    CPUReadFlatMemory(reader, kGbaSectionIo, g_ioMem, SIZE_IOMEM);
+
+    if (!coreOptions.skipSaveGameBattery) {
+        reader.OpenSection(kGbaSectionEeprom);
+        eepromReadGame(reader.cursor());
+
+        reader.OpenSection(kGbaSectionFlash);
+        flashReadGame(reader.cursor());
+    }
+
+    reader.OpenSection(kGbaSectionSound);
+    soundReadGame(reader.cursor());
+
+#ifndef __LIBRETRO__
+    if (!coreOptions.skipSaveGameCheats && reader.OpenSection(kGbaSectionCheats)) {
+        cheatsReadGame(reader.cursor());
+    }
+    // Only in file states, the memory states are loaded between frames.
+    if (reader.OpenSection(kGbaSectionPix)) {
+        utilReadMem(g_pix, reader.cursor(), SIZE_PIX);
+    }
+#endif
+
+    reader.OpenSection(kGbaSectionRtc);
+    rtcReadGame(reader.cursor());
+
+    CPUUpdateLoadedState();
+
+    return true;
+}
+
 #ifdef __LIBRETRO__
 #include <stddef.h>
 
@@ -683,109 +1131,46 @@ bool CPUReadState(const uint8_t* data)
     soundReadGame(data);
     rtcReadGame(data);
 
-    //// Copypasta stuff ...
-    // set pointers!
-    coreOptions.layerEnable = coreOptions.layerSettings & DISPCNT;
-
-    CPUUpdateRender();
-
-    // CPU Update Render Buffers set to true
-    CLEAR_ARRAY(g_line0);
-    CLEAR_ARRAY(g_line1);
-    CLEAR_ARRAY(g_line2);
-    CLEAR_ARRAY(g_line3);
-    // End of CPU Update Render Buffers set to true
-
-    CPUUpdateWindow0();
-    CPUUpdateWindow1();
-
-    SetSaveType(coreOptions.saveType);
-
-    systemSaveUpdateCounter = SYSTEM_SAVE_NOT_UPDATED;
-    if (armState) {
-        ARM_PREFETCH;
-    } else {
-        THUMB_PREFETCH;
-    }
-
-    CPUUpdateRegister(0x204, CPUReadHalfWordQuick(0x4000204));
+    CPUUpdateLoadedState();
 
     return true;
 }
 
 #else // !__LIBRETRO__
 
-static bool CPUWriteState(gzFile gzFile)
-{
-    utilWriteInt(gzFile, SAVE_GAME_VERSION);
-
-    utilGzWrite(gzFile, &g_rom[0xa0], 16);
-
-    utilWriteInt(gzFile, coreOptions.useBios);
-
-    utilGzWrite(gzFile, &reg[0], sizeof(reg));
-
-    utilWriteData(gzFile, saveGameStruct);
-
-    // new to version 0.7.1
-    utilWriteInt(gzFile, stopState);
-    // new to version 0.8
-    utilWriteInt(gzFile, IRQTicks);
-
-    utilGzWrite(gzFile, g_internalRAM, SIZE_IRAM);
-    utilGzWrite(gzFile, g_paletteRAM, SIZE_PRAM);
-    utilGzWrite(gzFile, g_workRAM, SIZE_WRAM);
-    utilGzWrite(gzFile, g_vram, SIZE_VRAM);
-    utilGzWrite(gzFile, g_oam, SIZE_OAM);
-    utilGzWrite(gzFile, g_pix, SIZE_PIX);
-    utilGzWrite(gzFile, g_ioMem, SIZE_IOMEM);
-
-    eepromSaveGame(gzFile);
-    flashSaveGame(gzFile);
-    soundSaveGame(gzFile);
-
-    cheatsSaveGame(gzFile);
-
-    // version 1.5
-    rtcSaveGame(gzFile);
-
-    return true;
-}
-
 bool CPUWriteState(const char* file)
 {
-    gzFile gzFile = utilGzOpen(file, "wb");
-
-    if (gzFile == NULL) {
-        systemMessage(MSG_ERROR_CREATING_FILE, N_("Error creating file %s"), file);
-        return false;
-    }
-
-    bool res = CPUWriteState(gzFile);
-
-    utilGzClose(gzFile);
-
-    return res;
+    // Save states are written as flat states with every section stored
+    // as-is, so that loading them can copy the sections straight from the
+    // mapped file, or in g_stateStore when set. Only the flat state is
+    // written on the emulation thread.
+    std::vector<uint8_t> state =
+        snapshotArena().Acquire(CPUFlatStateFileMaxSize());
+    state.resize(CPUWriteFlatState(state.data(), true));
+
+    const std::string name = file;
+    return writeBehindSubmit(
+        file, std::move(state),
+        [store = g_stateStore, name](const std::vector<uint8_t>& data,
+                                     std::vector<uint8_t>* contents) {
+            return stateStoreEncodeFile(store, name, data.data(), data.size(), contents);
+        },
+        [name](bool written) {
+            if (!written)
+                systemMessage(MSG_ERROR_CREATING_FILE, N_("Error creating file %s"), name.c_str());
+        });
 }
 
 bool CPUWriteMemState(char* memory, int available, long& reserved)
 {
-    gzFile gzFile = utilMemGzOpen(memory, available, "w");
-
-    if (gzFile == NULL) {
+    // Memory states are only used for rewind, so they are written as flat,
+    // uncompressed states.
+    if (available < 0 || (size_t)available < CPUFlatStateMaxSize()) {
         return false;
     }
 
-    bool res = CPUWriteState(gzFile);
-
-    reserved = utilGzMemTell(gzFile) + 8;
-
-    if (reserved >= (available))
-        res = false;
-
-    utilGzClose(gzFile);
-
-    return res;
+    reserved = CPUWriteFlatState((uint8_t*)memory);
+    return true;
 }
 
 static bool CPUReadState(gzFile gzFile)
@@ -911,30 +1296,17 @@ static bool CPUReadState(gzFile gzFile)
         interp_rate();
     }
 
-    // set pointers!
-    coreOptions.layerEnable = coreOptions.layerSettings & DISPCNT;
-
-    CPUUpdateRender();
-    CPUUpdateRenderBuffers(true);
-    CPUUpdateWindow0();
-    CPUUpdateWindow1();
-
-    SetSaveType(coreOptions.saveType);
-
-    systemSaveUpdateCounter = SYSTEM_SAVE_NOT_UPDATED;
-    if (armState) {
-        ARM_PREFETCH;
-    } else {
-        THUMB_PREFETCH;
-    }
-
-    CPUUpdateRegister(0x204, CPUReadHalfWordQuick(0x4000204));
+    CPUUpdateLoadedState();
 
     return true;
 }
 
 bool CPUReadMemState(char* memory, int available)
 {
+    if (flatStateIsFlat((const uint8_t*)memory, available)) {
+        return CPUReadFlatState((const uint8_t*)memory, available);
+    }
+
     gzFile gzFile = utilMemGzOpen(memory, available, "r");
 
     bool res = CPUReadState(gzFile);
@@ -946,6 +1318,34 @@ bool CPUReadMemState(char* memory, int available)
 
 bool CPUReadState(const char* file)
 {
+    // The file may still be queued for writing.
+    if (g_writeBehind != nullptr)
+        g_writeBehind->Flush();
+
+    MappedFile mapped;
+    if (!mapped.Open(file))
+        return false;
+
+    if (stateStoreIsReference(mapped.data(), mapped.size())) {
+        std::vector<uint8_t> contents;
+        if (!stateStoreLoadFile(file, mapped.data(), mapped.size(), &contents) ||
+            !CPUReadFlatState(contents.data(), contents.size())) {
+            systemMessage(MSG_FAILED_TO_READ_SGM, N_("Failed to read save game %s"), file);
+            return false;
+        }
+        return true;
+    }
+
+    if (flatStateIsFlat(mapped.data(), mapped.size())) {
+        if (!CPUReadFlatState(mapped.data(), mapped.size())) {
+            systemMessage(MSG_FAILED_TO_READ_SGM, N_("Failed to read save game %s"), file);
+            return false;
+        }
+        return true;
+    }
+    mapped.Close();
+
+    // Save states written before flat states are gzip streams.
     gzFile gzFile = utilGzOpen(file, "rb");
 
     if (gzFile == NULL)
@@ -984,40 +1384,32 @@ bool CPUExportEepromFile(const char* fileName)
     return true;
 }
 
+#ifndef __LIBRETRO__
 bool CPUWriteBatteryFile(const char* fileName)
 {
     if ((coreOptions.saveType) && (coreOptions.saveType != GBA_SAVE_NONE)) {
-        FILE* file = utilOpenFile(fileName, "wb");
-
-        if (!file) {
-            systemMessage(MSG_ERROR_CREATING_FILE, N_("Error creating file %s"),
-                fileName);
-            return false;
-        }
+        std::vector<uint8_t> data;
 
         // only save if Flash/Sram in use or EEprom in use
         if (!eepromInUse) {
             if (coreOptions.saveType == GBA_SAVE_FLASH) { // save flash type
-                if (fwrite(flashSaveMemory, 1, g_flashSize, file) != (size_t)g_flashSize) {
-                    fclose(file);
-                    return false;
-                }
+                data.assign(flashSaveMemory, flashSaveMemory + g_flashSize);
             } else if (coreOptions.saveType == GBA_SAVE_SRAM) { // save sram type
-                if (fwrite(flashSaveMemory, 1, 0x8000, file) != 0x8000) {
-                    fclose(file);
-                    return false;
-                }
+                data.assign(flashSaveMemory, flashSaveMemory + 0x8000);
             }
         } else { // save eeprom type
-            if (fwrite(eepromData, 1, eepromSize, file) != (size_t)eepromSize) {
-                fclose(file);
-                return false;
-            }
+            data.assign(eepromData, eepromData + eepromSize);
         }
-        fclose(file);
+
+        const std::string name = fileName;
+        return writeBehindSubmit(fileName, std::move(data), nullptr, [name](bool written) {
+            if (!written)
+                systemMessage(MSG_ERROR_CREATING_FILE, N_("Error creating file %s"), name.c_str());
+        });
     }
     return true;
 }
+#endif // !__LIBRETRO__
 
 bool CPUReadGSASnapshot(const char* fileName)
 {
@@ -1246,6 +1638,12 @@ bool CPUImportEepromFile(const char* fileName)
 
 bool CPUReadBatteryFile(const char* fileName)
 {
+#ifndef __LIBRETRO__
+    // The file may still be queued for writing.
+    if (g_writeBehind != nullptr)
+        g_writeBehind->Flush();
+#endif
+
     FILE* file = utilOpenFile(fileName, "rb");
 
     if (!file)
@@ -1378,34 +1776,27 @@ bool CPUIsELF(const char* file)
 
 void CPUCleanUp()
 {
-#ifdef PROFILING
-    if (profilingTicksReload) {
-        profCleanup();
-    }
-#endif
-
     if (g_rom != NULL) {
-        free(g_rom);
-        g_rom = NULL;
+        CPUFreeRom();
     }
 
     if (g_vram != NULL) {
-        free(g_vram);
+        CPUFreeMemory(g_vram);
         g_vram = NULL;
     }
 
     if (g_paletteRAM != NULL) {
-        free(g_paletteRAM);
+        CPUFreeMemory(g_paletteRAM);
         g_paletteRAM = NULL;
     }
 
     if (g_internalRAM != NULL) {
-        free(g_internalRAM);
+        CPUFreeMemory(g_internalRAM);
         g_internalRAM = NULL;
     }
 
     if (g_workRAM != NULL) {
-        free(g_workRAM);
+        CPUFreeMemory(g_workRAM);
         g_workRAM = NULL;
     }
 
@@ -1420,12 +1811,12 @@ void CPUCleanUp()
     }
 
     if (g_oam != NULL) {
-        free(g_oam);
+        CPUFreeMemory(g_oam);
         g_oam = NULL;
     }
 
     if (g_ioMem != NULL) {
-        free(g_ioMem);
+        CPUFreeMemory(g_ioMem);
         g_ioMem = NULL;
     }
 
@@ -1488,13 +1879,12 @@ int CPULoadRom(const char* szFile)
 
     systemSaveUpdateCounter = SYSTEM_SAVE_NOT_UPDATED;
 
-    g_rom = (uint8_t*)malloc(SIZE_ROM);
-    if (g_rom == NULL) {
+    if (!CPUAllocateRom()) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "ROM");
         return 0;
     }
-    g_workRAM = (uint8_t*)calloc(1, SIZE_WRAM);
+    g_workRAM = CPUAllocateMemory(SIZE_WRAM);
     if (g_workRAM == NULL) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "WRAM");
@@ -1509,17 +1899,15 @@ int CPULoadRom(const char* szFile)
         if (!f) {
             systemMessage(MSG_ERROR_OPENING_IMAGE, N_("Error opening image %s"),
                 szFile);
-            free(g_rom);
-            g_rom = NULL;
-            free(g_workRAM);
+            CPUFreeRom();
+            CPUFreeMemory(g_workRAM);
             g_workRAM = NULL;
             return 0;
         }
         bool res = elfRead(szFile, romSize, f);
         if (!res || romSize == 0) {
-            free(g_rom);
-            g_rom = NULL;
-            free(g_workRAM);
+            CPUFreeRom();
+            CPUFreeMemory(g_workRAM);
             g_workRAM = NULL;
             elfCleanUp();
             return 0;
@@ -1527,24 +1915,21 @@ int CPULoadRom(const char* szFile)
     } else
 #endif  // defined(VBAM_ENABLE_DEBUGGER)
         if (szFile != NULL) {
-        if (!utilLoad(szFile,
-                utilIsGBAImage,
-                whereToLoad,
-                romSize)) {
-            free(g_rom);
-            g_rom = NULL;
-            free(g_workRAM);
-            g_workRAM = NULL;
-            return 0;
+        if (!CPUMapRom(szFile)) {
+            if (!utilLoad(szFile,
+                    utilIsGBAImage,
+                    whereToLoad,
+                    romSize)) {
+                CPUFreeRom();
+                CPUFreeMemory(g_workRAM);
+                g_workRAM = NULL;
+                return 0;
+            }
+            CPUShareLoadedRom(szFile);
         }
     }
 
-    uint16_t* temp = (uint16_t*)(g_rom + ((romSize + 1) & ~1));
-    int i;
-    for (i = (romSize + 1) & ~1; i < SIZE_ROM; i += 2) {
-        WRITE16LE(temp, (i >> 1) & 0xFFFF);
-        temp++;
-    }
+    CPUFillRomOpenBus(romSize);
 
     g_bios = (uint8_t*)calloc(1, SIZE_BIOS);
     if (g_bios == NULL) {
@@ -1553,28 +1938,28 @@ int CPULoadRom(const char* szFile)
         CPUCleanUp();
         return 0;
     }
-    g_internalRAM = (uint8_t*)calloc(1, SIZE_IRAM);
+    g_internalRAM = CPUAllocateMemory(SIZE_IRAM);
     if (g_internalRAM == NULL) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "IRAM");
         CPUCleanUp();
         return 0;
     }
-    g_paletteRAM = (uint8_t*)calloc(1, SIZE_PRAM);
+    g_paletteRAM = CPUAllocateMemory(SIZE_PRAM);
     if (g_paletteRAM == NULL) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "PRAM");
         CPUCleanUp();
         return 0;
     }
-    g_vram = (uint8_t*)calloc(1, SIZE_VRAM);
+    g_vram = CPUAllocateMemory(SIZE_VRAM);
     if (g_vram == NULL) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "VRAM");
         CPUCleanUp();
         return 0;
     }
-    g_oam = (uint8_t*)calloc(1, SIZE_OAM);
+    g_oam = CPUAllocateMemory(SIZE_OAM);
     if (g_oam == NULL) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "OAM");
@@ -1589,7 +1974,7 @@ int CPULoadRom(const char* szFile)
         CPUCleanUp();
         return 0;
     }
-    g_ioMem = (uint8_t*)calloc(1, SIZE_IOMEM);
+    g_ioMem = CPUAllocateMemory(SIZE_IOMEM);
     if (g_ioMem == NULL) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "IO");
@@ -1614,13 +1999,12 @@ int CPULoadRomData(const char* data, int size)
 
     systemSaveUpdateCounter = SYSTEM_SAVE_NOT_UPDATED;
 
-    g_rom = (uint8_t*)malloc(SIZE_ROM);
-    if (g_rom == NULL) {
+    if (!CPUAllocateRom()) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "ROM");
         return 0;
     }
-    g_workRAM = (uint8_t*)calloc(1, SIZE_WRAM);
+    g_workRAM = CPUAllocateMemory(SIZE_WRAM);
     if (g_workRAM == NULL) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "WRAM");
@@ -1632,12 +2016,7 @@ int CPULoadRomData(const char* data, int size)
     romSize = size % 2 == 0 ? size : size + 1;
     memcpy(whereToLoad, data, size);
 
-    uint16_t* temp = (uint16_t*)(g_rom + ((romSize + 1) & ~1));
-    int i;
-    for (i = (romSize + 1) & ~1; i < SIZE_ROM; i += 2) {
-        WRITE16LE(temp, (i >> 1) & 0xFFFF);
-        temp++;
-    }
+    CPUFillRomOpenBus(romSize);
 
     g_bios = (uint8_t*)calloc(1, SIZE_BIOS);
     if (g_bios == NULL) {
@@ -1646,28 +2025,28 @@ int CPULoadRomData(const char* data, int size)
         CPUCleanUp();
         return 0;
     }
-    g_internalRAM = (uint8_t*)calloc(1, SIZE_IRAM);
+    g_internalRAM = CPUAllocateMemory(SIZE_IRAM);
     if (g_internalRAM == NULL) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "IRAM");
         CPUCleanUp();
         return 0;
     }
-    g_paletteRAM = (uint8_t*)calloc(1, SIZE_PRAM);
+    g_paletteRAM = CPUAllocateMemory(SIZE_PRAM);
     if (g_paletteRAM == NULL) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "PRAM");
         CPUCleanUp();
         return 0;
     }
-    g_vram = (uint8_t*)calloc(1, SIZE_VRAM);
+    g_vram = CPUAllocateMemory(SIZE_VRAM);
     if (g_vram == NULL) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "VRAM");
         CPUCleanUp();
         return 0;
     }
-    g_oam = (uint8_t*)calloc(1, SIZE_OAM);
+    g_oam = CPUAllocateMemory(SIZE_OAM);
     if (g_oam == NULL) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "OAM");
@@ -1675,14 +2054,14 @@ int CPULoadRomData(const char* data, int size)
         return 0;
     }
 
-    g_pix = (uint8_t*)calloc(1, 4 * 240 * 160);
+    g_pix = (uint8_t*)calloc(1, SIZE_PIX);
     if (g_pix == NULL) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "PIX");
         CPUCleanUp();
         return 0;
     }
-    g_ioMem = (uint8_t*)calloc(1, SIZE_IOMEM);
+    g_ioMem = CPUAllocateMemory(SIZE_IOMEM);
     if (g_ioMem == NULL) {
         systemMessage(MSG_OUT_OF_MEMORY, N_("Failed to allocate memory for %s"),
             "IO");
@@ -2030,24 +2409,6 @@ void CPUSoftwareInterrupt(int comment)
         dbgOutput(NULL, reg[0].I);
         return;
     }
-#endif
-#ifdef PROFILING
-    if (comment == 0xfe) {
-        profStartup(reg[0].I, reg[1].I);
-        return;
-    }
-    if (comment == 0xfd) {
-        profControl(reg[0].I);
-        return;
-    }
-    if (comment == 0xfc) {
-        profCleanup();
-        return;
-    }
-    if (comment == 0xfb) {
-        profCount();
-        return;
-    }
 #endif
     if (comment == 0xfa) {
         agbPrintFlush();
@@ -2363,6 +2724,7 @@ void doDMA(uint32_t& s, uint32_t& d, uint32_t si, uint32_t di, uint32_t c, int t
     int dw = 0;
     int sc = c;
 
+    VBAM_INSTR_COUNT(kDmaBytes, c << (transfer32 ? 2 : 1));
     cpuDmaRunning = true;
     cpuDmaPC = reg[15].I;
     cpuDmaCount = c;
@@ -3450,6 +3812,8 @@ void SetSaveType(int st)
 
 void CPUReset()
 {
+    gbaDirtyMarkAll();
+
     switch (CheckEReaderRegion()) {
     case 1: //US
         EReaderWriteMemory(0x8009134, 0x46C0DFE0);
@@ -3690,6 +4054,7 @@ void CPUReset()
 
 void CPUInterrupt()
 {
+    VBAM_INSTR_COUNT(kIrqs, 1);
     uint32_t PC = reg[15].I;
     bool savedState = armState;
     CPUSwitchMode(0x12, true, false);
@@ -3747,6 +4112,7 @@ static void gbaUpdateJoypads(void)
 
 void CPULoop(int ticks)
 {
+    VBAM_INSTR_ZONE(kCpu);
     int clockTicks;
     int timerOverflow = 0;
     // variable used by the CPU core
@@ -3877,21 +4243,24 @@ void CPULoop(int ticks)
                         lcdTicks += 1008;
                         DISPSTAT &= 0xFFFD;
                         if (VCOUNT == 160) {
-                            g_count++;
                             systemFrame();
+                            VBAM_INSTR_END_FRAME();
 
-                            if ((g_count % 10) == 0) {
-                                system10Frames();
-                            }
-                            if (g_count == 60) {
-                                uint32_t time = systemGetClock();
-                                if (time != lastTime) {
-                                    uint32_t t = 100000 / (time - lastTime);
-                                    systemShowSpeed(t);
-                                } else
-                                    systemShowSpeed(0);
-                                lastTime = time;
-                                g_count = 0;
+                            if (!coreOptions.speculating) {
+                                g_count++;
+                                if ((g_count % 10) == 0) {
+                                    system10Frames();
+                                }
+                                if (g_count == 60) {
+                                    uint32_t time = systemGetClock();
+                                    if (time != lastTime) {
+                                        uint32_t t = 100000 / (time - lastTime);
+                                        systemShowSpeed(t);
+                                    } else
+                                        systemShowSpeed(0);
+                                    lastTime = time;
+                                    g_count = 0;
+                                }
                             }
 
                             uint32_t ext = (joy >> 10);
@@ -3921,7 +4290,10 @@ void CPULoop(int ticks)
                             }
                             CPUCheckDMA(1, 0x0f);
 
-                            psoundTickfn();
+                            {
+                                VBAM_INSTR_ZONE(kSound);
+                                psoundTickfn();
+                            }
 
                             if (frameCount >= framesToSkip) {
                                 systemDrawScreen();
@@ -3941,7 +4313,10 @@ void CPULoop(int ticks)
 
                     } else {
                         if (frameCount >= framesToSkip) {
-                            (*renderLine)();
+                            {
+                                VBAM_INSTR_ZONE(kRender);
+                                (*renderLine)();
+                            }
                             switch (systemColorDepth) {
                             case 16: {
 #ifdef __LIBRETRO__
@@ -4174,25 +4549,18 @@ void CPULoop(int ticks)
 
             timerOverflow = 0;
 
-#ifdef PROFILING
-            profilingTicks -= clockTicks;
-            if (profilingTicks <= 0) {
-                profilingTicks += profilingTicksReload;
-                if (profilSegment) {
-                    profile_segment* seg = profilSegment;
-                    do {
-                        uint16_t* b = (uint16_t*)seg->sbuf;
-                        int pc = ((reg[15].I - seg->s_lowpc) * seg->s_scale) / 0x10000;
-                        if (pc >= 0 && pc < seg->ssiz) {
-                            b[pc]++;
-                            break;
-                        }
-
-                        seg = seg->next;
-                    } while (seg);
+#if defined(VBAM_ENABLE_DEBUGGER)
+            if (gbaProfilerInterval != 0) {
+                // The overshoot is carried over, so that the rate does not
+                // drift. An instruction longer than the interval is sampled
+                // once per interval it spans.
+                gbaProfilerTicks -= clockTicks;
+                while (gbaProfilerTicks <= 0) {
+                    gbaProfilerTicks += gbaProfilerInterval;
+                    gbaProfilerSample(armNextPC, reg[14].I);
                 }
             }
-#endif
+#endif  // defined(VBAM_ENABLE_DEBUGGER)
 
             ticks -= clockTicks;
 
@@ -4312,6 +4680,8 @@ struct EmulatedSystem GBASystem = {
     CPUWriteState,  // emuWriteState
     NULL,           // emuReadMemState
     NULL,           // emuWriteMemState
+    NULL,           // emuMemStateSize
+    NULL,           // emuWriteIncrementalState
     NULL,           // emuWritePNG
     NULL,           // emuWriteBMP
 #else
@@ -4327,6 +4697,10 @@ struct EmulatedSystem GBASystem = {
     CPUReadMemState,
     // emuWriteMemState
     CPUWriteMemState,
+    // emuMemStateSize
+    CPUFlatStateMaxSize,
+    // emuWriteIncrementalState
+    CPUWriteIncrementalState,
     // emuWritePNG
     CPUWritePNGFile,
     // emuWriteBMP
@@ -96,8 +96,45 @@ typedef union {
 #endif
 } reg_pair;
 
+// State of the CPU core used by nearly every emulated instruction, kept in
+// one cache-line aligned object so that the interpreter loops touch as few
+// cache lines as possible and address all of it from a single base. The
+// globals of the same names are references to its members, the cold state
+// stays in separate globals.
+struct alignas(64) GBACpuHotState {
+    reg_pair reg[45] = {};
+    uint32_t armNextPC = 0x00000000;
+    uint32_t cpuPrefetch[2] = {};
+    uint32_t busPrefetchCount = 0;
+    int cpuNextEvent = 0;
+    int cpuTotalTicks = 0;
+    int clockTicks = 0;
+    int SWITicks = 0;
+    int armMode = 0x1f;
+    bool N_FLAG = false;
+    bool C_FLAG = false;
+    bool Z_FLAG = false;
+    bool V_FLAG = false;
+    bool armState = true;
+    bool armIrqEnable = true;
+    bool busPrefetch = false;
+    bool busPrefetchEnable = false;
+    bool holdState = false;
+
+    // Wait states of the 16 memory regions.
+    uint8_t memoryWait[16] = { 0, 0, 2, 0, 0, 0, 0, 0, 4, 4, 4, 4, 4, 4, 4, 0 };
+    uint8_t memoryWait32[16] = { 0, 0, 5, 0, 0, 1, 1, 0, 7, 7, 9, 9, 13, 13, 4, 0 };
+    uint8_t memoryWaitSeq[16] = { 0, 0, 2, 0, 0, 0, 0, 0, 2, 2, 4, 4, 8, 8, 4, 0 };
+    uint8_t memoryWaitSeq32[16] = { 0, 0, 5, 0, 0, 1, 1, 0, 5, 5, 9, 9, 17, 17, 4, 0 };
+
+    // Last, only the first 16 entries are used by the games.
+    memoryMap map[256] = {};
+};
+
+extern GBACpuHotState g_cpu;
+
 #ifndef NO_GBA_MAP
-extern memoryMap map[256];
+static memoryMap (&map)[256] = g_cpu.map;
 #endif
 
 extern uint8_t biosProtected[4];
@@ -134,7 +171,17 @@ extern void CPUCleanUp();
 extern void CPUUpdateRender();
 extern void CPUUpdateRenderBuffers(bool);
 extern bool CPUReadMemState(char*, int);
-extern bool CPUWriteMemState(char*, int);
+extern bool CPUWriteMemState(char*, int, long&);
+// Flat, uncompressed in-memory states. CPUWriteFlatState() requires a buffer
+// of at least CPUFlatStateMaxSize() bytes and returns the size of the state.
+extern size_t CPUFlatStateMaxSize();
+extern size_t CPUWriteFlatState(uint8_t* data);
+// Incremental flat states for rewind, see
+// EmulatedSystem::emuWriteIncrementalState. The pages of WRAM and VRAM
+// written since the previous call are tracked in core/gba/gbaDirty.h, there
+// can only be one caller at a time as the call clears them.
+extern size_t CPUWriteIncrementalState(uint8_t* data, size_t size, bool full, uint64_t* dirty);
+extern bool CPUReadFlatState(const uint8_t* data, size_t size);
 #ifdef __LIBRETRO__
 extern bool CPUReadState(const uint8_t*);
 extern unsigned int CPUWriteState(uint8_t* data, unsigned int size);
@@ -154,11 +201,6 @@ extern void CPULoop(int);
 extern void CPUCheckDMA(int, int);
 extern bool CPUIsGBAImage(const char*);
 extern bool CPUIsZipFile(const char*);
-#ifdef PROFILING
-#include "prof/prof.h"
-extern void cpuProfil(profile_segment* seg);
-extern void cpuEnableProfiling(int hz);
-#endif
 
 const char* GetLoadDotCodeFile();
 const char* GetSaveDotCodeFile();
@@ -167,8 +209,11 @@ void SetLoadDotCodeFile(const char* szFile);
 void ResetSaveDotCodeFile();
 void SetSaveDotCodeFile(const char* szFile);
 
-// Updates romSize and realloc rom pointer if needed after soft-patching
-void gbaUpdateRomSize(int size);
+#ifndef __LIBRETRO__
+// Attempts to apply `patchName` to the currently loaded ROM. Returns true on
+// success.
+bool CPUApplyPatch(const char* patchName);
+#endif  // __LIBRETRO__
 
 extern struct EmulatedSystem GBASystem;
 
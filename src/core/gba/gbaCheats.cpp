@@ -287,14 +287,23 @@ uint8_t v3_deadtable2[256] = {
 #define debuggerReadByte(addr) \
     map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask]
 
-#define debuggerWriteMemory(addr, value) \
-    WRITE32LE(&map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask], value)
-
-#define debuggerWriteHalfWord(addr, value) \
-    WRITE16LE(&map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask], value)
-
-#define debuggerWriteByte(addr, value) \
-    map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask] = (value)
+#define debuggerWriteMemory(addr, value)                                              \
+    do {                                                                              \
+        WRITE32LE(&map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask], value); \
+        gbaDirtyMark(addr);                                                           \
+    } while (0)
+
+#define debuggerWriteHalfWord(addr, value)                                            \
+    do {                                                                              \
+        WRITE16LE(&map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask], value); \
+        gbaDirtyMark(addr);                                                           \
+    } while (0)
+
+#define debuggerWriteByte(addr, value)                                         \
+    do {                                                                       \
+        map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask] = (value);   \
+        gbaDirtyMark(addr);                                                    \
+    } while (0)
 
 #define CHEAT_IS_HEX(a) (((a) >= 'A' && (a) <= 'F') || ((a) >= '0' && (a) <= '9'))
 
@@ -2583,34 +2592,12 @@ void cheatsSaveGame(gzFile file)
     utilGzWrite(file, cheatsList, sizeof(cheatsList));
 }
 
-void cheatsReadGame(gzFile file, int version)
+// Applies a cheat list loaded from a save state.
+static void cheatsUpdateLoadedList()
 {
-    cheatsNumber = 0;
-
-    cheatsNumber = utilReadInt(file);
-
-    if (cheatsNumber > MAX_CHEATS)
-        cheatsNumber = MAX_CHEATS;
-
-    if (version > 8)
-        utilGzRead(file, cheatsList, sizeof(cheatsList));
-
     bool firstCodeBreaker = true;
 
     for (int i = 0; i < cheatsNumber; i++) {
-        if (version < 9) {
-            cheatsList[i].code = utilReadInt(file);
-            cheatsList[i].size = utilReadInt(file);
-            cheatsList[i].status = utilReadInt(file);
-            cheatsList[i].enabled = utilReadInt(file) ? true : false;
-            utilGzRead(file, &cheatsList[i].address, sizeof(uint32_t));
-            cheatsList[i].rawaddress = cheatsList[i].address;
-            utilGzRead(file, &cheatsList[i].value, sizeof(uint32_t));
-            utilGzRead(file, &cheatsList[i].oldValue, sizeof(uint32_t));
-            utilGzRead(file, &cheatsList[i].codestring, 20 * sizeof(char));
-            utilGzRead(file, &cheatsList[i].desc, 32 * sizeof(char));
-        }
-
         cheatsList[i].status = 0;
         if (!cheatsList[i].codestring[0]) {
             switch (cheatsList[i].size) {
@@ -2654,6 +2641,54 @@ void cheatsReadGame(gzFile file, int version)
     }
 }
 
+void cheatsReadGame(gzFile file, int version)
+{
+    cheatsNumber = 0;
+
+    cheatsNumber = utilReadInt(file);
+
+    if (cheatsNumber > MAX_CHEATS)
+        cheatsNumber = MAX_CHEATS;
+
+    if (version > 8)
+        utilGzRead(file, cheatsList, sizeof(cheatsList));
+
+    if (version < 9) {
+        for (int i = 0; i < cheatsNumber; i++) {
+            cheatsList[i].code = utilReadInt(file);
+            cheatsList[i].size = utilReadInt(file);
+            cheatsList[i].status = utilReadInt(file);
+            cheatsList[i].enabled = utilReadInt(file) ? true : false;
+            utilGzRead(file, &cheatsList[i].address, sizeof(uint32_t));
+            cheatsList[i].rawaddress = cheatsList[i].address;
+            utilGzRead(file, &cheatsList[i].value, sizeof(uint32_t));
+            utilGzRead(file, &cheatsList[i].oldValue, sizeof(uint32_t));
+            utilGzRead(file, &cheatsList[i].codestring, 20 * sizeof(char));
+            utilGzRead(file, &cheatsList[i].desc, 32 * sizeof(char));
+        }
+    }
+
+    cheatsUpdateLoadedList();
+}
+
+void cheatsSaveGame(uint8_t*& data)
+{
+    utilWriteIntMem(data, cheatsNumber);
+    utilWriteMem(data, cheatsList, cheatsNumber * sizeof(CheatsData));
+}
+
+void cheatsReadGame(const uint8_t*& data)
+{
+    cheatsNumber = utilReadIntMem(data);
+
+    if (cheatsNumber < 0 || cheatsNumber > MAX_CHEATS)
+        cheatsNumber = 0;
+
+    utilReadMem(cheatsList, data, cheatsNumber * sizeof(CheatsData));
+
+    cheatsUpdateLoadedList();
+}
+
 // skip the cheat list data
 void cheatsReadGameSkip(gzFile file, int version)
 {
@@ -2798,7 +2833,6 @@ bool cheatsLoadCheatList(const char* file)
 }
 #endif
 
-extern int cpuNextEvent;
 
 extern void debuggerBreakOnWrite(uint32_t, uint32_t, uint32_t, int, int);
 
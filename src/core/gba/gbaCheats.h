@@ -36,6 +36,8 @@ void cheatsDisable(int number);
 void cheatsSaveGame(gzFile file);
 void cheatsReadGame(gzFile file, int version);
 void cheatsReadGameSkip(gzFile file, int version);
+void cheatsSaveGame(uint8_t*& data);
+void cheatsReadGame(const uint8_t*& data);
 void cheatsSaveCheatList(const char* file);
 bool cheatsLoadCheatList(const char* file);
 #endif
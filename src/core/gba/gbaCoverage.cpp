@@ -0,0 +1,186 @@
+#include "core/gba/gbaCoverage.h"
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "core/base/file_util.h"
+#include "core/base/port.h"
+
+#if defined(VBAM_ENABLE_DEBUGGER)
+#include "core/gba/gbaElf.h"
+#endif  // defined(VBAM_ENABLE_DEBUGGER)
+
+GbaCoverageMap gbaCoverageMaps[16] = {};
+
+namespace {
+
+struct Region {
+    uint32_t base;
+    uint32_t size;
+    // Memory regions mapped to the bitmaps.
+    int first_map;
+    int last_map;
+};
+
+// EWRAM, IWRAM and the ROM, with its wait state mirrors.
+constexpr Region kRegions[] = {
+    {0x02000000, 0x40000, 0x2, 0x2},
+    {0x03000000, 0x8000, 0x3, 0x3},
+    {0x08000000, 0x2000000, 0x8, 0xd},
+};
+constexpr size_t kRegionCount = sizeof(kRegions) / sizeof(kRegions[0]);
+
+// Bits of the ARM and Thumb states, one per halfword.
+std::vector<uint8_t> g_bits[kRegionCount][2];
+
+// Size of the bitmaps of the `size` bytes at the start of a region.
+constexpr uint32_t BitmapSize(uint32_t size) {
+    return size / 16;
+}
+
+bool IsCovered(uint32_t address) {
+    for (size_t i = 0; i < kRegionCount; i++) {
+        const Region& region = kRegions[i];
+        const uint32_t map = address >> 24;
+        if (map < static_cast<uint32_t>(region.first_map) ||
+            map > static_cast<uint32_t>(region.last_map) || g_bits[i][0].empty()) {
+            continue;
+        }
+        const uint32_t index = (address & (region.size - 1)) >> 1;
+        return ((g_bits[i][0][index >> 3] | g_bits[i][1][index >> 3]) >> (index & 7)) & 1;
+    }
+    return false;
+}
+
+}  // namespace
+
+void gbaCoverageStart() {
+    for (size_t i = 0; i < kRegionCount; i++) {
+        const Region& region = kRegions[i];
+        for (int state = 0; state < 2; state++) {
+            g_bits[i][state].assign(BitmapSize(region.size), 0);
+        }
+        for (int map = region.first_map; map <= region.last_map; map++) {
+            gbaCoverageMaps[map] = {{g_bits[i][0].data(), g_bits[i][1].data()}, region.size - 1};
+        }
+    }
+}
+
+void gbaCoverageStop() {
+    for (GbaCoverageMap& map : gbaCoverageMaps) {
+        map = {};
+    }
+    for (auto& bits : g_bits) {
+        bits[0] = std::vector<uint8_t>();
+        bits[1] = std::vector<uint8_t>();
+    }
+}
+
+bool gbaCoverageWriteBitmap(const char* path) {
+    FILE* file = utilOpenFile(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    bool result = fwrite("VBAMCOV1", 1, 8, file) == 8;
+    const auto write32 = [&](uint32_t value) {
+        uint8_t bytes[4];
+        WRITE32LE(bytes, value);
+        result &= fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+    };
+
+    write32(kRegionCount);
+    for (size_t i = 0; i < kRegionCount; i++) {
+        const std::vector<uint8_t>& arm = g_bits[i][0];
+        const std::vector<uint8_t>& thumb = g_bits[i][1];
+
+        // Trim the unused end of the region, in 64 KiB steps.
+        uint32_t size = arm.empty() ? 0 : kRegions[i].size;
+        while (size > 0) {
+            const uint32_t start = size > 0x10000 ? size - 0x10000 : 0;
+            bool used = false;
+            for (uint32_t byte = BitmapSize(start); byte < BitmapSize(size) && !used; byte++) {
+                used = arm[byte] != 0 || thumb[byte] != 0;
+            }
+            if (used) {
+                break;
+            }
+            size = start;
+        }
+
+        write32(kRegions[i].base);
+        write32(size);
+        if (size > 0) {
+            result &= fwrite(arm.data(), 1, BitmapSize(size), file) == BitmapSize(size);
+            result &= fwrite(thumb.data(), 1, BitmapSize(size), file) == BitmapSize(size);
+        }
+    }
+
+    result &= fclose(file) == 0;
+    return result;
+}
+
+bool gbaCoverageWriteLcov(const char* path) {
+#if defined(VBAM_ENABLE_DEBUGGER)
+    // Lines of each source file, and whether they were executed.
+    std::map<std::string, std::map<int, bool>> files;
+    for (CompileUnit* unit = elfCompileUnits; unit != nullptr; unit = unit->next) {
+        if (!unit->hasLineInfo || unit->lineInfoTable == nullptr) {
+            continue;
+        }
+
+        const LineInfoItem* lines = unit->lineInfoTable->lines;
+        const int count = unit->lineInfoTable->number;
+        for (int i = 0; i < count; i++) {
+            if (lines[i].file == nullptr || lines[i].line <= 0) {
+                continue;
+            }
+
+            // A line spans up to the address of the next one.
+            uint32_t end = lines[i].address + 2;
+            if (i + 1 < count && lines[i + 1].address > lines[i].address &&
+                lines[i + 1].address - lines[i].address <= 0x1000) {
+                end = lines[i + 1].address;
+            }
+            bool executed = false;
+            for (uint32_t address = lines[i].address & ~1u; address < end && !executed;
+                 address += 2) {
+                executed = IsCovered(address);
+            }
+
+            std::string name = lines[i].file;
+            if (name[0] != '/' && unit->compdir != nullptr) {
+                name = std::string(unit->compdir) + "/" + name;
+            }
+            bool& hit = files[name][lines[i].line];
+            hit = hit || executed;
+        }
+    }
+    if (files.empty()) {
+        return false;
+    }
+
+    FILE* file = utilOpenFile(path, "w");
+    if (file == nullptr) {
+        return false;
+    }
+    bool result = fprintf(file, "TN:\n") > 0;
+    for (const auto& source : files) {
+        int hit_count = 0;
+        result &= fprintf(file, "SF:%s\n", source.first.c_str()) > 0;
+        for (const auto& line : source.second) {
+            result &= fprintf(file, "DA:%d,%d\n", line.first, line.second ? 1 : 0) > 0;
+            hit_count += line.second ? 1 : 0;
+        }
+        result &= fprintf(file, "LF:%d\nLH:%d\nend_of_record\n",
+                          static_cast<int>(source.second.size()), hit_count) > 0;
+    }
+    result &= fclose(file) == 0;
+    return result;
+#else
+    (void)path;
+    return false;
+#endif  // defined(VBAM_ENABLE_DEBUGGER)
+}
@@ -0,0 +1,59 @@
+#ifndef VBAM_CORE_GBA_GBACOVERAGE_H_
+#define VBAM_CORE_GBA_GBACOVERAGE_H_
+
+#include <cstdint>
+
+// Coverage of the emulated GBA code: one bit per halfword of ROM, EWRAM and
+// IWRAM, set when an instruction at that address is executed, with separate
+// bitmaps for the ARM and Thumb states.
+//
+// The CPU cores only mark the executed instructions in builds with
+// ENABLE_INSTRUMENTATION, and then only between gbaCoverageStart() and
+// gbaCoverageStop(). Otherwise, VBAM_GBA_COVERAGE() compiles to nothing.
+
+struct GbaCoverageMap {
+    // Bitmaps of the ARM and Thumb states, null when not recording.
+    uint8_t* bits[2];
+    uint32_t mask;
+};
+
+// Indexed by the top 8 bits of the address, for the 16 memory regions.
+extern GbaCoverageMap gbaCoverageMaps[16];
+
+// Allocates and clears the bitmaps, and starts recording.
+void gbaCoverageStart();
+// Stops recording and frees the bitmaps.
+void gbaCoverageStop();
+
+inline void gbaCoverageMark(uint32_t address, bool thumb) {
+    uint8_t* bits = gbaCoverageMaps[(address >> 24) & 15].bits[thumb];
+    if (bits != nullptr) {
+        const uint32_t index = (address & gbaCoverageMaps[(address >> 24) & 15].mask) >> 1;
+        bits[index >> 3] |= 1 << (index & 7);
+    }
+}
+
+// Writes the bitmaps to `path`. The file starts with the "VBAMCOV1" magic and
+// the number of regions, as a little-endian uint32_t. Each region then has
+// its base address and size in bytes, also uint32_t, followed by the ARM and
+// Thumb bitmaps of size / 16 bytes each, bit n of byte i covering the
+// halfword at base + (i * 8 + n) * 2. The regions are trimmed after their
+// last 64 KiB holding executed code, to a size of 0 if none was executed.
+// Returns false on failure.
+bool gbaCoverageWriteBitmap(const char* path);
+
+// Writes an lcov tracefile of the lines of the loaded ELF file, from its DWARF
+// line information. Must be called before CPUCleanUp(), which unloads the ELF
+// file. Returns false if there is no line information or on failure. Only
+// available in debugger builds.
+bool gbaCoverageWriteLcov(const char* path);
+
+#if defined(VBAM_ENABLE_INSTRUMENTATION)
+#define VBAM_GBA_COVERAGE(address, thumb) gbaCoverageMark(address, thumb)
+#else
+#define VBAM_GBA_COVERAGE(address, thumb) \
+    do {                                  \
+    } while (0)
+#endif  // defined(VBAM_ENABLE_INSTRUMENTATION)
+
+#endif  // VBAM_CORE_GBA_GBACOVERAGE_H_
@@ -45,19 +45,19 @@ extern int thumbExecute();
 
 #define THUMB_PREFETCH_NEXT cpuPrefetch[1] = CPUReadHalfWordQuick(armNextPC + 2);
 
-extern int SWITicks;
+static int& SWITicks = g_cpu.SWITicks;
+static bool& busPrefetch = g_cpu.busPrefetch;
+static bool& busPrefetchEnable = g_cpu.busPrefetchEnable;
+static uint32_t& busPrefetchCount = g_cpu.busPrefetchCount;
+static int& cpuNextEvent = g_cpu.cpuNextEvent;
+static bool& holdState = g_cpu.holdState;
+static uint32_t (&cpuPrefetch)[2] = g_cpu.cpuPrefetch;
+static int& cpuTotalTicks = g_cpu.cpuTotalTicks;
+static uint8_t (&memoryWait)[16] = g_cpu.memoryWait;
+static uint8_t (&memoryWait32)[16] = g_cpu.memoryWait32;
+static uint8_t (&memoryWaitSeq)[16] = g_cpu.memoryWaitSeq;
+static uint8_t (&memoryWaitSeq32)[16] = g_cpu.memoryWaitSeq32;
 extern uint32_t mastercode;
-extern bool busPrefetch;
-extern bool busPrefetchEnable;
-extern uint32_t busPrefetchCount;
-extern int cpuNextEvent;
-extern bool holdState;
-extern uint32_t cpuPrefetch[2];
-extern int cpuTotalTicks;
-extern uint8_t memoryWait[16];
-extern uint8_t memoryWait32[16];
-extern uint8_t memoryWaitSeq[16];
-extern uint8_t memoryWaitSeq32[16];
 extern uint8_t cpuBitsSet[256];
 extern uint8_t cpuLowestBitSet[256];
 extern void CPUSwitchMode(int mode, bool saveState, bool breakLoop);
@@ -1,5 +1,7 @@
 #include "core/gba/gba.h"
 
+#include "core/base/instrumentation.h"
+#include "core/gba/gbaCoverage.h"
 #include "core/gba/gbaCpu.h"
 #include "core/gba/gbaInline.h"
 #include "core/gba/gbaGlobals.h"
@@ -8,10 +10,6 @@
 #include "core/gba/gbaRemote.h"
 #endif  // defined(VBAM_ENABLE_DEBUGGER)
 
-#ifdef PROFILING
-#include "prof/prof.h"
-#endif
-
 #ifdef _MSC_VER
 // Disable "empty statement" warnings
 #pragma warning(disable : 4390)
@@ -22,7 +20,7 @@
 
 ///////////////////////////////////////////////////////////////////////////
 
-static int clockTicks;
+static int& clockTicks = g_cpu.clockTicks;
 
 static INSN_REGPARM void armUnknownInsn(uint32_t opcode)
 {
@@ -2855,6 +2853,8 @@ int armExecute()
         }
 #endif
 
+        VBAM_GBA_COVERAGE(static_cast<uint32_t>(oldArmNextPC), false);
+
         int cond = opcode >> 28;
         bool cond_res = true;
         if (UNLIKELY(cond != 0x0E)) { // most opcodes are AL (always)
@@ -2914,6 +2914,7 @@ int armExecute()
 
         if (cond_res)
             (*armInsnTable[((opcode >> 16) & 0xFF0) | ((opcode >> 4) & 0x0F)])(opcode);
+        VBAM_INSTR_COUNT(kInstructions, 1);
 #ifdef INSN_COUNTER
         count(opcode, cond_res);
 #endif
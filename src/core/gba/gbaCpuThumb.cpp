@@ -6,7 +6,9 @@
 #include <strings.h>
 #endif
 
+#include "core/base/instrumentation.h"
 #include "core/gba/gba.h"
+#include "core/gba/gbaCoverage.h"
 #include "core/gba/gbaCpu.h"
 #include "core/gba/gbaInline.h"
 #include "core/gba/gbaGlobals.h"
@@ -15,17 +17,13 @@
 #include "core/gba/gbaRemote.h"
 #endif  // defined(VBAM_ENABLE_DEBUGGER)
 
-#ifdef PROFILING
-#include "prof/prof.h"
-#endif
-
 #ifdef _MSC_VER
 #define snprintf _snprintf
 #endif
 
 ///////////////////////////////////////////////////////////////////////////
 
-static int clockTicks;
+static int& clockTicks = g_cpu.clockTicks;
 
 static INSN_REGPARM void thumbUnknownInsn(uint32_t opcode)
 {
@@ -2036,7 +2034,9 @@ int thumbExecute()
         }
 #endif
 
+        VBAM_GBA_COVERAGE(oldArmNextPC, true);
         (*thumbInsnTable[opcode >> 6])(opcode);
+        VBAM_INSTR_COUNT(kInstructions, 1);
 
 #ifdef VBAM_ENABLE_DEBUGGER
         if (enableRegBreak) {
@@ -0,0 +1,36 @@
+#include "core/gba/gbaDirty.h"
+
+#include <algorithm>
+
+uint64_t gbaDirtyWram[kGbaDirtyWramWords] = {};
+uint64_t gbaDirtyVram[kGbaDirtyVramWords] = {};
+
+void gbaDirtyMark(uint32_t address)
+{
+    switch (address >> 24) {
+    case 2:
+        gbaDirtyWramMark(address & 0x3FFFF);
+        break;
+    case 6:
+        address &= 0x1FFFF;
+        if ((address & 0x18000) == 0x18000)
+            address &= 0x17FFF;
+        gbaDirtyVramMark(address);
+        break;
+    default:
+        // The other regions are copied in full.
+        break;
+    }
+}
+
+void gbaDirtyMarkAll()
+{
+    std::fill(gbaDirtyWram, gbaDirtyWram + kGbaDirtyWramWords, ~uint64_t{0});
+    std::fill(gbaDirtyVram, gbaDirtyVram + kGbaDirtyVramWords, ~uint64_t{0});
+}
+
+void gbaDirtyClear()
+{
+    std::fill(gbaDirtyWram, gbaDirtyWram + kGbaDirtyWramWords, 0);
+    std::fill(gbaDirtyVram, gbaDirtyVram + kGbaDirtyVramWords, 0);
+}
@@ -0,0 +1,42 @@
+#ifndef VBAM_CORE_GBA_GBADIRTY_H_
+#define VBAM_CORE_GBA_GBADIRTY_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Pages of WRAM and VRAM written since the last incremental state, one bit
+// per 256-byte page. The write paths mark the pages, CPUWriteIncrementalState()
+// only copies the marked pages and clears the bitmaps.
+
+constexpr int kGbaDirtyPageShift = 8;
+constexpr size_t kGbaDirtyPageSize = size_t{1} << kGbaDirtyPageShift;
+
+// 256 KiB of WRAM and 96 KiB of VRAM.
+constexpr size_t kGbaDirtyWramWords = 0x40000 >> kGbaDirtyPageShift >> 6;
+constexpr size_t kGbaDirtyVramWords = 0x18000 >> kGbaDirtyPageShift >> 6;
+
+extern uint64_t gbaDirtyWram[kGbaDirtyWramWords];
+extern uint64_t gbaDirtyVram[kGbaDirtyVramWords];
+
+// `offset` is the offset in the region, as masked by the write paths.
+inline void gbaDirtyWramMark(uint32_t offset)
+{
+    offset >>= kGbaDirtyPageShift;
+    gbaDirtyWram[offset >> 6] |= uint64_t{1} << (offset & 63);
+}
+
+inline void gbaDirtyVramMark(uint32_t offset)
+{
+    offset >>= kGbaDirtyPageShift;
+    gbaDirtyVram[offset >> 6] |= uint64_t{1} << (offset & 63);
+}
+
+// Marks the page mapped at bus `address`, for the writes that go through the
+// memory map rather than the CPUWrite*() functions (cheats, debuggers).
+void gbaDirtyMark(uint32_t address);
+// Marks every page, after the whole memory changed (reset, state load).
+void gbaDirtyMarkAll();
+// Clears the bitmaps, once the marked pages were copied.
+void gbaDirtyClear();
+
+#endif  // VBAM_CORE_GBA_GBADIRTY_H_
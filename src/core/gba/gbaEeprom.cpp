@@ -44,7 +44,6 @@ void eepromReset()
     eepromAddress = 0;
 }
 
-#ifdef __LIBRETRO__
 void eepromSaveGame(uint8_t*& data)
 {
     utilWriteDataMem(data, eepromSaveData);
@@ -59,8 +58,12 @@ void eepromReadGame(const uint8_t*& data)
     utilReadMem(eepromData, data, SIZE_EEPROM_8K);
 }
 
-#else // !__LIBRETRO__
+size_t eepromSaveGameSize()
+{
+    return utilDataSize(eepromSaveData) + sizeof(int) + SIZE_EEPROM_8K;
+}
 
+#ifndef __LIBRETRO__
 void eepromSaveGame(gzFile gzFile)
 {
     utilWriteData(gzFile, eepromSaveData);
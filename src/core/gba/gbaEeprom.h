@@ -1,16 +1,18 @@
 #ifndef VBAM_CORE_GBA_GBAEEPROM_H_
 #define VBAM_CORE_GBA_GBAEEPROM_H_
 
+#include <cstddef>
 #include <cstdint>
 
 #if !defined(__LIBRETRO__)
 #include <zlib.h>
 #endif  // defined(__LIBRETRO__)
 
-#if defined(__LIBRETRO__)
 extern void eepromSaveGame(uint8_t*& data);
 extern void eepromReadGame(const uint8_t*& data);
-#else // !defined(__LIBRETRO__)
+// Number of bytes written by eepromSaveGame().
+extern size_t eepromSaveGameSize();
+#if !defined(__LIBRETRO__)
 extern void eepromSaveGame(gzFile _gzFile);
 extern void eepromReadGame(gzFile _gzFile, int version);
 extern void eepromReadGameSkip(gzFile _gzFile, int version);
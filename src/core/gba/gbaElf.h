@@ -248,6 +248,8 @@ struct Symbol {
     uint32_t size;
 };
 
+extern CompileUnit* elfCompileUnits;
+
 extern uint32_t elfReadLEB128(uint8_t*, int*);
 extern int32_t elfReadSignedLEB128(uint8_t*, int*);
 extern bool elfRead(const char*, int&, FILE* f);
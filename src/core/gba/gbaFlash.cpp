@@ -284,7 +284,6 @@ static variable_desc flashSaveData3[] = {
     { NULL, 0 }
 };
 
-#ifdef __LIBRETRO__
 void flashSaveGame(uint8_t*& data)
 {
     utilWriteDataMem(data, flashSaveData3);
@@ -295,7 +294,12 @@ void flashReadGame(const uint8_t*& data)
     utilReadDataMem(data, flashSaveData3);
 }
 
-#else // !__LIBRETRO__
+size_t flashSaveGameSize()
+{
+    return utilDataSize(flashSaveData3);
+}
+
+#ifndef __LIBRETRO__
 static variable_desc flashSaveData[] = {
     { &flashState, sizeof(int) },
     { &flashReadState, sizeof(int) },
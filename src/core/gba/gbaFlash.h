@@ -1,6 +1,7 @@
 #ifndef VBAM_CORE_GBA_GBAFLASH_H_
 #define VBAM_CORE_GBA_GBAFLASH_H_
 
+#include <cstddef>
 #include <cstdint>
 
 #if !defined(__LIBRETRO__)
@@ -11,10 +12,11 @@
 
 void flashDetectSaveType(const int size);
 
-#if defined(__LIBRETRO__)
 extern void flashSaveGame(uint8_t*& data);
 extern void flashReadGame(const uint8_t*& data);
-#else  // !defined(__LIBRETRO__)
+// Number of bytes written by flashSaveGame().
+extern size_t flashSaveGameSize();
+#if !defined(__LIBRETRO__)
 extern void flashSaveGame(gzFile _gzFile);
 extern void flashReadGame(gzFile _gzFile, int version);
 extern void flashReadGameSkip(gzFile _gzFile, int version);
@@ -5,17 +5,8 @@ int oldreg[18];
 char oldbuffer[10];
 #endif
 
-reg_pair reg[45];
-memoryMap map[256];
+GBACpuHotState g_cpu;
 bool ioReadable[0x400];
-bool N_FLAG = 0;
-bool C_FLAG = 0;
-bool Z_FLAG = 0;
-bool V_FLAG = 0;
-bool armState = true;
-bool armIrqEnable = true;
-uint32_t armNextPC = 0x00000000;
-int armMode = 0x1f;
 uint32_t stop = 0x08000568;
 // Joybus
 bool gba_joybus_enabled = false;
@@ -15,16 +15,16 @@
 #define VERBOSE_AGBPRINT 512
 #define VERBOSE_SOUNDOUTPUT 1024
 
-extern reg_pair reg[45];
+static reg_pair (&reg)[45] = g_cpu.reg;
+static bool& N_FLAG = g_cpu.N_FLAG;
+static bool& C_FLAG = g_cpu.C_FLAG;
+static bool& Z_FLAG = g_cpu.Z_FLAG;
+static bool& V_FLAG = g_cpu.V_FLAG;
+static bool& armState = g_cpu.armState;
+static bool& armIrqEnable = g_cpu.armIrqEnable;
+static uint32_t& armNextPC = g_cpu.armNextPC;
+static int& armMode = g_cpu.armMode;
 extern bool ioReadable[0x400];
-extern bool N_FLAG;
-extern bool C_FLAG;
-extern bool Z_FLAG;
-extern bool V_FLAG;
-extern bool armState;
-extern bool armIrqEnable;
-extern uint32_t armNextPC;
-extern int armMode;
 extern uint32_t stop;
 extern bool gba_joybus_enabled;
 extern bool gba_joybus_active;
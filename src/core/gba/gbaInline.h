@@ -7,6 +7,7 @@
 #include "core/base/port.h"
 #include "core/base/system.h"
 #include "core/gba/gbaCpu.h"
+#include "core/gba/gbaDirty.h"
 #include "core/gba/gbaEeprom.h"
 #include "core/gba/gbaFlash.h"
 #include "core/gba/gbaPrint.h"
@@ -20,9 +21,7 @@
 extern const uint32_t objTilesAddress[3];
 
 extern bool stopState;
-extern bool holdState;
 extern int holdType;
-extern int cpuNextEvent;
 extern bool cpuSramEnabled;
 extern bool cpuFlashEnabled;
 extern bool cpuEEPROMEnabled;
@@ -42,7 +41,6 @@ extern int timer2ClockReload;
 extern bool timer3On;
 extern int timer3Ticks;
 extern int timer3ClockReload;
-extern int cpuTotalTicks;
 
 #define CPUReadByteQuick(addr) map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask]
 
@@ -488,6 +486,7 @@ static inline void CPUWriteMemory(uint32_t address, uint32_t value)
         else
 #endif
             WRITE32LE(((uint32_t*)&g_workRAM[address & 0x3FFFC]), value);
+        gbaDirtyWramMark(address & 0x3FFFC);
         break;
     case 0x03:
 #ifdef VBAM_ENABLE_DEBUGGER
@@ -526,6 +525,7 @@ static inline void CPUWriteMemory(uint32_t address, uint32_t value)
 #endif
 
             WRITE32LE(((uint32_t*)&g_vram[address]), value);
+        gbaDirtyVramMark(address);
         break;
     case 0x07:
 #ifdef VBAM_ENABLE_DEBUGGER
@@ -593,6 +593,7 @@ static inline void CPUWriteHalfWord(uint32_t address, uint16_t value)
         else
 #endif
             WRITE16LE(((uint16_t*)&g_workRAM[address & 0x3FFFE]), value);
+        gbaDirtyWramMark(address & 0x3FFFE);
         break;
     case 3:
 #ifdef VBAM_ENABLE_DEBUGGER
@@ -628,6 +629,7 @@ static inline void CPUWriteHalfWord(uint32_t address, uint16_t value)
         else
 #endif
             WRITE16LE(((uint16_t*)&g_vram[address]), value);
+        gbaDirtyVramMark(address);
         break;
     case 7:
 #ifdef VBAM_ENABLE_DEBUGGER
@@ -691,6 +693,7 @@ static inline void CPUWriteByte(uint32_t address, uint8_t b)
         else
 #endif
             g_workRAM[address & 0x3FFFF] = b;
+        gbaDirtyWramMark(address & 0x3FFFF);
         break;
     case 3:
 #ifdef VBAM_ENABLE_DEBUGGER
@@ -786,6 +789,7 @@ static inline void CPUWriteByte(uint32_t address, uint8_t b)
             else
 #endif
                 *((uint16_t*)&g_vram[address]) = (b << 8) | b;
+            gbaDirtyVramMark(address);
         }
         break;
     case 7:
@@ -31,6 +31,7 @@
 #include <libintl.h>
 #define _(x) gettext(x)
 
+#include "core/base/instrumentation.h"
 #include "core/base/message.h"
 #include "core/base/port.h"
 #include "core/gba/gba.h"
@@ -666,6 +667,9 @@ ConnectionState InitLink(LinkMode mode)
 
 void StartLink(uint16_t siocnt)
 {
+    if (siocnt & 0x80)
+        VBAM_INSTR_MARK(kLinkTransfer);
+
     if (!linkDriver || !linkDriver->start) {
         // We still need to update the SIOCNT register for consistency. Some
         // games (e.g. Digimon Racing EUR) will be stuck in an infinite loop
@@ -2500,6 +2504,8 @@ void gbInitLink()
 
 uint8_t gbStartLink(uint8_t b) //used on internal clock
 {
+    VBAM_INSTR_MARK(kLinkTransfer);
+
     uint8_t dat = 0xff; //master (w/ internal clock) will gets 0xff if slave is turned off (or not ready yet also?)
     //if(linkid) return 0xff; //b; //Slave shouldn't be sending from here
     //int gbSerialOn = (gbMemory[0xff02] & 0x80); //not needed?
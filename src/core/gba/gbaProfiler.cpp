@@ -0,0 +1,101 @@
+#include "core/gba/gbaProfiler.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+#include "core/base/file_util.h"
+#include "core/gba/gbaElf.h"
+
+int gbaProfilerInterval = 0;
+int gbaProfilerTicks = 0;
+
+namespace {
+
+// Sample counts, keyed by the link register in the high 32 bits and the
+// address of the sampled instruction in the low ones.
+std::unordered_map<uint64_t, uint32_t> g_samples;
+uint64_t g_sample_count = 0;
+
+// Returns the name of the function at `address`: its DWARF name, else its
+// symbol name, else the 256-byte range holding it.
+std::string FunctionName(uint32_t address) {
+    Function* function = nullptr;
+    CompileUnit* unit = nullptr;
+    if (elfGetCurrentFunction(address, &function, &unit) && function->name != nullptr) {
+        return function->name;
+    }
+
+    std::string symbol = elfGetAddressSymbol(address);
+    if (!symbol.empty()) {
+        // Drop the "+offset" suffix.
+        const size_t plus = symbol.rfind('+');
+        if (plus != std::string::npos && plus > 0 &&
+            strspn(symbol.c_str() + plus + 1, "0123456789") == symbol.size() - plus - 1) {
+            symbol.resize(plus);
+        }
+        return symbol;
+    }
+
+    char range[32];
+    snprintf(range, sizeof(range), "%08x-%08x", address & ~0xffu, address | 0xffu);
+    return range;
+}
+
+}  // namespace
+
+void gbaProfilerStart(int interval) {
+    g_samples.clear();
+    g_sample_count = 0;
+    gbaProfilerInterval = gbaProfilerTicks = interval > 0 ? interval : kGbaProfilerDefaultInterval;
+}
+
+void gbaProfilerStop() {
+    gbaProfilerInterval = 0;
+}
+
+uint64_t gbaProfilerSampleCount() {
+    return g_sample_count;
+}
+
+void gbaProfilerSample(uint32_t pc, uint32_t lr) {
+    // Thumb return addresses have their low bit set.
+    g_samples[(static_cast<uint64_t>(lr & ~1u) << 32) | pc]++;
+    g_sample_count++;
+}
+
+bool gbaProfilerWriteCollapsed(const char* path) {
+    std::unordered_map<uint32_t, std::string> names;
+    const auto name = [&names](uint32_t address) -> const std::string& {
+        auto it = names.find(address);
+        if (it == names.end()) {
+            it = names.emplace(address, FunctionName(address)).first;
+        }
+        return it->second;
+    };
+
+    // Sorted, so that identical runs write identical files.
+    std::map<std::string, uint64_t> stacks;
+    for (const auto& sample : g_samples) {
+        const std::string& function = name(static_cast<uint32_t>(sample.first));
+        const uint32_t lr = static_cast<uint32_t>(sample.first >> 32);
+        // The link register is stale in the functions that already called
+        // others, when it points into the function itself.
+        const std::string& caller = lr != 0 ? name(lr) : function;
+        stacks[caller == function ? function : caller + ";" + function] += sample.second;
+    }
+
+    FILE* file = utilOpenFile(path, "w");
+    if (file == nullptr) {
+        return false;
+    }
+    bool result = true;
+    for (const auto& stack : stacks) {
+        result &= fprintf(file, "%s %llu\n", stack.first.c_str(),
+                          static_cast<unsigned long long>(stack.second)) > 0;
+    }
+    result &= fclose(file) == 0;
+    return result;
+}
@@ -0,0 +1,36 @@
+#ifndef VBAM_CORE_GBA_GBAPROFILER_H_
+#define VBAM_CORE_GBA_GBAPROFILER_H_
+
+#include <cstdint>
+
+// Sampling profiler of the emulated GBA code, to find the hot spots of
+// homebrew programs. Only available in debugger builds.
+//
+// Every `interval` emulated cycles, CPULoop() samples the address of the next
+// instruction and the link register, for one level of call graph. The samples
+// are attributed to the functions of the loaded ELF file, if any, and to
+// 256-byte address ranges otherwise.
+
+// 10000 samples per emulated second.
+constexpr int kGbaProfilerDefaultInterval = 16777216 / 10000;
+
+// Sampling interval in cycles, 0 when the profiler is stopped, and cycles
+// left until the next sample. Only used by CPULoop().
+extern int gbaProfilerInterval;
+extern int gbaProfilerTicks;
+
+// Starts sampling every `interval` cycles, discarding the previous samples.
+void gbaProfilerStart(int interval);
+// Stops sampling, keeping the samples.
+void gbaProfilerStop();
+uint64_t gbaProfilerSampleCount();
+
+// Records a sample. Called by CPULoop().
+void gbaProfilerSample(uint32_t pc, uint32_t lr);
+
+// Writes the samples as collapsed stacks, "caller;function count" lines, the
+// input of flamegraph.pl and compatible viewers. Must be called before
+// CPUCleanUp(), which unloads the ELF file. Returns false on failure.
+bool gbaProfilerWriteCollapsed(const char* path);
+
+#endif  // VBAM_CORE_GBA_GBAPROFILER_H_
@@ -43,6 +43,7 @@
 #include <sstream>
 
 #include "core/gba/gba.h"
+#include "core/gba/gbaDirty.h"
 #include "core/gba/gbaElf.h"
 #include "core/gba/gbaGlobals.h"
 #include "core/gba/gbaRemote.h"
@@ -81,13 +82,16 @@ void remoteSetSockets(SOCKET l, SOCKET r)
     map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask]
 
 #define debuggerWriteMemory(addr, value) \
-    *(uint32_t*)&map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask] = (value)
+    (*(uint32_t*)&map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask] = (value), \
+     gbaDirtyMark(addr))
 
 #define debuggerWriteHalfWord(addr, value) \
-    *(uint16_t*)&map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask] = (value)
+    (*(uint16_t*)&map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask] = (value), \
+     gbaDirtyMark(addr))
 
 #define debuggerWriteByte(addr, value) \
-    map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask] = (value)
+    (map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask] = (value), \
+     gbaDirtyMark(addr))
 
 bool dontBreakNow = false;
 int debuggerNumOfDontBreak = 0;
@@ -307,7 +307,6 @@ void rtcReset()
     SetGBATime();
 }
 
-#ifdef __LIBRETRO__
 void rtcSaveGame(uint8_t*& data)
 {
     utilWriteMem(data, &rtcClockData, sizeof(rtcClockData));
@@ -317,7 +316,13 @@ void rtcReadGame(const uint8_t*& data)
 {
     utilReadMem(&rtcClockData, data, sizeof(rtcClockData));
 }
-#else
+
+size_t rtcSaveGameSize()
+{
+    return sizeof(rtcClockData);
+}
+
+#ifndef __LIBRETRO__
 void rtcSaveGame(gzFile gzFile)
 {
     utilGzWrite(gzFile, &rtcClockData, sizeof(rtcClockData));
@@ -1,6 +1,7 @@
 #ifndef VBAM_CORE_GBA_GBARTC_H_
 #define VBAM_CORE_GBA_GBARTC_H_
 
+#include <cstddef>
 #include <cstdint>
 
 #if !defined(__LIBRETRO__)
@@ -15,10 +16,11 @@ void rtcEnableRumble(bool e);
 bool rtcIsEnabled();
 void rtcReset();
 
-#if defined(__LIBRETRO__)
 void rtcReadGame(const uint8_t*& data);
 void rtcSaveGame(uint8_t*& data);
-#else  // !defined(__LIBRETRO__)
+// Number of bytes written by rtcSaveGame().
+size_t rtcSaveGameSize();
+#if !defined(__LIBRETRO__)
 void rtcReadGame(gzFile gzFile);
 void rtcSaveGame(gzFile gzFile);
 #endif  // defined(__LIBRETRO__)
@@ -6,6 +6,7 @@
 #include "core/apu/Gb_Apu.h"
 #include "core/apu/Multi_Buffer.h"
 #include "core/base/file_util.h"
+#include "core/base/instrumentation.h"
 #include "core/base/port.h"
 #include "core/base/sound_driver.h"
 #include "core/gba/gba.h"
@@ -340,13 +341,22 @@ static void end_frame(blip_time_t time)
 #ifdef __LIBRETRO__
 void flush_samples(Multi_Buffer* buffer)
 {
+    VBAM_INSTR_ZONE(kSoundFlush);
     int numSamples = buffer->read_samples((blip_sample_t*)soundFinalWave, buffer->samples_avail());
-    soundDriver->write(soundFinalWave, numSamples);
+    if (coreOptions.muteSound)
+        return;
+
+    {
+        VBAM_INSTR_ZONE(kAudioWrite);
+        soundDriver->write(soundFinalWave, numSamples);
+    }
     systemOnWriteDataToSoundBuffer(soundFinalWave, numSamples);
 }
 #else
 void flush_samples(Multi_Buffer* buffer)
 {
+    VBAM_INSTR_ZONE(kSoundFlush);
+
     // We want to write the data frame by frame to support legacy audio drivers
     // that don't use the length parameter of the write method.
     // TODO: Update the Win32 audio drivers (DS, OAL, XA2), and flush all the
@@ -362,10 +372,16 @@ void flush_samples(Multi_Buffer* buffer)
     // Keep filling and writing soundFinalWave until it can't be fully filled
     while (buffer->samples_avail() >= out_buf_size) {
         buffer->read_samples((blip_sample_t*)soundFinalWave, out_buf_size);
+        if (coreOptions.muteSound)
+            continue;
+
         if (soundPaused)
             soundResume();
 
-        soundDriver->write(soundFinalWave, soundBufferLen);
+        {
+            VBAM_INSTR_ZONE(kAudioWrite);
+            soundDriver->write(soundFinalWave, soundBufferLen);
+        }
         systemOnWriteDataToSoundBuffer(soundFinalWave, soundBufferLen);
     }
 }
@@ -424,11 +440,13 @@ static void apply_muting()
     }
 }
 
-static void reset_apu()
+// Resets the APU, dropping the samples in the output buffer unless
+// `keep_buffer`.
+static void reset_apu(bool keep_buffer = false)
 {
     gb_apu->reset(gb_apu->mode_agb, true);
 
-    if (stereo_buffer)
+    if (stereo_buffer && !keep_buffer)
         stereo_buffer->clear();
 
     soundTicks = 0;
@@ -818,7 +836,6 @@ void soundReadGame(gzFile in, int version)
 }
 #endif // !__LIBRETRO__
 
-#ifdef __LIBRETRO__
 void soundSaveGame(uint8_t*& out)
 {
     gb_apu->save_state(&state.apu);
@@ -831,8 +848,9 @@ void soundSaveGame(uint8_t*& out)
 
 void soundReadGame(const uint8_t*& in)
 {
-    // Prepare APU and default state
-    reset_apu();
+    // Prepare APU and default state. The buffered samples are kept, run-ahead
+    // and rollback restore a state every frame.
+    reset_apu(true);
     gb_apu->save_state(&state.apu);
 
     utilReadDataMem(in, gba_state);
@@ -842,4 +860,8 @@ void soundReadGame(const uint8_t*& in)
 
     apply_muting();
 }
-#endif // __LIBRETRO__
+
+size_t soundSaveGameSize()
+{
+    return utilDataSize(gba_state);
+}
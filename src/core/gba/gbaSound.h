@@ -1,6 +1,7 @@
 #ifndef VBAM_CORE_GBA_GBASOUND_H_
 #define VBAM_CORE_GBA_GBASOUND_H_
 
+#include <cstddef>
 #include <cstdint>
 
 #if !defined(__LIBRETRO__)
@@ -80,10 +81,11 @@ extern int SOUND_CLOCK_TICKS; // Number of 16.8 MHz clocks between calls to soun
 extern int soundTicks;
 
 // Saves/loads emulator state
-#ifdef __LIBRETRO__
 void soundSaveGame(uint8_t*&);
 void soundReadGame(const uint8_t*& in);
-#else
+// Number of bytes written by soundSaveGame().
+size_t soundSaveGameSize();
+#ifndef __LIBRETRO__
 void soundSaveGame(gzFile);
 void soundReadGame(gzFile, int version);
 #endif
@@ -846,6 +846,8 @@ void BIOS_RegisterRamReset(uint32_t flags)
     CPUUpdateRegister(0x0, 0x80);
 
     if (flags) {
+        gbaDirtyMarkAll();
+
         if (flags & 0x01) {
             // clear work RAM
             memset(g_workRAM, 0, SIZE_WRAM);
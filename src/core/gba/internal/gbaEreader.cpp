@@ -202,6 +202,7 @@ void EReaderWriteMemory(uint32_t address, uint32_t value)
     switch (address >> 24) {
     case 2:
         WRITE32LE(((uint32_t*)&g_workRAM[address & 0x3FFFF]), value);
+        gbaDirtyWramMark(address & 0x3FFFF);
         break;
     case 3:
         WRITE32LE(((uint32_t*)&g_internalRAM[address & 0x7FFF]), value);
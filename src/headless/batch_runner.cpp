@@ -0,0 +1,437 @@
+#include "headless/batch_runner.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif  // !defined(_WIN32)
+
+#include "headless/headless_runner.h"
+#include "headless/headless_system.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Time given to a job past its timeout to load the ROM and to write its
+// outputs, before its process is killed.
+constexpr double kKillGraceSeconds = 10;
+
+struct BatchJob {
+    std::string id;
+    HeadlessJob job;
+    bool check_hash = false;
+    uint64_t expected_hash = 0;
+};
+
+// Outcome of a job, as reported.
+struct BatchOutcome {
+    // "passed", "failed", "error", "crashed" or "killed".
+    std::string status;
+    std::string detail;
+    std::string system;
+    std::string stop_reason;
+    int frames = 0;
+    double wall_ms = 0;
+    double fps = 0;
+    double speed = 0;
+    uint64_t final_hash = 0;
+};
+
+bool ParseManifest(const BatchOptions& options, std::vector<BatchJob>* jobs) {
+    std::ifstream manifest(options.manifest);
+    if (!manifest) {
+        fprintf(stderr, "Cannot open %s\n", options.manifest.c_str());
+        return false;
+    }
+
+    std::string line;
+    for (int line_number = 1; std::getline(manifest, line); line_number++) {
+        std::istringstream tokens(line);
+        std::string token;
+        if (!(tokens >> token) || token[0] == '#') {
+            continue;
+        }
+
+        BatchJob job;
+        job.job.rom = token;
+        while (tokens >> token) {
+            const size_t equal = token.find('=');
+            const std::string name = token.substr(0, equal);
+            const std::string value = equal == std::string::npos ? "" : token.substr(equal + 1);
+            bool valid = equal != std::string::npos;
+            if (name == "id") {
+                job.id = value;
+            } else if (name == "expect") {
+                char* end = nullptr;
+                job.check_hash = true;
+                job.expected_hash = strtoull(value.c_str(), &end, 16);
+                valid &= !value.empty() && *end == '\0';
+            } else {
+                valid &= headlessSetJobOption(&job.job, name.c_str(), value.c_str());
+            }
+            if (!valid) {
+                fprintf(stderr, "%s:%d: invalid option %s\n", options.manifest.c_str(),
+                        line_number, token.c_str());
+                return false;
+            }
+        }
+
+        if (job.id.empty()) {
+            job.id = job.job.rom;
+        }
+        if (options.max_frames > 0 &&
+            (job.job.frames == 0 || job.job.frames > options.max_frames)) {
+            job.job.frames = options.max_frames;
+        }
+        if (options.max_seconds > 0 &&
+            (job.job.timeout == 0 || job.job.timeout > options.max_seconds)) {
+            job.job.timeout = options.max_seconds;
+        }
+        jobs->push_back(job);
+    }
+    return true;
+}
+
+#if !defined(_WIN32)
+
+BatchOutcome Outcome(const BatchJob& job, const HeadlessResult& result) {
+    BatchOutcome outcome;
+    if (!result.ran) {
+        outcome.status = "error";
+        outcome.detail = result.error;
+        return outcome;
+    }
+
+    outcome.system = result.system;
+    outcome.stop_reason = result.stop_reason;
+    outcome.frames = result.frames;
+    outcome.wall_ms = result.wall_ms;
+    outcome.fps = result.fps;
+    outcome.speed = result.speed;
+    outcome.final_hash = result.final_hash;
+
+    if (!result.outputs_ok) {
+        outcome.status = "failed";
+        outcome.detail = "cannot write the outputs";
+    } else if (job.check_hash && result.final_hash != job.expected_hash) {
+        char detail[64];
+        snprintf(detail, sizeof(detail), "expected hash %016" PRIx64, job.expected_hash);
+        outcome.status = "failed";
+        outcome.detail = detail;
+    } else {
+        outcome.status = "passed";
+    }
+    return outcome;
+}
+
+void PrintProgress(size_t done, size_t total, const BatchJob& job, const BatchOutcome& outcome) {
+    if (outcome.detail.empty()) {
+        fprintf(stderr, "[%zu/%zu] %s: %s, %d frames, %.1f fps\n", done, total, job.id.c_str(),
+                outcome.status.c_str(), outcome.frames, outcome.fps);
+    } else {
+        fprintf(stderr, "[%zu/%zu] %s: %s, %s\n", done, total, job.id.c_str(),
+                outcome.status.c_str(), outcome.detail.c_str());
+    }
+}
+
+// Result of a job, as sent by its process.
+struct WireResult {
+    bool ran;
+    bool outputs_ok;
+    int frames;
+    double wall_ms;
+    double fps;
+    double speed;
+    uint64_t final_hash;
+    char system[8];
+    char stop_reason[16];
+    char error[256];
+};
+
+// Process running a job.
+struct JobProcess {
+    size_t index;
+    pid_t pid;
+    // Read end of the pipe of the WireResult.
+    int fd;
+    WireResult result;
+    size_t received;
+    bool has_deadline;
+    Clock::time_point deadline;
+    bool killed;
+};
+
+// Runs `job` in the forked process and sends its result to `fd`.
+[[noreturn]] void RunChild(const BatchJob& job, int fd) {
+    HeadlessResult result;
+    headlessRun(job.job, &result);
+
+    WireResult wire = {};
+    wire.ran = result.ran;
+    wire.outputs_ok = result.outputs_ok;
+    wire.frames = result.frames;
+    wire.wall_ms = result.wall_ms;
+    wire.fps = result.fps;
+    wire.speed = result.speed;
+    wire.final_hash = result.final_hash;
+    snprintf(wire.system, sizeof(wire.system), "%s", result.system);
+    snprintf(wire.stop_reason, sizeof(wire.stop_reason), "%s", result.stop_reason);
+    snprintf(wire.error, sizeof(wire.error), "%s", result.error.c_str());
+
+    const char* data = reinterpret_cast<const char*>(&wire);
+    size_t written = 0;
+    while (written < sizeof(wire)) {
+        const ssize_t count = write(fd, data + written, sizeof(wire) - written);
+        if (count <= 0) {
+            _exit(EXIT_FAILURE);
+        }
+        written += count;
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+bool StartProcess(const BatchJob& job, size_t index, JobProcess* process) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+
+    // The buffered output would be written again by the child.
+    fflush(stdout);
+    fflush(stderr);
+    const pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        RunChild(job, fds[1]);
+    }
+    close(fds[1]);
+
+    *process = {};
+    process->index = index;
+    process->pid = pid;
+    process->fd = fds[0];
+    process->has_deadline = job.job.timeout > 0;
+    process->deadline =
+        Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(job.job.timeout + kKillGraceSeconds));
+    return true;
+}
+
+// Reaps the exited `process` and returns the outcome of its job.
+BatchOutcome FinishProcess(const BatchJob& job, JobProcess* process) {
+    close(process->fd);
+    int status = 0;
+    while (waitpid(process->pid, &status, 0) < 0 && errno == EINTR) {
+    }
+
+    BatchOutcome outcome;
+    if (process->killed) {
+        outcome.status = "killed";
+        outcome.detail = "timed out";
+    } else if (WIFSIGNALED(status)) {
+        outcome.status = "crashed";
+        outcome.detail = "signal " + std::to_string(WTERMSIG(status));
+    } else if (process->received != sizeof(process->result)) {
+        outcome.status = "crashed";
+        outcome.detail = "exited without a result";
+    } else {
+        const WireResult& wire = process->result;
+        HeadlessResult result;
+        result.ran = wire.ran;
+        result.outputs_ok = wire.outputs_ok;
+        result.error = wire.error;
+        result.system = wire.system;
+        result.frames = wire.frames;
+        result.stop_reason = wire.stop_reason;
+        result.wall_ms = wire.wall_ms;
+        result.fps = wire.fps;
+        result.speed = wire.speed;
+        result.final_hash = wire.final_hash;
+        outcome = Outcome(job, result);
+    }
+    return outcome;
+}
+
+// Runs every job in its own process, `workers` at a time.
+void RunProcesses(const std::vector<BatchJob>& jobs,
+                  int workers,
+                  std::vector<BatchOutcome>* outcomes) {
+    std::vector<JobProcess> running;
+    std::vector<pollfd> fds;
+    size_t next = 0;
+    size_t done = 0;
+
+    while (next < jobs.size() || !running.empty()) {
+        while (running.size() < static_cast<size_t>(workers) && next < jobs.size()) {
+            JobProcess process;
+            if (StartProcess(jobs[next], next, &process)) {
+                running.push_back(process);
+            } else {
+                (*outcomes)[next].status = "error";
+                (*outcomes)[next].detail = "cannot start a process";
+                PrintProgress(++done, jobs.size(), jobs[next], (*outcomes)[next]);
+            }
+            next++;
+        }
+        if (running.empty()) {
+            continue;
+        }
+
+        // Wait for a result, or for the next deadline.
+        Clock::time_point now = Clock::now();
+        int timeout_ms = -1;
+        fds.clear();
+        for (const JobProcess& process : running) {
+            fds.push_back({process.fd, POLLIN, 0});
+            if (process.has_deadline && !process.killed) {
+                const int remaining_ms = static_cast<int>(
+                    std::chrono::duration_cast<std::chrono::milliseconds>(process.deadline - now)
+                        .count());
+                timeout_ms = std::max(0, timeout_ms < 0 ? remaining_ms
+                                                        : std::min(timeout_ms, remaining_ms));
+            }
+        }
+        if (poll(fds.data(), fds.size(), timeout_ms) < 0 && errno != EINTR) {
+            perror("poll");
+            return;
+        }
+
+        now = Clock::now();
+        for (size_t i = running.size(); i-- > 0;) {
+            JobProcess& process = running[i];
+            if (fds[i].revents != 0) {
+                char* data = reinterpret_cast<char*>(&process.result);
+                const ssize_t count = read(process.fd, data + process.received,
+                                           sizeof(process.result) - process.received);
+                if (count > 0) {
+                    process.received += count;
+                } else if (count == 0 || errno != EINTR) {
+                    const BatchJob& job = jobs[process.index];
+                    (*outcomes)[process.index] = FinishProcess(job, &process);
+                    PrintProgress(++done, jobs.size(), job, (*outcomes)[process.index]);
+                    running.erase(running.begin() + i);
+                    continue;
+                }
+            }
+            if (process.has_deadline && !process.killed && now >= process.deadline) {
+                kill(process.pid, SIGKILL);
+                process.killed = true;
+            }
+        }
+    }
+}
+
+#endif  // !defined(_WIN32)
+
+std::string ReportJson(const BatchOptions& options,
+                       const std::vector<BatchJob>& jobs,
+                       const std::vector<BatchOutcome>& outcomes,
+                       int workers,
+                       double wall_ms,
+                       size_t passed) {
+    char buffer[512];
+    std::string json = "{\n  \"manifest\": ";
+    headlessAppendJsonString(&json, options.manifest);
+    snprintf(buffer, sizeof(buffer),
+             ",\n  \"workers\": %d,\n  \"isolation\": \"process\",\n  \"wall_ms\": %.3f,\n"
+             "  \"jobs\": %zu,\n  \"passed\": %zu,\n  \"failed\": %zu,\n  \"results\": [",
+             workers, wall_ms, jobs.size(), passed,
+             jobs.size() - passed);
+    json += buffer;
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const BatchOutcome& outcome = outcomes[i];
+        json += i == 0 ? "\n    {\"id\": " : ",\n    {\"id\": ";
+        headlessAppendJsonString(&json, jobs[i].id);
+        json += ", \"rom\": ";
+        headlessAppendJsonString(&json, jobs[i].job.rom);
+        json += ", \"status\": ";
+        headlessAppendJsonString(&json, outcome.status);
+        json += ", \"detail\": ";
+        headlessAppendJsonString(&json, outcome.detail);
+        json += ", \"system\": ";
+        headlessAppendJsonString(&json, outcome.system);
+        json += ", \"stop_reason\": ";
+        headlessAppendJsonString(&json, outcome.stop_reason);
+        snprintf(buffer, sizeof(buffer),
+                 ", \"frames\": %d, \"wall_ms\": %.3f, \"fps\": %.2f, \"speed\": %.3f, "
+                 "\"final_hash\": \"%016" PRIx64 "\"}",
+                 outcome.frames, outcome.wall_ms, outcome.fps, outcome.speed, outcome.final_hash);
+        json += buffer;
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+}  // namespace
+
+bool headlessRunBatch(const BatchOptions& options) {
+    std::vector<BatchJob> jobs;
+    if (!ParseManifest(options, &jobs)) {
+        return false;
+    }
+
+    int workers = options.workers;
+    if (workers <= 0) {
+        workers = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    workers = std::min(workers, std::max(1, static_cast<int>(jobs.size())));
+
+    std::vector<BatchOutcome> outcomes(jobs.size());
+    const Clock::time_point start = Clock::now();
+#if defined(_WIN32)
+    fprintf(stderr, "Batch runs require process isolation, which is not supported on "
+                    "Windows\n");
+    return false;
+#else
+    // The tables of the frontend are built before forking, the jobs then
+    // share their pages instead of each writing its own copy.
+    headlessInit();
+    RunProcesses(jobs, workers, &outcomes);
+#endif  // defined(_WIN32)
+    const double wall_ms =
+        std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    size_t passed = 0;
+    long long frames = 0;
+    for (const BatchOutcome& outcome : outcomes) {
+        passed += outcome.status == "passed";
+        frames += outcome.frames;
+    }
+    printf("%zu jobs, %zu passed, %zu failed, %lld frames in %.1f s on %d workers\n",
+           jobs.size(), passed, jobs.size() - passed, frames, wall_ms / 1000, workers);
+
+    bool result = passed == jobs.size();
+    if (!options.report.empty()) {
+        const std::string json = ReportJson(options, jobs, outcomes, workers, wall_ms, passed);
+        FILE* file = fopen(options.report.c_str(), "w");
+        bool written = file != nullptr && fwrite(json.data(), 1, json.size(), file) == json.size();
+        if (file != nullptr) {
+            written &= fclose(file) == 0;
+        }
+        if (!written) {
+            fprintf(stderr, "Cannot write %s\n", options.report.c_str());
+            result = false;
+        }
+    }
+    return result;
+}
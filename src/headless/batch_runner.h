@@ -0,0 +1,41 @@
+#ifndef VBAM_HEADLESS_BATCH_RUNNER_H_
+#define VBAM_HEADLESS_BATCH_RUNNER_H_
+
+#include <string>
+
+// Runs the jobs of a manifest on a pool of workers, one job per core.
+//
+// The manifest has one job per line: the ROM, followed by `name=value`
+// options named after the command line options of vbam-headless, plus `id`,
+// the name of the job in the report, and `expect`, the expected hash of the
+// last frame. Empty lines and lines starting with '#' are ignored, e.g.:
+//
+//   # Intro of the game, checked against a known frame.
+//   game.gba id=intro frames=600 expect=0123456789abcdef
+//   game.gba id=replay movie=replay.vmv png-dir=out png-interval=600
+//
+// The cores keep their state in globals, so every job runs in a forked
+// process, which also isolates the jobs from each other's crashes. Running
+// the jobs on threads would need per-instance cores, which this runner does
+// not attempt. The jobs share the read-only pages instead: the tables of the
+// frontend are built before forking, and the GBA ROMs are shared through the
+// ROM cache, see core/base/rom_mapping.h.
+// Workers pick the next pending job as soon as they are done, so long jobs
+// do not hold back the others.
+
+struct BatchOptions {
+    std::string manifest;
+    // Number of jobs run concurrently, 0 for one per hardware thread.
+    int workers = 0;
+    // Limits applied to every job, 0 for none. Jobs with a larger or no limit
+    // of their own are capped.
+    int max_frames = 0;
+    double max_seconds = 0;
+    // JSON report of all the jobs, empty for none.
+    std::string report;
+};
+
+// Runs the jobs of `options.manifest`. Returns true if all of them passed.
+bool headlessRunBatch(const BatchOptions& options);
+
+#endif  // VBAM_HEADLESS_BATCH_RUNNER_H_
@@ -0,0 +1,550 @@
+#include "headless/headless_runner.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "core/base/file_util.h"
+#include "core/base/huge_pages.h"
+#include "core/base/instrumentation.h"
+#include "core/base/message.h"
+#include "core/base/sizes.h"
+#include "core/base/system.h"
+#include "core/gb/gb.h"
+#include "core/gb/gbGlobals.h"
+#include "core/gba/gba.h"
+#include "core/gba/gbaCoverage.h"
+#include "core/gba/gbaFlash.h"
+#include "core/gba/gbaGlobals.h"
+#include "core/gba/gbaProfiler.h"
+#include "core/gba/gbaSound.h"
+#include "headless/headless_system.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Frame rate of both the GB and the GBA hardware.
+constexpr double kHardwareFps = 16777216.0 / 280896.0;
+// Size of the GBA frame buffer at 32 bits per pixel, see CPULoadRom().
+constexpr size_t kGBAPixSize = 4 * 241 * 162;
+// Maximum number of emuMain() calls for a single frame. A frame normally ends
+// within a few calls, this only guards against games that never end a frame.
+constexpr int kMaxSlicesPerFrame = 8;
+
+// Playback of a VMV movie, following the frontend logic: a version, then
+// {frame, joypad} little-endian entries. Version 1 entries hold absolute
+// frame numbers, version 2 entries hold the frames since the previous entry.
+class MoviePlayback final {
+public:
+    MoviePlayback() = default;
+    ~MoviePlayback() {
+        if (file_ != nullptr) {
+            fclose(file_);
+        }
+    }
+
+    // Disable copy constructor and assignment operator.
+    MoviePlayback(const MoviePlayback&) = delete;
+    MoviePlayback& operator=(const MoviePlayback&) = delete;
+
+    // Opens the movie at `path`. Returns false if it is not a VMV movie.
+    bool Open(const char* path) {
+        file_ = utilOpenFile(path, "rb");
+        uint32_t version = 0;
+        if (file_ == nullptr || !ReadU32(&version) || version < 1 || version > 2 ||
+            !ReadEntry()) {
+            return false;
+        }
+        version_ = version;
+        return true;
+    }
+
+    bool ended() const { return ended_; }
+
+    // Returns the joypad of the current frame.
+    uint32_t ReadJoypad() {
+        if (ended_) {
+            return joypad_;
+        }
+
+        if (version_ == 2) {
+            if (frame_ >= next_frame_) {
+                joypad_ = next_joypad_;
+                ended_ = !ReadEntry();
+                frame_ = 0;
+            }
+        } else {
+            while (!ended_ && frame_ >= next_frame_) {
+                joypad_ = next_joypad_;
+                ended_ = !ReadEntry();
+            }
+        }
+        return joypad_;
+    }
+
+    void OnFrame() { frame_++; }
+
+private:
+    bool ReadU32(uint32_t* value) {
+        uint8_t bytes[4];
+        if (fread(bytes, 1, sizeof(bytes), file_) != sizeof(bytes)) {
+            return false;
+        }
+        *value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (uint32_t(bytes[3]) << 24);
+        return true;
+    }
+
+    bool ReadEntry() { return ReadU32(&next_frame_) && ReadU32(&next_joypad_); }
+
+    FILE* file_ = nullptr;
+    uint32_t version_ = 0;
+    uint32_t frame_ = 0;
+    uint32_t joypad_ = 0;
+    uint32_t next_frame_ = 0;
+    uint32_t next_joypad_ = 0;
+    bool ended_ = false;
+};
+
+// State of the running job, for the system*() hooks.
+MoviePlayback* g_movie = nullptr;
+std::vector<uint8_t>* g_audio = nullptr;
+// Frames ended by the core, counted by systemFrame().
+int g_frame_count = 0;
+
+uint32_t ReadMovieJoypad(int) {
+    return g_movie->ReadJoypad();
+}
+
+void OnFrame() {
+    g_frame_count++;
+    if (g_movie != nullptr) {
+        g_movie->OnFrame();
+    }
+}
+
+void OnSoundWrite(const uint16_t* samples, int length) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(samples);
+    g_audio->insert(g_audio->end(), bytes, bytes + length);
+}
+
+void PutU16(std::vector<uint8_t>* data, uint16_t value) {
+    data->push_back(value & 0xff);
+    data->push_back(value >> 8);
+}
+
+void PutU32(std::vector<uint8_t>* data, uint32_t value) {
+    PutU16(data, value & 0xffff);
+    PutU16(data, value >> 16);
+}
+
+// Writes the 16 bits stereo `samples` as a WAV file.
+bool WriteWav(const char* path, const std::vector<uint8_t>& samples, uint32_t sample_rate) {
+    constexpr uint16_t kChannels = 2;
+    constexpr uint16_t kBitsPerSample = 16;
+    constexpr uint16_t kBlockAlign = kChannels * kBitsPerSample / 8;
+    const uint32_t data_size = static_cast<uint32_t>(samples.size());
+
+    std::vector<uint8_t> header;
+    header.insert(header.end(), {'R', 'I', 'F', 'F'});
+    PutU32(&header, 36 + data_size);
+    header.insert(header.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+    PutU32(&header, 16);
+    PutU16(&header, 1);  // PCM
+    PutU16(&header, kChannels);
+    PutU32(&header, sample_rate);
+    PutU32(&header, sample_rate * kBlockAlign);
+    PutU16(&header, kBlockAlign);
+    PutU16(&header, kBitsPerSample);
+    header.insert(header.end(), {'d', 'a', 't', 'a'});
+    PutU32(&header, data_size);
+
+    FILE* file = utilOpenFile(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool result = fwrite(header.data(), 1, header.size(), file) == header.size() &&
+                  fwrite(samples.data(), 1, samples.size(), file) == samples.size();
+    result &= fclose(file) == 0;
+    return result;
+}
+
+// Loads the ROM of `job` and returns its system, or null on failure.
+const EmulatedSystem* LoadRom(const HeadlessJob& job, HeadlessResult* result) {
+    const char* bios = job.bios.empty() ? nullptr : job.bios.c_str();
+    switch (utilFindType(job.rom.c_str())) {
+        case IMAGE_GB:
+            if (!gbLoadRom(job.rom.c_str())) {
+                break;
+            }
+            gbGetHardwareType();
+            if (gbHardware & 7) {
+                gbCPUInit(bios, bios != nullptr);
+            }
+            gbReset();
+            result->system = "gb";
+            return &GBSystem;
+
+        case IMAGE_GBA: {
+            const int size = CPULoadRom(job.rom.c_str());
+            if (size == 0) {
+                break;
+            }
+            if (coreOptions.cpuSaveType == 0) {
+                flashDetectSaveType(size);
+            } else {
+                coreOptions.saveType = coreOptions.cpuSaveType;
+            }
+            CPUInit(bios, bios != nullptr);
+            CPUReset();
+            result->system = "gba";
+            return &GBASystem;
+        }
+
+        case IMAGE_UNKNOWN:
+            result->error = "unknown file type " + job.rom;
+            return nullptr;
+    }
+
+    result->error = "failed to load " + job.rom;
+    return nullptr;
+}
+
+// Emulates the frames of `job` on the loaded `system`.
+bool RunFrames(const HeadlessJob& job,
+               const EmulatedSystem& system,
+               MoviePlayback* movie,
+               HeadlessResult* result) {
+    const size_t pix_size = &system == &GBSystem ? kGBPixSize : kGBAPixSize;
+    bool outputs_ok = true;
+
+    FILE* hashes = nullptr;
+    if (!job.hash_path.empty()) {
+        hashes = utilOpenFile(job.hash_path.c_str(), "w");
+        if (hashes == nullptr) {
+            systemMessage(0, "Cannot write %s", job.hash_path.c_str());
+            outputs_ok = false;
+        }
+    }
+
+    const Clock::time_point start = Clock::now();
+    const Clock::duration timeout =
+        std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(job.timeout));
+    int frame = 0;
+    for (;;) {
+        if (job.frames > 0 && frame >= job.frames) {
+            result->stop_reason = "frames";
+            break;
+        }
+        if (movie != nullptr && movie->ended() && job.frames == 0) {
+            result->stop_reason = "movie-end";
+            break;
+        }
+        if (job.timeout > 0 && Clock::now() - start >= timeout) {
+            result->stop_reason = "timeout";
+            break;
+        }
+
+        // emuMain() returns after emuCount cycles or at the end of a frame,
+        // whichever comes first. Slices that do not end a frame still count
+        // as one, so that the stop conditions apply.
+        const int frame_count = g_frame_count;
+        for (int i = 0; i < kMaxSlicesPerFrame && g_frame_count == frame_count; i++) {
+            system.emuMain(system.emuCount);
+        }
+        frame++;
+
+        const bool hash_due = hashes != nullptr && frame % job.hash_interval == 0;
+        if (hash_due || job.stop_on_hash) {
+            const uint64_t hash = headlessHash(g_pix, pix_size);
+            if (hash_due) {
+                fprintf(hashes, "%d %016" PRIx64 "\n", frame, hash);
+            }
+            if (job.stop_on_hash && hash == job.until_hash) {
+                result->stop_reason = "hash";
+                break;
+            }
+        }
+
+        if (!job.png_dir.empty() && frame % job.png_interval == 0) {
+            char name[32];
+            snprintf(name, sizeof(name), "/frame-%06d.png", frame);
+            const std::string path = job.png_dir + name;
+            if (!system.emuWritePNG(path.c_str())) {
+                systemMessage(0, "Cannot write %s", path.c_str());
+                outputs_ok = false;
+            }
+        }
+    }
+
+    result->wall_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    result->frames = frame;
+    result->fps = result->wall_ms > 0 ? frame * 1000.0 / result->wall_ms : 0;
+    result->speed = result->fps / kHardwareFps;
+    result->final_hash = headlessHash(g_pix, pix_size);
+
+    if (hashes != nullptr && fclose(hashes) != 0) {
+        systemMessage(0, "Cannot write %s", job.hash_path.c_str());
+        outputs_ok = false;
+    }
+    return outputs_ok;
+}
+
+}  // namespace
+
+bool headlessSetJobOption(HeadlessJob* job, const char* name, const char* value) {
+    const struct {
+        const char* name;
+        std::string HeadlessJob::*field;
+    } paths[] = {
+        {"bios", &HeadlessJob::bios},
+        {"state", &HeadlessJob::state},
+        {"movie", &HeadlessJob::movie},
+        {"hashes", &HeadlessJob::hash_path},
+        {"png-dir", &HeadlessJob::png_dir},
+        {"wav", &HeadlessJob::wav_path},
+        {"save-state", &HeadlessJob::save_state},
+        {"json", &HeadlessJob::json_path},
+        {"instrumentation", &HeadlessJob::instrumentation_path},
+        {"instrumentation-trace", &HeadlessJob::trace_path},
+        {"profile", &HeadlessJob::profile_path},
+        {"coverage", &HeadlessJob::coverage_path},
+        {"coverage-lcov", &HeadlessJob::lcov_path},
+    };
+    for (const auto& path : paths) {
+        if (strcmp(name, path.name) == 0) {
+            job->*path.field = value;
+            return true;
+        }
+    }
+
+    char* end = nullptr;
+    if (strcmp(name, "until-hash") == 0) {
+        job->stop_on_hash = true;
+        job->until_hash = strtoull(value, &end, 16);
+    } else if (strcmp(name, "timeout") == 0) {
+        job->timeout = strtod(value, &end);
+        return *end == '\0' && job->timeout >= 0;
+    } else if (strcmp(name, "frames") == 0) {
+        job->frames = static_cast<int>(strtol(value, &end, 10));
+        return *end == '\0' && job->frames >= 0;
+    } else if (strcmp(name, "hash-interval") == 0) {
+        job->hash_interval = static_cast<int>(strtol(value, &end, 10));
+    } else if (strcmp(name, "png-interval") == 0) {
+        job->png_interval = static_cast<int>(strtol(value, &end, 10));
+    } else if (strcmp(name, "profile-hz") == 0) {
+        job->profile_hz = static_cast<int>(strtol(value, &end, 10));
+        return *end == '\0' && job->profile_hz > 0;
+    } else {
+        return false;
+    }
+    return end != value && *end == '\0';
+}
+
+bool headlessRun(const HeadlessJob& job, HeadlessResult* result) {
+    *result = HeadlessResult();
+    if (job.frames <= 0 && job.movie.empty() && !job.stop_on_hash && job.timeout <= 0) {
+        result->error = "no stop condition";
+        return false;
+    }
+    if (job.hash_interval <= 0 || job.png_interval <= 0) {
+        result->error = "invalid output interval";
+        return false;
+    }
+
+    headlessInit();
+    soundInit();
+
+    const EmulatedSystem* system = LoadRom(job, result);
+    if (system == nullptr) {
+        soundShutdown();
+        return false;
+    }
+
+    MoviePlayback movie;
+    std::vector<uint8_t> audio;
+    if (!job.movie.empty()) {
+        std::string movie_state = job.movie;
+        movie_state.back() = '0';
+        if (!movie.Open(job.movie.c_str())) {
+            result->error = "cannot open movie " + job.movie;
+        } else if (!system->emuReadState(movie_state.c_str())) {
+            result->error = "cannot read movie state " + movie_state;
+        }
+    } else if (!job.state.empty() && !system->emuReadState(job.state.c_str())) {
+        result->error = "cannot read state " + job.state;
+    }
+
+    if (result->error.empty()) {
+        if (!job.movie.empty()) {
+            g_movie = &movie;
+            headlessReadJoypad = ReadMovieJoypad;
+        }
+        g_frame_count = 0;
+        headlessOnFrame = OnFrame;
+        if (!job.wav_path.empty()) {
+            g_audio = &audio;
+            headlessOnSoundWrite = OnSoundWrite;
+        }
+
+        if (!job.trace_path.empty()) {
+            VBAM_INSTR_THREAD_NAME("emulation");
+            instrStartTrace();
+        }
+#if defined(VBAM_ENABLE_DEBUGGER)
+        if (!job.profile_path.empty()) {
+            gbaProfilerStart(16777216 / job.profile_hz);
+        }
+#endif  // defined(VBAM_ENABLE_DEBUGGER)
+        const bool coverage = !job.coverage_path.empty() || !job.lcov_path.empty();
+        if (coverage && kInstrumentationEnabled) {
+            gbaCoverageStart();
+        }
+
+        result->ran = true;
+        result->outputs_ok = RunFrames(job, *system, job.movie.empty() ? nullptr : &movie, result);
+
+        headlessReadJoypad = nullptr;
+        headlessOnFrame = nullptr;
+        headlessOnSoundWrite = nullptr;
+        g_movie = nullptr;
+        g_audio = nullptr;
+
+        if (!job.wav_path.empty() &&
+            !WriteWav(job.wav_path.c_str(), audio, static_cast<uint32_t>(soundGetSampleRate()))) {
+            systemMessage(0, "Cannot write %s", job.wav_path.c_str());
+            result->outputs_ok = false;
+        }
+        if (!job.save_state.empty() && !system->emuWriteState(job.save_state.c_str())) {
+            systemMessage(0, "Cannot write %s", job.save_state.c_str());
+            result->outputs_ok = false;
+        }
+        if (!job.profile_path.empty()) {
+#if defined(VBAM_ENABLE_DEBUGGER)
+            gbaProfilerStop();
+            // Before the clean up, which unloads the ELF symbols.
+            if (system != &GBASystem) {
+                systemMessage(0, "Cannot write %s, only GBA code is profiled",
+                              job.profile_path.c_str());
+                result->outputs_ok = false;
+            } else if (!gbaProfilerWriteCollapsed(job.profile_path.c_str())) {
+                systemMessage(0, "Cannot write %s", job.profile_path.c_str());
+                result->outputs_ok = false;
+            }
+#else
+            systemMessage(0, "Cannot write %s, built without ENABLE_DEBUGGER",
+                          job.profile_path.c_str());
+            result->outputs_ok = false;
+#endif  // defined(VBAM_ENABLE_DEBUGGER)
+        }
+        if (coverage) {
+            // Also before the clean up, for the ELF line information.
+#if defined(VBAM_ENABLE_DEBUGGER)
+            constexpr bool has_lcov = true;
+#else
+            constexpr bool has_lcov = false;
+#endif  // defined(VBAM_ENABLE_DEBUGGER)
+            for (const std::string* path : {&job.coverage_path, &job.lcov_path}) {
+                if (path->empty()) {
+                    continue;
+                }
+                if (!kInstrumentationEnabled) {
+                    systemMessage(0, "Cannot write %s, built without ENABLE_INSTRUMENTATION",
+                                  path->c_str());
+                    result->outputs_ok = false;
+                } else if (path == &job.lcov_path && !has_lcov) {
+                    systemMessage(0, "Cannot write %s, built without ENABLE_DEBUGGER",
+                                  path->c_str());
+                    result->outputs_ok = false;
+                } else if (system != &GBASystem) {
+                    systemMessage(0, "Cannot write %s, only GBA code is covered",
+                                  path->c_str());
+                    result->outputs_ok = false;
+                } else if (!(path == &job.lcov_path ? gbaCoverageWriteLcov(path->c_str())
+                                                    : gbaCoverageWriteBitmap(path->c_str()))) {
+                    systemMessage(0, "Cannot write %s", path->c_str());
+                    result->outputs_ok = false;
+                }
+            }
+            gbaCoverageStop();
+        }
+        for (const std::string* path : {&job.instrumentation_path, &job.trace_path}) {
+            if (path->empty()) {
+                continue;
+            }
+            if (!kInstrumentationEnabled) {
+                systemMessage(0, "Cannot write %s, built without ENABLE_INSTRUMENTATION",
+                              path->c_str());
+                result->outputs_ok = false;
+            } else if (!(path == &job.trace_path ? instrWriteTrace(path->c_str())
+                                                 : instrWriteDump(path->c_str()))) {
+                systemMessage(0, "Cannot write %s", path->c_str());
+                result->outputs_ok = false;
+            }
+        }
+    }
+
+    const HugePageStats huge_pages = hugePageStats();
+    result->huge_page_buffer_bytes = huge_pages.bytes;
+    result->huge_page_bytes = huge_pages.explicit_bytes + huge_pages.transparent_bytes;
+
+    if (system == &GBSystem) {
+        gbCleanUp();
+    } else {
+        CPUCleanUp();
+    }
+    soundShutdown();
+
+    if (result->ran && !job.json_path.empty()) {
+        const std::string json = headlessResultJson(job, *result);
+        FILE* file = utilOpenFile(job.json_path.c_str(), "w");
+        bool written = file != nullptr && fwrite(json.data(), 1, json.size(), file) == json.size();
+        if (file != nullptr) {
+            written &= fclose(file) == 0;
+        }
+        if (!written) {
+            systemMessage(0, "Cannot write %s", job.json_path.c_str());
+            result->outputs_ok = false;
+        }
+    }
+
+    return result->ran && result->outputs_ok;
+}
+
+void headlessAppendJsonString(std::string* json, const std::string& value) {
+    json->push_back('"');
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            json->push_back('\\');
+            json->push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            json->append(escape);
+        } else {
+            json->push_back(c);
+        }
+    }
+    json->push_back('"');
+}
+
+std::string headlessResultJson(const HeadlessJob& job, const HeadlessResult& result) {
+    char buffer[256];
+    std::string json = "{\n  \"rom\": ";
+    headlessAppendJsonString(&json, job.rom);
+    json += ",\n  \"system\": ";
+    headlessAppendJsonString(&json, result.system);
+    snprintf(buffer, sizeof(buffer),
+             ",\n  \"frames\": %d,\n  \"stop_reason\": \"%s\",\n  \"wall_ms\": %.3f,\n"
+             "  \"fps\": %.2f,\n  \"speed\": %.3f,\n  \"final_hash\": \"%016" PRIx64 "\",\n"
+             "  \"huge_page_buffer_bytes\": %zu,\n  \"huge_page_bytes\": %zu,\n"
+             "  \"outputs_ok\": %s\n}\n",
+             result.frames, result.stop_reason, result.wall_ms, result.fps, result.speed,
+             result.final_hash, result.huge_page_buffer_bytes, result.huge_page_bytes,
+             result.outputs_ok ? "true" : "false");
+    json += buffer;
+    return json;
+}
@@ -0,0 +1,98 @@
+#ifndef VBAM_HEADLESS_HEADLESS_RUNNER_H_
+#define VBAM_HEADLESS_HEADLESS_RUNNER_H_
+
+#include <cstdint>
+#include <string>
+
+// Runs a ROM without a frontend, as fast as the host allows.
+//
+// The ROM is loaded with its optional BIOS, then the optional savestate or
+// VMV movie is loaded, and frames are emulated until one of the stop
+// conditions of the job is met. Every output of the job is optional: frame
+// hashes, PNG dumps, the audio as a WAV file, the final savestate and a JSON
+// summary of the run.
+
+// Work order of a run. Paths are UTF-8, empty to disable the output.
+struct HeadlessJob {
+    std::string rom;
+    std::string bios;
+    // Savestate loaded after the ROM.
+    std::string state;
+    // VMV movie played back from its initial savestate, "<name>.vm0". The
+    // run stops at the end of the movie unless `frames` is set.
+    std::string movie;
+
+    // Number of frames to run, 0 to only stop on the other conditions.
+    int frames = 0;
+    // Stops when a frame hashes to this value, if set.
+    bool stop_on_hash = false;
+    uint64_t until_hash = 0;
+    // Wall-clock limit in seconds, 0 for none.
+    double timeout = 0;
+
+    // Frame hashes, one "<frame> <hash>" line every `hash_interval` frames.
+    std::string hash_path;
+    int hash_interval = 1;
+    // PNG dumps, "<png_dir>/frame-<frame>.png" every `png_interval` frames.
+    std::string png_dir;
+    int png_interval = 60;
+    std::string wav_path;
+    // Savestate written at the end of the run.
+    std::string save_state;
+    std::string json_path;
+    // Per-frame timings and Chrome trace of the run, see instrumentation.h.
+    // Need a build with ENABLE_INSTRUMENTATION.
+    std::string instrumentation_path;
+    std::string trace_path;
+    // Samples of the emulated GBA code, see gbaProfiler.h, written as
+    // collapsed stacks. Needs a build with ENABLE_DEBUGGER.
+    std::string profile_path;
+    int profile_hz = 10000;
+    // Executed GBA code, see gbaCoverage.h, as a bitmap and as an lcov
+    // tracefile of the ELF file. Need a build with ENABLE_INSTRUMENTATION,
+    // and ENABLE_DEBUGGER for the tracefile.
+    std::string coverage_path;
+    std::string lcov_path;
+};
+
+// Outcome of a run.
+struct HeadlessResult {
+    // Set if the ROM ran, even if some outputs failed.
+    bool ran = false;
+    // Set if all the outputs were written.
+    bool outputs_ok = false;
+    // Error message when `ran` is not set.
+    std::string error;
+
+    // "gb" or "gba".
+    const char* system = "";
+    int frames = 0;
+    // "frames", "hash", "movie-end" or "timeout".
+    const char* stop_reason = "";
+    double wall_ms = 0;
+    // Emulated frames per second, and speed relative to the hardware.
+    double fps = 0;
+    double speed = 0;
+    uint64_t final_hash = 0;
+    // Bytes of the buffers allocated for huge pages at the end of the run, and
+    // of those actually backed by huge pages, see huge_pages.h.
+    size_t huge_page_buffer_bytes = 0;
+    size_t huge_page_bytes = 0;
+};
+
+// Sets the option `name` of `job` to `value`. Options are named after the
+// command line options of vbam-headless, without the leading dashes. Returns
+// false if `name` is unknown or `value` is invalid.
+bool headlessSetJobOption(HeadlessJob* job, const char* name, const char* value);
+
+// Runs `job`. The cores keep their state in globals, so only one job may run
+// per process at a time. Returns `result.ran && result.outputs_ok`.
+bool headlessRun(const HeadlessJob& job, HeadlessResult* result);
+
+// Returns the JSON summary of the run of `job`.
+std::string headlessResultJson(const HeadlessJob& job, const HeadlessResult& result);
+
+// Appends `value` to `json` as a JSON string.
+void headlessAppendJsonString(std::string* json, const std::string& value);
+
+#endif  // VBAM_HEADLESS_HEADLESS_RUNNER_H_
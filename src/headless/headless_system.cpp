@@ -0,0 +1,167 @@
+#include "headless/headless_system.h"
+
+#include <cstdarg>
+#include <cstdio>
+
+#include "core/base/message.h"
+#include "core/base/sound_driver.h"
+#include "core/base/system.h"
+
+namespace {
+
+// Sound driver that drops all samples.
+class NullSoundDriver final : public SoundDriver {
+public:
+    NullSoundDriver() = default;
+    ~NullSoundDriver() override = default;
+
+    bool init(long) override { return true; }
+    void pause() override {}
+    void reset() override {}
+    void resume() override {}
+    void write(uint16_t*, int) override {}
+    void setThrottle(unsigned short) override {}
+};
+
+}  // namespace
+
+// Frontend globals required by the core.
+struct CoreOptions coreOptions;
+void (*dbgOutput)(const char* s, uint32_t addr) = nullptr;
+void (*dbgSignal)(int sig, int number) = nullptr;
+int emulating = 0;
+
+uint16_t systemColorMap16[0x10000];
+uint32_t systemColorMap32[0x10000];
+uint16_t systemGbPalette[24];
+int systemRedShift = 0;
+int systemGreenShift = 0;
+int systemBlueShift = 0;
+int systemColorDepth = 0;
+int systemVerbose = 0;
+int systemFrameSkip = 0;
+int systemSaveUpdateCounter = SYSTEM_SAVE_NOT_UPDATED;
+int systemSpeed = 0;
+
+void (*headlessOnDrawScreen)() = nullptr;
+void (*headlessOnFrame)() = nullptr;
+uint32_t (*headlessReadJoypad)(int joy) = nullptr;
+void (*headlessOnSoundWrite)(const uint16_t* samples, int length) = nullptr;
+int headlessFramesDrawn = 0;
+
+void headlessInit() {
+    systemColorDepth = 32;
+    systemRedShift = 19;
+    systemGreenShift = 11;
+    systemBlueShift = 3;
+
+    // The color map never changes, it is only built once so that the batch
+    // jobs forked after the first call share its pages.
+    static bool color_map_built = false;
+    if (!color_map_built) {
+        for (int i = 0; i < 0x10000; i++) {
+            systemColorMap32[i] = ((i & 0x1f) << systemRedShift) |
+                                  (((i & 0x3e0) >> 5) << systemGreenShift) |
+                                  (((i & 0x7c00) >> 10) << systemBlueShift);
+        }
+        color_map_built = true;
+    }
+
+    // Default DMG palette, as used by the frontends.
+    static const uint16_t kDefaultGbPalette[] = {
+        0x7fff, 0x56b5, 0x318c, 0x0000, 0x7fff, 0x56b5, 0x318c, 0x0000,
+    };
+    for (int i = 0; i < 24; i++) {
+        systemGbPalette[i] = kDefaultGbPalette[i % 8];
+    }
+
+    headlessFramesDrawn = 0;
+    emulating = 1;
+}
+
+uint64_t headlessHash(const uint8_t* data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+void log(const char* defaultMsg, ...) {
+    va_list valist;
+    va_start(valist, defaultMsg);
+    vfprintf(stderr, defaultMsg, valist);
+    va_end(valist);
+}
+
+void systemMessage(int, const char* msg, ...) {
+    va_list valist;
+    va_start(valist, msg);
+    vfprintf(stderr, msg, valist);
+    va_end(valist);
+    fputc('\n', stderr);
+}
+
+bool systemPauseOnFrame() {
+    return true;
+}
+
+void systemDrawScreen() {
+    headlessFramesDrawn++;
+    if (headlessOnDrawScreen) {
+        headlessOnDrawScreen();
+    }
+}
+
+std::unique_ptr<SoundDriver> systemSoundInit() {
+    return std::unique_ptr<SoundDriver>(new NullSoundDriver());
+}
+
+void systemGbPrint(uint8_t*, int, int, int, int, int) {}
+void systemScreenCapture(int) {}
+void systemSendScreen() {}
+bool systemReadJoypads() {
+    return true;
+}
+uint32_t systemReadJoypad(int joy) {
+    return headlessReadJoypad ? headlessReadJoypad(joy) : 0;
+}
+uint32_t systemGetClock() {
+    return 0;
+}
+void systemSetTitle(const char*) {}
+void systemOnWriteDataToSoundBuffer(const uint16_t* finalWave, int length) {
+    if (headlessOnSoundWrite) {
+        headlessOnSoundWrite(finalWave, length);
+    }
+}
+void systemOnSoundShutdown() {}
+void systemScreenMessage(const char*) {}
+void systemUpdateMotionSensor() {}
+int systemGetSensorX() {
+    return 0;
+}
+int systemGetSensorY() {
+    return 0;
+}
+int systemGetSensorZ() {
+    return 0;
+}
+uint8_t systemGetSensorDarkness() {
+    return 0xe8;
+}
+void systemCartridgeRumble(bool) {}
+void systemPossibleCartridgeRumble(bool) {}
+void updateRumbleFrame() {}
+bool systemCanChangeSoundQuality() {
+    return false;
+}
+void systemShowSpeed(int) {}
+void system10Frames() {}
+void systemFrame() {
+    if (headlessOnFrame) {
+        headlessOnFrame();
+    }
+}
+void systemGbBorderOn() {}
@@ -0,0 +1,34 @@
+#ifndef VBAM_HEADLESS_HEADLESS_SYSTEM_H_
+#define VBAM_HEADLESS_HEADLESS_SYSTEM_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Implementation of the system*() callbacks for running the cores without a
+// frontend. Sound output is discarded unless captured with
+// headlessOnSoundWrite, input is released unless provided with
+// headlessReadJoypad and systemPauseOnFrame() returns true, so the emulation
+// function of the cores returns after every drawn frame.
+
+// Sets up a 32 bits per pixel output with a fixed color map and marks the
+// emulator as running. Must be called before loading a ROM. The color map is
+// only written by the first call.
+void headlessInit();
+
+// Called from systemDrawScreen() when set.
+extern void (*headlessOnDrawScreen)();
+// Called from systemFrame() when set.
+extern void (*headlessOnFrame)();
+// Returns the systemReadJoypad() input when set.
+extern uint32_t (*headlessReadJoypad)(int joy);
+// Called with the sound output when set, `length` bytes of 16 bits stereo
+// samples at soundGetSampleRate().
+extern void (*headlessOnSoundWrite)(const uint16_t* samples, int length);
+
+// Number of systemDrawScreen() calls since the last reset.
+extern int headlessFramesDrawn;
+
+// FNV-1a hash of `size` bytes at `data`, used to identify frames.
+uint64_t headlessHash(const uint8_t* data, size_t size);
+
+#endif  // VBAM_HEADLESS_HEADLESS_SYSTEM_H_
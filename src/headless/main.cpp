@@ -0,0 +1,121 @@
+// Headless runner: runs a GB or GBA ROM without a frontend, as fast as the host
+// allows, and writes the requested outputs. See headless_runner.h, and
+// batch_runner.h for running many jobs at once.
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "headless/batch_runner.h"
+#include "headless/headless_runner.h"
+
+namespace {
+
+void Usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options] ROM\n"
+            "       %s --batch MANIFEST [batch options]\n"
+            "Options:\n"
+            "  --bios FILE         BIOS or boot ROM\n"
+            "  --state FILE        Savestate loaded after the ROM\n"
+            "  --movie FILE        VMV movie to play back, runs until its end by default\n"
+            "  --frames N          Number of frames to run\n"
+            "  --until-hash HASH   Stop when a frame hashes to HASH\n"
+            "  --timeout SECONDS   Stop after SECONDS of wall-clock time\n"
+            "  --hashes FILE       Write the frame hashes to FILE\n"
+            "  --hash-interval N   Hash every N frames (default: 1)\n"
+            "  --png-dir DIR       Write PNG dumps of the frames to DIR\n"
+            "  --png-interval N    Dump every N frames (default: 60)\n"
+            "  --wav FILE          Write the audio to FILE\n"
+            "  --save-state FILE   Write a savestate at the end of the run\n"
+            "  --json FILE         Write a JSON timing summary to FILE, - for stdout\n"
+            "  --instrumentation FILE\n"
+            "                      Write the per-frame timings to FILE, as JSON if it ends\n"
+            "                      with .json and CSV otherwise\n"
+            "  --instrumentation-trace FILE\n"
+            "                      Write a Chrome trace of the run to FILE\n"
+            "  --profile FILE      Write samples of the emulated GBA code to FILE, as\n"
+            "                      collapsed stacks for flame graphs\n"
+            "  --profile-hz N      Samples per emulated second (default: 10000)\n"
+            "  --coverage FILE     Write a bitmap of the executed GBA code to FILE\n"
+            "  --coverage-lcov FILE\n"
+            "                      Write an lcov tracefile of the executed lines of the\n"
+            "                      ELF file to FILE\n"
+            "Batch options:\n"
+            "  --batch MANIFEST    Run the jobs of MANIFEST, one ROM and its options per line\n"
+            "  --workers N         Number of concurrent jobs (default: one per CPU)\n"
+            "  --max-frames N      Frame limit of every job\n"
+            "  --max-seconds S     Time limit of every job\n"
+            "  --report FILE       Write a JSON report of all the jobs to FILE\n"
+            "Environment:\n"
+            "  VBAM_ROM_CACHE      Directory of the read-only ROM copies shared by the jobs\n"
+            "                      running the same GBA ROM, empty to disable (default:\n"
+            "                      $XDG_CACHE_HOME/visualboyadvance-m/roms)\n",
+            program, program);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    HeadlessJob job;
+    BatchOptions batch;
+    bool json_stdout = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc && strcmp(argv[i + 1], "-") == 0) {
+            json_stdout = true;
+            i++;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch.manifest = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            batch.workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-frames") == 0 && i + 1 < argc) {
+            batch.max_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-seconds") == 0 && i + 1 < argc) {
+            batch.max_seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            batch.report = argv[++i];
+        } else if (strncmp(argv[i], "--", 2) == 0 && i + 1 < argc &&
+                   headlessSetJobOption(&job, argv[i] + 2, argv[i + 1])) {
+            i++;
+        } else if (argv[i][0] != '-' && job.rom.empty()) {
+            job.rom = argv[i];
+        } else {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!batch.manifest.empty()) {
+        if (!job.rom.empty() || batch.workers < 0 || batch.max_frames < 0 ||
+            batch.max_seconds < 0) {
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return headlessRunBatch(batch) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (job.rom.empty() ||
+        (job.frames == 0 && job.movie.empty() && !job.stop_on_hash && job.timeout == 0)) {
+        Usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    HeadlessResult result;
+    const bool succeeded = headlessRun(job, &result);
+    if (!result.ran) {
+        fprintf(stderr, "%s: %s\n", job.rom.c_str(), result.error.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (json_stdout) {
+        fputs(headlessResultJson(job, result).c_str(), stdout);
+    } else {
+        printf("%s: %d frames in %.1f ms, %.1f fps (%.1fx), stopped on %s, final hash %016" PRIx64
+               "\n",
+               job.rom.c_str(), result.frames, result.wall_ms, result.fps, result.speed,
+               result.stop_reason, result.final_hash);
+    }
+    return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -47,6 +47,7 @@
 #include "core/gba/gba.h"
 #include "core/gba/gbaFlash.h"
 #include "core/gba/gbaPrint.h"
+#include "core/gba/gbaProfiler.h"
 #include "core/gba/gbaRemote.h"
 #include "core/gba/gbaRtc.h"
 #include "core/gba/gbaSound.h"
@@ -87,9 +88,13 @@ enum named_opts
 	OPT_GB_FRAME_SKIP,
 	OPT_GB_PALETTE_OPTION,
 	OPT_IFB_TYPE,
+	OPT_INSTRUMENTATION_DUMP,
+	OPT_INSTRUMENTATION_TRACE,
 	OPT_OPT_FLASH_SIZE,
+	OPT_PROFILE_OUTPUT,
 	OPT_REWIND_TIMER,
 	OPT_RTC_ENABLED,
+	OPT_RUN_AHEAD_FRAMES,
 	OPT_SAVE_DIR,
 	OPT_SCREEN_SHOT_DIR,
 	OPT_SHOW_SPEED,
@@ -105,9 +110,6 @@ enum named_opts
 #define SOUND_ECHO       0.2
 #define SOUND_STEREO     0.15
 
-#define REWIND_NUM 8
-#define REWIND_SIZE 400000
-
 char path[2048];
 
 dictionary* preferences;
@@ -116,6 +118,9 @@ const char* batteryDir;
 const char* biosFileNameGB;
 const char* biosFileNameGBA;
 const char* biosFileNameGBC;
+const char* instrumentationDump;
+const char* instrumentationTrace;
+const char* profileOutput;
 const char* saveDir;
 const char* screenShotDir;
 int agbPrint;
@@ -123,6 +128,7 @@ int autoFireMaxCount = 1;
 int autoFrameSkip = 0;
 int autoPatch;
 int captureFormat = 0;
+int dedupStates = 0;
 int disableStatusMessages = 0;
 int filter = kStretch2x;
 int frameSkip = 1;
@@ -134,6 +140,7 @@ int optPrintUsage;
 int pauseWhenInactive = 0;
 int preparedCheats = 0;
 int rewindTimer = 0;
+int runAheadFrames = 0;
 int showSpeed;
 int showSpeedTransparent;
 
@@ -172,6 +179,7 @@ struct option argOptions[] = {
 	{ "cpu-disable-sfx", no_argument, &coreOptions.cpuDisableSfx, 1 },
 	{ "cpu-save-type", required_argument, 0, OPT_CPU_SAVE_TYPE },
 	{ "debug", no_argument, 0, 'd' },
+	{ "dedup-states", no_argument, &dedupStates, 1 },
 	{ "disable-sfx", no_argument, &coreOptions.cpuDisableSfx, 1 },
 	{ "disable-status-messages", no_argument, &disableStatusMessages, 1 },
 	{ "dotcode-file-name-load", required_argument, 0, OPT_DOTCODE_FILE_NAME_LOAD },
@@ -193,9 +201,12 @@ struct option argOptions[] = {
 	{ "help", no_argument, &optPrintUsage, 1 },
 	{ "ifb-filter", required_argument, 0, 'I' },
 	{ "ifb-type", required_argument, 0, OPT_IFB_TYPE },
+	{ "instrumentation-dump", required_argument, 0, OPT_INSTRUMENTATION_DUMP },
+	{ "instrumentation-trace", required_argument, 0, OPT_INSTRUMENTATION_TRACE },
 	{ "no-agb-print", no_argument, &agbPrint, 0 },
 	{ "no-auto-frameskip", no_argument, &autoFrameSkip, 0 },
 	{ "no-debug", no_argument, 0, 'N' },
+	{ "no-dedup-states", no_argument, &dedupStates, 0 },
 	{ "no-opengl", no_argument, &openGL, 0 },
 	{ "no-patch", no_argument, &autoPatch, 0 },
 	{ "no-pause-when-inactive", no_argument, &pauseWhenInactive, 0 },
@@ -208,9 +219,11 @@ struct option argOptions[] = {
 	{ "patch", required_argument, 0, 'i' },
 	{ "pause-when-inactive", no_argument, &pauseWhenInactive, 1 },
 	{ "profile", optional_argument, 0, 'p' },
+	{ "profile-output", required_argument, 0, OPT_PROFILE_OUTPUT },
 	{ "rewind-timer", required_argument, 0, OPT_REWIND_TIMER },
 	{ "rtc", no_argument, &coreOptions.rtcEnabled, 1 },
 	{ "rtc-enabled", required_argument, 0, OPT_RTC_ENABLED },
+	{ "run-ahead-frames", required_argument, 0, OPT_RUN_AHEAD_FRAMES },
 	{ "save-auto", no_argument, &coreOptions.cpuSaveType, 0 },
 	{ "save-dir", required_argument, 0, OPT_SAVE_DIR },
 	{ "save-eeprom", no_argument, &coreOptions.cpuSaveType, 1 },
@@ -293,6 +306,8 @@ void ValidateConfig()
 		showSpeed = 1;
 	if (rewindTimer < 0 || rewindTimer > 600)
 		rewindTimer = 0;
+	if (runAheadFrames < 0 || runAheadFrames > 4)
+		runAheadFrames = 0;
 	if (autoFireMaxCount < 1)
 		autoFireMaxCount = 1;
 }
@@ -311,6 +326,7 @@ void LoadConfig()
 	coreOptions.cheatsEnabled = ReadPref("cheatsEnabled", 0);
 	coreOptions.cpuDisableSfx = ReadPref("disableSfx", 0);
 	coreOptions.cpuSaveType = ReadPrefHex("saveType");
+	dedupStates = ReadPref("dedupStates", 0);
 	disableStatusMessages = ReadPrefHex("disableStatus");
 	filter = ReadPref("filter", 0);
 	frameSkip = ReadPref("frameSkip", 0);
@@ -327,12 +343,15 @@ void LoadConfig()
 	gb_effects_config.stereo = (float)ReadPref("gbSoundEffectsStereo", 15) / 100.0f;
 	gb_effects_config.surround = ReadPref("gbSoundEffectsSurround", 0);
 	ifbType = ReadPref("ifbType", 0);
+	instrumentationDump = ReadPrefString("instrumentationDump");
+	instrumentationTrace = ReadPrefString("instrumentationTrace");
 	coreOptions.loadDotCodeFile = ReadPrefString("loadDotCodeFile");
 	openGL = ReadPrefHex("openGL");
 	optFlashSize = ReadPref("flashSize", 0);
 	pauseWhenInactive = ReadPref("pauseWhenInactive", 1);
 	rewindTimer = ReadPref("rewindTimer", 0);
 	coreOptions.rtcEnabled = ReadPref("rtcEnabled", 0);
+	runAheadFrames = ReadPref("runAheadFrames", 0);
 	saveDir = ReadPrefString("saveDir");
 	coreOptions.saveDotCodeFile = ReadPrefString("saveDotCodeFile");
 	screenShotDir = ReadPrefString("screenShotDir");
@@ -763,13 +782,14 @@ int ReadOpts(int argc, char ** argv)
 			}
 			break;
 		case 'p':
-#ifdef PROFILING
-			if (optarg) {
-				cpuEnableProfiling(atoi(optarg));
+#if defined(VBAM_ENABLE_DEBUGGER)
+			// --profile[=HERTZ], samples per emulated second
+			if (optarg && atoi(optarg) > 0) {
+				gbaProfilerStart(16777216 / atoi(optarg));
 			}
 			else
-				cpuEnableProfiling(100);
-#endif
+				gbaProfilerStart(kGbaProfilerDefaultInterval);
+#endif  // defined(VBAM_ENABLE_DEBUGGER)
 			break;
 		case 'S':
 			optFlashSize = atoi(optarg);
@@ -885,6 +905,21 @@ int ReadOpts(int argc, char ** argv)
 			}
 			break;
 
+		case OPT_INSTRUMENTATION_DUMP:
+			// --instrumentation-dump
+			instrumentationDump = optarg;
+			break;
+
+		case OPT_INSTRUMENTATION_TRACE:
+			// --instrumentation-trace
+			instrumentationTrace = optarg;
+			break;
+
+		case OPT_PROFILE_OUTPUT:
+			// --profile-output
+			profileOutput = optarg;
+			break;
+
 		case OPT_GB_BORDER_AUTOMATIC:
 			// --border-automatic
 			// --gb-border-automatic
@@ -924,6 +959,13 @@ int ReadOpts(int argc, char ** argv)
 			}
 			break;
 
+		case OPT_RUN_AHEAD_FRAMES:
+			// --run-ahead-frames
+			if (optarg) {
+				runAheadFrames = atoi(optarg);
+			}
+			break;
+
 		case OPT_BIOS_FILE_NAME_GB:
 			// --bios-file-name-gb
 			biosFileNameGB = optarg;
@@ -8,11 +8,15 @@
 extern const char *biosFileNameGB;
 extern const char *biosFileNameGBA;
 extern const char *biosFileNameGBC;
+extern const char *instrumentationDump;
+extern const char *instrumentationTrace;
+extern const char *profileOutput;
 extern int agbPrint;
 extern int autoFireMaxCount;
 extern int autoFrameSkip;
 extern int autoPatch;
 extern int captureFormat;
+extern int dedupStates;
 extern int disableStatusMessages;
 extern int filter;
 extern int frameSkip;
@@ -23,6 +27,7 @@ extern int optFlashSize;
 extern int optPrintUsage;
 extern int pauseWhenInactive;
 extern int rewindTimer;
+extern int runAheadFrames;
 extern int showSpeed;
 extern int showSpeedTransparent;
 
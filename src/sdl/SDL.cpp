@@ -22,6 +22,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <string>
 
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -97,9 +98,15 @@
 #include "components/filters_agb/filters_agb.h"
 #include "components/user_config/user_config.h"
 #include "core/base/file_util.h"
+#include "core/base/flat_state.h"
+#include "core/base/instrumentation.h"
 #include "core/base/message.h"
-#include "core/base/patch.h"
+#include "core/base/rewind.h"
+#include "core/base/run_ahead.h"
+#include "core/base/sizes.h"
+#include "core/base/state_store.h"
 #include "core/base/version.h"
+#include "core/base/write_behind.h"
 #include "core/gb/gb.h"
 #include "core/gb/gbCheats.h"
 #include "core/gb/gbGlobals.h"
@@ -108,6 +115,7 @@
 #include "core/gba/gbaCheats.h"
 #include "core/gba/gbaFlash.h"
 #include "core/gba/gbaGlobals.h"
+#include "core/gba/gbaProfiler.h"
 #include "core/gba/gbaRtc.h"
 #include "core/gba/gbaSound.h"
 #include "sdl/ConfigManager.h"
@@ -141,6 +149,8 @@ struct EmulatedSystem emulator = {
     NULL,
     NULL,
     NULL,
+    NULL,
+    NULL,
     false,
     0
 };
@@ -165,13 +175,17 @@ int showRenderedFrames = 0;
 int mouseCounter = 0;
 uint32_t autoFrameSkipLastTime = 0;
 
-char* rewindMemory = NULL;
-int rewindCount;
-int rewindCounter;
+RewindBuffer* rewindBuffer = NULL;
+// snapshot selected with the rewind keys, 0 is the newest one
 int rewindPos;
 int rewindSaveNeeded = 0;
-int rewindTopPos;
-int* rewindSerials = NULL;
+
+// created on the first frame when runAheadFrames is set
+RunAhead* runAhead = NULL;
+// writes savestate and battery files off the emulation thread
+WriteBehind* writeBehind = NULL;
+// pack of the savestates of the game when dedupStates is set
+StateStore* stateStore = NULL;
 
 int srcPitch = 0;
 int destWidth = 0;
@@ -203,8 +217,6 @@ uint16_t systemGbPalette[24];
 
 char filename[2048];
 
-static int rewindSerial = 0;
-
 static int sdlSaveKeysSwitch = 0;
 // if 0, then SHIFT+F# saves, F# loads (old VBA, ...)
 // if 1, then SHIFT+F# loads, F# saves (linux snes9x, ...)
@@ -222,8 +234,10 @@ static int sdlSoundToggledOff = 0;
 
 extern int autoFireMaxCount;
 
-#define REWIND_NUM 8
-#define REWIND_SIZE 400000
+// memory used by the rewind snapshots, captured every frame
+#define REWIND_BUDGET k64MiB
+// number of snapshots between two full rewind snapshots
+#define REWIND_KEYFRAME_INTERVAL 60
 
 enum VIDEO_SIZE {
     VIDEO_1X,
@@ -678,22 +692,55 @@ static char* sdlStateName(int num)
     return stateName;
 }
 
+/*
+ * Returns the name of the pack shared by the savestates of the game, next to
+ * the savestates. Uses a static buffer, like sdlStateName.
+ */
+static char* sdlStatePackName()
+{
+    static char packName[2048];
+    char *gameDir = sdlGetFilePath(filename);
+    char *gameFile = sdlGetFilename(filename);
+
+    if (saveDir)
+        sprintf(packName, "%s%c%s.vbpack", saveDir, kFileSep, gameFile);
+    else if (access(gameDir, W_OK) == 0)
+        sprintf(packName, "%s%c%s.vbpack", gameDir, kFileSep, gameFile);
+    else
+        sprintf(packName, "%s%c%s.vbpack", homeDataDir, kFileSep, gameFile);
+
+    freeSafe(gameDir);
+    freeSafe(gameFile);
+    return packName;
+}
+
 void sdlWriteState(int num)
 {
     char* stateName;
 
     stateName = sdlStateName(num);
 
-    if (emulator.emuWriteState)
+    if (emulator.emuWriteState) {
+        VBAM_INSTR_ZONE(kSaveState);
         emulator.emuWriteState(stateName);
+    }
 
-    // now we reuse the stateName buffer - 2048 bytes fit in a lot
+    char message[64] = "";
     if (num == SLOT_POS_LOAD_BACKUP) {
-        sprintf(stateName, "Current state backed up to %d", num + 1);
-        systemScreenMessage(stateName);
+        sprintf(message, "Current state backed up to %d", num + 1);
     } else if (num >= 0) {
-        sprintf(stateName, "Wrote state %d", num + 1);
-        systemScreenMessage(stateName);
+        sprintf(message, "Wrote state %d", num + 1);
+    }
+
+    // the state is written in the background, report it once written
+    if (message[0] && writeBehind) {
+        const std::string text = message;
+        writeBehind->Notify(stateName, [text](bool written) {
+            if (written)
+                systemScreenMessage(text.c_str());
+        });
+    } else if (message[0]) {
+        systemScreenMessage(message);
     }
 
     systemDrawScreen();
@@ -704,8 +751,10 @@ void sdlReadState(int num)
     char* stateName;
 
     stateName = sdlStateName(num);
-    if (emulator.emuReadState)
+    if (emulator.emuReadState) {
+        VBAM_INSTR_ZONE(kSaveState);
         emulator.emuReadState(stateName);
+    }
 
     if (num == SLOT_POS_LOAD_BACKUP) {
         sprintf(stateName, "Last load UNDONE");
@@ -731,6 +780,10 @@ void sdlWriteBackupStateExchange(int from, int to, int backup)
     char* stateNameDest = NULL;
     char* stateNameBack = NULL;
 
+    // the states must be written before being moved around
+    if (writeBehind)
+        writeBehind->Flush();
+
     dmp = sdlStateName(from);
     stateNameOrig = (char*)realloc(stateNameOrig, strlen(dmp) + 1);
     strcpy(stateNameOrig, dmp);
@@ -940,17 +993,23 @@ void sdlInitVideo()
  */
 void change_rewind(int howmuch)
 {
-    if (emulating && emulator.emuReadMemState && rewindMemory
-        && rewindCount) {
-        rewindPos = (rewindPos + rewindCount + howmuch) % rewindCount;
-        emulator.emuReadMemState(
-            &rewindMemory[REWIND_SIZE * rewindPos],
-            REWIND_SIZE);
-        rewindCounter = 0;
+    if (emulating && rewindBuffer && rewindBuffer->count()) {
+        // each step moves by rewindTimer seconds of snapshots
+        int last = (int)rewindBuffer->count() - 1;
+        int pos = rewindPos - howmuch * rewindTimer * 60;
+        if (pos < 0)
+            pos = 0;
+        if (pos > last)
+            pos = last;
+        // stay on the current snapshot if the new one cannot be restored
+        if (!rewindBuffer->Restore(emulator, pos)) {
+            systemConsoleMessage("Error reading rewind state");
+            return;
+        }
+        rewindPos = pos;
         {
             char rewindMsgBuffer[50];
-            sprintf(rewindMsgBuffer, "Rewind to %1d [%d]", rewindPos + 1, rewindSerials[rewindPos]);
-            rewindMsgBuffer[49] = 0;
+            snprintf(rewindMsgBuffer, sizeof(rewindMsgBuffer), "Rewind to -%.1fs", rewindPos / 60.0);
             systemConsoleMessage(rewindMsgBuffer);
         }
     }
@@ -1124,8 +1183,10 @@ void sdlPollEvents()
                     change_rewind(0);
                 break;
             case SDLK_j:
-                if (!(event.key.keysym.mod & MOD_NOCTRL) && (event.key.keysym.mod & KMOD_CTRL))
-                    change_rewind((rewindTopPos - rewindPos) * ((rewindTopPos > rewindPos) ? +1 : -1));
+                if (!(event.key.keysym.mod & MOD_NOCTRL) && (event.key.keysym.mod & KMOD_CTRL)) {
+                    rewindPos = 0;
+                    change_rewind(0);
+                }
                 break;
             case SDLK_e:
                 if (!(event.key.keysym.mod & MOD_NOCTRL) && (event.key.keysym.mod & KMOD_CTRL)) {
@@ -1475,7 +1536,8 @@ Options:\n\
     printf("\
   -h, --help                   Print this help\n\
   -i, --patch=PATCH            Apply given patch\n\
-  -p, --profile=[HERTZ]        Enable profiling\n\
+  -p, --profile=[HERTZ]        Sample the emulated GBA code HERTZ times per\n\
+                               emulated second (default: 10000)\n\
   -s, --frameskip=FRAMESKIP    Set frame skip (0...9)\n\
   -t, --save-type=TYPE         Set the available save type\n\
       --save-auto               0 - Automatic (EEPROM, SRAM, FLASH)\n\
@@ -1499,14 +1561,22 @@ Options:\n\
 Long options only:\n\
       --agb-print              Enable AGBPrint support\n\
       --auto-frameskip         Enable auto frameskipping\n\
+      --dedup-states           Share the identical savestate blocks on disk\n\
+      --instrumentation-dump=FILE Write the per-frame timings to FILE on exit,\n\
+                               as JSON if FILE ends with .json, CSV otherwise\n\
+      --instrumentation-trace=FILE Write a Chrome trace of the emulation,\n\
+                               filter, audio and presentation threads to FILE\n\
       --no-agb-print           Disable AGBPrint support\n\
       --no-auto-frameskip      Disable auto frameskipping\n\
+      --no-dedup-states        Write every savestate in full\n\
       --no-patch               Do not automatically apply patch\n\
       --no-pause-when-inactive Don't pause when inactive\n\
       --no-rtc                 Disable RTC support\n\
       --no-show-speed          Don't show emulation speed\n\
       --no-throttle            Disable throttle\n\
       --pause-when-inactive    Pause when inactive\n\
+      --profile-output=FILE    Write the --profile samples to FILE on exit, as\n\
+                               collapsed stacks (default: vbam.folded)\n\
       --rtc                    Enable RTC support\n\
       --show-speed-normal      Show emulation speed\n\
       --show-speed-detailed    Show detailed speed data\n\
@@ -1519,37 +1589,14 @@ Long options only:\n\
  */
 void handleRewinds()
 {
-    int curSavePos; // where we are saving today [1]
-
-    rewindCount++; // how many rewinds will be stored after this store
-    if (rewindCount > REWIND_NUM)
-        rewindCount = REWIND_NUM;
-
-    curSavePos = (rewindTopPos + 1) % rewindCount; // [1] depends on previous
-    long resize;
-    if (
-        emulator.emuWriteMemState
-        && emulator.emuWriteMemState(
-               &rewindMemory[curSavePos * REWIND_SIZE],
-               REWIND_SIZE, /* available*/
-               resize /* actual size */
-               )) {
-        char rewMsgBuf[100];
-        sprintf(rewMsgBuf, "Remembered rewind %1d (of %1d), serial %d.", curSavePos + 1, rewindCount, rewindSerial);
-        rewMsgBuf[99] = 0;
-        systemConsoleMessage(rewMsgBuf);
-        rewindSerials[curSavePos] = rewindSerial;
-
-        // set up next rewind save
-        // - don't clobber the current rewind position, unless it is the original top
-        if (rewindPos == rewindTopPos) {
-            rewindPos = curSavePos;
-        }
-        // - new identification and top
-        rewindSerial++;
-        rewindTopPos = curSavePos;
-        // for the rest of the code, rewindTopPos will be where the newest rewind got stored
+    // resuming from a selected rewind forgets the snapshots that came after it
+    if (rewindPos) {
+        rewindBuffer->Drop(rewindPos);
+        rewindPos = 0;
     }
+
+    if (!rewindBuffer->Capture(emulator))
+        systemConsoleMessage("Error writing rewind state");
 }
 
 void SetHomeConfigDir()
@@ -1591,8 +1638,7 @@ int main(int argc, char** argv)
 
     // Additional configuration.
 	if (rewindTimer) {
-		rewindMemory = (char *)malloc(REWIND_NUM*REWIND_SIZE);
-		rewindSerials = (int *)calloc(REWIND_NUM, sizeof(int)); // init to zeroes
+		rewindBuffer = new RewindBuffer(REWIND_BUDGET, REWIND_KEYFRAME_INTERVAL, flatStateCodecZlib());
 	}
 
 
@@ -1767,7 +1813,7 @@ int main(int argc, char** argv)
                 int patchnum;
                 for (patchnum = 0; patchnum < patchNum; patchnum++) {
                     fprintf(stdout, "Trying patch %s%s\n", patchNames[patchnum],
-                        applyPatch(patchNames[patchnum], &g_rom, &size) ? " [success]" : "");
+                        CPUApplyPatch(patchNames[patchnum]) ? " [success]" : "");
                 }
                 CPUReset();
             }
@@ -1874,6 +1920,11 @@ int main(int argc, char** argv)
     emulating = 1;
     renderedFrames = 0;
 
+    if (kInstrumentationEnabled && instrumentationTrace && *instrumentationTrace) {
+        VBAM_INSTR_THREAD_NAME("emulation");
+        instrStartTrace();
+    }
+
     autoFrameSkipLastTime = throttleLastTime = systemGetClock();
 
     // now we can enable cheats?
@@ -1899,13 +1950,33 @@ int main(int argc, char** argv)
         }
     }
 
+    writeBehind = new WriteBehind();
+    g_writeBehind = writeBehind;
+
+    if (dedupStates) {
+        stateStore = new StateStore();
+        if (stateStore->Open(sdlStatePackName(), true))
+            g_stateStore = stateStore;
+        else
+            fprintf(stderr, "Cannot open savestate pack %s\n", sdlStatePackName());
+    }
+
     while (emulating) {
         if (!paused) {
             if (debugger && emulator.emuHasDebugger)
                 remoteStubMain();
             else {
-                emulator.emuMain(emulator.emuCount);
-                if (rewindSaveNeeded && rewindMemory && emulator.emuWriteMemState) {
+                if (runAheadFrames > 0) {
+                    if (!runAhead)
+                        runAhead = new RunAhead(runAheadFrames);
+                    if (!runAhead->RunFrame(emulator) && runAhead->failed()) {
+                        fprintf(stderr, "Cannot restore the run-ahead state, run-ahead disabled\n");
+                        runAheadFrames = 0;
+                    }
+                } else {
+                    emulator.emuMain(emulator.emuCount);
+                }
+                if (rewindSaveNeeded && rewindBuffer && emulator.emuWriteMemState) {
                     handleRewinds();
                 }
 
@@ -1915,6 +1986,7 @@ int main(int argc, char** argv)
             SDL_Delay(500);
         }
         sdlPollEvents();
+        writeBehind->Poll();
 #if defined(VBAM_ENABLE_LIRC)
         lircCheckInput();
 #endif
@@ -1930,10 +2002,33 @@ int main(int argc, char** argv)
     remoteCleanUp();
     soundShutdown();
 
+    if (kInstrumentationEnabled && instrumentationDump && *instrumentationDump) {
+        if (!instrWriteDump(instrumentationDump))
+            fprintf(stderr, "Cannot write the instrumentation dump %s\n",
+                instrumentationDump);
+    }
+    if (kInstrumentationEnabled && instrumentationTrace && *instrumentationTrace) {
+        if (!instrWriteTrace(instrumentationTrace))
+            fprintf(stderr, "Cannot write the instrumentation trace %s\n",
+                instrumentationTrace);
+    }
+
     if (openGL) {
         SDL_GL_DeleteContext(glcontext);
     }
 
+#if defined(VBAM_ENABLE_DEBUGGER)
+    // before the clean up, which unloads the ELF symbols
+    if (gbaProfilerInterval != 0) {
+        const char* output = profileOutput ? profileOutput : "vbam.folded";
+        if (gbaProfilerWriteCollapsed(output))
+            fprintf(stdout, "Wrote %llu profiler samples to %s\n",
+                (unsigned long long)gbaProfilerSampleCount(), output);
+        else
+            fprintf(stderr, "Cannot write the profile %s\n", output);
+    }
+#endif  // defined(VBAM_ENABLE_DEBUGGER)
+
     if (gbRom != NULL || g_rom != NULL) {
         sdlWriteBattery();
         emulator.emuCleanUp();
@@ -1949,6 +2044,26 @@ int main(int argc, char** argv)
         filterPix = NULL;
     }
 
+    if (rewindBuffer) {
+        delete rewindBuffer;
+        rewindBuffer = NULL;
+    }
+
+    if (runAhead) {
+        delete runAhead;
+        runAhead = NULL;
+    }
+
+    // completes the pending savestate and battery writes
+    g_writeBehind = NULL;
+    delete writeBehind;
+    writeBehind = NULL;
+
+    // only once the savestates using it are written
+    g_stateStore = NULL;
+    delete stateStore;
+    stateStore = NULL;
+
     for (int i = 0; i < patchNum; i++) {
         free(patchNames[i]);
     }
@@ -2007,6 +2122,11 @@ void systemDrawScreen()
     unsigned int destPitch = destWidth * (systemColorDepth >> 3);
     uint8_t* screen;
 
+    // only the last frame of a run-ahead batch is presented
+    if (runAhead && !runAhead->draw_screen())
+        return;
+
+    VBAM_INSTR_ZONE(kDrawScreen);
     renderedFrames++;
 
     if (openGL)
@@ -2016,11 +2136,14 @@ void systemDrawScreen()
         SDL_LockSurface(surface);
     }
 
-    if (ifbFunction)
-        ifbFunction(g_pix + srcPitch, srcPitch, sizeX, sizeY);
+    {
+        VBAM_INSTR_ZONE(kFilter);
+        if (ifbFunction)
+            ifbFunction(g_pix + srcPitch, srcPitch, sizeX, sizeY);
 
-    filterFunction(g_pix + srcPitch, srcPitch, delta, screen,
-        destPitch, sizeX, sizeY);
+        filterFunction(g_pix + srcPitch, srcPitch, delta, screen,
+            destPitch, sizeX, sizeY);
+    }
 
     if (openGL) {
         int bytes = (systemColorDepth >> 3);
@@ -2041,13 +2164,16 @@ void systemDrawScreen()
     if (openGL) {
         glClear(GL_COLOR_BUFFER_BIT);
         glPixelStorei(GL_UNPACK_ROW_LENGTH, destWidth);
-        if (systemColorDepth == 16)
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, destWidth, destHeight,
-                GL_RGB, GL_UNSIGNED_SHORT_5_6_5, screen);
-        else
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, destWidth, destHeight,
-                //GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, screen);
-                GL_RGBA, GL_UNSIGNED_BYTE, screen);
+        {
+            VBAM_INSTR_ZONE(kTextureUpload);
+            if (systemColorDepth == 16)
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, destWidth, destHeight,
+                    GL_RGB, GL_UNSIGNED_SHORT_5_6_5, screen);
+            else
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, destWidth, destHeight,
+                    //GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, screen);
+                    GL_RGBA, GL_UNSIGNED_BYTE, screen);
+        }
 
         glBegin(GL_TRIANGLE_STRIP);
         glTexCoord2f(0.0f, 0.0f);
@@ -2060,10 +2186,15 @@ void systemDrawScreen()
             destHeight / (GLfloat)textureSize);
         glVertex3i(1, 1, 0);
         glEnd();
+        VBAM_INSTR_ZONE(kPresent);
         SDL_GL_SwapWindow(window);
     } else {
         SDL_UnlockSurface(surface);
-        SDL_UpdateTexture(texture, NULL, surface->pixels, surface->pitch);
+        {
+            VBAM_INSTR_ZONE(kTextureUpload);
+            SDL_UpdateTexture(texture, NULL, surface->pixels, surface->pitch);
+        }
+        VBAM_INSTR_ZONE(kPresent);
         SDL_RenderCopy(renderer, texture, NULL, NULL);
         SDL_RenderPresent(renderer);
     }
@@ -2094,18 +2225,30 @@ void systemShowSpeed(int speed)
                 systemFrameSkip,
                 showRenderedFrames);
 
-        systemSetTitle(buffer);
+        // the instrumentation summary is empty unless it is compiled in
+        std::string title = buffer;
+        const std::string summary = instrSummary();
+        if (!summary.empty())
+            title += " - " + summary;
+
+        systemSetTitle(title.c_str());
     }
 }
 
 void systemFrame()
 {
+    if (runAhead)
+        runAhead->OnFrame();
+
+    if (rewindBuffer)
+        rewindSaveNeeded = true;
 }
 
 void system10Frames()
 {
     uint32_t time = systemGetClock();
-    if (!wasPaused && autoFrameSkip) {
+    // run-ahead emulates several frames per presented one without skipping
+    if (!wasPaused && autoFrameSkip && !(runAhead && runAhead->running())) {
         uint32_t diff = time - autoFrameSkipLastTime;
         int speed = 100;
 
@@ -2133,13 +2276,6 @@ void system10Frames()
             }
         }
     }
-    if (rewindMemory) {
-        if (++rewindCounter >= rewindTimer) {
-            rewindSaveNeeded = true;
-            rewindCounter = 0;
-        }
-    }
-
     if (systemSaveUpdateCounter) {
         if (--systemSaveUpdateCounter <= SYSTEM_SAVE_NOT_UPDATED) {
             sdlWriteBattery();
@@ -2256,7 +2392,8 @@ bool systemPauseOnFrame()
         pauseNextFrame = false;
         return true;
     }
-    return false;
+    // return to the run-ahead loop at the end of each frame
+    return runAhead && runAhead->running();
 }
 
 void systemGbBorderOn()
@@ -2279,7 +2416,12 @@ bool systemReadJoypads()
 
 uint32_t systemReadJoypad(int which)
 {
-    return inputReadJoypad(which);
+    // the speculative run-ahead frames replay the input of the real frame
+    static uint32_t joypad[5];
+    const int index = which < 0 || which > 3 ? 4 : which;
+    if (!runAhead || !runAhead->speculating())
+        joypad[index] = inputReadJoypad(which);
+    return joypad[index];
 }
 //static uint8_t sensorDarkness = 0xE8; // total darkness (including daylight on rainy days)
 
@@ -22,6 +22,7 @@
 
 #include <SDL_events.h>
 
+#include "core/base/instrumentation.h"
 #include "core/gba/gbaGlobals.h"
 #include "core/gba/gbaSound.h"
 
@@ -38,6 +39,8 @@ SoundSDL::SoundSDL():
 {}
 
 void SoundSDL::soundCallback(void* data, uint8_t* stream, int len) {
+    VBAM_INSTR_THREAD_NAME("audio");
+    VBAM_INSTR_ZONE(kAudioCallback);
     reinterpret_cast<SoundSDL*>(data)->read(reinterpret_cast<uint16_t*>(stream), len);
 }
 
@@ -101,9 +104,10 @@ void SoundSDL::write(uint16_t * finalWave, int length) {
 
 	SDL_SemPost(data_available);
 
-	if (should_wait())
+	if (should_wait()) {
+	    VBAM_INSTR_ZONE(kThrottle);
 	    SDL_SemWait(data_read);
-	else
+	} else
 	    // Drop the remainder of the audio data
 	    return;
 
@@ -26,6 +26,7 @@
 #include "core/base/port.h"
 #include "core/gba/gbaCpu.h"
 #include "core/gba/gbaCpuArmDis.h"
+#include "core/gba/gbaDirty.h"
 #include "core/gba/gbaElf.h"
 #include "core/gba/gbaSound.h"
 #include "sdl/exprNode.h"
@@ -46,14 +47,23 @@ extern struct EmulatedSystem emulator;
 #define debuggerReadByte(addr) \
     map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask]
 
-#define debuggerWriteMemory(addr, value) \
-    WRITE32LE(&map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask], value)
+#define debuggerWriteMemory(addr, value)                                            \
+    do {                                                                            \
+        WRITE32LE(&map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask], value); \
+        gbaDirtyMark(addr);                                                         \
+    } while (0)
 
-#define debuggerWriteHalfWord(addr, value) \
-    WRITE16LE(&map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask], value)
+#define debuggerWriteHalfWord(addr, value)                                          \
+    do {                                                                            \
+        WRITE16LE(&map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask], value); \
+        gbaDirtyMark(addr);                                                         \
+    } while (0)
 
-#define debuggerWriteByte(addr, value) \
-    map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask] = (value)
+#define debuggerWriteByte(addr, value)                                \
+    do {                                                              \
+        map[(addr) >> 24].address[(addr)&map[(addr) >> 24].mask] = (value); \
+        gbaDirtyMark(addr);                                           \
+    } while (0)
 
 struct breakpointInfo {
     uint32_t address;
@@ -199,7 +209,6 @@ bool debuggerAtBreakpoint = false;
 int debuggerBreakpointNumber = 0;
 int debuggerRadix = 0;
 
-extern uint32_t cpuPrefetch[2];
 
 #define ARM_PREFETCH                                        \
     {                                                       \
@@ -18,6 +18,7 @@
 #include <wx/log.h>
 #include <wx/translation.h>
 
+#include "core/base/instrumentation.h"
 #include "core/base/system.h"
 #include "core/gba/gbaGlobals.h"
 #include "wx/config/option-proxy.h"
@@ -105,6 +106,7 @@ private:
     bool signaled_ = false;
 
     static void StaticOnBufferEnd(FAudioVoiceCallback* callback, void*) {
+        VBAM_INSTR_MARK(kAudioBufferEnd);
         static_cast<FAudio_BufferNotify*>(callback)->SignalBufferEnd();
     }
     static void StaticOnVoiceProcessingPassStart(FAudioVoiceCallback*, uint32_t) {}
@@ -397,6 +399,7 @@ void FAudio_Output::write(uint16_t* finalWave, int) {
             // the maximum number of buffers is currently queued
             if (!coreOptions.speedup && coreOptions.throttle && !gba_joybus_active) {
                 // wait for one buffer to finish playing
+                VBAM_INSTR_ZONE(kThrottle);
                 if (notify.WaitForSignal()) {
                     device_changed = true;
                 }
@@ -37,6 +37,7 @@ typedef const ALCchar*(ALC_APIENTRY* LPALCGETSTRING)(ALCdevice* device, ALCenum
 #include <wx/translation.h>
 #include <wx/utils.h>
 
+#include "core/base/instrumentation.h"
 #include "core/gba/gbaGlobals.h"
 #include "core/gba/gbaSound.h"
 #include "wx/config/option-proxy.h"
@@ -325,6 +326,7 @@ void OpenAL::write(uint16_t* finalWave, int length) {
 
         if (!coreOptions.speedup && coreOptions.throttle && !gba_joybus_active) {
             // wait until at least one buffer has finished
+            VBAM_INSTR_ZONE(kThrottle);
             while (nBuffersProcessed == 0) {
                 winlog(" waiting...\n");
                 // wait for about half the time one buffer needs to finish
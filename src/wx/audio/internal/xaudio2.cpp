@@ -22,6 +22,7 @@
 #include <wx/log.h>
 #include <wx/translation.h>
 
+#include "core/base/instrumentation.h"
 #include "core/base/sound_driver.h"
 #include "core/base/system.h"  // for systemMessage()
 #include "core/gba/gbaGlobals.h"
@@ -173,6 +174,7 @@ public:
     STDMETHOD_(void, OnBufferEnd)
     (void*) {
         assert(hBufferEndEvent != NULL);
+        VBAM_INSTR_MARK(kAudioBufferEnd);
         SetEvent(hBufferEndEvent);
     }
 
@@ -482,6 +484,7 @@ void XAudio2_Output::write(uint16_t* finalWave, int) {
             // the maximum number of buffers is currently queued
             if (!coreOptions.speedup && coreOptions.throttle && !gba_joybus_active) {
                 // wait for one buffer to finish playing
+                VBAM_INSTR_ZONE(kThrottle);
                 if (WaitForSingleObject(notify.hBufferEndEvent, 10000) == WAIT_TIMEOUT) {
                     device_changed = true;
                 }
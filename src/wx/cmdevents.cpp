@@ -1,5 +1,7 @@
 #include "wx/wxvbam.h"
 
+#include <algorithm>
+
 #include <wx/aboutdlg.h>
 #include <wx/ffile.h>
 #include <wx/numdlg.h>
@@ -610,14 +612,22 @@ EVT_HANDLER_MASK(ExportBatteryFile, "Export battery file...", CMDEN_GB | CMDEN_G
         return;
 
     wxString fn = dlg.GetPath();
-    wxString msg;
+    bool ret = panel->emusys->emuWriteBattery(UTF8(fn));
 
-    if (panel->emusys->emuWriteBattery(UTF8(fn)))
-        msg.Printf(_("Wrote battery %s"), fn.wc_str());
-    else
-        msg.Printf(_("Error writing battery %s"), fn.wc_str());
+    // The battery is written in the background, report it once written.
+    auto report = [fn](bool written) {
+        wxString msg;
+        if (written)
+            msg.Printf(_("Wrote battery %s"), fn.wc_str());
+        else
+            msg.Printf(_("Error writing battery %s"), fn.wc_str());
 
-    systemScreenMessage(msg);
+        systemScreenMessage(msg);
+    };
+    if (ret && g_writeBehind)
+        g_writeBehind->Notify(ToString(UTF8(fn)), report);
+    else
+        report(ret);
 }
 
 EVT_HANDLER_MASK(ExportGamesharkSnapshot, "Export GameShark snapshot...", CMDEN_GBA)
@@ -971,6 +981,19 @@ EVT_HANDLER_MASK(PlayMovieStartPlaying, "Start playing movie...", CMDEN_NGREC |
     systemStartGamePlayback(dlg.GetPath(), getSupMovFormatsToPlayback()[mov_extno]);
 }
 
+EVT_HANDLER_MASK(PlayMovieSeek, "Seek in movie...", CMDEN_GPLAY)
+{
+    long frame;
+    {
+        ModalPause mp;
+        frame = wxGetNumberFromUser(_("Frame to seek to:"), wxEmptyString, _("Seek in movie"),
+                                    systemGetGamePlaybackFrame(), 0, 0x7fffffff, this);
+    }
+
+    if (frame >= 0)
+        systemSeekGamePlayback(frame);
+}
+
 EVT_HANDLER_MASK(PlayMovieStopPlaying, "Stop playing movie", CMDEN_GPLAY)
 {
     systemStopGamePlayback();
@@ -1413,25 +1436,24 @@ EVT_HANDLER_MASK(IncrGameSlotSave, "Increase state slot number and save", CMDEN_
 
 EVT_HANDLER_MASK(Rewind, "Rewind", CMDEN_REWIND)
 {
-    int rew_st = (panel->next_rewind_state + NUM_REWINDS - 1) % NUM_REWINDS;
+    RewindBuffer* rewind = panel->rewind_buffer.get();
 
-    // if within 5 seconds of last one, and > 1 state, delete last state & move back
-    // FIXME: 5 should actually be user-configurable
-    // maybe instead of 5, 10% of rewind_interval
-    if (panel->num_rewind_states > 1 && (gopts.rewind_interval <= 5 || (int)panel->rewind_time / 6 > gopts.rewind_interval - 5)) {
-        --panel->num_rewind_states;
-        panel->next_rewind_state = rew_st;
+    if (!rewind || !rewind->count())
+        return;
 
-        if (gopts.rewind_interval > 5)
-            rew_st = (rew_st + NUM_REWINDS - 1) % NUM_REWINDS;
-    }
+    // snapshots are captured every frame: go back rewind_interval seconds,
+    // or to the oldest snapshot, and forget the snapshots that were skipped
+    size_t back = std::min<size_t>(gopts.rewind_interval * 60, rewind->count() - 1);
 
-    panel->emusys->emuReadMemState(&panel->rewind_mem[rew_st * REWIND_SIZE],
-        REWIND_SIZE);
+    // keep the history if the snapshot cannot be restored
+    if (!rewind->Restore(*panel->emusys, back)) {
+        wxLogError(_("Error reading rewind state"));
+        return;
+    }
+    rewind->Drop(back);
     InterframeCleanup();
     // FIXME: if(paused) blank screen
     panel->do_rewind = false;
-    panel->rewind_time = gopts.rewind_interval * 6;
     //    systemScreenMessage(_("Rewinded"));
 }
 
@@ -1909,18 +1931,15 @@ EVT_HANDLER(GeneralConfigure, "General options...")
 
     if (rew != gopts.rewind_interval) {
         if (!gopts.rewind_interval) {
-            if (panel->num_rewind_states) {
+            if (panel->rewind_buffer) {
                 cmd_enable &= ~CMDEN_REWIND;
                 enable_menus();
             }
 
-            panel->num_rewind_states = 0;
+            panel->rewind_buffer.reset();
             panel->do_rewind = false;
         } else {
-            if (!panel->num_rewind_states)
-                panel->do_rewind = true;
-
-            panel->rewind_time = gopts.rewind_interval * 6;
+            panel->do_rewind = true;
         }
     }
 }
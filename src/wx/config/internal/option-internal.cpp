@@ -168,11 +168,14 @@ std::array<Option, kNbOptions>& Option::All() {
         bool auto_patch = true;
         bool autoload_cheats = false;
         uint32_t capture_format = 0;
+        bool dedup_states = false;
         bool disable_status_messages = false;
         uint32_t flash_size = 0;
         int32_t frame_skip = 0;
         bool gdb_break_on_load  = false;
+        int32_t movie_keyframe_interval = 0;
         bool pause_when_inactive = false;
+        int32_t run_ahead_frames = 0;
         uint32_t show_speed = 0;
         bool show_speed_transparent = false;
         bool use_bios_file_gb = false;
@@ -305,6 +308,7 @@ std::array<Option, kNbOptions>& Option::All() {
         Option(OptionID::kPrefBorderOn, &gbBorderOn),
         Option(OptionID::kPrefCaptureFormat, &g_owned_opts.capture_format, 0, 1),
         Option(OptionID::kPrefCheatsEnabled, &coreOptions.cheatsEnabled, 0, 1),
+        Option(OptionID::kPrefDedupStates, &g_owned_opts.dedup_states),
         Option(OptionID::kPrefDisableStatus, &g_owned_opts.disable_status_messages),
         Option(OptionID::kPrefEmulatorType, &gbEmulatorType, 0, 5),
         Option(OptionID::kPrefFlashSize, &g_owned_opts.flash_size, 0, 1),
@@ -317,8 +321,10 @@ std::array<Option, kNbOptions>& Option::All() {
         Option(OptionID::kPrefLinkNumPlayers, &gopts.link_num_players, 2, 4),
 #endif
         Option(OptionID::kPrefMaxScale, &gopts.max_scale, 0, 100),
+        Option(OptionID::kPrefMovieKeyframeInterval, &g_owned_opts.movie_keyframe_interval, 0, 36000),
         Option(OptionID::kPrefPauseWhenInactive, &g_owned_opts.pause_when_inactive),
         Option(OptionID::kPrefRTCEnabled, &coreOptions.rtcEnabled, 0, 1),
+        Option(OptionID::kPrefRunAheadFrames, &g_owned_opts.run_ahead_frames, 0, 4),
         Option(OptionID::kPrefSaveType, &coreOptions.cpuSaveType, 0, 5),
         Option(OptionID::kPrefShowSpeed, &g_owned_opts.show_speed, 0, 2),
         Option(OptionID::kPrefShowSpeedTransparent, &g_owned_opts.show_speed_transparent),
@@ -448,7 +454,7 @@ const std::array<OptionData, kNbOptions + 1> kAllOptionsData = {
                _("Directory to store A / V and game recordings (relative paths "
                  "are relative to ROM)")},
     OptionData{"General/RewindInterval", "",
-               _("Number of seconds between rewind snapshots (0 to disable)")},
+               _("Number of seconds to go back on each rewind (0 to disable)")},
     OptionData{"General/ScreenshotDir", "",
                _("Directory to store screenshots (relative paths are relative "
                  "to ROM)")},
@@ -491,6 +497,9 @@ const std::array<OptionData, kNbOptions + 1> kAllOptionsData = {
     OptionData{"preferences/borderOn", "", _("Always enable border")},
     OptionData{"preferences/captureFormat", "", _("Screen capture file format")},
     OptionData{"preferences/cheatsEnabled", "", _("Enable cheats")},
+    OptionData{"preferences/dedupStates", "",
+               _("Store the savestates of a game in a shared pack, so that their identical "
+                 "blocks are only stored once")},
     OptionData{"preferences/disableStatus", "NoStatusMsg", _("Disable on-screen status messages")},
     OptionData{"preferences/emulatorType", "", _("Type of system to emulate")},
     OptionData{"preferences/flashSize", "", _("Flash size 0 = 64 KB 1 = 128 KB")},
@@ -506,10 +515,16 @@ const std::array<OptionData, kNbOptions + 1> kAllOptionsData = {
     OptionData{"preferences/LinkNumPlayers", "", _("Number of players in network")},
 #endif
     OptionData{"preferences/maxScale", "", _("Maximum scale factor (0 = no limit)")},
+    OptionData{"preferences/movieKeyframeInterval", "",
+               _("Number of frames between the keyframes of the movie index, used to "
+                 "seek in movies (0 = no index)")},
     OptionData{"preferences/pauseWhenInactive", "PauseWhenInactive",
                _("Pause game when main window loses focus")},
     OptionData{"preferences/rtcEnabled", "RTC",
                _("Enable RTC (vba-over.ini override is rtcEnabled")},
+    OptionData{"preferences/runAheadFrames", "",
+               _("Number of frames to run ahead of the input to reduce input "
+                 "latency (0-4, 0 = disabled)")},
     OptionData{"preferences/saveType", "", _("Native save (\"battery\") hardware type")},
     OptionData{"preferences/showSpeed", "", _("Show speed indicator")},
     OptionData{"preferences/showSpeedTransparent", "Transparent",
@@ -75,6 +75,7 @@ enum class OptionID {
     kPrefBorderOn,
     kPrefCaptureFormat,
     kPrefCheatsEnabled,
+    kPrefDedupStates,
     kPrefDisableStatus,
     kPrefEmulatorType,
     kPrefFlashSize,
@@ -87,8 +88,10 @@ enum class OptionID {
     kPrefLinkNumPlayers,
 #endif
     kPrefMaxScale,
+    kPrefMovieKeyframeInterval,
     kPrefPauseWhenInactive,
     kPrefRTCEnabled,
+    kPrefRunAheadFrames,
     kPrefSaveType,
     kPrefShowSpeed,
     kPrefShowSpeedTransparent,
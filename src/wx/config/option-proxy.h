@@ -79,6 +79,7 @@ static constexpr std::array<Option::Type, kNbOptions> kOptionsTypes = {
     /*kPrefBorderOn*/ Option::Type::kBool,
     /*kPrefCaptureFormat*/ Option::Type::kUnsigned,
     /*kPrefCheatsEnabled*/ Option::Type::kInt,
+    /*kPrefDedupStates*/ Option::Type::kBool,
     /*kPrefDisableStatus*/ Option::Type::kBool,
     /*kPrefEmulatorType*/ Option::Type::kUnsigned,
     /*kPrefFlashSize*/ Option::Type::kUnsigned,
@@ -91,8 +92,10 @@ static constexpr std::array<Option::Type, kNbOptions> kOptionsTypes = {
     /*kPrefLinkNumPlayers*/ Option::Type::kInt,
 #endif
     /*kPrefMaxScale*/ Option::Type::kInt,
+    /*kPrefMovieKeyframeInterval*/ Option::Type::kInt,
     /*kPrefPauseWhenInactive*/ Option::Type::kBool,
     /*kPrefRTCEnabled*/ Option::Type::kInt,
+    /*kPrefRunAheadFrames*/ Option::Type::kInt,
     /*kPrefSaveType*/ Option::Type::kInt,
     /*kPrefShowSpeed*/ Option::Type::kUnsigned,
     /*kPrefShowSpeedTransparent*/ Option::Type::kBool,
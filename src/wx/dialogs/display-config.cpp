@@ -246,6 +246,9 @@ DisplayConfig::DisplayConfig(wxWindow* parent)
     GetValidatedChild(this, "FrameSkip")
         ->SetValidator(
             widgets::OptionIntValidator(config::OptionID::kPrefFrameSkip));
+    GetValidatedChild(this, "RunAheadFrames")
+        ->SetValidator(
+            widgets::OptionIntValidator(config::OptionID::kPrefRunAheadFrames));
 
     // On-Screen Display
     GetValidatedChild(this, "SpeedIndicator")
@@ -21,9 +21,6 @@
        disableSfx(F) -> cpuDisableSfx
        priority(2) -> threadPriority
        saveMoreCPU(F) -> Sm60FPS
-
-     SDL:
-      -p/--profile=hz
 */
 
 namespace {
@@ -28,7 +28,9 @@
 #include "components/draw_text/draw_text.h"
 #include "components/filters/filters.h"
 #include "core/base/file_util.h"
-#include "core/base/patch.h"
+#include "core/base/flat_state.h"
+#include "core/base/instrumentation.h"
+#include "core/base/sizes.h"
 #include "core/base/version.h"
 #include "core/gb/gb.h"
 #include "core/gb/gbCheats.h"
@@ -39,6 +41,7 @@
 #include "core/gba/gbaFlash.h"
 #include "core/gba/gbaGlobals.h"
 #include "core/gba/gbaPrint.h"
+#include "core/gba/gbaProfiler.h"
 #include "core/gba/gbaRtc.h"
 #include "core/gba/gbaSound.h"
 #include "wx/config/game-control.h"
@@ -57,6 +60,11 @@
 
 namespace {
 
+// Memory used by the rewind snapshots. Snapshots are captured every frame.
+constexpr size_t kRewindBudget = k64MiB;
+// Number of snapshots between two full rewind snapshots.
+constexpr size_t kRewindKeyframeInterval = 60;
+
 double GetFilterScale() {
     switch (OPTION(kDispFilter)) {
         case config::Filter::kNone:
@@ -131,10 +139,7 @@ GameArea::GameArea()
       panel(NULL),
       emusys(NULL),
       was_paused(false),
-      rewind_time(0),
       do_rewind(false),
-      rewind_mem(0),
-      num_rewind_states(0),
       loaded(IMAGE_UNKNOWN),
       basic_width(GBAWidth),
       basic_height(GBAHeight),
@@ -349,13 +354,7 @@ void GameArea::LoadGame(const wxString& name)
         rom_crc32 = crc32(0L, g_rom, rom_size);
 
         if (loadpatch) {
-            // don't use real rom size or it might try to resize rom[]
-            // instead, use known size of rom[]
-            int size = 0x2000000 < rom_size ? 0x2000000 : rom_size;
-            applyPatch(UTF8(pfn.GetFullPath()), &g_rom, &size);
-            // that means we no longer really know rom_size either <sigh>
-
-            gbaUpdateRomSize(size);
+            CPUApplyPatch(UTF8(pfn.GetFullPath()));
         }
 
         wxFileConfig* cfg = wxGetApp().overrides;
@@ -471,6 +470,7 @@ void GameArea::LoadGame(const wxString& name)
 
     // load battery and/or saved state
     recompute_dirs();
+    OpenStateStore();
     mf->update_state_ts(true);
     bool did_autoload = OPTION(kGenAutoLoadLastState) ? LoadState() : false;
 
@@ -620,6 +620,22 @@ void GameArea::recompute_dirs()
     }
 }
 
+void GameArea::OpenStateStore()
+{
+    if (!OPTION(kPrefDedupStates))
+        return;
+
+    wxFileName pack(statedir, game_name() + wxT(".vbpack"));
+    state_store.reset(new StateStore());
+
+    if (state_store->Open(UTF8(pack.GetFullPath()), true)) {
+        g_stateStore = state_store.get();
+    } else {
+        wxLogError(_("Cannot open savestate pack %s"), pack.GetFullPath());
+        state_store.reset();
+    }
+}
+
 void GameArea::UnloadGame(bool destruct)
 {
     if (!emulating)
@@ -662,6 +678,15 @@ void GameArea::UnloadGame(bool destruct)
     debugger = false;
     remoteCleanUp();
     mf->cmd_enable |= CMDEN_NGDB_ANY;
+
+    // before the clean up, which unloads the ELF symbols
+    const wxString& profile = wxGetApp().profile_output;
+    if (loaded == IMAGE_GBA && !profile.empty()) {
+        if (!gbaProfilerWriteCollapsed(UTF8(profile)))
+            wxLogError(_("Error writing the profile %s"), profile.c_str());
+        // the next game starts a new profile
+        gbaProfilerStart(gbaProfilerInterval);
+    }
 #endif  // VBAM_ENABLE_DEBUGGER
 
     if (loaded == IMAGE_GB) {
@@ -672,6 +697,15 @@ void GameArea::UnloadGame(bool destruct)
         cheatsDeleteAll(false);
     }
 
+    // the pending savestates may still be written to the pack
+    if (state_store) {
+        if (g_writeBehind)
+            g_writeBehind->Flush();
+
+        g_stateStore = nullptr;
+        state_store.reset();
+    }
+
     UnsuspendScreenSaver();
     emulating = false;
     loaded = IMAGE_UNKNOWN;
@@ -701,8 +735,8 @@ void GameArea::UnloadGame(bool destruct)
     mf->SetJoystick();
     mf->ResetCheatSearch();
 
-    if (rewind_mem)
-        num_rewind_states = 0;
+    if (rewind_buffer)
+        rewind_buffer->Clear();
 }
 
 bool GameArea::LoadState()
@@ -725,18 +759,19 @@ bool GameArea::LoadState(int slot)
 bool GameArea::LoadState(const wxFileName& fname)
 {
     // FIXME: first save to backup state if not backup state
-    bool ret = emusys->emuReadState(UTF8(fname.GetFullPath()));
+    bool ret;
+    {
+        VBAM_INSTR_ZONE(kSaveState);
+        ret = emusys->emuReadState(UTF8(fname.GetFullPath()));
+    }
 
-    if (ret && num_rewind_states) {
+    if (ret && rewind_buffer && rewind_buffer->count()) {
         MainFrame* mf = wxGetApp().frame;
         mf->cmd_enable &= ~CMDEN_REWIND;
         mf->enable_menus();
-        num_rewind_states = 0;
+        rewind_buffer->Clear();
         // do an immediate rewind save
-        // even if loaded from state file: not smart enough yet to just
-        // do a reset or load from state file when # rewinds == 0
-        do_rewind = true;
-        rewind_time = gopts.rewind_interval * 6;
+        do_rewind = gopts.rewind_interval > 0;
     }
 
     if (ret) {
@@ -772,12 +807,24 @@ bool GameArea::SaveState(int slot)
 bool GameArea::SaveState(const wxFileName& fname)
 {
     // FIXME: first copy to backup state if not backup state
-    bool ret = emusys->emuWriteState(UTF8(fname.GetFullPath()));
-    wxGetApp().frame->update_state_ts(true);
-    wxString msg;
-    msg.Printf(ret ? _("Saved state %s") : _("Error saving state %s"),
-        fname.GetFullPath().wc_str());
-    systemScreenMessage(msg);
+    const wxString path = fname.GetFullPath();
+    bool ret;
+    {
+        VBAM_INSTR_ZONE(kSaveState);
+        ret = emusys->emuWriteState(UTF8(path));
+    }
+
+    // The state is written in the background, report it once written.
+    auto report = [path](bool written) {
+        wxGetApp().frame->update_state_ts(true);
+        wxString msg;
+        msg.Printf(written ? _("Saved state %s") : _("Error saving state %s"), path.wc_str());
+        systemScreenMessage(msg);
+    };
+    if (ret && g_writeBehind)
+        g_writeBehind->Notify(ToString(UTF8(path)), report);
+    else
+        report(ret);
     return ret;
 }
 
@@ -1049,9 +1096,6 @@ GameArea::~GameArea()
 {
     UnloadGame(true);
 
-    if (rewind_mem)
-        free(rewind_mem);
-
     if (gopts.fs_mode.w && gopts.fs_mode.h && fullscreen) {
         MainFrame* tlw = wxGetApp().frame;
         int dno = wxDisplay::GetFromWindow(tlw);
@@ -1108,11 +1152,32 @@ void GameArea::Resume()
     SetFocus();
 }
 
+bool GameArea::CanRunAhead()
+{
+    if (OPTION(kPrefRunAheadFrames) <= 0 || game_recording || game_playback)
+        return false;
+
+#ifndef NO_LINK
+    if (loaded == IMAGE_GBA && GetLinkMode() != LINK_DISCONNECTED)
+        return false;
+#endif
+
+    return true;
+}
+
 void GameArea::OnIdle(wxIdleEvent& event)
 {
     wxString pl = wxGetApp().pending_load;
     MainFrame* mf = wxGetApp().frame;
 
+    // Report the completed savestate and battery writes, and keep the idle
+    // events coming until the queued ones complete.
+    if (g_writeBehind) {
+        g_writeBehind->Poll();
+        if (g_writeBehind->Pending())
+            event.RequestMore();
+    }
+
     if (pl.size()) {
         // sometimes this gets into a loop if LoadGame() called before
         // clearing pending_load.  weird.
@@ -1273,7 +1338,18 @@ void GameArea::OnIdle(wxIdleEvent& event)
         }
 #endif  // defined(VBAM_ENABLE_DEBUGGER)
 
-        emusys->emuMain(emusys->emuCount);
+        if (CanRunAhead()) {
+            if (!run_ahead)
+                run_ahead.reset(new RunAhead(OPTION(kPrefRunAheadFrames)));
+
+            run_ahead->set_frames(OPTION(kPrefRunAheadFrames));
+            const bool failed = run_ahead->failed();
+            run_ahead->RunFrame(*emusys);
+            if (!failed && run_ahead->failed())
+                wxLogError(_("Cannot restore the run-ahead state, run-ahead disabled"));
+        } else {
+            emusys->emuMain(emusys->emuCount);
+        }
 #ifndef NO_LINK
 
         if (loaded == IMAGE_GBA && GetLinkMode() != LINK_DISCONNECTED)
@@ -1289,34 +1365,21 @@ void GameArea::OnIdle(wxIdleEvent& event)
         ShowMenuBar();
     }
 
-    if (do_rewind && emusys->emuWriteMemState) {
-        if (!rewind_mem) {
-            rewind_mem = (char*)malloc(NUM_REWINDS * REWIND_SIZE);
-            num_rewind_states = next_rewind_state = 0;
-        }
-
-        if (!rewind_mem) {
-            wxLogError(_("No memory for rewinding"));
-            wxGetApp().frame->Close(true);
-            return;
-        }
+    // the movie keyframes are captured between emulation slices, like the
+    // rewind snapshots
+    if (!paused)
+        systemAddGameMovieKeyframe();
 
-        long resize;
+    if (do_rewind && emusys->emuWriteMemState) {
+        if (!rewind_buffer)
+            rewind_buffer.reset(new RewindBuffer(kRewindBudget, kRewindKeyframeInterval,
+                                                 flatStateCodecZlib()));
 
-        if (!emusys->emuWriteMemState(&rewind_mem[REWIND_SIZE * next_rewind_state],
-                REWIND_SIZE, resize /* actual size */))
-            // if you see a lot of these, maybe increase REWIND_SIZE
+        if (!rewind_buffer->Capture(*emusys))
             wxLogInfo(_("Error writing rewind state"));
-        else {
-            if (!num_rewind_states) {
-                mf->cmd_enable |= CMDEN_REWIND;
-                mf->enable_menus();
-            }
-
-            if (num_rewind_states < NUM_REWINDS)
-                ++num_rewind_states;
-
-            next_rewind_state = (next_rewind_state + 1) % NUM_REWINDS;
+        else if (!(mf->cmd_enable & CMDEN_REWIND)) {
+            mf->cmd_enable |= CMDEN_REWIND;
+            mf->enable_menus();
         }
 
         do_rewind = false;
@@ -1597,6 +1660,8 @@ public:
     uint8_t* src_;
 
     ExitCode Entry() override {
+        VBAM_INSTR_THREAD_NAME("filter");
+
         // This is the band this thread will process
         // threadno == -1 means just do a dummy round on the border line
         const int procy = height_ * threadno_ / nthreads_;
@@ -1660,6 +1725,7 @@ private:
     // definitely not thread safe by default
     // added procy param to provide offset into accum buffers
     void ApplyInterframe(int instride, int procy) {
+        VBAM_INSTR_ZONE(kFilter);
         switch (OPTION(kDispIFB)) {
             case config::Interframe::kNone:
                 break;
@@ -1688,6 +1754,7 @@ private:
     // naturally, any of these with accumulation buffers like those
     // of the IFB filters will screw up royally as well
     void ApplyFilter(int instride, int outstride) {
+        VBAM_INSTR_ZONE(kFilter);
         switch (OPTION(kDispFilter)) {
             case config::Filter::k2xsai:
                 _2xSaI32(src_, instride, delta_, dst_, outstride, width_,
@@ -2469,12 +2536,16 @@ void GLDrawingPanel::DrawArea(wxWindowDC& dc)
             glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
 
 #endif
-        glTexImage2D(GL_TEXTURE_2D, 0, int_fmt, std::ceil(width * scale), (int)std::ceil(height * scale),
-            0, tex_fmt, todraw + (int)std::ceil(rowlen * (out_16 ? 2 : 4) * scale));
+        {
+            VBAM_INSTR_ZONE(kTextureUpload);
+            glTexImage2D(GL_TEXTURE_2D, 0, int_fmt, std::ceil(width * scale), (int)std::ceil(height * scale),
+                0, tex_fmt, todraw + (int)std::ceil(rowlen * (out_16 ? 2 : 4) * scale));
+        }
         glCallList(vlist);
     } else
         glClear(GL_COLOR_BUFFER_BIT);
 
+    VBAM_INSTR_ZONE(kPresent);
     SwapBuffers();
 }
 
@@ -7,6 +7,8 @@
 #include <SDL.h>
 
 #include "core/base/image_util.h"
+#include "core/base/instrumentation.h"
+#include "core/base/movie_index.h"
 #include "core/gb/gbGlobals.h"
 #include "core/gba/gbaGlobals.h"
 #include "core/gba/gbaSound.h"
@@ -85,7 +87,10 @@ void systemSendScreen()
 {
 #ifndef NO_FFMPEG
     GameArea* ga = wxGetApp().frame->GetPanel();
-    if (ga) ga->AddFrame(g_pix);
+    if (ga) {
+        VBAM_INSTR_ZONE(kRecording);
+        ga->AddFrame(g_pix);
+    }
 #endif
 }
 
@@ -93,15 +98,27 @@ static int frames = 0;
 
 void systemDrawScreen()
 {
-    frames++;
     MainFrame* mf = wxGetApp().frame;
+    GameArea* ga = mf->GetPanel();
+
+    // only the last frame of a run-ahead batch is presented
+    if (ga && ga->run_ahead && !ga->run_ahead->draw_screen())
+        return;
+
+    // the frames replayed to seek in a movie are not presented
+    if (game_seeking)
+        return;
+
+    VBAM_INSTR_ZONE(kDrawScreen);
+    frames++;
     mf->UpdateViewers();
     // FIXME: Sm60FPS crap and sondBufferLow crap
-    GameArea* ga = mf->GetPanel();
 #ifndef NO_FFMPEG
 
-    if (ga)
+    if (ga) {
+        VBAM_INSTR_ZONE(kRecording);
         ga->AddFrame(g_pix);
+    }
 
 #endif
 
@@ -120,6 +137,9 @@ void systemDrawScreen()
 //        <joypad>.32 = default joypad reading at that time
 //     }
 //  <name>.vm0 = saved state
+//  <name>.vmi = optional keyframe index of the movie from <name>.vm0, see
+//               MovieIndex; rebuilt (or deleted without keyframes) when
+//               recording and created on the first playback if missing
 
 struct supportedMovie {
     MVFormatID formatId;
@@ -195,6 +215,41 @@ wxFFile game_file;
 bool game_recording, game_playback;
 uint32_t game_frame;
 uint32_t game_joypad;
+// frames since the start of the movie
+uint32_t game_movie_frame;
+// initial state of the movie played back
+wxString game_state_name;
+MovieIndex game_index;
+// true while replaying frames up to game_seek_frame
+bool game_seeking;
+uint32_t game_seek_frame;
+// coreOptions.muteSound before the seek, restored once it is over
+static bool game_seek_mute_sound;
+
+// size of a joypad log entry
+static const wxFileOffset kGameLogEntrySize = 2 * sizeof(uint32_t);
+
+// Ends a seek in the movie played back, the sound is unmuted unless it was
+// already muted before the seek.
+static void StopGameSeek()
+{
+    if (!game_seeking)
+        return;
+
+    game_seeking = false;
+    coreOptions.muteSound = game_seek_mute_sound;
+}
+
+// fn is the name of the movie's saved state
+static void OpenGameIndex(wxString fn, bool truncate)
+{
+    wxString index_fn = fn;
+    index_fn[index_fn.size() - 1] = wxT('i');
+
+    if (!game_index.Open(UTF8(index_fn), UTF8(fn), OPTION(kPrefMovieKeyframeInterval), truncate) &&
+        OPTION(kPrefMovieKeyframeInterval) > 0)
+        wxLogInfo(_("Cannot open movie index %s"), index_fn.c_str());
+}
 
 void systemStartGameRecording(const wxString& fname, MVFormatID format)
 {
@@ -231,8 +286,20 @@ void systemStartGameRecording(const wxString& fname, MVFormatID format)
         return;
     }
 
+    // the index of a previous recording must not outlive it
+    if (OPTION(kPrefMovieKeyframeInterval) > 0) {
+        OpenGameIndex(fn, true);
+    } else {
+        wxString index_fn = fn;
+        index_fn[index_fn.size() - 1] = wxT('i');
+
+        if (wxFileExists(index_fn))
+            wxRemoveFile(index_fn);
+    }
+
     game_frame = 0;
     game_joypad = 0;
+    game_movie_frame = 0;
     game_recording = true;
     MainFrame* mf = wxGetApp().frame;
     mf->cmd_enable &= ~(CMDEN_NGREC | CMDEN_GPLAY | CMDEN_NGPLAY);
@@ -248,6 +315,7 @@ void systemStopGameRecording()
     if (game_file.Write(&game_frame, sizeof(game_frame)) != sizeof(game_frame) || game_file.Write(&game_joypad, sizeof(game_joypad)) != sizeof(game_joypad) || !game_file.Close())
         wxLogError(_("Error writing game recording"));
 
+    game_index.Close();
     game_recording = false;
     MainFrame* mf = wxGetApp().frame;
     mf->cmd_enable &= ~CMDEN_GREC;
@@ -306,8 +374,13 @@ void systemStartGamePlayback(const wxString& fname, MVFormatID format)
         return;
     }
 
+    game_state_name = fn;
+    OpenGameIndex(fn, false);
+
     game_frame = 0;
     game_joypad = 0;
+    game_movie_frame = 0;
+    game_seeking = false;
     game_playback = true;
     MainFrame* mf = wxGetApp().frame;
     mf->cmd_enable &= ~(CMDEN_NGREC | CMDEN_GREC | CMDEN_NGPLAY);
@@ -321,13 +394,97 @@ void systemStopGamePlayback()
         return;
 
     game_file.Close();
+    game_index.Close();
     game_playback = false;
+
+    StopGameSeek();
     MainFrame* mf = wxGetApp().frame;
     mf->cmd_enable &= ~CMDEN_GPLAY;
     mf->cmd_enable |= CMDEN_NGREC | CMDEN_NGPLAY;
     mf->enable_menus();
 }
 
+uint32_t systemGetGamePlaybackFrame()
+{
+    return game_movie_frame;
+}
+
+bool systemSeekGamePlayback(uint32_t frame)
+{
+    GameArea* panel = wxGetApp().frame->GetPanel();
+
+    if (!game_playback || !panel)
+        return false;
+
+    const int index = game_index.Find(frame);
+
+    // replaying from the current frame is cheaper than from an older keyframe
+    if (frame < game_movie_frame || (index >= 0 && game_index.keyframe(index).frame > game_movie_frame)) {
+        MovieKeyframe keyframe;
+
+        if (index >= 0) {
+            keyframe = game_index.keyframe(index);
+
+            if (!game_index.Restore(index, *panel->emusys)) {
+                wxLogError(_("Error reading movie index"));
+                return false;
+            }
+        } else {
+            keyframe.log_offset = sizeof(uint32_t);
+
+            if (!panel->emusys->emuReadState(UTF8(game_state_name))) {
+                wxLogError(_("Error reading game recording"));
+                return false;
+            }
+        }
+
+        uint32_t gf, jp;
+
+        if (!game_file.Seek(keyframe.log_offset) || game_file.Read(&gf, sizeof(gf)) != sizeof(gf) || game_file.Read(&jp, sizeof(jp)) != sizeof(jp)) {
+            systemStopGamePlayback();
+            wxLogError(_("Error reading game recording"));
+            return false;
+        }
+
+        game_next_frame = wxUINT32_SWAP_ON_BE(gf);
+        game_next_joypad = wxUINT32_SWAP_ON_BE(jp);
+        game_frame = keyframe.log_frame;
+        game_joypad = keyframe.joypad;
+        game_movie_frame = keyframe.frame;
+    }
+
+    // the remaining frames are emulated without video and sound
+    game_seek_frame = frame;
+    if (game_movie_frame < frame) {
+        if (!game_seeking) {
+            game_seek_mute_sound = coreOptions.muteSound;
+            game_seeking = true;
+        }
+        coreOptions.muteSound = true;
+    } else {
+        StopGameSeek();
+    }
+    return true;
+}
+
+void systemAddGameMovieKeyframe()
+{
+    if (!(game_recording || game_playback) || !game_index.Due(game_movie_frame))
+        return;
+
+    MovieKeyframe keyframe;
+    keyframe.frame = game_movie_frame;
+    // the next log entry was already read ahead when playing back
+    keyframe.log_offset = game_file.Tell() - (game_playback ? kGameLogEntrySize : 0);
+    keyframe.log_frame = game_frame;
+    keyframe.joypad = game_joypad;
+
+    if (!game_index.Add(keyframe, *wxGetApp().frame->GetPanel()->emusys)) {
+        wxLogInfo(_("Error writing movie index"));
+        game_index.Close();
+    }
+}
+
 // updates the joystick data (done in background using wxJoyPoller)
 bool systemReadJoypads()
 {
@@ -340,6 +497,12 @@ uint32_t systemReadJoypad(int joy)
     if (joy < 0 || joy > 3)
         joy = OPTION(kJoyDefault) - 1;
 
+    // the speculative run-ahead frames replay the input of the real frame
+    static uint32_t last_joypad[4];
+    GameArea* panel = wxGetApp().frame->GetPanel();
+    if (panel->run_ahead && panel->run_ahead->speculating())
+        return last_joypad[joy];
+
     uint32_t ret = config::GameControlState::Instance().GetJoypad(joy);
 
     if (turbo)
@@ -447,6 +610,7 @@ uint32_t systemReadJoypad(int joy)
         ret = game_joypad;
     }
 
+    last_joypad[joy] = ret;
     return ret;
 }
 
@@ -456,6 +620,11 @@ void systemShowSpeed(int speed)
     wxString s;
     s.Printf(_("%d %% (%d, %d fps)"), speed, systemFrameSkip, frames * speed / 100);
 
+    // empty unless the instrumentation is compiled in
+    const std::string summary = instrSummary();
+    if (!summary.empty())
+        s += wxT(" - ") + wxString(summary.c_str(), wxConvUTF8);
+
     switch (OPTION(kPrefShowSpeed)) {
     case SS_NONE:
         f->GetPanel()->osdstat.clear();
@@ -479,7 +648,8 @@ int systemSaveUpdateCounter = SYSTEM_SAVE_NOT_UPDATED;
 void system10Frames() {
     GameArea* panel = wxGetApp().frame->GetPanel();
 
-    if (OPTION(kPrefFrameSkip) == -1) {
+    // run-ahead emulates several frames per presented one without skipping
+    if (OPTION(kPrefFrameSkip) == -1 && !(panel->run_ahead && panel->run_ahead->running())) {
         // We keep a rolling mean of the last second and use this value to
         // adjust the systemFrameSkip value dynamically.
 
@@ -527,13 +697,6 @@ void system10Frames() {
         panel->was_paused = false;
     }
 
-    if (gopts.rewind_interval) {
-        if (!panel->rewind_time)
-            panel->rewind_time = gopts.rewind_interval * 6;
-        else if (!--panel->rewind_time)
-            panel->do_rewind = true;
-    }
-
     if (--systemSaveUpdateCounter == SYSTEM_SAVE_NOT_UPDATED)
         panel->SaveBattery();
     else if (systemSaveUpdateCounter < SYSTEM_SAVE_NOT_UPDATED)
@@ -542,8 +705,22 @@ void system10Frames() {
 
 void systemFrame()
 {
-    if (game_recording || game_playback)
+    GameArea* panel = wxGetApp().frame->GetPanel();
+
+    if (panel->run_ahead)
+        panel->run_ahead->OnFrame();
+
+    if (game_recording || game_playback) {
         game_frame++;
+        game_movie_frame++;
+    }
+
+    if (game_seeking && game_movie_frame >= game_seek_frame)
+        StopGameSeek();
+
+    // capture a rewind snapshot after every frame
+    if (gopts.rewind_interval)
+        panel->do_rewind = true;
 }
 
 // technically, num is ignored in favor of finding the first
@@ -1207,14 +1384,16 @@ bool systemCanChangeSoundQuality()
 
 bool systemPauseOnFrame()
 {
+    GameArea* panel = wxGetApp().frame->GetPanel();
+
     if (pause_next) {
         pause_next = false;
-        MainFrame* fr = wxGetApp().frame;
-        fr->GetPanel()->Pause();
+        panel->Pause();
         return true;
     }
 
-    return false;
+    // return to the run-ahead loop at the end of each frame
+    return panel->run_ahead && panel->run_ahead->running();
 }
 
 void systemGbBorderOn()
@@ -1239,8 +1418,10 @@ void systemOnWriteDataToSoundBuffer(const uint16_t* finalWave, int length)
 #ifndef NO_FFMPEG
     GameArea* panel = wxGetApp().frame->GetPanel();
 
-    if (panel)
+    if (panel) {
+        VBAM_INSTR_ZONE(kRecording);
         panel->AddFrame(finalWave, length);
+    }
 
 #endif
 }
@@ -619,12 +619,21 @@ END_EVENT_TABLE()
 
 // These are what mfc interface used.  Maybe it would be safer
 // to avoid the Quick() routines in favor of the long ones...
-#define CPUWriteByteQuick(addr, b) \
-    ::map[(addr) >> 24].address[(addr) & ::map[(addr) >> 24].mask] = (b)
-#define CPUWriteHalfWordQuick(addr, b) \
-    WRITE16LE((uint16_t*)&::map[(addr) >> 24].address[(addr) & ::map[(addr) >> 24].mask], b)
-#define CPUWriteMemoryQuick(addr, b) \
-    WRITE32LE((uint32_t*)&::map[(addr) >> 24].address[(addr) & ::map[(addr) >> 24].mask], b)
+#define CPUWriteByteQuick(addr, b)                                                  \
+    do {                                                                            \
+        ::map[(addr) >> 24].address[(addr) & ::map[(addr) >> 24].mask] = (b);      \
+        gbaDirtyMark(addr);                                                         \
+    } while (0)
+#define CPUWriteHalfWordQuick(addr, b)                                                             \
+    do {                                                                                           \
+        WRITE16LE((uint16_t*)&::map[(addr) >> 24].address[(addr) & ::map[(addr) >> 24].mask], b); \
+        gbaDirtyMark(addr);                                                                        \
+    } while (0)
+#define CPUWriteMemoryQuick(addr, b)                                                               \
+    do {                                                                                           \
+        WRITE32LE((uint32_t*)&::map[(addr) >> 24].address[(addr) & ::map[(addr) >> 24].mask], b); \
+        gbaDirtyMark(addr);                                                                        \
+    } while (0)
 #define GBWriteByteQuick(addr, b) \
     *((uint8_t*)&gbMemoryMap[(addr) >> 12][(addr)&0xfff]) = (b)
 #define GBWriteHalfWordQuick(addr, b) \
@@ -902,6 +911,7 @@ public:
             return;
 
         // this does the equivalent of the CPUWriteMemoryQuick()
+        gbaDirtyMarkAll();
         while (len > 0) {
             memoryMap m = map[addr >> 24];
             uint32_t off = addr & m.mask;
@@ -31,7 +31,9 @@
 #include <wx/zipstrm.h>
 
 #include "components/user_config/user_config.h"
+#include "core/base/instrumentation.h"
 #include "core/gb/gbGlobals.h"
+#include "core/gba/gbaProfiler.h"
 #include "core/gba/gbaSound.h"
 
 #if defined(VBAM_ENABLE_DEBUGGER)
@@ -342,6 +344,9 @@ bool wxvbamApp::OnInit() {
     if (!wxApp::OnInit())
         return false;
 
+    write_behind.reset(new WriteBehind());
+    g_writeBehind = write_behind.get();
+
     if (console_mode)
         return true;
 
@@ -653,6 +658,19 @@ void wxvbamApp::OnInitCmdLine(wxCmdLineParser& cl)
         { wxCMD_LINE_OPTION, t("c"), t("config"),
             N_("Set a configuration file"),
             wxCMD_LINE_VAL_STRING, 0 },
+#if defined(VBAM_ENABLE_DEBUGGER)
+        { wxCMD_LINE_OPTION, NULL, t("profile"),
+            N_("Sample the emulated GBA code, written to a collapsed stacks file when the game is closed"),
+            wxCMD_LINE_VAL_STRING, 0 },
+#endif
+#if defined(VBAM_ENABLE_INSTRUMENTATION)
+        { wxCMD_LINE_OPTION, NULL, t("instrumentation-dump"),
+            N_("Write the per-frame timings to a CSV or JSON file on exit"),
+            wxCMD_LINE_VAL_STRING, 0 },
+        { wxCMD_LINE_OPTION, NULL, t("instrumentation-trace"),
+            N_("Write a Chrome trace of the emulation, filter and audio threads on exit"),
+            wxCMD_LINE_VAL_STRING, 0 },
+#endif
 #if !defined(NO_LINK) && !defined(__WXMSW__)
         { wxCMD_LINE_SWITCH, t("s"), t("delete-shared-state"),
             N_("Delete shared link state first, if it exists"),
@@ -780,6 +798,19 @@ bool wxvbamApp::OnCmdLineParsed(wxCmdLineParser& cl)
         config_file_ = s;
     }
 
+#if defined(VBAM_ENABLE_DEBUGGER)
+    if (cl.Found(wxT("profile"), &profile_output))
+        gbaProfilerStart(kGbaProfilerDefaultInterval);
+#endif
+#if defined(VBAM_ENABLE_INSTRUMENTATION)
+    cl.Found(wxT("instrumentation-dump"), &instrumentation_dump);
+    if (cl.Found(wxT("instrumentation-trace"), &instrumentation_trace)) {
+        // the emulation runs from the idle events of the main thread
+        VBAM_INSTR_THREAD_NAME("emulation");
+        instrStartTrace();
+    }
+#endif
+
 #if !defined(NO_LINK) && !defined(__WXMSW__)
 
     if (cl.Found(wxT("s"))) {
@@ -829,6 +860,21 @@ wxString wxvbamApp::GetDataDir()
 }
 
 wxvbamApp::~wxvbamApp() {
+    // Completes the pending savestate and battery writes.
+    g_writeBehind = nullptr;
+    write_behind.reset();
+
+    if (kInstrumentationEnabled && !instrumentation_dump.empty() &&
+        !instrWriteDump(UTF8(instrumentation_dump))) {
+        wxFprintf(stderr, _("Cannot write the instrumentation dump %s\n"),
+                  instrumentation_dump.c_str());
+    }
+    if (kInstrumentationEnabled && !instrumentation_trace.empty() &&
+        !instrWriteTrace(UTF8(instrumentation_trace))) {
+        wxFprintf(stderr, _("Cannot write the instrumentation trace %s\n"),
+                  instrumentation_trace.c_str());
+    }
+
     if (home != NULL)
     {
         free(home);
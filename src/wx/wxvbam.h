@@ -11,7 +11,11 @@
 #include <wx/propdlg.h>
 #include <wx/datetime.h>
 
+#include "core/base/rewind.h"
+#include "core/base/run_ahead.h"
+#include "core/base/state_store.h"
 #include "core/base/system.h"
+#include "core/base/write_behind.h"
 #include "wx/config/option-observer.h"
 #include "wx/config/option.h"
 #include "wx/widgets/dpi-support.h"
@@ -83,6 +87,11 @@ public:
     wxArrayString pending_optset;
     // set fullscreen mode after init
     bool pending_fullscreen;
+    // per-frame timings and trace written on exit, see instrumentation.h
+    wxString instrumentation_dump;
+    wxString instrumentation_trace;
+    // collapsed stacks of the GBA profiler, written when a game is closed
+    wxString profile_output;
 #if __WXMAC__
     // I suppose making this work will require tweaking the bundle
     void MacOpenFile(const wxString& f)
@@ -109,6 +118,8 @@ public:
     wxString log;
     // there's no way to retrieve "current" locale, so this is public
     wxLocale locale;
+    // writes savestate and battery files off the emulation thread
+    std::unique_ptr<WriteBehind> write_behind;
 
     // Handle most exceptions
     virtual bool OnExceptionInMainLoop()
@@ -200,6 +211,11 @@ class JoystickPoller;
 // true if pause should happen at next frame
 extern bool pause_next;
 
+// true while a game movie is recorded or played back
+extern bool game_recording, game_playback;
+// true while seeking in a game movie
+extern bool game_seeking;
+
 class MainFrame : public wxFrame {
 public:
     MainFrame();
@@ -481,6 +497,8 @@ public:
         return statedir;
     }
     void recompute_dirs();
+    // Opens the savestate pack of the loaded game if kPrefDedupStates is set
+    void OpenStateStore();
 
     bool LoadState();
     bool LoadState(int slot);
@@ -518,14 +536,16 @@ public:
     wxString osdtext;
     uint32_t osdtime;
 
-    // Rewind: count down to 0 and rewind
-    uint32_t rewind_time;
-    // Rewind: flag to OnIdle to do a rewind
+    // Rewind: flag to OnIdle to capture a rewind snapshot
     bool do_rewind;
-    // Rewind: rewind states
-    char* rewind_mem; // should be uint8_t, really
-    int num_rewind_states;
-    int next_rewind_state;
+    // Rewind: snapshot history, created on the first capture
+    std::unique_ptr<RewindBuffer> rewind_buffer;
+
+    // Run-ahead: created when the first frame is run ahead
+    std::unique_ptr<RunAhead> run_ahead;
+
+    // Savestate pack of the loaded game, in the state directory
+    std::unique_ptr<StateStore> state_store;
 
     // Loaded rom information
     IMAGE_TYPE loaded;
@@ -536,10 +556,6 @@ public:
     wxString rom_scene_rls_name;
     uint32_t rom_size;
 
-// FIXME: size this properly
-#define NUM_REWINDS 8
-#define REWIND_SIZE 1024 * 512 * NUM_REWINDS
-
     // Resets the panel, it will be re-created on the next frame.
     void ResetPanel();
 
@@ -581,6 +597,9 @@ protected:
     bool fullscreen;
 
     bool paused;
+    // Run-ahead is disabled while a movie is recorded or played back, the
+    // speculative frames would be part of the movie, and in link mode.
+    bool CanRunAhead();
     void OnIdle(wxIdleEvent&);
     void OnKeyDown(wxKeyEvent& ev);
     void OnKeyUp(wxKeyEvent& ev);
@@ -751,6 +770,13 @@ void systemStartGameRecording(const wxString& fname, MVFormatID format);
 void systemStopGameRecording();
 void systemStartGamePlayback(const wxString& fname, MVFormatID format);
 void systemStopGamePlayback();
+// frames since the start of the movie played back
+uint32_t systemGetGamePlaybackFrame();
+// restores the nearest keyframe of the movie index and replays the frames
+// up to `frame`
+bool systemSeekGamePlayback(uint32_t frame);
+// adds a keyframe to the movie index if one is due
+void systemAddGameMovieKeyframe();
 
 // true if turbo mode (like pressing turbo button constantly)
 extern bool turbo;